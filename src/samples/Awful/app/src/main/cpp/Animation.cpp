@@ -0,0 +1,411 @@
+#include "Animation.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "GltfAccess.h"
+#include "ThreadPool.h"
+
+namespace {
+// GCC/Clang vector extension, as in MipGenerator: a keyframe value per vector.
+typedef float Float4 __attribute__((vector_size(16)));
+
+constexpr uint32_t kMaxCursorSteps = 4;  // past this, a binary search is cheaper
+constexpr size_t kSamplersPerTask = 256;
+constexpr size_t kPosesPerTask = 128;
+
+Float4 Load(const float* p) {
+  Float4 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void Store(float* p, Float4 v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+Float4 Splat(float v) {
+  return Float4{v, v, v, v};
+}
+
+float Dot(Float4 a, Float4 b) {
+  const Float4 p = a * b;
+  return p[0] + p[1] + p[2] + p[3];
+}
+
+Float4 Normalize(Float4 q) {
+  const float length = std::sqrt(Dot(q, q));
+  return length > 0.0f ? q * Splat(1.0f / length) : q;
+}
+
+// Shortest path slerp, as r3::Quaternion::Slerp, dropping to a normalized lerp where the
+// keys are close enough that it's indistinguishable (and sin(omega) would lose precision).
+Float4 Slerp(Float4 a, Float4 b, float u) {
+  float cosOmega = Dot(a, b);
+  if (cosOmega < 0.0f) {
+    b = -b;
+    cosOmega = -cosOmega;
+  }
+  if (cosOmega > 0.9995f) {
+    return Normalize(a + (b - a) * Splat(u));
+  }
+  const float omega = std::acos(cosOmega);
+  const float oneOverSinOmega = 1.0f / std::sin(omega);
+  return a * Splat(std::sin((1.0f - u) * omega) * oneOverSinOmega) + b * Splat(std::sin(u * omega) * oneOverSinOmega);
+}
+
+bool ParsePath(const std::string& path, AnimationPath& out) {
+  if (path == "translation") {
+    out = AnimationPath::Translation;
+  } else if (path == "rotation") {
+    out = AnimationPath::Rotation;
+  } else if (path == "scale") {
+    out = AnimationPath::Scale;
+  } else if (path == "weights") {
+    out = AnimationPath::Weights;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+AnimationInterpolation ParseInterpolation(const std::string& interpolation) {
+  if (interpolation == "STEP") return AnimationInterpolation::Step;
+  if (interpolation == "CUBICSPLINE") return AnimationInterpolation::CubicSpline;
+  return AnimationInterpolation::Linear;
+}
+
+// Appends a glTF sampler's keys to the clip. False if the accessors don't fit the path, or
+// for weights, the target count.
+bool CompileSampler(const tinygltf::Model& model, const tinygltf::AnimationSampler& gltfSampler, AnimationPath path,
+                    size_t weightCount, AnimationClip& clip) {
+  std::vector<float> times, values;
+  if (ReadAccessorFloats(model, gltfSampler.input, times) != 1 || times.empty()) {
+    return false;
+  }
+  AnimationClip::Sampler sampler;
+  sampler.interpolation = ParseInterpolation(gltfSampler.interpolation);
+  sampler.path = path;
+  const size_t valuesPerKey = sampler.interpolation == AnimationInterpolation::CubicSpline ? 3 : 1;
+  // Weights are scalars, a run of one per target for each value.
+  const int accessorComponents = path == AnimationPath::Weights ? 1 : path == AnimationPath::Rotation ? 4 : 3;
+  const size_t components = path == AnimationPath::Weights ? weightCount : accessorComponents;
+  if (components == 0 || ReadAccessorFloats(model, gltfSampler.output, values) != accessorComponents ||
+      values.size() != times.size() * valuesPerKey * components) {
+    return false;
+  }
+  sampler.width = static_cast<uint32_t>((components + 3) / 4 * 4);
+  for (size_t k = 1; k < times.size(); k++) {
+    if (times[k] < times[k - 1]) return false;
+  }
+
+  sampler.firstKey = static_cast<uint32_t>(clip.times.size());
+  sampler.keyCount = static_cast<uint32_t>(times.size());
+  sampler.firstValue = static_cast<uint32_t>(clip.values.size());
+  clip.times.insert(clip.times.end(), times.begin(), times.end());
+  for (size_t v = 0; v < values.size(); v += components) {
+    clip.values.insert(clip.values.end(), &values[v], &values[v] + components);
+    clip.values.resize(clip.values.size() + sampler.width - components, 0.0f);
+  }
+  clip.samplers.push_back(sampler);
+  clip.duration = std::max(clip.duration, times.back());
+  return true;
+}
+
+void GetRestPose(const tinygltf::Node& node, float* translation, float* rotation, float* scale) {
+  for (size_t i = 0; i < node.translation.size() && i < 3; i++) translation[i] = static_cast<float>(node.translation[i]);
+  for (size_t i = 0; i < node.rotation.size() && i < 4; i++) rotation[i] = static_cast<float>(node.rotation[i]);
+  for (size_t i = 0; i < node.scale.size() && i < 3; i++) scale[i] = static_cast<float>(node.scale[i]);
+}
+}  // namespace
+
+uint32_t FindKeyframe(const float* times, uint32_t count, float time, uint32_t& cursor) {
+  uint32_t k = cursor;
+  if (k + 1 < count && times[k] <= time) {
+    // Playing forward, the answer is usually this interval or the next.
+    for (uint32_t step = 0; k + 2 < count && times[k + 1] <= time; step++) {
+      if (step == kMaxCursorSteps) {
+        k = count;  // jumped ahead, search
+        break;
+      }
+      k++;
+    }
+  } else {
+    k = count;
+  }
+  if (k == count) {
+    k = static_cast<uint32_t>(std::upper_bound(times, times + count, time) - times);
+    k = std::min(k > 0 ? k - 1 : 0, count - 2);
+  }
+  cursor = k;
+  return k;
+}
+
+std::vector<AnimationClip> CompileAnimations(const tinygltf::Model& model) {
+  std::vector<AnimationClip> clips;
+  for (const auto& animation : model.animations) {
+    AnimationClip& clip = clips.emplace_back();
+    clip.name = animation.name;
+    // glTF samplers compile on first use, so ones no valid channel uses are skipped.
+    std::vector<int> compiled(animation.samplers.size(), -1);
+    size_t dropped = 0;
+    for (const auto& channel : animation.channels) {
+      AnimationPath path;
+      const int node = channel.target_node;
+      if (!ParsePath(channel.target_path, path) || node < 0 || static_cast<size_t>(node) >= model.nodes.size() ||
+          (path != AnimationPath::Weights && model.nodes[node].matrix.size() == 16) || channel.sampler < 0 ||
+          static_cast<size_t>(channel.sampler) >= animation.samplers.size()) {
+        dropped++;
+        continue;
+      }
+      size_t weightCount = 0;
+      const int mesh = model.nodes[node].mesh;
+      if (path == AnimationPath::Weights && mesh >= 0 && static_cast<size_t>(mesh) < model.meshes.size()) {
+        for (const auto& prim : model.meshes[mesh].primitives) {
+          weightCount = std::max(weightCount, prim.targets.size());
+        }
+      }
+      int& sampler = compiled[channel.sampler];
+      if (sampler < 0 || clip.samplers[sampler].path != path) {
+        if (!CompileSampler(model, animation.samplers[channel.sampler], path, weightCount, clip)) {
+          dropped++;
+          continue;
+        }
+        sampler = static_cast<int>(clip.samplers.size()) - 1;
+      }
+      clip.channels.push_back({static_cast<uint32_t>(sampler), node, path});
+    }
+    if (dropped > 0) {
+      __android_log_print(ANDROID_LOG_WARN, "Animation", "Animation %s: dropped %zu of %zu channels", clip.name.c_str(),
+                          dropped, animation.channels.size());
+    }
+  }
+  return clips;
+}
+
+bool AnimationSystem::Init(const tinygltf::Model& model, SceneGraph& scene) {
+  Clear();
+  scene_ = &scene;
+  clips_ = CompileAnimations(model);
+  const auto& nodes = scene.GetNodes();
+  restPoses_.resize(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    Pose& pose = restPoses_[i];
+    pose.node = static_cast<int>(i);
+    GetRestPose(model.nodes[nodes[i].gltfNode], pose.translation, pose.rotation, pose.scale);
+    pose.local = nodes[i].local;
+  }
+  size_t channels = 0;
+  for (const auto& clip : clips_) {
+    channels += clip.channels.size();
+  }
+  __android_log_print(ANDROID_LOG_INFO, "Animation", "Compiled %zu animations, %zu channels", clips_.size(), channels);
+  return true;
+}
+
+void AnimationSystem::Clear() {
+  scene_ = nullptr;
+  clips_.clear();
+  restPoses_.clear();
+  instances_.clear();
+  samplerWork_.clear();
+  poseWork_.clear();
+  workDirty_ = false;
+  playing_ = 0;
+}
+
+int AnimationSystem::FindClip(const std::string& name) const {
+  for (size_t i = 0; i < clips_.size(); i++) {
+    if (clips_[i].name == name) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+int AnimationSystem::Play(int clip, int root, bool loop, float speed) {
+  if (!scene_ || clip < 0 || static_cast<size_t>(clip) >= clips_.size()) {
+    return -1;
+  }
+  const auto& nodes = scene_->GetNodes();
+  const int begin = root < 0 ? 0 : root;
+  const int end = root < 0 ? static_cast<int>(nodes.size()) : nodes[root].subtreeEnd;
+
+  const AnimationClip& animation = clips_[clip];
+  Instance instance;
+  instance.clip = clip;
+  instance.loop = loop;
+  instance.speed = speed;
+  instance.cursors.assign(animation.samplers.size(), 0);
+  instance.targets.resize(animation.samplers.size());
+  std::vector<int> poseOf(end - begin, -1);
+  for (const auto& channel : animation.channels) {
+    for (int node : scene_->GetInstances(channel.node)) {
+      if (node < begin || node >= end) continue;
+      int& pose = poseOf[node - begin];
+      if (pose < 0) {
+        pose = static_cast<int>(instance.poses.size());
+        instance.poses.push_back(restPoses_[node]);
+      }
+      if (channel.path == AnimationPath::Weights) {
+        instance.poses[pose].weights = scene_->GetNodes()[node].weights;
+      } else {
+        instance.poses[pose].moved = true;
+      }
+      instance.targets[channel.sampler].push_back({static_cast<uint32_t>(pose), channel.path});
+    }
+  }
+  if (instance.poses.empty()) {
+    __android_log_print(ANDROID_LOG_WARN, "Animation", "Animation %s targets nothing under node %d", animation.name.c_str(),
+                        root);
+    return -1;
+  }
+  // Handles aren't reused, so instance order is start order, which settles overlaps.
+  instances_.push_back(std::move(instance));
+  playing_++;
+  workDirty_ = true;
+  return static_cast<int>(instances_.size()) - 1;
+}
+
+void AnimationSystem::Stop(int handle) {
+  if (handle < 0 || static_cast<size_t>(handle) >= instances_.size() || instances_[handle].clip < 0) {
+    return;
+  }
+  // Stopped nodes hold their last pose.
+  instances_[handle] = Instance{};
+  playing_--;
+  workDirty_ = true;
+}
+
+void AnimationSystem::SetTime(int handle, float seconds) {
+  if (handle >= 0 && static_cast<size_t>(handle) < instances_.size()) {
+    instances_[handle].time = seconds;
+  }
+}
+
+void AnimationSystem::RebuildWork() {
+  samplerWork_.clear();
+  poseWork_.clear();
+  for (uint32_t i = 0; i < instances_.size(); i++) {
+    const Instance& instance = instances_[i];
+    if (instance.clip < 0) continue;
+    for (uint32_t s = 0; s < instance.targets.size(); s++) {
+      if (!instance.targets[s].empty()) samplerWork_.push_back({i, s});
+    }
+    for (uint32_t p = 0; p < instance.poses.size(); p++) {
+      poseWork_.push_back({i, p});
+    }
+  }
+  workDirty_ = false;
+}
+
+void AnimationSystem::EvaluateSampler(Instance& instance, uint32_t s, float time) {
+  const AnimationClip& clip = clips_[instance.clip];
+  const AnimationClip::Sampler& sampler = clip.samplers[s];
+  const float* times = &clip.times[sampler.firstKey];
+  const float* values = &clip.values[sampler.firstValue];
+  const bool cubic = sampler.interpolation == AnimationInterpolation::CubicSpline;
+  const uint32_t width = sampler.width;
+  const uint32_t stride = cubic ? 3 * width : width;  // floats per key
+  const uint32_t last = sampler.keyCount - 1;
+
+  // The keys to blend, or just one when time is outside them.
+  const float* key0;
+  const float* key1 = nullptr;
+  float u = 0.0f, dt = 0.0f;
+  if (last == 0 || time <= times[0]) {
+    key0 = values;
+  } else if (time >= times[last]) {
+    key0 = values + last * stride;
+  } else {
+    const uint32_t k = FindKeyframe(times, sampler.keyCount, time, instance.cursors[s]);
+    key0 = values + k * stride;
+    key1 = key0 + stride;
+    dt = times[k + 1] - times[k];
+    u = dt > 0.0f ? (time - times[k]) / dt : 0.0f;
+  }
+
+  // A vector at a time: one for transforms, a run for morph weights.
+  for (uint32_t c = 0; c < width; c += 4) {
+    const uint32_t valueOffset = cubic ? width + c : c;
+    Float4 value;
+    if (!key1 || sampler.interpolation == AnimationInterpolation::Step) {
+      value = Load(key0 + valueOffset);
+    } else if (sampler.interpolation == AnimationInterpolation::Linear) {
+      if (sampler.path == AnimationPath::Rotation) {
+        value = Slerp(Load(key0 + c), Load(key1 + c), u);
+      } else {
+        const Float4 v0 = Load(key0 + c);
+        value = v0 + (Load(key1 + c) - v0) * Splat(u);
+      }
+    } else {
+      // Hermite basis, with the tangents scaled by the interval as the spec describes.
+      const float u2 = u * u, u3 = u2 * u;
+      const Float4 v0 = Load(key0 + width + c), outTangent0 = Load(key0 + 2 * width + c);
+      const Float4 inTangent1 = Load(key1 + c), v1 = Load(key1 + width + c);
+      value = v0 * Splat(2.0f * u3 - 3.0f * u2 + 1.0f) + outTangent0 * Splat((u3 - 2.0f * u2 + u) * dt) +
+              v1 * Splat(-2.0f * u3 + 3.0f * u2) + inTangent1 * Splat((u3 - u2) * dt);
+      if (sampler.path == AnimationPath::Rotation) value = Normalize(value);
+    }
+
+    for (const Target& target : instance.targets[s]) {
+      Pose& pose = instance.poses[target.pose];
+      switch (target.path) {
+        case AnimationPath::Translation:
+          Store(pose.translation, value);
+          break;
+        case AnimationPath::Rotation:
+          Store(pose.rotation, value);
+          break;
+        case AnimationPath::Scale:
+          Store(pose.scale, value);
+          break;
+        case AnimationPath::Weights:
+          for (uint32_t i = 0; i < 4 && c + i < pose.weights.size(); i++) pose.weights[c + i] = value[i];
+          break;
+      }
+    }
+  }
+}
+
+void AnimationSystem::Update(float seconds, ThreadPool* pool) {
+  if (!scene_ || playing_ == 0) {
+    return;
+  }
+  if (workDirty_) {
+    RebuildWork();
+  }
+  for (auto& instance : instances_) {
+    if (instance.clip < 0) continue;
+    const float duration = clips_[instance.clip].duration;
+    instance.time += seconds * instance.speed;
+    if (instance.loop && duration > 0.0f) {
+      instance.time = std::fmod(instance.time, duration);
+      if (instance.time < 0.0f) instance.time += duration;
+    } else {
+      instance.time = std::clamp(instance.time, 0.0f, duration);
+    }
+  }
+
+  // Samplers write disjoint parts of the poses, and each pose is composed by one task.
+  ParallelForRanges(pool, samplerWork_.size(), kSamplersPerTask, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      Instance& instance = instances_[samplerWork_[i].instance];
+      EvaluateSampler(instance, samplerWork_[i].item, instance.time);
+    }
+  });
+  ParallelForRanges(pool, poseWork_.size(), kPosesPerTask, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      Pose& pose = instances_[poseWork_[i].instance].poses[poseWork_[i].item];
+      if (!pose.moved) continue;
+      const r3::Quaternionf rotation(pose.rotation[0], pose.rotation[1], pose.rotation[2], pose.rotation[3]);
+      pose.local = SceneGraph::ComposeLocal(r3::Vec3f(pose.translation), rotation, r3::Vec3f(pose.scale));
+    }
+  });
+  for (const WorkItem& work : poseWork_) {
+    const Pose& pose = instances_[work.instance].poses[work.item];
+    if (pose.moved) scene_->SetLocalMatrix(pose.node, pose.local);
+    if (!pose.weights.empty()) scene_->SetMorphWeights(pose.node, pose.weights.data(), pose.weights.size());
+  }
+}
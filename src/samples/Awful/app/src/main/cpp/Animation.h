@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SceneGraph.h"
+#include "linear.h"
+#include "tiny_gltf.h"
+
+class ThreadPool;
+
+// glTF animation playback. Each animation is compiled once into packed keyframe arrays:
+// every sampler's key times in one float array and its values in another, four floats per
+// value (xyz0 for translation and scale, xyzw for rotation, morph weights padded to a multiple
+// of four) so a key loads as whole SIMD vectors.
+// Playing instances keep a cursor per sampler, the key found last frame, so a forward step
+// usually costs a compare or two instead of a binary search.
+//
+// Update() evaluates every sampler of every instance, spread over a thread pool, then composes
+// each animated node's T * R * S, and finally writes the matrices into the scene graph on the
+// calling thread (SceneGraph isn't thread safe), along with any animated morph weights.
+//
+//   AnimationSystem animations;
+//   animations.Init(model, renderer.GetScene());
+//   animations.Play(animations.FindClip("Walk"));
+//   ...
+//   animations.Update(frameSeconds, &pool);
+//   renderer.Render(toClipFromWorld);
+
+enum class AnimationPath : uint8_t { Translation, Rotation, Scale, Weights };
+enum class AnimationInterpolation : uint8_t { Step, Linear, CubicSpline };
+
+struct AnimationClip {
+  struct Sampler {
+    AnimationInterpolation interpolation = AnimationInterpolation::Linear;
+    AnimationPath path = AnimationPath::Translation;  // of the channels using it, for normalizing rotations
+    uint32_t firstKey = 0;    // into times
+    uint32_t keyCount = 0;
+    uint32_t firstValue = 0;  // into values, in floats; cubic splines store in-tangent, value, out-tangent per key
+    uint32_t width = 4;       // floats per value
+  };
+  struct Channel {
+    uint32_t sampler = 0;
+    int node = -1;  // into tinygltf::Model::nodes
+    AnimationPath path = AnimationPath::Translation;
+  };
+
+  std::string name;
+  float duration = 0.0f;  // the last key time of any sampler
+  std::vector<float> times;
+  std::vector<float> values;
+  std::vector<Sampler> samplers;
+  std::vector<Channel> channels;
+};
+
+// Compiles every animation in the model. Channels that move nodes with a matrix (which the
+// spec forbids) or have malformed samplers are dropped with a warning.
+std::vector<AnimationClip> CompileAnimations(const tinygltf::Model& model);
+
+class AnimationSystem {
+ public:
+  // Compiles the model's animations and records every node's rest translation, rotation and
+  // scale, which stay in place for the paths a clip doesn't animate. The scene is posed by
+  // Update() and must outlive the system, or be followed by Clear().
+  bool Init(const tinygltf::Model& model, SceneGraph& scene);
+  void Clear();
+
+  const std::vector<AnimationClip>& GetClips() const {
+    return clips_;
+  }
+  // -1 if there's no clip with that name.
+  int FindClip(const std::string& name) const;
+
+  // Starts a clip on the instances of its target nodes inside the subtree at root (an index
+  // into scene.GetNodes()), or on every instance with -1, so copies of a character in several
+  // scenes can play independently. Returns a handle, or -1 when there's nothing to animate.
+  // Where instances animate the same node, the one started last wins.
+  int Play(int clip, int root = -1, bool loop = true, float speed = 1.0f);
+  void Stop(int handle);
+  void SetTime(int handle, float seconds);
+
+  // Advances every playing instance and poses the scene. Runs inline without a pool.
+  void Update(float seconds, ThreadPool* pool = nullptr);
+
+  size_t GetPlayingCount() const {
+    return playing_;
+  }
+
+ private:
+  // An animated node's local transform, as floats so a vector loads each part, and its morph
+  // weights.
+  struct Pose {
+    int node = -1;  // into SceneGraph::GetNodes()
+    float translation[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float rotation[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    float scale[4] = {1.0f, 1.0f, 1.0f, 0.0f};
+    r3::Matrix4f local;
+    bool moved = false;          // some channel animates the transform
+    std::vector<float> weights;  // empty unless some channel animates them
+  };
+  // Where a sampler's value goes: a part of one of the instance's poses.
+  struct Target {
+    uint32_t pose = 0;
+    AnimationPath path = AnimationPath::Translation;
+  };
+  struct Instance {
+    int clip = -1;  // -1 once stopped
+    float time = 0.0f;
+    float speed = 1.0f;
+    bool loop = true;
+    std::vector<uint32_t> cursors;             // per sampler
+    std::vector<std::vector<Target>> targets;  // per sampler
+    std::vector<Pose> poses;
+  };
+  // A flattened (instance, item) pair, so the pool splits the work evenly however it's spread
+  // over instances.
+  struct WorkItem {
+    uint32_t instance = 0;
+    uint32_t item = 0;
+  };
+
+  void EvaluateSampler(Instance& instance, uint32_t sampler, float time);
+  void RebuildWork();
+
+  SceneGraph* scene_ = nullptr;
+  std::vector<AnimationClip> clips_;
+  std::vector<Pose> restPoses_;  // per scene node, with its rest transform
+  std::vector<Instance> instances_;
+  std::vector<WorkItem> samplerWork_;
+  std::vector<WorkItem> poseWork_;
+  bool workDirty_ = false;
+  size_t playing_ = 0;
+};
+
+// Finds the key interval holding time: the k with times[k] <= time < times[k + 1], clamped to
+// [0, count - 2]. Starts from cursor and steps forward, falling back to a binary search when
+// time went backwards or jumped ahead; cursor is left at the result. count must be at least 2.
+uint32_t FindKeyframe(const float* times, uint32_t count, float time, uint32_t& cursor);
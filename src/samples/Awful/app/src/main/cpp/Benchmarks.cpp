@@ -0,0 +1,587 @@
+#include "Benchmarks.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Animation.h"
+#include "AndroidOut.h"
+#include "GltfGeometry.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "SceneBvh.h"
+#include "SceneGraph.h"
+#include "Skinning.h"
+#include "ThreadPool.h"
+#include "linear.h"
+#include "tiny_gltf.h"
+
+using namespace std;
+
+namespace {
+using Clock = chrono::steady_clock;
+
+double ElapsedMicros(Clock::time_point start) {
+  return chrono::duration<double, micro>(Clock::now() - start).count();
+}
+
+// Small deterministic generator so runs are comparable.
+struct Lcg {
+  uint32_t state = 12345;
+  uint32_t Next() {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+  double Uniform(double lo, double hi) {
+    return lo + (hi - lo) * (Next() & 0xffff) / 65535.0;
+  }
+};
+
+// A wide, moderately deep random hierarchy with TRS transforms, like an exported level.
+tinygltf::Model MakeSyntheticScene(int nodeCount) {
+  Lcg rng;
+  tinygltf::Model model;
+  model.nodes.resize(nodeCount);
+  tinygltf::Scene scene;
+  for (int i = 0; i < nodeCount; i++) {
+    auto& node = model.nodes[i];
+    node.translation = {rng.Uniform(-1, 1), rng.Uniform(-1, 1), rng.Uniform(-1, 1)};
+    r3::Quaterniond q(r3::Vec3d(rng.Uniform(-1, 1), rng.Uniform(-1, 1), rng.Uniform(-1, 1)), rng.Uniform(-3, 3));
+    node.rotation = {q.x, q.y, q.z, q.w};
+    node.scale = {1.0, 1.0, 1.0};
+    node.mesh = (i % 4 == 0) ? 0 : -1;
+    if (i < 16) {
+      scene.nodes.push_back(i);
+    } else {
+      // parent somewhere among the recent nodes gives a depth in the tens
+      int window = min(i, 64);
+      int parent = i - 1 - static_cast<int>(rng.Next() % window);
+      model.nodes[parent].children.push_back(i);
+    }
+  }
+  model.scenes.push_back(scene);
+  return model;
+}
+
+// The traversal GltfRenderer used before SceneGraph.
+r3::Matrix4f LegacyNodeTransform(const tinygltf::Node& node) {
+  r3::Vec3f translation(static_cast<float>(node.translation[0]), static_cast<float>(node.translation[1]),
+                        static_cast<float>(node.translation[2]));
+  r3::Quaternionf rotation(static_cast<float>(node.rotation[0]), static_cast<float>(node.rotation[1]),
+                           static_cast<float>(node.rotation[2]), static_cast<float>(node.rotation[3]));
+  r3::Vec3f scale(static_cast<float>(node.scale[0]), static_cast<float>(node.scale[1]), static_cast<float>(node.scale[2]));
+  return r3::Matrix4f::Translate(translation) * rotation.GetMatrix4() * r3::Matrix4f::Scale(scale);
+}
+
+// Appends a tightly packed accessor with its own buffer view.
+template <typename T>
+int AddAccessor(tinygltf::Model& model, const vector<T>& values, int type, int componentType) {
+  auto& buffer = model.buffers.empty() ? model.buffers.emplace_back() : model.buffers.back();
+  tinygltf::BufferView view;
+  view.buffer = 0;
+  view.byteOffset = buffer.data.size();
+  view.byteLength = values.size() * sizeof(T);
+  const auto* bytes = reinterpret_cast<const unsigned char*>(values.data());
+  buffer.data.insert(buffer.data.end(), bytes, bytes + view.byteLength);
+  model.bufferViews.push_back(view);
+
+  tinygltf::Accessor accessor;
+  accessor.bufferView = static_cast<int>(model.bufferViews.size()) - 1;
+  accessor.componentType = componentType;
+  accessor.type = type;
+  accessor.count = values.size() / tinygltf::GetNumComponentsInType(type);
+  model.accessors.push_back(accessor);
+  return static_cast<int>(model.accessors.size()) - 1;
+}
+
+int AddFloatAccessor(tinygltf::Model& model, const vector<float>& values, int type) {
+  return AddAccessor(model, values, type, TINYGLTF_COMPONENT_TYPE_FLOAT);
+}
+
+// A chain of joints, in one scene per character, with a looping animation that swings every
+// joint about z through keys evenly spaced over a second.
+tinygltf::Model MakeSyntheticCrowd(int characters, int joints, int keys) {
+  tinygltf::Model model;
+  model.nodes.resize(joints);
+  for (int j = 0; j < joints; j++) {
+    model.nodes[j].translation = {0.0, j == 0 ? 0.0 : 0.1, 0.0};
+    if (j + 1 < joints) model.nodes[j].children.push_back(j + 1);
+  }
+  for (int c = 0; c < characters; c++) {
+    tinygltf::Scene scene;
+    scene.nodes.push_back(0);
+    model.scenes.push_back(scene);
+  }
+
+  vector<float> times(keys);
+  for (int k = 0; k < keys; k++) times[k] = float(k) / (keys - 1);
+  const int input = AddFloatAccessor(model, times, TINYGLTF_TYPE_SCALAR);
+  tinygltf::Animation animation;
+  animation.name = "Swing";
+  for (int j = 0; j < joints; j++) {
+    vector<float> rotations;
+    for (int k = 0; k < keys; k++) {
+      const r3::Quaternionf q(r3::Vec3f(0.0f, 0.0f, 1.0f), 0.3f * sin(2.0f * float(M_PI) * times[k] + 0.2f * j));
+      rotations.insert(rotations.end(), {q.x, q.y, q.z, q.w});
+    }
+    tinygltf::AnimationSampler sampler;
+    sampler.input = input;
+    sampler.output = AddFloatAccessor(model, rotations, TINYGLTF_TYPE_VEC4);
+    sampler.interpolation = "LINEAR";
+    animation.samplers.push_back(sampler);
+    tinygltf::AnimationChannel channel;
+    channel.sampler = j;
+    channel.target_node = j;
+    channel.target_path = "rotation";
+    animation.channels.push_back(channel);
+  }
+  model.animations.push_back(animation);
+  return model;
+}
+
+// A skin and the bind pose vertices it drives.
+struct Rig {
+  Skin skin;
+  std::vector<SkinnedVertices> primitives;
+};
+
+// A chain of jointCount bones up the y axis with a tube of rings around it, each vertex
+// weighted between the two joints nearest its ring.
+tinygltf::Model MakeSyntheticRig(int jointCount, int rings, int ringVertices, SkinnedVertices& vertices) {
+  tinygltf::Model model;
+  model.nodes.resize(jointCount);
+  for (int i = 0; i < jointCount; i++) {
+    model.nodes[i].translation = {0.0, i == 0 ? 0.0 : 0.1, 0.0};
+    if (i + 1 < jointCount) model.nodes[i].children.push_back(i + 1);
+  }
+  tinygltf::Scene scene;
+  scene.nodes.push_back(0);
+  model.scenes.push_back(scene);
+
+  const float height = 0.1f * (jointCount - 1);
+  vertices = SkinnedVertices{};
+  vertices.vertexCount = rings * ringVertices;
+  for (int r = 0; r < rings; r++) {
+    const float y = height * r / (rings - 1);
+    const float joint = y / 0.1f;
+    const int j0 = min(static_cast<int>(joint), jointCount - 1);
+    const int j1 = min(j0 + 1, jointCount - 1);
+    const float t = joint - j0;
+    for (int v = 0; v < ringVertices; v++) {
+      const float angle = 2.0f * float(M_PI) * v / ringVertices;
+      const float c = cos(angle), s = sin(angle);
+      vertices.positions.insert(vertices.positions.end(), {0.05f * c, y, 0.05f * s});
+      vertices.normals.insert(vertices.normals.end(), {c, 0.0f, s});
+      vertices.joints.insert(vertices.joints.end(), {uint16_t(j0), uint16_t(j1), 0, 0});
+      vertices.weights.insert(vertices.weights.end(), {1.0f - t, t, 0.0f, 0.0f});
+    }
+  }
+  return model;
+}
+
+// A side x side grid of nodes in the xy plane, each instancing one UV sphere of radius 0.4.
+tinygltf::Model MakeSyntheticGrid(int side) {
+  tinygltf::Model model;
+  const int segments = 16;
+  vector<float> positions;
+  for (int i = 0; i <= segments; i++) {
+    for (int j = 0; j <= segments; j++) {
+      const float theta = float(M_PI) * i / segments, phi = 2.0f * float(M_PI) * j / segments;
+      positions.insert(positions.end(), {0.4f * sin(theta) * cos(phi), 0.4f * cos(theta), 0.4f * sin(theta) * sin(phi)});
+    }
+  }
+  tinygltf::Primitive prim;
+  prim.attributes["POSITION"] = AddFloatAccessor(model, positions, TINYGLTF_TYPE_VEC3);
+  model.accessors.back().minValues = {-0.4, -0.4, -0.4};
+  model.accessors.back().maxValues = {0.4, 0.4, 0.4};
+  vector<uint32_t> triangles;
+  for (int i = 0; i < segments; i++) {
+    for (int j = 0; j < segments; j++) {
+      const uint32_t a = i * (segments + 1) + j, b = a + 1, c = a + segments + 1, d = c + 1;
+      triangles.insert(triangles.end(), {a, c, b, b, c, d});
+    }
+  }
+  prim.indices = AddAccessor(model, triangles, TINYGLTF_TYPE_SCALAR, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT);
+  model.meshes.emplace_back().primitives.push_back(prim);
+
+  tinygltf::Scene scene;
+  for (int y = 0; y < side; y++) {
+    for (int x = 0; x < side; x++) {
+      tinygltf::Node& node = model.nodes.emplace_back();
+      node.mesh = 0;
+      node.translation = {double(x), double(y), 0.0};
+      scene.nodes.push_back(static_cast<int>(model.nodes.size()) - 1);
+    }
+  }
+  model.scenes.push_back(scene);
+  return model;
+}
+
+void LegacyTraverse(const tinygltf::Model& model, int nodeIndex, const r3::Matrix4f& parent, float& sink) {
+  const auto& node = model.nodes[nodeIndex];
+  r3::Matrix4f world = parent * LegacyNodeTransform(node);
+  if (node.mesh >= 0) {
+    sink += world(0, 3);
+  }
+  for (int child : node.children) {
+    LegacyTraverse(model, child, world, sink);
+  }
+}
+}  // namespace
+
+void RunSceneGraphBenchmark(int nodeCount, int frames) {
+  tinygltf::Model model = MakeSyntheticScene(nodeCount);
+  float sink = 0.0f;
+
+  auto start = Clock::now();
+  for (int f = 0; f < frames; f++) {
+    for (int root : model.scenes[0].nodes) {
+      LegacyTraverse(model, root, r3::Matrix4f::Identity(), sink);
+    }
+  }
+  double legacyUs = ElapsedMicros(start) / frames;
+
+  SceneGraph scene;
+  start = Clock::now();
+  scene.Build(model);
+  double buildUs = ElapsedMicros(start);
+
+  const auto& nodes = scene.GetNodes();
+  auto visitMeshes = [&]() {
+    for (const auto& node : nodes) {
+      if (node.mesh >= 0) {
+        sink += node.world(0, 3);
+      }
+    }
+  };
+
+  // Static frame: nothing changed, only the mesh nodes are visited for drawing.
+  start = Clock::now();
+  for (int f = 0; f < frames; f++) {
+    scene.UpdateWorldMatrices();
+    visitMeshes();
+  }
+  double staticUs = ElapsedMicros(start) / frames;
+
+  // Animated frame: 1% of the nodes get a new local transform.
+  Lcg rng;
+  const int animated = max(1, nodeCount / 100);
+  size_t recomputed = 0;
+  start = Clock::now();
+  for (int f = 0; f < frames; f++) {
+    for (int a = 0; a < animated; a++) {
+      int idx = static_cast<int>(rng.Next() % nodes.size());
+      scene.SetLocalTransform(idx, r3::Vec3f(0.0f, 0.1f * f, 0.0f), r3::Quaternionf::Identity(), r3::Vec3f(1.0f, 1.0f, 1.0f));
+    }
+    recomputed += scene.UpdateWorldMatrices();
+    visitMeshes();
+  }
+  double animatedUs = ElapsedMicros(start) / frames;
+
+  // Everything changed, the worst case for the cached path.
+  start = Clock::now();
+  for (int f = 0; f < frames; f++) {
+    for (int root = 0; root < static_cast<int>(nodes.size()); root = nodes[root].subtreeEnd) {
+      scene.SetLocalMatrix(root, nodes[root].local);
+    }
+    scene.UpdateWorldMatrices();
+    visitMeshes();
+  }
+  double fullUs = ElapsedMicros(start) / frames;
+
+  aout << "SceneGraph benchmark, " << nodeCount << " nodes, " << frames << " frames (sink " << sink << ")" << endl;
+  aout << "  legacy recursive traversal: " << legacyUs << " us/frame" << endl;
+  aout << "  build: " << buildUs << " us" << endl;
+  aout << "  static frame: " << staticUs << " us/frame" << endl;
+  aout << "  1% animated: " << animatedUs << " us/frame, " << recomputed / frames << " world matrices/frame" << endl;
+  aout << "  full update: " << fullUs << " us/frame" << endl;
+}
+
+void RunMeshOptimizerBenchmark(const tinygltf::Model& model) {
+  aout << "Mesh optimizer benchmark" << endl;
+  double totalUs = 0.0;
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    const auto& mesh = model.meshes[m];
+    for (size_t p = 0; p < mesh.primitives.size(); p++) {
+      PrimitiveGeometry geom;
+      if (!BuildPrimitiveGeometry(model, mesh.primitives[p], geom) || geom.mode != GL_TRIANGLES || geom.indices.empty()) {
+        continue;
+      }
+      const size_t triangles = geom.indices.size() / 3;
+      auto start = Clock::now();
+      MeshOptimizeStats stats = OptimizePrimitiveGeometry(geom);
+      const double us = ElapsedMicros(start);
+      totalUs += us;
+      aout << "  mesh " << m << " prim " << p << ": " << triangles << " triangles, " << us << " us, ACMR "
+           << stats.before.acmr << " -> " << stats.after.acmr << ", ATVR " << stats.before.atvr << " -> "
+           << stats.after.atvr << (stats.overdrawSorted ? ", overdraw sorted" : "") << endl;
+    }
+  }
+  aout << "  total: " << totalUs << " us" << endl;
+}
+
+void RunLodBenchmark(const tinygltf::Model& model) {
+  aout << "LOD generation benchmark" << endl;
+  tinygltf::Model copy = model;
+  auto start = Clock::now();
+  const int added = GenerateLods(copy);
+  const double us = ElapsedMicros(start);
+  auto triangles = [&](int mesh) {
+    size_t count = 0;
+    for (const auto& prim : copy.meshes[mesh].primitives) {
+      if (prim.indices >= 0) count += copy.accessors[prim.indices].count / 3;
+    }
+    return count;
+  };
+  for (size_t n = 0; n < model.nodes.size(); n++) {
+    const auto& node = copy.nodes[n];
+    if (node.lods.empty() || !model.nodes[n].lods.empty()) continue;
+    aout << "  node " << n << " (" << node.name << "): " << triangles(node.mesh);
+    for (int lod : node.lods) {
+      aout << " -> " << triangles(copy.nodes[lod].mesh);
+    }
+    aout << " triangles" << endl;
+  }
+  aout << "  " << added << " LOD nodes in " << us << " us" << endl;
+}
+
+void RunSkinningBenchmark(const tinygltf::Model& model, int frames) {
+  SceneGraph scene;
+  vector<Rig> rigs;
+  if (!model.skins.empty() && scene.Build(model)) {
+    vector<Skin> skins = BuildSkins(model, scene);
+    for (const auto& node : model.nodes) {
+      if (node.skin < 0 || static_cast<size_t>(node.skin) >= skins.size() || node.mesh < 0 ||
+          static_cast<size_t>(node.mesh) >= model.meshes.size()) {
+        continue;
+      }
+      Rig rig;
+      rig.skin = skins[node.skin];
+      for (const auto& prim : model.meshes[node.mesh].primitives) {
+        PrimitiveGeometry geom;
+        SkinnedVertices vertices;
+        if (BuildPrimitiveGeometry(model, prim, geom) && JointLimit(geom) <= rig.skin.joints.size() &&
+            ExtractSkinnedVertices(geom, JointLimit(geom), vertices)) {
+          rig.primitives.push_back(std::move(vertices));
+        }
+      }
+      if (!rig.primitives.empty()) rigs.push_back(std::move(rig));
+    }
+  }
+  const bool synthetic = rigs.empty();
+  tinygltf::Model rigModel;
+  if (synthetic) {
+    Rig rig;
+    rig.primitives.emplace_back();
+    rigModel = MakeSyntheticRig(64, 512, 64, rig.primitives.back());
+    scene.Build(rigModel);
+    scene.UpdateWorldMatrices();
+    for (int i = 0; i < static_cast<int>(rigModel.nodes.size()); i++) {
+      const int joint = scene.GetInstances(i)[0];
+      rig.skin.joints.push_back(joint);
+      rig.skin.inverseBind.push_back(scene.GetNodes()[joint].world.Inverted());
+    }
+    rigs.push_back(std::move(rig));
+  }
+
+  size_t jointCount = 0, vertexCount = 0;
+  for (const auto& rig : rigs) {
+    jointCount += rig.skin.joints.size();
+    for (const auto& vertices : rig.primitives) vertexCount += vertices.vertexCount;
+  }
+  vector<r3::Matrix4f> bindLocal;
+  for (const auto& node : scene.GetNodes()) bindLocal.push_back(node.local);
+
+  ThreadPool pool;
+  vector<vector<r3::Matrix4f>> palettes(rigs.size());
+  vector<float> positions, normals;
+  double paletteUs = 0.0, serialUs = 0.0, pooledUs = 0.0;
+  for (int f = 0; f < frames; f++) {
+    // Every joint bends a little, differently each frame.
+    for (const auto& rig : rigs) {
+      for (int joint : rig.skin.joints) {
+        r3::Matrix4f local = bindLocal[joint];
+        local.MultRight(r3::Quaternionf(r3::Vec3f(0.0f, 0.0f, 1.0f), 0.02f * sin(0.1f * f + joint)).GetMatrix4());
+        scene.SetLocalMatrix(joint, local);
+      }
+    }
+    scene.UpdateWorldMatrices();
+
+    auto start = Clock::now();
+    for (size_t r = 0; r < rigs.size(); r++) ComputeJointPalette(rigs[r].skin, scene, palettes[r]);
+    paletteUs += ElapsedMicros(start);
+
+    for (ThreadPool* threads : {static_cast<ThreadPool*>(nullptr), &pool}) {
+      start = Clock::now();
+      for (size_t r = 0; r < rigs.size(); r++) {
+        for (const auto& vertices : rigs[r].primitives) {
+          positions.resize(vertices.positions.size());
+          normals.resize(vertices.normals.size());
+          SkinVertices(vertices, palettes[r].data(), positions.data(), normals.empty() ? nullptr : normals.data(), threads);
+        }
+      }
+      (threads ? pooledUs : serialUs) += ElapsedMicros(start);
+    }
+  }
+
+  aout << "Skinning benchmark, " << (synthetic ? "synthetic rig" : "model skins") << ", " << rigs.size() << " skinned nodes, "
+       << jointCount << " joints, " << vertexCount << " vertices, " << frames << " frames" << endl;
+  aout << "  palette update: " << paletteUs / frames << " us/frame, " << jointCount * sizeof(r3::Matrix4f)
+       << " bytes/frame of uniforms for GPU skinning" << endl;
+  aout << "  CPU skinning, 1 thread: " << serialUs / frames << " us/frame" << endl;
+  aout << "  CPU skinning, " << pool.GetThreadCount() + 1 << " threads: " << pooledUs / frames << " us/frame" << endl;
+}
+
+void RunAnimationBenchmark(int characters, int joints, int frames) {
+  const tinygltf::Model model = MakeSyntheticCrowd(characters, joints, 31);
+  SceneGraph scene;
+  scene.Build(model);
+  AnimationSystem animations;
+  animations.Init(model, scene);
+  const AnimationClip& clip = animations.GetClips()[0];
+  const auto& roots = scene.GetInstances(0);
+  // Each character at its own phase, as a crowd would be.
+  for (int c = 0; c < characters; c++) {
+    animations.SetTime(animations.Play(0, roots[c]), 0.37f * c);
+  }
+  const float frameSeconds = 1.0f / 72.0f;
+
+  // The straightforward player: find each channel's keys by binary search, slerp with r3.
+  auto start = Clock::now();
+  for (int f = 0; f < frames; f++) {
+    for (int c = 0; c < characters; c++) {
+      const float time = fmod(0.37f * c + f * frameSeconds, clip.duration);
+      for (const auto& channel : clip.channels) {
+        const auto& sampler = clip.samplers[channel.sampler];
+        const float* times = &clip.times[sampler.firstKey];
+        const float* values = &clip.values[sampler.firstValue];
+        const int k = min<int>(max<int>(upper_bound(times, times + sampler.keyCount, time) - times - 1, 0),
+                               sampler.keyCount - 2);
+        const float u = (time - times[k]) / (times[k + 1] - times[k]);
+        const r3::Quaternionf rotation =
+            r3::Quaternionf::Slerp(r3::Quaternionf(values + 4 * k), r3::Quaternionf(values + 4 * k + 4), u);
+        const int node = scene.GetInstances(channel.node)[c];
+        scene.SetLocalTransform(node, r3::Vec3f(scene.GetNodes()[node].local.m + 12), rotation,
+                                r3::Vec3f(1.0f, 1.0f, 1.0f));
+      }
+    }
+    scene.UpdateWorldMatrices();
+  }
+  const double naiveUs = ElapsedMicros(start);
+
+  start = Clock::now();
+  for (int f = 0; f < frames; f++) {
+    animations.Update(frameSeconds);
+    scene.UpdateWorldMatrices();
+  }
+  const double serialUs = ElapsedMicros(start);
+
+  ThreadPool pool;
+  start = Clock::now();
+  for (int f = 0; f < frames; f++) {
+    animations.Update(frameSeconds, &pool);
+    scene.UpdateWorldMatrices();
+  }
+  const double pooledUs = ElapsedMicros(start);
+
+  aout << "Animation benchmark, " << characters << " characters x " << joints << " joints, " << frames << " frames" << endl;
+  aout << "  binary search + scalar slerp: " << naiveUs / frames << " us/frame" << endl;
+  aout << "  AnimationSystem, 1 thread: " << serialUs / frames << " us/frame" << endl;
+  aout << "  AnimationSystem, " << pool.GetThreadCount() + 1 << " threads: " << pooledUs / frames << " us/frame" << endl;
+}
+
+void RunSceneBvhBenchmark(int side, int frames, int rays) {
+  const tinygltf::Model model = MakeSyntheticGrid(side);
+  SceneGraph scene;
+  scene.Build(model);
+  const int itemCount = static_cast<int>(scene.GetNodes().size());
+  auto addItems = [&](SceneBvh& bvh) {
+    for (int i = 0; i < itemCount; i++) bvh.AddItem(i, 0);
+  };
+  SceneBvh bvh;
+  addItems(bvh);
+  auto start = Clock::now();
+  bvh.Build(model, scene);
+  const double buildUs = ElapsedMicros(start);
+
+  // Every node bobs a little each frame, as if animated; rebuilding the top level alone
+  // (no triangles) against refitting it.
+  Lcg rng;
+  auto move = [&](int frame) {
+    for (int i = 0; i < itemCount; i++) {
+      const r3::Vec3f offset(float(rng.Uniform(-0.2, 0.2)), float(rng.Uniform(-0.2, 0.2)), 0.1f * sin(0.1f * frame + i));
+      scene.SetLocalMatrix(i, r3::Matrix4f::Translate(r3::Vec3f(float(i % side), float(i / side), 0.0f) + offset));
+    }
+    scene.UpdateWorldMatrices();
+  };
+  double rebuildUs = 0.0, refitUs = 0.0;
+  for (int f = 0; f < frames; f++) {
+    move(f);
+    SceneBvh rebuilt;
+    addItems(rebuilt);
+    start = Clock::now();
+    rebuilt.Build(model, scene, false);
+    rebuildUs += ElapsedMicros(start);
+    start = Clock::now();
+    bvh.Refit(scene);
+    refitUs += ElapsedMicros(start);
+  }
+
+  // A perspective camera sweeping across the grid from above, seeing a few percent of it.
+  const float center = 0.5f * (side - 1);
+  const r3::Matrix4f projection = r3::Perspective(60.0f, 1.0f, 0.1f, 100.0f);
+  double flatUs = 0.0, hierarchicalUs = 0.0;
+  size_t flatVisible = 0, visible = 0;
+  vector<uint8_t> flags;
+  for (int f = 0; f < frames; f++) {
+    const float x = center + 0.4f * side * cos(0.05f * f), y = center + 0.4f * side * sin(0.05f * f);
+    const r3::Matrix4f toClipFromWorld = projection * r3::Matrix4f::Translate(r3::Vec3f(-x, -y, -8.0f));
+    // Every item's box against all six planes, what culling without the hierarchy costs.
+    start = Clock::now();
+    float planes[6][4];
+    for (int p = 0; p < 6; p++) {
+      for (int c = 0; c < 4; c++) {
+        planes[p][c] = toClipFromWorld(3, c) + (p % 2 ? -1.0f : 1.0f) * toClipFromWorld(p / 2, c);
+      }
+    }
+    const auto& nodes = scene.GetNodes();
+    for (int i = 0; i < itemCount; i++) {
+      bool inside = true;
+      for (int p = 0; p < 6 && inside; p++) {
+        float farthest = planes[p][3];
+        for (int c = 0; c < 3; c++) {
+          farthest += planes[p][c] * nodes[i].world(c, 3) + fabs(planes[p][c]) * 0.4f;
+        }
+        inside = farthest >= 0.0f;
+      }
+      flatVisible += inside ? 1 : 0;
+    }
+    flatUs += ElapsedMicros(start);
+    start = Clock::now();
+    visible += bvh.Cull(toClipFromWorld, flags);
+    hierarchicalUs += ElapsedMicros(start);
+  }
+
+  // Rays from above at random points of the grid, as a controller pointing down at it.
+  double rayUs = 0.0, worstRayUs = 0.0;
+  int hits = 0;
+  for (int r = 0; r < rays; r++) {
+    const r3::Vec3f origin(float(rng.Uniform(0, side)), float(rng.Uniform(0, side)), 5.0f);
+    const r3::Vec3f target(float(rng.Uniform(0, side)), float(rng.Uniform(0, side)), 0.0f);
+    SceneBvh::RayHit hit;
+    start = Clock::now();
+    hits += bvh.Raycast(origin, target - origin, 100.0f, hit) ? 1 : 0;
+    const double us = ElapsedMicros(start);
+    rayUs += us;
+    worstRayUs = max(worstRayUs, us);
+  }
+
+  aout << "Scene BVH benchmark, " << itemCount << " items, " << frames << " frames" << endl;
+  aout << "  build with triangles: " << buildUs << " us" << endl;
+  aout << "  top level rebuild: " << rebuildUs / frames << " us/frame, refit: " << refitUs / frames << " us/frame" << endl;
+  aout << "  cull every item: " << flatUs / frames << " us/frame, " << flatVisible / frames
+       << " visible; hierarchical: " << hierarchicalUs / frames << " us/frame, " << visible / frames << " visible" << endl;
+  aout << "  " << rays << " rays, " << hits << " hits: " << rayUs / rays << " us average, " << worstRayUs << " us worst"
+       << endl;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "tiny_gltf.h"
+
+// CPU micro-benchmarks for the Awful sample. They're compiled in when AWFUL_BENCHMARKS is
+// defined, run once at startup, and report to logcat.
+
+// Per-frame node traversal cost on a synthetic scene: the old recursive walk that rebuilds
+// T * R * S from the glTF doubles every frame, against SceneGraph's cached update.
+void RunSceneGraphBenchmark(int nodeCount = 10000, int frames = 100);
+
+// Mesh optimization on every triangle primitive of a model: time taken and ACMR/ATVR before
+// and after. Works on any model tinygltf loads, e.g. the ones under tinygltf/models.
+void RunMeshOptimizerBenchmark(const tinygltf::Model& model);
+
+// LOD chain generation on a copy of the model: time taken, and triangles per level of each
+// mesh the generator gave a chain.
+void RunLodBenchmark(const tinygltf::Model& model);
+
+// Per-frame skinning cost with every joint animated: joint palette updates (all the GPU path
+// does on the CPU, plus its upload size), and CPU skinning on one thread and on a pool. Uses
+// the model's skinned meshes, or a synthetic rigged tube when it has none.
+void RunSkinningBenchmark(const tinygltf::Model& model, int frames = 100);
+
+// Animation playback for a crowd of characters sharing one clip, each a chain of joints with
+// a rotation channel per joint: a per-channel binary search and scalar slerp every frame,
+// against AnimationSystem's cursors and vector evaluation on one thread and on a pool.
+void RunAnimationBenchmark(int characters = 200, int joints = 32, int frames = 100);
+
+// SceneBvh on a side x side grid of spheres that all move every frame: a rebuild against a
+// refit, frustum culling every item's box against the hierarchical cull, and ray picks
+// against the triangles.
+void RunSceneBvhBenchmark(int side = 64, int frames = 100, int rays = 1000);
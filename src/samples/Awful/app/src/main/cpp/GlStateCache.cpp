@@ -0,0 +1,50 @@
+#include "GlStateCache.h"
+
+void GlStateCache::Invalidate() {
+  program_ = kUnknown;
+  vao_ = kUnknown;
+  activeUnit_ = -1;
+  textures2D_.fill(kUnknown);
+  textures2DArray_.fill(kUnknown);
+}
+
+void GlStateCache::UseProgram(GLuint program) {
+  if (program == program_) {
+    stats_.bindsAvoided++;
+    return;
+  }
+  glUseProgram(program);
+  program_ = program;
+  stats_.stateChanges++;
+}
+
+void GlStateCache::BindVertexArray(GLuint vao) {
+  if (vao == vao_) {
+    stats_.bindsAvoided++;
+    return;
+  }
+  glBindVertexArray(vao);
+  vao_ = vao;
+  stats_.stateChanges++;
+}
+
+void GlStateCache::BindTexture(int unit, GLenum target, GLuint texture) {
+  // Only 2D and 2D array bindings are shadowed, other targets always go through.
+  GLuint* shadow = nullptr;
+  if (unit >= 0 && unit < kMaxTextureUnits) {
+    shadow = target == GL_TEXTURE_2D ? &textures2D_[unit] : target == GL_TEXTURE_2D_ARRAY ? &textures2DArray_[unit] : nullptr;
+  }
+  if (shadow && *shadow == texture) {
+    stats_.bindsAvoided++;
+    return;
+  }
+  if (unit != activeUnit_) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    activeUnit_ = unit;
+  }
+  glBindTexture(target, texture);
+  if (shadow) {
+    *shadow = texture;
+  }
+  stats_.stateChanges++;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <array>
+#include <cstdint>
+
+// Shadows the bits of GL binding state the renderers touch, and skips calls that would
+// set what is already set. Anything else that changes these bindings behind the cache's
+// back must be followed by Invalidate().
+class GlStateCache {
+ public:
+  static constexpr int kMaxTextureUnits = 8;
+
+  struct Stats {
+    uint32_t drawCalls = 0;
+    uint32_t instances = 0;     // instances drawn, >= drawCalls when instancing batches them
+    uint32_t stateChanges = 0;  // GL binds actually issued
+    uint32_t bindsAvoided = 0;  // redundant binds skipped
+  };
+
+  GlStateCache() {
+    Invalidate();
+  }
+
+  // Forget the shadowed state, e.g. at the start of a frame.
+  void Invalidate();
+
+  void UseProgram(GLuint program);
+  void BindVertexArray(GLuint vao);
+  void BindTexture(int unit, GLenum target, GLuint texture);
+
+  void CountDraw(uint32_t instanceCount = 1) {
+    stats_.drawCalls++;
+    stats_.instances += instanceCount;
+  }
+
+  const Stats& GetStats() const {
+    return stats_;
+  }
+
+  void ResetStats() {
+    stats_ = {};
+  }
+
+ private:
+  // Sentinel that never matches a real GL name, so the first bind after Invalidate() is issued.
+  static constexpr GLuint kUnknown = ~0u;
+
+  GLuint program_ = kUnknown;
+  GLuint vao_ = kUnknown;
+  int activeUnit_ = -1;
+  std::array<GLuint, kMaxTextureUnits> textures2D_;
+  std::array<GLuint, kMaxTextureUnits> textures2DArray_;
+  Stats stats_;
+};
@@ -0,0 +1,209 @@
+#include "GltfAccess.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+float ComponentToFloat(const uint8_t* p, int componentType, bool normalized) {
+  switch (componentType) {
+    case TINYGLTF_COMPONENT_TYPE_BYTE: {
+      int8_t v;
+      memcpy(&v, p, sizeof(v));
+      return normalized ? std::max(v / 127.0f, -1.0f) : float(v);
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+      uint8_t v = *p;
+      return normalized ? v / 255.0f : float(v);
+    }
+    case TINYGLTF_COMPONENT_TYPE_SHORT: {
+      int16_t v;
+      memcpy(&v, p, sizeof(v));
+      return normalized ? std::max(v / 32767.0f, -1.0f) : float(v);
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      uint16_t v;
+      memcpy(&v, p, sizeof(v));
+      return normalized ? v / 65535.0f : float(v);
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+      uint32_t v;
+      memcpy(&v, p, sizeof(v));
+      return float(v);
+    }
+    case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+      float v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    default:
+      return 0.0f;
+  }
+}
+
+uint32_t ComponentToIndex(const uint8_t* p, int componentType) {
+  switch (componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      return *p;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      uint16_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+      uint32_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    default:
+      return 0;
+  }
+}
+
+const uint8_t* GetViewData(const tinygltf::Model& model, int bufferView, size_t byteOffset, size_t byteLength) {
+  if (bufferView < 0 || static_cast<size_t>(bufferView) >= model.bufferViews.size()) {
+    return nullptr;
+  }
+  const auto& bv = model.bufferViews[bufferView];
+  if (bv.buffer < 0 || static_cast<size_t>(bv.buffer) >= model.buffers.size()) {
+    return nullptr;
+  }
+  const auto& buf = model.buffers[bv.buffer];
+  if (byteOffset + byteLength > bv.byteLength || bv.byteOffset + bv.byteLength > buf.data.size()) {
+    return nullptr;
+  }
+  return buf.data.data() + bv.byteOffset + byteOffset;
+}
+}  // namespace
+
+const uint8_t* GetAccessorData(const tinygltf::Model& model, const tinygltf::Accessor& accessor, int* byteStride) {
+  if (accessor.bufferView < 0 || static_cast<size_t>(accessor.bufferView) >= model.bufferViews.size()) {
+    return nullptr;
+  }
+  const auto& bv = model.bufferViews[accessor.bufferView];
+  const int stride = accessor.ByteStride(bv);
+  if (stride <= 0) {
+    return nullptr;
+  }
+  const size_t elementSize = tinygltf::GetComponentSizeInBytes(accessor.componentType) *
+                             tinygltf::GetNumComponentsInType(accessor.type);
+  const size_t length = accessor.count == 0 ? 0 : (accessor.count - 1) * stride + elementSize;
+  const uint8_t* data = GetViewData(model, accessor.bufferView, accessor.byteOffset, length);
+  if (data && byteStride) {
+    *byteStride = stride;
+  }
+  return data;
+}
+
+int ReadAccessorFloats(const tinygltf::Model& model, int accessorIndex, std::vector<float>& out) {
+  if (accessorIndex < 0 || static_cast<size_t>(accessorIndex) >= model.accessors.size()) {
+    return 0;
+  }
+  const auto& accessor = model.accessors[accessorIndex];
+  const int numComponents = tinygltf::GetNumComponentsInType(accessor.type);
+  const int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  if (numComponents <= 0 || componentSize <= 0) {
+    return 0;
+  }
+
+  out.assign(accessor.count * numComponents, 0.0f);
+
+  // A sparse accessor without a bufferView is all zeros before substitution.
+  if (accessor.bufferView >= 0) {
+    int stride = 0;
+    const uint8_t* data = GetAccessorData(model, accessor, &stride);
+    if (!data) {
+      return 0;
+    }
+    for (size_t i = 0; i < accessor.count; i++) {
+      const uint8_t* element = data + i * stride;
+      for (int c = 0; c < numComponents; c++) {
+        out[i * numComponents + c] = ComponentToFloat(element + c * componentSize, accessor.componentType, accessor.normalized);
+      }
+    }
+  }
+
+  if (accessor.sparse.isSparse) {
+    const auto& sparse = accessor.sparse;
+    const int indexSize = tinygltf::GetComponentSizeInBytes(sparse.indices.componentType);
+    const size_t elementSize = size_t(componentSize) * numComponents;
+    const uint8_t* indices = GetViewData(model, sparse.indices.bufferView, sparse.indices.byteOffset, sparse.count * indexSize);
+    const uint8_t* values = GetViewData(model, sparse.values.bufferView, sparse.values.byteOffset, sparse.count * elementSize);
+    if (!indices || !values || indexSize <= 0) {
+      return 0;
+    }
+    for (int s = 0; s < sparse.count; s++) {
+      const uint32_t idx = ComponentToIndex(indices + s * indexSize, sparse.indices.componentType);
+      if (idx >= accessor.count) {
+        return 0;
+      }
+      for (int c = 0; c < numComponents; c++) {
+        out[idx * numComponents + c] =
+            ComponentToFloat(values + s * elementSize + c * componentSize, accessor.componentType, accessor.normalized);
+      }
+    }
+  }
+  return numComponents;
+}
+
+int ReadSparseAccessorFloats(const tinygltf::Model& model, int accessorIndex, std::vector<uint32_t>& indices,
+                             std::vector<float>& values) {
+  indices.clear();
+  values.clear();
+  if (accessorIndex < 0 || static_cast<size_t>(accessorIndex) >= model.accessors.size()) {
+    return 0;
+  }
+  const auto& accessor = model.accessors[accessorIndex];
+  const auto& sparse = accessor.sparse;
+  const int numComponents = tinygltf::GetNumComponentsInType(accessor.type);
+  const int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  const int indexSize = tinygltf::GetComponentSizeInBytes(sparse.indices.componentType);
+  if (!sparse.isSparse || accessor.bufferView >= 0 || numComponents <= 0 || componentSize <= 0 || indexSize <= 0) {
+    return 0;
+  }
+  const size_t elementSize = size_t(componentSize) * numComponents;
+  const uint8_t* indexData = GetViewData(model, sparse.indices.bufferView, sparse.indices.byteOffset, sparse.count * indexSize);
+  const uint8_t* valueData = GetViewData(model, sparse.values.bufferView, sparse.values.byteOffset, sparse.count * elementSize);
+  if (!indexData || !valueData) {
+    return 0;
+  }
+  indices.resize(sparse.count);
+  values.resize(size_t(sparse.count) * numComponents);
+  for (int s = 0; s < sparse.count; s++) {
+    indices[s] = ComponentToIndex(indexData + s * indexSize, sparse.indices.componentType);
+    // The spec requires strictly increasing indices, which lookups rely on.
+    if (indices[s] >= accessor.count || (s > 0 && indices[s] <= indices[s - 1])) {
+      indices.clear();
+      values.clear();
+      return 0;
+    }
+    for (int c = 0; c < numComponents; c++) {
+      values[size_t(s) * numComponents + c] =
+          ComponentToFloat(valueData + s * elementSize + c * componentSize, accessor.componentType, accessor.normalized);
+    }
+  }
+  return numComponents;
+}
+
+bool ReadAccessorIndices(const tinygltf::Model& model, int accessorIndex, std::vector<uint32_t>& out) {
+  if (accessorIndex < 0 || static_cast<size_t>(accessorIndex) >= model.accessors.size()) {
+    return false;
+  }
+  const auto& accessor = model.accessors[accessorIndex];
+  const int numComponents = tinygltf::GetNumComponentsInType(accessor.type);
+  const int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  if (numComponents <= 0 || componentSize <= 0 || accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+    return false;
+  }
+  int stride = 0;
+  const uint8_t* data = GetAccessorData(model, accessor, &stride);
+  if (!data) {
+    return false;
+  }
+  out.resize(accessor.count * numComponents);
+  for (size_t i = 0; i < accessor.count; i++) {
+    for (int c = 0; c < numComponents; c++) {
+      out[i * numComponents + c] = ComponentToIndex(data + i * stride + c * componentSize, accessor.componentType);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "tiny_gltf.h"
+
+// CPU-side readers for glTF accessor data. They handle byte strides, normalized integer
+// components and sparse substitution, and don't touch GL, so they can be used at load time
+// on any thread.
+
+// Reads an accessor as floats, count * components values. Normalized integers are mapped
+// to [0, 1] or [-1, 1] as the spec describes; other integers are converted as is.
+// Returns the number of components per element, or 0 on failure.
+int ReadAccessorFloats(const tinygltf::Model& model, int accessorIndex, std::vector<float>& out);
+
+// Reads a sparse accessor that has no bufferView (all zeros apart from its substitutions) as
+// it's stored: the substituted element indices, ascending, and their count * components
+// values. Returns the number of components per element, or 0 for any other accessor, which
+// ReadAccessorFloats reads densely.
+int ReadSparseAccessorFloats(const tinygltf::Model& model, int accessorIndex, std::vector<uint32_t>& indices,
+                             std::vector<float>& values);
+
+// Reads an index (or joint) accessor of any unsigned integer type.
+bool ReadAccessorIndices(const tinygltf::Model& model, int accessorIndex, std::vector<uint32_t>& out);
+
+// Pointer to the first byte of an accessor's data and its stride, or nullptr when the accessor
+// has no bufferView or its range doesn't fit the buffer.
+const uint8_t* GetAccessorData(const tinygltf::Model& model, const tinygltf::Accessor& accessor, int* byteStride);
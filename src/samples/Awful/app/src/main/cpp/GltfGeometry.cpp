@@ -0,0 +1,315 @@
+#include "GltfGeometry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "GltfAccess.h"
+
+namespace {
+struct Semantic {
+  const char* name;
+  GLuint location;
+  int components;  // as stored in the stream; shorter sources are padded
+};
+
+// The attributes the renderer knows how to consume, in stream order.
+constexpr Semantic kSemantics[] = {
+    {"POSITION", kLocationPosition, 3},   {"NORMAL", kLocationNormal, 3},         {"TANGENT", kLocationTangent, 4},
+    {"TEXCOORD_0", kLocationTexCoord0, 2}, {"TEXCOORD_1", kLocationTexCoord1, 2}, {"COLOR_0", kLocationColor0, 4},
+    {"JOINTS_0", kLocationJoints0, 4},     {"WEIGHTS_0", kLocationWeights0, 4},
+};
+
+int16_t ToSnorm16(float v) {
+  return static_cast<int16_t>(std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+int8_t ToSnorm8(float v) {
+  return static_cast<int8_t>(std::lround(std::clamp(v, -1.0f, 1.0f) * 127.0f));
+}
+
+uint16_t ToUnorm16(float v) {
+  return static_cast<uint16_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+uint8_t ToUnorm8(float v) {
+  return static_cast<uint8_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * 255.0f));
+}
+
+// IEEE 754 binary16, round to nearest even, flushing values too small for a half to zero.
+uint16_t ToHalf(float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (((bits >> 23) & 0xff) == 0xff) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);  // inf or nan
+  }
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) return sign;
+    mantissa |= 0x800000;
+    const uint32_t shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) half++;
+    return sign | half;
+  }
+  uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;  // may carry into the exponent, which is right
+  return sign | half;
+}
+
+// Projects a unit vector onto the octahedron and unfolds the lower half, giving two values in [-1, 1].
+void OctahedralEncode(const float* n, float* e) {
+  const float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+  if (l1 == 0.0f) {
+    e[0] = e[1] = 0.0f;
+    return;
+  }
+  float x = n[0] / l1, y = n[1] / l1;
+  if (n[2] < 0.0f) {
+    const float ox = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    const float oy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = ox;
+    y = oy;
+  }
+  e[0] = x;
+  e[1] = y;
+}
+}  // namespace
+
+const VertexAttribute* PrimitiveGeometry::FindAttribute(GLuint location) const {
+  for (const auto& attribute : attributes) {
+    if (attribute.location == location) return &attribute;
+  }
+  return nullptr;
+}
+
+uint32_t IndexSize(GLenum indexType) {
+  switch (indexType) {
+    case GL_UNSIGNED_BYTE:
+      return 1;
+    case GL_UNSIGNED_SHORT:
+      return 2;
+    case GL_UNSIGNED_INT:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+bool BuildPrimitiveGeometry(const tinygltf::Model& model, const tinygltf::Primitive& prim, PrimitiveGeometry& out) {
+  out = PrimitiveGeometry{};
+  out.mode = prim.mode == -1 ? GL_TRIANGLES : prim.mode;
+
+  auto pos = prim.attributes.find("POSITION");
+  if (pos == prim.attributes.end() || pos->second < 0 || static_cast<size_t>(pos->second) >= model.accessors.size()) {
+    return false;
+  }
+  out.vertexCount = static_cast<uint32_t>(model.accessors[pos->second].count);
+
+  // Read each attribute the renderer uses; everything else in the buffers is left behind.
+  std::vector<std::vector<float>> sources;
+  std::vector<int> sourceComponents;
+  for (const auto& semantic : kSemantics) {
+    auto it = prim.attributes.find(semantic.name);
+    if (it == prim.attributes.end()) continue;
+    std::vector<float> values;
+    const int components = ReadAccessorFloats(model, it->second, values);
+    if (components == 0 || components > semantic.components || values.size() != size_t(components) * out.vertexCount) {
+      if (semantic.location == kLocationPosition) return false;
+      continue;  // malformed optional attribute: drop it rather than the whole primitive
+    }
+    VertexAttribute attribute;
+    attribute.location = semantic.location;
+    attribute.components = semantic.components;
+    attribute.offset = out.stride;
+    out.stride += semantic.components * sizeof(float);
+    out.attributes.push_back(attribute);
+    sources.push_back(std::move(values));
+    sourceComponents.push_back(components);
+  }
+
+  // Interleave. Missing trailing components get 0, except a missing alpha which is 1.
+  out.vertices.resize(size_t(out.stride) * out.vertexCount);
+  for (uint32_t v = 0; v < out.vertexCount; v++) {
+    uint8_t* vertex = out.vertices.data() + size_t(v) * out.stride;
+    for (size_t a = 0; a < out.attributes.size(); a++) {
+      const auto& attribute = out.attributes[a];
+      const int srcComponents = sourceComponents[a];
+      float value[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+      memcpy(value, &sources[a][size_t(v) * srcComponents], srcComponents * sizeof(float));
+      memcpy(vertex + attribute.offset, value, attribute.components * sizeof(float));
+    }
+  }
+
+  if (prim.indices >= 0) {
+    if (!ReadAccessorIndices(model, prim.indices, out.indices)) {
+      return false;
+    }
+    for (uint32_t index : out.indices) {
+      if (index >= out.vertexCount) return false;
+    }
+    // 8-bit indices are a slow path on a lot of mobile hardware, so widen them.
+    const int componentType = model.accessors[prim.indices].componentType;
+    out.indexType = componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+  }
+  return true;
+}
+
+void QuantizePrimitiveGeometry(PrimitiveGeometry& geom) {
+  if (geom.quantized || geom.vertexCount == 0) {
+    return;
+  }
+  auto source = [&](uint32_t v, const VertexAttribute& attribute) {
+    return reinterpret_cast<const float*>(geom.vertices.data() + size_t(v) * geom.stride + attribute.offset);
+  };
+
+  // Positions: center the bounds and scale by the largest half extent.
+  float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+  const VertexAttribute* position = geom.FindAttribute(kLocationPosition);
+  for (uint32_t v = 0; v < geom.vertexCount; v++) {
+    const float* p = source(v, *position);
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], p[c]);
+      hi[c] = std::max(hi[c], p[c]);
+    }
+  }
+  const float center[3] = {(lo[0] + hi[0]) * 0.5f, (lo[1] + hi[1]) * 0.5f, (lo[2] + hi[2]) * 0.5f};
+  float scale = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]}) * 0.5f;
+  if (!(scale > 0.0f)) scale = 1.0f;
+
+  // The new layout, attribute for attribute; everything is 4 byte aligned.
+  std::vector<VertexAttribute> attributes;
+  uint32_t stride = 0;
+  for (const auto& src : geom.attributes) {
+    VertexAttribute dst;
+    dst.location = src.location;
+    dst.offset = stride;
+    dst.normalized = GL_TRUE;
+    bool unorm = false;
+    switch (src.location) {
+      case kLocationPosition:
+        dst.components = 4;  // w is 1, and pads to 8 bytes
+        dst.type = GL_SHORT;
+        break;
+      case kLocationNormal:
+        dst.components = 2;
+        dst.type = GL_SHORT;
+        break;
+      case kLocationTangent:
+        dst.components = 4;  // octahedral xy, handedness, pad
+        dst.type = GL_BYTE;
+        break;
+      case kLocationTexCoord0:
+      case kLocationTexCoord1:
+        dst.components = 2;
+        unorm = true;
+        for (uint32_t v = 0; v < geom.vertexCount && unorm; v++) {
+          const float* uv = source(v, src);
+          unorm = uv[0] >= 0.0f && uv[0] <= 1.0f && uv[1] >= 0.0f && uv[1] <= 1.0f;
+        }
+        dst.type = unorm ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT;
+        dst.normalized = unorm ? GL_TRUE : GL_FALSE;
+        break;
+      case kLocationColor0:
+        dst.components = 4;
+        dst.type = GL_UNSIGNED_BYTE;
+        break;
+      default:
+        dst = src;
+        dst.offset = stride;
+        break;
+    }
+    const uint32_t componentSize = dst.type == GL_FLOAT ? 4 : (dst.type == GL_BYTE || dst.type == GL_UNSIGNED_BYTE) ? 1 : 2;
+    stride += (dst.components * componentSize + 3) & ~3u;
+    attributes.push_back(dst);
+  }
+
+  std::vector<uint8_t> vertices(size_t(stride) * geom.vertexCount);
+  for (uint32_t v = 0; v < geom.vertexCount; v++) {
+    uint8_t* vertex = vertices.data() + size_t(v) * stride;
+    for (size_t a = 0; a < attributes.size(); a++) {
+      const float* in = source(v, geom.attributes[a]);
+      const VertexAttribute& dst = attributes[a];
+      uint8_t* out = vertex + dst.offset;
+      switch (dst.location) {
+        case kLocationPosition: {
+          const int16_t q[4] = {ToSnorm16((in[0] - center[0]) / scale), ToSnorm16((in[1] - center[1]) / scale),
+                                ToSnorm16((in[2] - center[2]) / scale), 32767};
+          memcpy(out, q, sizeof(q));
+          break;
+        }
+        case kLocationNormal: {
+          float e[2];
+          OctahedralEncode(in, e);
+          const int16_t q[2] = {ToSnorm16(e[0]), ToSnorm16(e[1])};
+          memcpy(out, q, sizeof(q));
+          break;
+        }
+        case kLocationTangent: {
+          float e[2];
+          OctahedralEncode(in, e);
+          const int8_t q[4] = {ToSnorm8(e[0]), ToSnorm8(e[1]), int8_t(in[3] < 0.0f ? -127 : 127), 0};
+          memcpy(out, q, sizeof(q));
+          break;
+        }
+        case kLocationTexCoord0:
+        case kLocationTexCoord1: {
+          const uint16_t q[2] = {dst.type == GL_UNSIGNED_SHORT ? ToUnorm16(in[0]) : ToHalf(in[0]),
+                                 dst.type == GL_UNSIGNED_SHORT ? ToUnorm16(in[1]) : ToHalf(in[1])};
+          memcpy(out, q, sizeof(q));
+          break;
+        }
+        case kLocationColor0: {
+          const uint8_t q[4] = {ToUnorm8(in[0]), ToUnorm8(in[1]), ToUnorm8(in[2]), ToUnorm8(in[3])};
+          memcpy(out, q, sizeof(q));
+          break;
+        }
+        default:
+          memcpy(out, in, dst.components * sizeof(float));
+          break;
+      }
+    }
+  }
+
+  geom.attributes = std::move(attributes);
+  geom.vertices = std::move(vertices);
+  geom.stride = stride;
+  geom.quantized = true;
+  geom.dequantize = r3::Matrix4f(scale, 0.0f, 0.0f, center[0],  //
+                                 0.0f, scale, 0.0f, center[1],  //
+                                 0.0f, 0.0f, scale, center[2],  //
+                                 0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+float UvDensity(const PrimitiveGeometry& geom) {
+  const VertexAttribute* position = geom.FindAttribute(kLocationPosition);
+  const VertexAttribute* texCoord = geom.FindAttribute(kLocationTexCoord0);
+  if (geom.quantized || geom.mode != GL_TRIANGLES || !position || !texCoord) {
+    return 0.0f;
+  }
+  auto source = [&](uint32_t v, const VertexAttribute& attribute) {
+    return reinterpret_cast<const float*>(geom.vertices.data() + size_t(v) * geom.stride + attribute.offset);
+  };
+  const uint32_t count = geom.indices.empty() ? geom.vertexCount : static_cast<uint32_t>(geom.indices.size());
+  double area = 0.0, uvArea = 0.0;
+  for (uint32_t i = 0; i + 2 < count; i += 3) {
+    uint32_t v[3];
+    for (int k = 0; k < 3; k++) v[k] = geom.indices.empty() ? i + k : geom.indices[i + k];
+    const float *p0 = source(v[0], *position), *p1 = source(v[1], *position), *p2 = source(v[2], *position);
+    const float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    const float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    const float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+    area += 0.5 * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    const float *t0 = source(v[0], *texCoord), *t1 = source(v[1], *texCoord), *t2 = source(v[2], *texCoord);
+    uvArea += 0.5 * std::fabs((t1[0] - t0[0]) * (t2[1] - t0[1]) - (t2[0] - t0[0]) * (t1[1] - t0[1]));
+  }
+  return area > 0.0 ? static_cast<float>(uvArea / area) : 0.0f;
+}
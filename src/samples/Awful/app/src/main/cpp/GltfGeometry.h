@@ -0,0 +1,77 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "linear.h"
+#include "tiny_gltf.h"
+
+// A glTF primitive repacked for upload: the attributes the renderer consumes interleaved into
+// a single vertex stream, plus the indices. Built on the CPU from the accessors, so only the
+// bytes a primitive actually references end up on the GPU, whatever else shares its buffers.
+
+// Attribute locations shared with the shaders. 4-7 hold the per-instance matrix.
+enum VertexLocation : GLuint {
+  kLocationPosition = 0,
+  kLocationTexCoord0 = 1,
+  kLocationNormal = 2,
+  kLocationTangent = 3,
+  kLocationTexCoord1 = 8,
+  kLocationColor0 = 9,
+  kLocationJoints0 = 10,  // joint indices as floats, which are exact well past any palette size
+  kLocationWeights0 = 11,
+};
+
+struct VertexAttribute {
+  GLuint location = 0;
+  GLint components = 0;
+  GLenum type = GL_FLOAT;
+  GLboolean normalized = GL_FALSE;
+  uint32_t offset = 0;  // within a vertex
+};
+
+struct PrimitiveGeometry {
+  GLenum mode = GL_TRIANGLES;
+  std::vector<VertexAttribute> attributes;
+  uint32_t stride = 0;
+  uint32_t vertexCount = 0;
+  std::vector<uint8_t> vertices;  // vertexCount * stride bytes, interleaved
+  std::vector<uint32_t> indices;  // empty for non-indexed primitives
+  GLenum indexType = 0;           // the type to upload indices as, 0 if non-indexed
+
+  // Maps the stored positions back to the asset's object space. Identity unless quantized,
+  // in which case it's folded into the instance matrices.
+  bool quantized = false;
+  r3::Matrix4f dequantize;
+
+  const VertexAttribute* FindAttribute(GLuint location) const;
+};
+
+// Fails if the primitive has no POSITION, or an attribute's count doesn't match it.
+bool BuildPrimitiveGeometry(const tinygltf::Model& model, const tinygltf::Primitive& prim, PrimitiveGeometry& out);
+
+// Repacks a float stream (as built above) into compact attributes:
+//  - positions as normalized 16-bit ints over the primitive's bounds, with a uniform scale so
+//    the dequantize matrix doesn't skew normals
+//  - normals octahedral encoded in 2 x snorm16, tangents in 2 x snorm8 plus the handedness
+//    sign in the third component. GltfRenderer's shaders are unlit and don't read either; a
+//    shader that does has to decode them with
+//      vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+//      if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+//      n = normalize(n);
+//  - texture coordinates as unorm16 when they're all in [0, 1], half floats otherwise
+//  - colors as unorm8
+//  - joints and weights stay float, though the renderer leaves skinned primitives unquantized
+//    since their positions are skinned in object space
+// A vertex with every unskinned attribute shrinks from 72 bytes to 28.
+void QuantizePrimitiveGeometry(PrimitiveGeometry& geom);
+
+// TEXCOORD_0 area per unit of object-space surface area, averaged over the triangles: how
+// many texels a texture of size w x h spreads over each unit of surface is this times w * h.
+// Reads the float stream, so call it before quantizing. 0 when there's nothing to measure.
+float UvDensity(const PrimitiveGeometry& geom);
+
+// Bytes per index for GL_UNSIGNED_BYTE/SHORT/INT.
+uint32_t IndexSize(GLenum indexType);
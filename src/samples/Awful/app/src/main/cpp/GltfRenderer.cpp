@@ -2,6 +2,305 @@
 
 #include <android/log.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+
+#include "GltfAccess.h"
+#include "GltfGeometry.h"
+#include "GpuResources.h"
+#include "MeshOptimizer.h"
+#include "TextureArrays.h"
+#include "TextureCodec.h"
+#include "ThreadPool.h"
+
+namespace {
+// Same as the Renderer's program, except the object to world matrix is a per-instance
+// attribute (locations 4-7) so every instance of a primitive can share one draw. Deformations
+// are variants (see ShaderVariants.h), chosen by what's defined ahead of it:
+//  - MAX_JOINTS: up to four joints per vertex blended from a palette. The palette size is set
+//    to fit the largest skin drawn this way, since a bound uniform range has to cover the
+//    whole block.
+//  - MAX_MORPH_TARGETS: the position deltas of the targets in the Morph block, looked up in
+//    the morph texture (see MorphTargets.h), added before skinning.
+const char* kVertexBody = R"vertex(
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec2 inUV;
+layout(location = 4) in mat4 inWorldFromObject;
+#ifdef MAX_JOINTS
+layout(location = 10) in vec4 inJoints;
+layout(location = 11) in vec4 inWeights;
+#endif
+
+out vec2 fragUV;
+
+layout(std140) uniform View {
+    mat4 uToClipFromWorld;
+};
+
+#ifdef MAX_JOINTS
+layout(std140) uniform Skin {
+    mat4 uJoints[MAX_JOINTS];
+};
+#endif
+
+#ifdef MAX_MORPH_TARGETS
+uniform highp sampler2D uMorphDeltas;
+
+layout(std140) uniform Morph {
+    ivec4 uMorphSegments[MAX_MORPH_TARGETS];  // first texel, texel count, sparse
+    vec4 uMorphWeights[MAX_MORPH_TARGETS / 4];
+    int uMorphCount;
+};
+
+vec4 MorphTexel(int i) {
+    return texelFetch(uMorphDeltas, ivec2(i % MORPH_TEXTURE_WIDTH, i / MORPH_TEXTURE_WIDTH), 0);
+}
+
+// Sparse runs hold ascending vertex indices in w.
+vec3 MorphDelta(ivec4 segment) {
+    if (segment.z == 0) {
+        return MorphTexel(segment.x + gl_VertexID).xyz;
+    }
+    float vertex = float(gl_VertexID);
+    int lo = segment.x;
+    int hi = segment.x + segment.y - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        vec4 texel = MorphTexel(mid);
+        if (texel.w < vertex) {
+            lo = mid + 1;
+        } else if (texel.w > vertex) {
+            hi = mid - 1;
+        } else {
+            return texel.xyz;
+        }
+    }
+    return vec3(0.0);
+}
+#endif
+
+void main() {
+    vec4 position = vec4(inPosition, 1.0);
+#ifdef MAX_MORPH_TARGETS
+    for (int t = 0; t < uMorphCount; t++) {
+        position.xyz += uMorphWeights[t / 4][t % 4] * MorphDelta(uMorphSegments[t]);
+    }
+#endif
+#ifdef MAX_JOINTS
+    mat4 skin = inWeights.x * uJoints[int(inJoints.x)] + inWeights.y * uJoints[int(inJoints.y)] +
+                inWeights.z * uJoints[int(inJoints.z)] + inWeights.w * uJoints[int(inJoints.w)];
+    position = skin * position;
+#endif
+    fragUV = inUV;
+    gl_Position = uToClipFromWorld * (inWorldFromObject * position);
+}
+)vertex";
+
+// ALPHA_MASK discards what's under the material's alphaCutoff. TEXTURE_ARRAY samples the base
+// color from the material's layer of a texture array (see TextureArrays.h).
+const char* kFragmentBody = R"fragment(
+precision mediump float;
+
+in vec2 fragUV;
+
+#ifdef TEXTURE_ARRAY
+uniform mediump sampler2DArray uTexture;
+#else
+uniform sampler2D uTexture;
+#endif
+
+layout(std140) uniform Material {
+    vec4 uBaseColorFactor;
+    vec4 uMetallicRoughnessAlphaCutoff;
+    float uTextureLayer;
+};
+
+out vec4 outColor;
+
+void main() {
+#ifdef TEXTURE_ARRAY
+    outColor = texture(uTexture, vec3(fragUV, uTextureLayer)) * uBaseColorFactor;
+#else
+    outColor = texture(uTexture, fragUV) * uBaseColorFactor;
+#endif
+#ifdef ALPHA_MASK
+    if (outColor.a < uMetallicRoughnessAlphaCutoff.z) {
+        discard;
+    }
+#endif
+}
+)fragment";
+
+constexpr GLuint kInstanceMatrixLocation = 4;  // a mat4 takes 4 consecutive locations
+
+// Uniform buffer binding points. Per-draw blocks (anything that varies per draw rather than
+// per instance or material) get kDrawBlockBinding.
+constexpr GLuint kViewBlockBinding = 0;
+constexpr GLuint kMaterialBlockBinding = 1;
+constexpr GLuint kDrawBlockBinding = 2;
+constexpr GLuint kMorphBlockBinding = 3;
+
+constexpr GLint kMorphTextureUnit = 1;
+
+// Local transforms from a node's EXT_mesh_gpu_instancing extension, empty if it has none.
+std::vector<r3::Matrix4f> ReadGpuInstances(const tinygltf::Model& model, const tinygltf::Node& node) {
+  std::vector<r3::Matrix4f> result;
+  auto ext = node.extensions.find("EXT_mesh_gpu_instancing");
+  if (ext == node.extensions.end() || !ext->second.Has("attributes")) {
+    return result;
+  }
+  const tinygltf::Value& attributes = ext->second.Get("attributes");
+  auto read = [&](const char* name, int components, std::vector<float>& out) {
+    if (!attributes.Has(name)) return true;
+    const tinygltf::Value& accessor = attributes.Get(name);
+    return accessor.IsNumber() && ReadAccessorFloats(model, accessor.GetNumberAsInt(), out) == components;
+  };
+  std::vector<float> translation, rotation, scale;
+  if (!read("TRANSLATION", 3, translation) || !read("ROTATION", 4, rotation) || !read("SCALE", 3, scale)) {
+    __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Bad EXT_mesh_gpu_instancing on node %s", node.name.c_str());
+    return result;
+  }
+
+  // All attributes share a count; the spec requires it, but be defensive about it.
+  size_t count = std::max({translation.size() / 3, rotation.size() / 4, scale.size() / 3});
+  if ((!translation.empty() && translation.size() / 3 != count) || (!rotation.empty() && rotation.size() / 4 != count) ||
+      (!scale.empty() && scale.size() / 3 != count)) {
+    __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Mismatched EXT_mesh_gpu_instancing counts on node %s",
+                        node.name.c_str());
+    return result;
+  }
+  result.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    r3::Vec3f t(0.0f, 0.0f, 0.0f);
+    r3::Quaternionf r = r3::Quaternionf::Identity();
+    r3::Vec3f s(1.0f, 1.0f, 1.0f);
+    if (!translation.empty()) t = r3::Vec3f(&translation[i * 3]);
+    if (!rotation.empty()) r = r3::Quaternionf(rotation[i * 4], rotation[i * 4 + 1], rotation[i * 4 + 2], rotation[i * 4 + 3]);
+    if (!scale.empty()) s = r3::Vec3f(&scale[i * 3]);
+    result.push_back(SceneGraph::ComposeLocal(t, r, s));
+  }
+  return result;
+}
+
+// MSFT_lod puts the minimum screen coverage of each level in the node's extras. Without it,
+// each level takes over at a quarter of the previous one's coverage and the last is never
+// culled.
+std::vector<float> ReadLodCoverage(const tinygltf::Node& node, size_t levels) {
+  std::vector<float> coverage;
+  if (node.extras.IsObject() && node.extras.Has("MSFT_screencoverage")) {
+    const tinygltf::Value& values = node.extras.Get("MSFT_screencoverage");
+    for (size_t i = 0; values.IsArray() && i < values.ArrayLen(); i++) {
+      if (values.Get(int(i)).IsNumber()) coverage.push_back(static_cast<float>(values.Get(int(i)).GetNumberAsDouble()));
+    }
+    if (coverage.size() == levels) {
+      return coverage;
+    }
+    __android_log_print(ANDROID_LOG_WARN, "GltfRenderer", "Node %s has %zu screen coverages for %zu LODs, ignoring them",
+                        node.name.c_str(), coverage.size(), levels);
+  }
+  coverage.assign(levels, 0.0f);
+  float threshold = 0.25f;
+  for (size_t i = 0; i + 1 < levels; i++) {
+    coverage[i] = threshold;
+    threshold *= 0.25f;
+  }
+  return coverage;
+}
+
+// Materials decide how each image is filtered; images used as color anywhere are treated
+// as color, and images no material uses default to it.
+std::vector<TextureUsage> ClassifyImages(const tinygltf::Model& model) {
+  std::vector<TextureUsage> usage(model.images.size(), TextureUsage::Color);
+  std::vector<bool> color(model.images.size(), false);
+  auto mark = [&](int textureIndex, TextureUsage use) {
+    if (textureIndex < 0 || static_cast<size_t>(textureIndex) >= model.textures.size()) return;
+    const tinygltf::Texture& texture = model.textures[textureIndex];
+    std::vector<int> sources = {texture.source};
+    auto basisu = texture.extensions.find("KHR_texture_basisu");
+    if (basisu != texture.extensions.end() && basisu->second.Has("source")) {
+      sources.push_back(basisu->second.Get("source").GetNumberAsInt());
+    }
+    for (int image : sources) {
+      if (image < 0 || static_cast<size_t>(image) >= usage.size() || color[image]) continue;
+      usage[image] = use;
+      color[image] = use == TextureUsage::Color;
+    }
+  };
+  for (const auto& material : model.materials) {
+    mark(material.pbrMetallicRoughness.baseColorTexture.index, TextureUsage::Color);
+    mark(material.emissiveTexture.index, TextureUsage::Color);
+  }
+  for (const auto& material : model.materials) {
+    mark(material.normalTexture.index, TextureUsage::Normal);
+    mark(material.occlusionTexture.index, TextureUsage::Data);
+    mark(material.pbrMetallicRoughness.metallicRoughnessTexture.index, TextureUsage::Data);
+  }
+  return usage;
+}
+
+// The KHR_texture_basisu image of a texture, or -1.
+int Ktx2Source(const tinygltf::Texture& texture) {
+  auto basisu = texture.extensions.find("KHR_texture_basisu");
+  return basisu != texture.extensions.end() && basisu->second.Has("source") ? basisu->second.Get("source").GetNumberAsInt()
+                                                                            : -1;
+}
+
+TextureFormatSupport QueryTextureFormatSupport() {
+  TextureFormatSupport support;
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+    if (ext && (!strcmp(ext, "GL_KHR_texture_compression_astc_ldr") || !strcmp(ext, "GL_OES_texture_compression_astc"))) {
+      support.astc = true;
+    }
+  }
+  return support;
+}
+}  // namespace
+
+// Everything the load's pool task hands FinishInit(): primitives in mesh order, repacked and
+// laid out in their buffers, every image's prepared chain, the packed texture arrays and
+// morph deltas, and what each scene node draws.
+struct GltfRenderer::PreparedLoad {
+  bool ok = false;
+  bool quantize = true;
+  bool compress = true;
+  TextureFormatSupport support;
+  uint32_t maxTextureSize = 2048;  // the GLES 3.0 minimums
+  uint32_t maxArrayLayers = 256;
+  std::vector<PrimitiveGeometry> geometry;
+  std::vector<uint8_t> valid;
+  std::vector<int> meshOf;
+  std::vector<float> uvDensity;
+  std::vector<uint32_t> jointLimit;
+  std::vector<int> skinnedVertices;
+  std::vector<int> morphTargets;
+  std::vector<size_t> vertexOffsets;
+  std::vector<size_t> indexOffsets;
+  std::vector<uint8_t> vertexData;
+  std::vector<uint8_t> indexData;
+  std::vector<uint8_t> morphTexels;  // RGBA32F rows of kMorphTextureWidth, empty if none fit
+  uint32_t morphRows = 0;
+  std::vector<TextureData> textures;
+  std::vector<uint8_t> texturesOk;
+  TextureArrayPlan arrays;
+  std::vector<GpuUploader::TextureUpload> arrayUploads;  // per array, no levels if it couldn't be packed
+  // Per scene node.
+  struct NodePlan {
+    std::vector<int> levelMeshes;  // LOD 0 first; empty for nodes only drawn as another's LOD
+    int lod = -1;                  // into lods_
+    int firstGpuInstance = -1;     // into gpuInstanceLocal_, or -1 for a single instance
+    uint32_t instanceCount = 1;
+    int firstBvhItem = -1;  // into bvh_, an item per instance, or -1 if never culled
+  };
+  std::vector<NodePlan> nodes;
+  double ms = 0.0;
+};
+
 GltfRenderer::GltfRenderer() {}
 
 GltfRenderer::~GltfRenderer() {
@@ -9,254 +308,1351 @@ GltfRenderer::~GltfRenderer() {
   Destroy();
 }
 
-bool GltfRenderer::Init(const tinygltf::Model& model) {
+bool GltfRenderer::Init(const tinygltf::Model& model, uint32_t framesInFlight, bool quantizeVertices, bool compressTextures) {
   __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Init called");
+  return StartLoad(model, nullptr, framesInFlight, quantizeVertices, compressTextures);
+}
+
+bool GltfRenderer::Load(tinygltf::Model& model, std::function<bool(tinygltf::Model&)> parse, uint32_t framesInFlight,
+                        bool quantizeVertices, bool compressTextures) {
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Load called");
+  return StartLoad(model, [parse = std::move(parse), &model] { return parse(model); }, framesInFlight, quantizeVertices,
+                   compressTextures);
+}
+
+// Everything up to creating GL objects takes long enough to drop frames, parsing included,
+// so it runs on the pool and Render() picks the result up. Only the queries that need this
+// thread's context happen here.
+bool GltfRenderer::StartLoad(const tinygltf::Model& model, std::function<bool()> parse, uint32_t framesInFlight,
+                             bool quantizeVertices, bool compressTextures) {
+  if (loadPrepared_.valid()) {
+    loadPrepared_.wait();
+  }
+  loadStart_ = std::chrono::steady_clock::now();
+  loaded_ = false;
+  if (!uploader_) {
+    ownUploader_ = std::make_unique<GpuUploader>();
+    uploader_ = ownUploader_.get();
+  }
+  textures_.SetUploader(uploader_);
+  framesInFlight_ = framesInFlight;
   model_ = &model;
-  if (!CreateBuffers(model)) return false;
-  if (!CreateTextures(model)) return false;
-  if (!CreateVertexArrays(model)) return false;
-  // TODO: Create/load shaders and set up uniforms
+
+  load_ = std::make_unique<PreparedLoad>();
+  PreparedLoad& load = *load_;
+  load.quantize = quantizeVertices;
+  load.compress = compressTextures;
+  load.support = QueryTextureFormatSupport();
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Compressed formats: ETC2%s", load.support.astc ? ", ASTC" : "");
+  GLint maxTextureSize = 0, maxArrayLayers = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxArrayLayers);
+  load.maxTextureSize = std::max<uint32_t>(load.maxTextureSize, maxTextureSize);
+  load.maxArrayLayers = std::max<uint32_t>(load.maxArrayLayers, maxArrayLayers);
+  if (!loadPool_) {
+    loadPool_ = std::make_unique<ThreadPool>();
+  }
+  auto prepared = std::make_shared<std::promise<void>>();
+  loadPrepared_ = prepared->get_future();
+  loadPool_->Run([this, &model, &load, parse = std::move(parse), prepared] {
+    const auto start = std::chrono::steady_clock::now();
+    load.ok = (!parse || parse()) && PrepareScene(model);
+    if (load.ok) {
+      PrepareGeometry(model, load);
+      PrepareMorphTexture(load);
+      PrepareTextures(model, load);
+      PlaceNodes(model, load);
+    }
+    load.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    prepared->set_value();
+  });
   return true;
 }
 
-void GltfRenderer::Render(Shader* shader) {
-  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Render called");
-  if (!model_) return;
-  shader->activate();
-  // For each scene node, draw recursively
-  for (const auto& scene : model_->scenes) {
-    for (int nodeIdx : scene.nodes) {
-      DrawNode(nodeIdx, r3::Matrix4f::Identity(), shader);
+// Checks the model can be drawn and compiles its node hierarchy and skins.
+bool GltfRenderer::PrepareScene(const tinygltf::Model& model) {
+  // Accessors are read through GltfAccess, so quantized attributes decode like any others.
+  // KTX2 textures whose format can't be used are logged and left untextured.
+  static const char* kSupportedRequired[] = {"KHR_mesh_quantization", "EXT_mesh_gpu_instancing", "KHR_texture_basisu"};
+  for (const auto& ext : model.extensionsRequired) {
+    if (std::find(std::begin(kSupportedRequired), std::end(kSupportedRequired), ext) == std::end(kSupportedRequired)) {
+      __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Unsupported required extension %s", ext.c_str());
+      return false;
     }
   }
-  shader->deactivate();
+  if (!scene_.Build(model)) {
+    __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Invalid node hierarchy");
+    return false;
+  }
+  skins_ = BuildSkins(model, scene_);
+  palettes_.assign(skins_.size(), {});
+  return true;
 }
 
-void GltfRenderer::Destroy() {
-  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Destroy called");
-  for (auto& b : buffersGL_) {
-    if (b.buffer) glDeleteBuffers(1, &b.buffer);
-  }
-  for (auto& tex : texturesGL_) {
-    if (tex.texture) glDeleteTextures(1, &tex.texture);
-  }
-  glDeleteVertexArrays(vaos_.size(), vaos_.data());
-  buffersGL_.clear();
-  texturesGL_.clear();
-  vaos_.clear();
-}
-
-bool GltfRenderer::CreateBuffers(const tinygltf::Model& model) {
-  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "CreateBuffers called");
-  // Allocate OpenGL buffers for each bufferView
-  std::vector<GLuint> buffers(model.buffers.size());
-  buffersGL_.resize(model.buffers.size());
-  glGenBuffers(model.buffers.size(), buffers.data());
-
-  for (size_t i = 0; i < model.buffers.size(); ++i) {
-    const auto& buf = model.buffers[i];
-    auto buffer = buffers[i];
-    buffersGL_[i].buffer = buffer;
-    buffersGL_[i].size = buf.data.size();
-    // We don't know the target yet; will bind as needed for bufferViews
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, buf.data.size(), buf.data.data(), GL_STATIC_DRAW);
-    __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Created buffer %zu: size=%zu", i, buf.data.size());
+// The GL half of the load, on the render thread once the pool has prepared everything: only
+// object creation and queueing uploads are left.
+bool GltfRenderer::FinishInit(const tinygltf::Model& model) {
+  if (!load_->ok) {
+    load_.reset();
+    return false;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const bool created = CreateGeometry(model, *load_) && CreateTextures(model, *load_);
+  if (!created) {
+    load_.reset();
+    return false;
+  }
+  instanceBuffer_ = GpuResourceTracker::Get().CreateBuffer({"GltfRenderer", name_, "instances"});
+  BuildDrawList(model, *load_);
+  RequestPrograms();
+
+  // One view block, a block per run of equal materials in the draw list, and a palette per GPU
+  // skinned draw and a morph block per GPU morphed draw each frame. The list is sorted by program
+  // first, so a material shared across programs takes a block in each of its runs.
+  uint32_t materialRuns = 0;
+  for (size_t i = 0; i < drawList_.size(); i++) {
+    materialRuns += i == 0 || drawList_[i].material != drawList_[i - 1].material ? 1 : 0;
+  }
+  uint32_t gpuSkinnedDraws = 0, gpuMorphedDraws = 0;
+  for (const auto& draw : deformedDraws_) {
+    gpuSkinnedDraws += !draw.cpu && draw.skin >= 0 ? 1 : 0;
+    gpuMorphedDraws += !draw.cpu && draw.morph >= 0 ? 1 : 0;
+  }
+  const uint32_t blocksPerFrame = 1 + materialRuns + gpuSkinnedDraws + gpuMorphedDraws;
+  const GLsizeiptr bytesPerFrame = sizeof(ViewBlock) + GLsizeiptr(materialRuns) * sizeof(MaterialBlock) +
+                                   GLsizeiptr(gpuSkinnedDraws) * maxGpuJoints_ * sizeof(r3::Matrix4f) +
+                                   GLsizeiptr(gpuMorphedDraws) * sizeof(MorphBlock);
+  if (!uniforms_.Init(bytesPerFrame, blocksPerFrame, framesInFlight_, name_)) {
+    load_.reset();
+    return false;
+  }
+  loadTicket_ = uploader_->GetLastTicket();
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Prepared on %u threads in %.1f ms, GL objects created in %.2f ms",
+                      loadPool_->GetThreadCount(), load_->ms,
+                      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+  load_.reset();
+  return true;
+}
+
+// Every variant some draw uses, started now and picked up by Render() as they finish.
+void GltfRenderer::RequestPrograms() {
+  for (const auto& item : drawList_) {
+    std::string defines = "#version 300 es\n";
+    if (item.program & kShaderSkinned) {
+      defines += "#define MAX_JOINTS " + std::to_string(maxGpuJoints_) + "\n";
+    }
+    if (item.program & kShaderMorphed) {
+      defines += "#define MAX_MORPH_TARGETS " + std::to_string(kMaxGpuMorphTargets) + "\n#define MORPH_TEXTURE_WIDTH " +
+                 std::to_string(kMorphTextureWidth) + "\n";
+    }
+    std::string fragmentDefines = "#version 300 es\n";
+    if (item.program & kShaderAlphaMask) {
+      fragmentDefines += "#define ALPHA_MASK\n";
+    }
+    if (item.program & kShaderTextureArray) {
+      fragmentDefines += "#define TEXTURE_ARRAY\n";
+    }
+    variants_.Request(item.program, defines + kVertexBody, fragmentDefines + kFragmentBody);
+  }
+}
+
+// Binds the uniform blocks and samplers of a variant that just became ready.
+bool GltfRenderer::SetUpProgram(uint32_t variant) {
+  const Shader* shader = variants_.Get(variant);
+  if (!shader || !shader->bindUniformBlock("View", kViewBlockBinding) ||
+      !shader->bindUniformBlock("Material", kMaterialBlockBinding) ||
+      ((variant & kShaderSkinned) && !shader->bindUniformBlock("Skin", kDrawBlockBinding)) ||
+      ((variant & kShaderMorphed) && !shader->bindUniformBlock("Morph", kMorphBlockBinding))) {
+    __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Failed to set up program variant 0x%x", variant);
+    return false;
+  }
+  if (variant & kShaderMorphed) {
+    glUseProgram(shader->getProgram());
+    glUniform1i(glGetUniformLocation(shader->getProgram(), "uMorphDeltas"), kMorphTextureUnit);
+    glUseProgram(0);
   }
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
   return true;
 }
 
+void GltfRenderer::Render(const r3::Matrix4f& toClipFromWorld) {
+  if (!model_) return;
+  if (ownUploader_) {
+    ownUploader_->Update();
+  }
+  if (loadPrepared_.valid()) {
+    if (loadPrepared_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+    loadPrepared_.get();
+    if (!FinishInit(*model_)) {
+      __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Failed to load %s", name_.c_str());
+      model_ = nullptr;
+    }
+    // Its uploads can't be done yet, and the first variant can be built next frame.
+    return;
+  }
+  for (uint32_t variant : variants_.Poll()) {
+    SetUpProgram(variant);
+  }
+  if (!loaded_) {
+    if (!uploader_->IsComplete(loadTicket_)) return;
+    loaded_ = true;
+    const auto& uploads = uploader_->GetStats();
+    __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Uploaded in %.1f ms after Init began, %s, at most %.2f ms a frame",
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart_).count(),
+                        uploads.threaded ? "on the loader thread" : "on the frame budget", uploads.maxUpdateMs);
+  }
+  // Only subtrees whose transforms changed since last frame are recomputed, and the
+  // instance matrices are only streamed again when something did or a LOD switched.
+  const bool moved = scene_.UpdateWorldMatrices() > 0;
+  if (moved) {
+    bvh_.Refit(scene_);
+  }
+  const bool lodChanged = SelectLods(toClipFromWorld);
+  const bool visibilityChanged = CullItems(toClipFromWorld);
+  UpdateDeformations(moved || instancesDirty_);
+  if (moved || lodChanged || visibilityChanged || instancesDirty_) {
+    UploadInstances();
+  }
+  textures_.BeginFrame();
+  RequestTextureLevels(toClipFromWorld);
+
+  // Write this frame's uniform blocks up front, in one mapping, then unmap before drawing.
+  if (!uniforms_.BeginFrame()) return;
+  auto view = uniforms_.Allocate(sizeof(ViewBlock));
+  if (view.data) {
+    std::copy(toClipFromWorld.m, toClipFromWorld.m + 16, static_cast<ViewBlock*>(view.data)->toClipFromWorld);
+  }
+  // Draws are sorted by material, so each run shares one block.
+  std::vector<UniformRing::Allocation>& materials = materialAllocs_;
+  materials.clear();
+  for (size_t i = 0; i < drawList_.size(); i++) {
+    const int material = drawList_[i].material;
+    if (i > 0 && material == drawList_[i - 1].material) {
+      materials.push_back(materials.back());
+      continue;
+    }
+    auto block = uniforms_.Allocate(sizeof(MaterialBlock));
+    if (block.data) {
+      *static_cast<MaterialBlock*>(block.data) = materialBlocks_[material + 1];
+    }
+    materials.push_back(block);
+  }
+  // The palettes of GPU skinned draws and the weights of GPU morphed ones, which the ring needs
+  // every frame whether or not they changed.
+  const auto& nodes = scene_.GetNodes();
+  std::vector<UniformRing::Allocation>& skinBlocks = skinAllocs_;
+  std::vector<UniformRing::Allocation>& morphBlocks = morphAllocs_;
+  skinBlocks.assign(drawList_.size(), {});
+  morphBlocks.assign(drawList_.size(), {});
+  for (size_t i = 0; i < drawList_.size(); i++) {
+    const auto& item = drawList_[i];
+    if (item.visibleCount == 0) {
+      continue;
+    }
+    if (item.program & kShaderSkinned) {
+      skinBlocks[i] = uniforms_.Allocate(maxGpuJoints_ * sizeof(r3::Matrix4f));
+      if (skinBlocks[i].data) {
+        const auto& palette = palettes_[deformedDraws_[item.deformed].skin];
+        memcpy(skinBlocks[i].data, palette.data(), palette.size() * sizeof(r3::Matrix4f));
+      }
+    }
+    if (item.program & kShaderMorphed) {
+      morphBlocks[i] = uniforms_.Allocate(sizeof(MorphBlock));
+      if (morphBlocks[i].data) {
+        // Only targets that move something this frame are looked at.
+        const DeformedDraw& draw = deformedDraws_[item.deformed];
+        const auto& weights = nodes[draw.node].weights;
+        const auto& segments = morphSegments_[draw.morph];
+        MorphBlock block = {};
+        for (size_t t = 0; t < segments.size() && t < weights.size(); t++) {
+          if (weights[t] == 0.0f || segments[t].count == 0) continue;
+          int32_t* segment = block.segments[block.count];
+          segment[0] = static_cast<int32_t>(segments[t].firstTexel);
+          segment[1] = static_cast<int32_t>(segments[t].count);
+          segment[2] = segments[t].sparse ? 1 : 0;
+          block.weights[block.count++] = weights[t];
+        }
+        memcpy(morphBlocks[i].data, &block, sizeof(block));
+      }
+    }
+  }
+  uniforms_.Unmap();
+  // The ring is sized for this draw list, so this is a sizing bug; say so rather than let draws
+  // vanish, but not every frame.
+  const uint32_t overflows = uniforms_.GetStats().overflows;
+  if (overflows != loggedUniformOverflows_) {
+    if (overflows > 0) {
+      __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "%s: %u uniform blocks didn't fit, their draws are skipped",
+                          name_.c_str(), overflows);
+    }
+    loggedUniformOverflows_ = overflows;
+  }
+
+  // Other renderers share the context, so start from unknown GL state every frame.
+  glState_.Invalidate();
+  glState_.ResetStats();
+  if (view.data) {
+    uniforms_.Bind(kViewBlockBinding, view);
+  }
+  uint32_t waitingDraws = 0;
+  for (size_t i = 0; i < drawList_.size(); i++) {
+    const auto& item = drawList_[i];
+    if (!materials[i].data || item.visibleCount == 0) {
+      continue;  // ran out of uniform space, or no instance at this LOD
+    }
+    const bool gpuSkinned = item.program & kShaderSkinned, gpuMorphed = item.program & kShaderMorphed;
+    if ((gpuSkinned && !skinBlocks[i].data) || (gpuMorphed && !morphBlocks[i].data)) {
+      continue;
+    }
+    // Compiling here would stall the frame; the draw waits for the variant instead.
+    const Shader* shader = variants_.Get(item.program);
+    if (!shader) {
+      // Once nothing is pending, a missing variant failed and was logged when it did.
+      waitingDraws += variants_.IsPending() ? 1 : 0;
+      continue;
+    }
+    glState_.UseProgram(shader->getProgram());
+    if (i == 0 || materials[i].offset != materials[i - 1].offset) {
+      uniforms_.Bind(kMaterialBlockBinding, materials[i]);
+    }
+    if (gpuSkinned) {
+      uniforms_.Bind(kDrawBlockBinding, skinBlocks[i]);
+    }
+    if (gpuMorphed) {
+      uniforms_.Bind(kMorphBlockBinding, morphBlocks[i]);
+      glState_.BindTexture(kMorphTextureUnit, GL_TEXTURE_2D, morphTexture_);
+    }
+    if (item.textureArray >= 0) {
+      glState_.BindTexture(0, GL_TEXTURE_2D_ARRAY, textureArrays_[item.textureArray]);
+    } else {
+      const GLuint texture = item.baseColorTexture >= 0 ? textures_.GetTexture(item.baseColorTexture) : 0;
+      glState_.BindTexture(0, GL_TEXTURE_2D, texture ? texture : whiteTexture_);
+    }
+    glState_.BindVertexArray(item.vao);
+    if (item.indexType) {
+      glDrawElementsInstanced(item.mode, item.count, item.indexType, reinterpret_cast<const GLvoid*>(item.indexOffset),
+                              item.visibleCount);
+    } else {
+      glDrawArraysInstanced(item.mode, 0, item.count, item.visibleCount);
+    }
+    glState_.CountDraw(item.visibleCount);
+  }
+  glState_.BindVertexArray(0);
+  glUseProgram(0);
+  uniforms_.EndFrame();
+  variants_.CountMisses(waitingDraws);
+  frameStats_ = glState_.GetStats();
+
+  // After the draws, so new levels are uploaded while the GPU works on this frame and first
+  // sampled next frame.
+  textures_.Update();
+}
+
 namespace {
-GLint numComponents(const int type) {
-  switch (type) {
-    case TINYGLTF_TYPE_SCALAR:
-      return 1;
-    case TINYGLTF_TYPE_VEC2:
-      return 2;
-    case TINYGLTF_TYPE_VEC3:
-      return 3;
-    case TINYGLTF_TYPE_VEC4:
-      return 4;
-    case TINYGLTF_TYPE_MAT2:
-      return 4;  // 2x2 matrix
-    case TINYGLTF_TYPE_MAT3:
-      return 9;  // 3x3 matrix
-    case TINYGLTF_TYPE_MAT4:
-      return 16;  // 4x4 matrix
-    default:
-      return 0;  // Unsupported type
-  }
-}
-
-GLenum glComponentType(const int componentType) {
-  switch (componentType) {
-    case TINYGLTF_COMPONENT_TYPE_BYTE:
-      return GL_BYTE;
-    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-      return GL_UNSIGNED_BYTE;
-    case TINYGLTF_COMPONENT_TYPE_SHORT:
-      return GL_SHORT;
-    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-      return GL_UNSIGNED_SHORT;
-    case TINYGLTF_COMPONENT_TYPE_INT:
-      return GL_INT;
-    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-      return GL_UNSIGNED_INT;
-    case TINYGLTF_COMPONENT_TYPE_FLOAT:
-      return GL_FLOAT;
-    default:
-      return 0;  // Unsupported type
+// Fraction of the screen covered by a sphere's projection, estimated from its projected
+// radius along clip x and y. The scale of each clip axis is the length of that row of the
+// matrix, which keeps the estimate right for asymmetric and anisotropic projections. Only the
+// depth counts, not the direction, so a sphere behind the viewer gets what it would in front
+// and turning the head changes nothing.
+float ScreenCoverage(const r3::Matrix4f& toClipFromWorld, const r3::Vec3f& center, float radius) {
+  const r3::Vec4f clip = toClipFromWorld * r3::Vec4f(center.x, center.y, center.z, 1.0f);
+  const float w = std::abs(clip.w);
+  if (w <= radius) {
+    return 1.0f;  // the viewer is inside, or nearly
   }
+  const r3::Vec3f rowX(toClipFromWorld(0, 0), toClipFromWorld(0, 1), toClipFromWorld(0, 2));
+  const r3::Vec3f rowY(toClipFromWorld(1, 0), toClipFromWorld(1, 1), toClipFromWorld(1, 2));
+  const float rx = radius * rowX.Length() / w;
+  const float ry = radius * rowY.Length() / w;
+  // The viewport is 2 x 2 in NDC.
+  return std::min(1.0f, float(M_PI) * rx * ry / 4.0f);
 }
 
+// The largest scale along any axis, which bounds how much a transform grows a sphere.
+float MaxScale(const r3::Matrix4f& m) {
+  float scale = 0.0f;
+  for (int col = 0; col < 3; col++) {
+    scale = std::max(scale, r3::Vec3f(m(0, col), m(1, col), m(2, col)).Length());
+  }
+  return scale;
+}
+
+// How far coverage has to move past a threshold before the level changes back, so an object
+// sitting near a threshold doesn't pop between levels every frame.
+constexpr float kLodHysteresis = 0.1f;
 }  // namespace
 
-bool GltfRenderer::CreateVertexArrays(const tinygltf::Model& model) {
-  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "CreateVertexArrays called");
-  // For each mesh/primitive, create a VAO and set up attribute pointers
-  // This is a simplified example; real code should handle all attribute types and buffer bindings
-  int numVaos = 0;
-  for (const auto& mesh : model.meshes) {
-    for (const auto& prim : mesh.primitives) {
-      numVaos++;
-    }
-  }
-  vaos_.reserve(numVaos);
-  for (const auto& mesh : model.meshes) {
-    for (const auto& prim : mesh.primitives) {
-      __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Creating VAO for mesh");
-      GLuint vao = 0;
-      glGenVertexArrays(1, &vao);
-      glBindVertexArray(vao);
-
-      // Start with just indices (if any) and position.
-      if (prim.indices >= 0 && prim.indices < model.accessors.size()) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffersGL_[prim.indices].buffer);
+bool GltfRenderer::SelectLods(const r3::Matrix4f& toClipFromWorld) {
+  const auto& nodes = scene_.GetNodes();
+  bool changed = false;
+  for (auto& lod : lods_) {
+    const r3::Matrix4f& world = nodes[lod.node].world;
+    const r3::Vec3f center = world * lod.bounds.center;
+    const float coverage = ScreenCoverage(toClipFromWorld, center, lod.bounds.radius * MaxScale(world));
+
+    // The finest level whose threshold is met; finer than the current level has to clear the
+    // threshold by the hysteresis margin, the current level is kept until coverage falls the
+    // margin below its threshold.
+    int level = static_cast<int>(lod.coverage.size());
+    for (int i = 0; i < static_cast<int>(lod.coverage.size()); i++) {
+      const float margin = i < lod.level ? 1.0f + kLodHysteresis : 1.0f - kLodHysteresis;
+      if (coverage >= lod.coverage[i] * margin) {
+        level = i;
+        break;
+      }
+    }
+    if (level != lod.level) {
+      lod.level = level;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Frustum culls the BVH, hierarchically. True when some item's visibility changed since the
+// last call, so the instances need packing again.
+bool GltfRenderer::CullItems(const r3::Matrix4f& toClipFromWorld) {
+  if (!frustumCulling_ || bvh_.GetItemCount() == 0) {
+    return false;
+  }
+  bvh_.Cull(toClipFromWorld, cullScratch_);
+  if (cullScratch_ == visibleItems_) {
+    return false;
+  }
+  visibleItems_.swap(cullScratch_);
+  return true;
+}
+
+// Asks for the mip level whose texels come out about pixel sized on each primitive's largest
+// instance at its current LOD. Seen from outside, a primitive shows roughly the surface inside
+// its bounding sphere's silhouette, pi * r^2 in object space, which carries uvDensity * w * h *
+// pi * r^2 texels into coverage * viewportPixels_ pixels; each level quarters the texels.
+// Culled instances count too, so looking away doesn't make their mips eviction victims.
+void GltfRenderer::RequestTextureLevels(const r3::Matrix4f& toClipFromWorld) {
+  const auto& nodes = scene_.GetNodes();
+  for (const auto& item : drawList_) {
+    if (item.baseColorTexture < 0) {
+      continue;
+    }
+    const PrimitiveGL& prim = primitives_[item.primitive];
+    if (prim.uvDensity <= 0.0f || prim.mesh < 0) {
+      textures_.Request(item.baseColorTexture, 0);  // nothing to go on
+      continue;
+    }
+    const Bounds& bounds = meshBounds_[prim.mesh];
+    float coverage = 0.0f;
+    bool atLod = false;
+    for (uint32_t i = item.firstInstance; i < item.firstInstance + item.instanceCount; i++) {
+      const Instance& instance = instances_[i];
+      if (instance.lod >= 0 && lods_[instance.lod].level != instance.lodLevel) {
+        continue;
+      }
+      atLod = true;
+      r3::Matrix4f world = nodes[instance.node].world;
+      if (instance.gpuInstance >= 0) {
+        world.MultRight(gpuInstanceLocal_[instance.gpuInstance]);
+      }
+      coverage = std::max(coverage, ScreenCoverage(toClipFromWorld, world * bounds.center, bounds.radius * MaxScale(world)));
+    }
+    if (!atLod) {
+      continue;  // another level of the LOD is drawn instead
+    }
+    const float width = static_cast<float>(textures_.GetWidth(item.baseColorTexture));
+    const float height = static_cast<float>(textures_.GetHeight(item.baseColorTexture));
+    const float texels = prim.uvDensity * width * height * float(M_PI) * bounds.radius * bounds.radius;
+    const float pixels = std::max(coverage * viewportPixels_, 1.0f);
+    const int level = texels > pixels ? static_cast<int>(std::floor(0.5f * std::log2(texels / pixels))) : 0;
+    textures_.Request(item.baseColorTexture, level);
+  }
+}
+
+// The primitive's layout, except that CPU deformed draws read positions and normals from
+// their own buffer.
+GLuint GltfRenderer::CreateDeformedVao(const PrimitiveGL& prim, GLuint streamBuffer) const {
+  GLuint vao = 0;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  if (prim.indexType) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_);
+  }
+  for (const auto& attribute : prim.attributes) {
+    glEnableVertexAttribArray(attribute.location);
+    if (streamBuffer && (attribute.location == kLocationPosition || attribute.location == kLocationNormal)) {
+      const uintptr_t offset = attribute.location == kLocationNormal ? size_t(prim.vertexCount) * 3 * sizeof(float) : 0;
+      glBindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+      glVertexAttribPointer(attribute.location, 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const GLvoid*>(offset));
+    } else {
+      glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer_);
+      glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, prim.stride,
+                            reinterpret_cast<const GLvoid*>(prim.vertexOffset + attribute.offset));
+    }
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return vao;
+}
+
+// Joint palettes for every skin when the scene moved, then the vertices of CPU deformed draws
+// whose skin moved or whose morph weights changed, streamed to their buffers.
+void GltfRenderer::UpdateDeformations(bool moved) {
+  if (moved) {
+    for (size_t s = 0; s < skins_.size(); s++) {
+      ComputeJointPalette(skins_[s], scene_, palettes_[s]);
+    }
+  }
+  const auto& nodes = scene_.GetNodes();
+  bool bound = false;
+  for (auto& draw : deformedDraws_) {
+    if (!draw.cpu) continue;
+    const PrimitiveGL& prim = primitives_[draw.primitive];
+    const MorphTargetSet* morph = draw.morph >= 0 ? &morphTargets_[prim.morphTargets] : nullptr;
+    const SkinnedVertices* skinned = draw.skin >= 0 ? &skinnedVertices_[prim.skinnedVertices] : nullptr;
+    const std::vector<float>& weights = nodes[draw.node].weights;
+    if (draw.streamed && !(skinned && moved) && (!morph || weights == draw.blendedWeights)) {
+      continue;
+    }
+    // Morphing comes first, and feeds skinning when there's a skin too.
+    const size_t floats = size_t(prim.vertexCount) * 3;
+    const bool normals = morph ? !morph->baseNormals.empty() : !skinned->normals.empty();
+    deformedScratch_.resize(floats * (normals ? 2 : 1));
+    if (morph) {
+      std::vector<float>& blended = skinned ? morphScratch_ : deformedScratch_;
+      blended.resize(deformedScratch_.size());
+      BlendMorphTargets(*morph, weights.data(), weights.size(), blended.data(), normals ? blended.data() + floats : nullptr);
+      draw.blendedWeights = weights;
+    }
+    if (skinned) {
+      const float* positions = morph ? morphScratch_.data() : nullptr;
+      const float* morphedNormals = morph && normals ? morphScratch_.data() + floats : nullptr;
+      SkinVertices(*skinned, palettes_[draw.skin].data(), deformedScratch_.data(),
+                   normals ? deformedScratch_.data() + floats : nullptr, skinningPool_.get(), positions, morphedNormals);
+    }
+    // Orphan, as with the instance buffer.
+    const GLsizeiptr size = deformedScratch_.size() * sizeof(float);
+    glBindBuffer(GL_ARRAY_BUFFER, draw.streamBuffer);
+    glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, deformedScratch_.data());
+    GpuResourceTracker::Get().CountUpload(size);
+    draw.streamed = true;
+    bound = true;
+  }
+  if (bound) {
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+}
+
+void GltfRenderer::UploadInstances() {
+  const auto& nodes = scene_.GetNodes();
+  std::vector<float>& data = instanceData_;
+  data.resize(instances_.size() * 16);
+  for (auto& item : drawList_) {
+    const PrimitiveGL& prim = primitives_[item.primitive];
+    float* dst = data.data() + size_t(item.firstInstance) * 16;
+    item.visibleCount = 0;
+    for (uint32_t i = item.firstInstance; i < item.firstInstance + item.instanceCount; i++) {
+      const Instance& instance = instances_[i];
+      if (instance.lod >= 0 && lods_[instance.lod].level != instance.lodLevel) {
+        continue;
+      }
+      if (instance.bvhItem >= 0 && !visibleItems_.empty() && !visibleItems_[instance.bvhItem]) {
+        continue;
       }
+      // Skinned vertices come out of the palette in world space.
+      r3::Matrix4f mat = instance.skinned ? r3::Matrix4f::Identity() : nodes[instance.node].world;
+      if (instance.gpuInstance >= 0) {
+        mat.MultRight(gpuInstanceLocal_[instance.gpuInstance]);
+      }
+      // Quantized positions are in the unit cube; this puts them back in object space.
+      if (prim.quantized) {
+        mat.MultRight(prim.dequantize);
+      }
+      std::copy(mat.m, mat.m + 16, dst);
+      dst += 16;
+      item.visibleCount++;
+    }
+  }
+  // Orphan the old storage so the driver doesn't stall on draws still reading it.
+  const GLsizeiptr size = data.size() * sizeof(float);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+  glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, size, data.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  GpuResourceTracker::Get().SetBufferSize(instanceBuffer_, size);
+  GpuResourceTracker::Get().CountUpload(size);
+  instancesDirty_ = false;
+}
 
-      const int pos = prim.attributes.at("POSITION");
-      if (pos >= 0 && pos < model.accessors.size()) {
-        const auto& bvIdx = model.accessors[pos].bufferView;
-        const auto& bv = model.bufferViews[bvIdx];
-        glBindBuffer(GL_ARRAY_BUFFER, buffersGL_[bvIdx].buffer);
-        glEnableVertexAttribArray(0);  // Position attribute
-        const auto& accessor = model.accessors[pos];
-        glVertexAttribPointer(0, numComponents(accessor.type), glComponentType(accessor.componentType), GL_FALSE,
-                              accessor.ByteStride(bv), reinterpret_cast<const GLvoid*>(accessor.byteOffset));
+void GltfRenderer::Destroy() {
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Destroy called");
+  // Nothing may be deleted while the pool or the loader thread could still be writing it.
+  if (loadPrepared_.valid()) {
+    loadPrepared_.wait();
+    loadPrepared_ = {};
+  }
+  load_.reset();
+  if (uploader_) {
+    uploader_->Finish();
+  }
+  textures_.Destroy();
+  for (auto& prim : primitives_) {
+    if (prim.vao) glDeleteVertexArrays(1, &prim.vao);
+  }
+  auto& gpu = GpuResourceTracker::Get();
+  gpu.DeleteBuffer(vertexBuffer_);
+  gpu.DeleteBuffer(indexBuffer_);
+  for (GLuint& texture : textureArrays_) {
+    gpu.DeleteTexture(texture);
+  }
+  textureArrays_.clear();
+  gpu.DeleteTexture(whiteTexture_);
+  textureHandles_.clear();
+  imageLayers_.clear();
+  primitives_.clear();
+  meshFirstPrimitive_.clear();
+  meshBounds_.clear();
+  lods_.clear();
+  uploadStats_ = {};
+  drawList_.clear();
+  instances_.clear();
+  gpuInstanceLocal_.clear();
+  gpu.DeleteBuffer(instanceBuffer_);
+  bvh_.Clear();
+  visibleItems_.clear();
+  cullScratch_.clear();
+  for (auto& draw : deformedDraws_) {
+    if (draw.vao) glDeleteVertexArrays(1, &draw.vao);
+    gpu.DeleteBuffer(draw.streamBuffer);
+  }
+  deformedDraws_.clear();
+  skins_.clear();
+  palettes_.clear();
+  skinnedVertices_.clear();
+  deformedScratch_.clear();
+  maxGpuJoints_ = 0;
+  skinningPool_.reset();
+  morphTargets_.clear();
+  morphSegments_.clear();
+  morphScratch_.clear();
+  gpu.DeleteTexture(morphTexture_);
+  instancesDirty_ = true;
+  variants_.Clear();
+  uniforms_.Destroy();
+  loggedUniformOverflows_ = 0;
+  materialBlocks_.clear();
+  materialAllocs_.clear();
+  skinAllocs_.clear();
+  morphAllocs_.clear();
+  instanceData_.clear();
+  scene_.Clear();
+  if (ownUploader_) {
+    ownUploader_.reset();
+    uploader_ = nullptr;
+  }
+  loaded_ = false;
+  gpu.ReportLeaks("", name_);
+}
+
+// Repacks every primitive on the CPU first, so the GPU buffers can be sized exactly and only
+// hold bytes some primitive draws from. Primitives don't depend on each other, so they're
+// spread over the pool and numbered afterwards.
+void GltfRenderer::PrepareGeometry(const tinygltf::Model& model, PreparedLoad& load) {
+  meshFirstPrimitive_.clear();
+  meshBounds_.clear();
+  skinnedVertices_.clear();
+  morphTargets_.clear();
+  std::vector<const tinygltf::Primitive*> prims;
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); meshIdx++) {
+    meshFirstPrimitive_.push_back(static_cast<int>(prims.size()));
+    for (const auto& prim : model.meshes[meshIdx].primitives) {
+      prims.push_back(&prim);
+      load.meshOf.push_back(static_cast<int>(meshIdx));
+    }
+  }
+  const size_t count = prims.size();
+  load.geometry.resize(count);
+  load.valid.assign(count, 0);
+  load.uvDensity.assign(count, 0.0f);
+  load.jointLimit.assign(count, 0);
+  load.skinnedVertices.assign(count, -1);
+  load.morphTargets.assign(count, -1);
+  std::vector<SkinnedVertices> skinned(count);
+  std::vector<MorphTargetSet> morphs(count);
+  std::vector<float> extents(count * 6);
+  // Meshes some node skins keep float positions: they're skinned in object space, before any
+  // dequantize could be folded into an instance matrix. Morphed meshes too, since their deltas
+  // are in object space.
+  std::vector<bool> skinnedMesh(model.meshes.size(), false);
+  for (const auto& node : model.nodes) {
+    if (node.skin >= 0 && node.mesh >= 0 && static_cast<size_t>(node.mesh) < model.meshes.size()) skinnedMesh[node.mesh] = true;
+  }
+  loadPool_->ParallelFor(count, [&](size_t i) {
+    const auto& mesh = model.meshes[load.meshOf[i]];
+    const tinygltf::Primitive& prim = *prims[i];
+    PrimitiveGeometry& geom = load.geometry[i];
+    float* meshMin = &extents[i * 6];
+    float* meshMax = meshMin + 3;
+    std::fill(meshMin, meshMax, INFINITY);
+    std::fill(meshMax, meshMax + 3, -INFINITY);
+    load.valid[i] = BuildPrimitiveGeometry(model, prim, geom);
+    if (!load.valid[i]) {
+      __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Skipping invalid primitive in mesh %s", mesh.name.c_str());
+      return;
+    }
+    // Targets are read in the accessors' vertex order, and follow the vertices as they're
+    // reordered.
+    MorphTargetSet& targets = morphs[i];
+    const bool morphed = !prim.targets.empty() && BuildMorphTargets(model, prim, geom.vertexCount, targets);
+    std::vector<uint32_t> remap;
+    // Reorder before quantizing, the overdraw sort wants float positions.
+    const MeshOptimizeStats stats = OptimizePrimitiveGeometry(geom, morphed ? &remap : nullptr);
+    if (stats.before.acmr > 0.0f) {
+      __android_log_print(ANDROID_LOG_INFO, "GltfRenderer",
+                          "Mesh %s: %zu triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f%s%s", mesh.name.c_str(),
+                          geom.indices.size() / 3, stats.before.acmr, stats.after.acmr, stats.before.atvr,
+                          stats.after.atvr, stats.overdrawSorted ? ", overdraw sorted" : "",
+                          stats.narrowed ? ", 16-bit indices" : "");
+    }
+    if (const VertexAttribute* position = geom.FindAttribute(kLocationPosition)) {
+      for (uint32_t v = 0; v < geom.vertexCount; v++) {
+        const float* p = reinterpret_cast<const float*>(&geom.vertices[size_t(v) * geom.stride + position->offset]);
+        for (int c = 0; c < 3; c++) {
+          meshMin[c] = std::min(meshMin[c], p[c]);
+          meshMax[c] = std::max(meshMax[c], p[c]);
+        }
       }
+    }
+    load.uvDensity[i] = UvDensity(geom);
+    // Kept sets are marked 0 here and get their index once every primitive is done.
+    if (morphed) {
+      RemapMorphTargets(remap, geom.vertexCount, targets);
+      if (ExtractMorphBase(geom, targets)) load.morphTargets[i] = 0;
+    }
+    if (skinnedMesh[load.meshOf[i]]) {
+      // The bind pose copy is only kept if some draw ends up skinned on the CPU.
+      load.jointLimit[i] = JointLimit(geom);
+      if (ExtractSkinnedVertices(geom, load.jointLimit[i], skinned[i])) load.skinnedVertices[i] = 0;
+    } else if (load.quantize && !morphed) {
+      QuantizePrimitiveGeometry(geom);
+    }
+  });
 
-      vaos_.push_back(vao);
+  for (size_t i = 0; i < count; i++) {
+    if (load.morphTargets[i] >= 0) {
+      load.morphTargets[i] = static_cast<int>(morphTargets_.size());
+      morphTargets_.push_back(std::move(morphs[i]));
+    }
+    if (load.skinnedVertices[i] >= 0) {
+      load.skinnedVertices[i] = static_cast<int>(skinnedVertices_.size());
+      skinnedVertices_.push_back(std::move(skinned[i]));
+    }
+  }
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); meshIdx++) {
+    float meshMin[3] = {INFINITY, INFINITY, INFINITY}, meshMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    const size_t first = meshFirstPrimitive_[meshIdx], end = first + model.meshes[meshIdx].primitives.size();
+    for (size_t i = first; i < end; i++) {
+      for (int c = 0; c < 3; c++) {
+        meshMin[c] = std::min(meshMin[c], extents[i * 6 + c]);
+        meshMax[c] = std::max(meshMax[c], extents[i * 6 + 3 + c]);
+      }
+    }
+    Bounds& bounds = meshBounds_.emplace_back();
+    if (meshMin[0] <= meshMax[0]) {
+      const r3::Vec3f lo(meshMin), hi(meshMax);
+      bounds.center = (lo + hi) * 0.5f;
+      bounds.radius = (hi - lo).Length() * 0.5f;
+    }
+  }
+
+  // Lay the streams out back to back. Each stream starts on a multiple of its stride so
+  // vertices never straddle more cache lines than they have to.
+  load.vertexOffsets.assign(count, 0);
+  load.indexOffsets.assign(count, 0);
+  size_t vertexBytes = 0, indexBytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!load.valid[i]) continue;
+    const auto& geom = load.geometry[i];
+    vertexBytes = (vertexBytes + geom.stride - 1) / geom.stride * geom.stride;
+    load.vertexOffsets[i] = vertexBytes;
+    vertexBytes += geom.vertices.size();
+    const uint32_t indexSize = IndexSize(geom.indexType);
+    if (indexSize) {
+      indexBytes = (indexBytes + indexSize - 1) / indexSize * indexSize;
+      load.indexOffsets[i] = indexBytes;
+      indexBytes += geom.indices.size() * indexSize;
+    }
+  }
+
+  load.vertexData.assign(vertexBytes, 0);
+  load.indexData.assign(indexBytes, 0);
+  for (size_t i = 0; i < count; i++) {
+    if (!load.valid[i]) continue;
+    const auto& geom = load.geometry[i];
+    std::copy(geom.vertices.begin(), geom.vertices.end(), load.vertexData.begin() + load.vertexOffsets[i]);
+    uint8_t* dst = load.indexData.data() + load.indexOffsets[i];
+    for (uint32_t index : geom.indices) {
+      if (geom.indexType == GL_UNSIGNED_SHORT) {
+        const uint16_t narrow = static_cast<uint16_t>(index);
+        memcpy(dst, &narrow, sizeof(narrow));
+        dst += sizeof(narrow);
+      } else {
+        memcpy(dst, &index, sizeof(index));
+        dst += sizeof(index);
+      }
+    }
+  }
+}
+
+bool GltfRenderer::CreateGeometry(const tinygltf::Model& model, PreparedLoad& load) {
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "CreateGeometry called");
+  const std::vector<PrimitiveGeometry>& geometry = load.geometry;
+  const size_t vertexBytes = load.vertexData.size(), indexBytes = load.indexData.size();
+  // The VAOs can point at the buffers before their data lands; nothing draws until it has.
+  auto& gpu = GpuResourceTracker::Get();
+  vertexBuffer_ = gpu.CreateBuffer({"GltfRenderer", name_, "vertices"});
+  uploader_->UploadBuffer(vertexBuffer_, std::move(load.vertexData));
+  if (indexBytes) {
+    indexBuffer_ = gpu.CreateBuffer({"GltfRenderer", name_, "indices"});
+    uploader_->UploadBuffer(indexBuffer_, std::move(load.indexData));
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer_);
+
+  primitives_.assign(geometry.size(), PrimitiveGL{});
+  for (size_t i = 0; i < geometry.size(); i++) {
+    if (!load.valid[i]) continue;
+    const auto& geom = geometry[i];
+    PrimitiveGL& prim = primitives_[i];
+    prim.mode = geom.mode;
+    prim.indexType = geom.indexType;
+    prim.indexOffset = load.indexOffsets[i];
+    prim.count = static_cast<GLsizei>(geom.indexType ? geom.indices.size() : geom.vertexCount);
+    prim.quantized = geom.quantized;
+    prim.dequantize = geom.dequantize;
+    prim.mesh = load.meshOf[i];
+    prim.uvDensity = load.uvDensity[i];
+    prim.attributes = geom.attributes;
+    prim.stride = geom.stride;
+    prim.vertexCount = geom.vertexCount;
+    prim.vertexOffset = load.vertexOffsets[i];
+    prim.jointLimit = load.jointLimit[i];
+    prim.skinnedVertices = load.skinnedVertices[i];
+    prim.morphTargets = load.morphTargets[i];
+
+    glGenVertexArrays(1, &prim.vao);
+    glBindVertexArray(prim.vao);
+    if (geom.indexType) {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_);
+    }
+    for (const auto& attribute : geom.attributes) {
+      glEnableVertexAttribArray(attribute.location);
+      glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, geom.stride,
+                            reinterpret_cast<const GLvoid*>(load.vertexOffsets[i] + attribute.offset));
     }
   }
   glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  uploadStats_ = {};
+  for (const auto& buf : model.buffers) {
+    uploadStats_.rawBufferBytes += buf.data.size();
+  }
+  uploadStats_.vertexBytes = vertexBytes;
+  uploadStats_.indexBytes = indexBytes;
+  if (!morphTargets_.empty() && !CreateMorphTexture(load)) {
+    // Everything morphed is blended on the CPU instead.
+    morphMode_ = MorphMode::Cpu;
+  }
+  const long saved = long(uploadStats_.rawBufferBytes) - long(vertexBytes + indexBytes);
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer",
+                      "Geometry: %zu primitives, %zu vertex + %zu index bytes uploaded, %zu in buffers, %ld saved",
+                      geometry.size(), uploadStats_.vertexBytes, uploadStats_.indexBytes, uploadStats_.rawBufferBytes, saved);
   return true;
 }
 
-bool GltfRenderer::CreateTextures(const tinygltf::Model& model) {
-  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "CreateTextures called");
-  // Allocate OpenGL textures for each image
-  texturesGL_.resize(model.images.size());
+// Packs the position deltas of every morphed primitive into the texels of one float
+// texture, rows of kMorphTextureWidth, for the morphing vertex shader to fetch from.
+void GltfRenderer::PrepareMorphTexture(PreparedLoad& load) {
+  morphSegments_.clear();
+  if (morphTargets_.empty()) return;
+  std::vector<float> texels;
+  size_t sparseTargets = 0, targetCount = 0;
+  for (const auto& targets : morphTargets_) {
+    morphSegments_.push_back(PackMorphPositions(targets, texels));
+    for (const auto& segment : morphSegments_.back()) {
+      sparseTargets += segment.sparse ? 1 : 0;
+    }
+    targetCount += targets.targets.size();
+  }
+  const uint32_t height = std::max<uint32_t>(1, (texels.size() / 4 + kMorphTextureWidth - 1) / kMorphTextureWidth);
+  if (height > load.maxTextureSize) {
+    __android_log_print(ANDROID_LOG_WARN, "GltfRenderer", "Morph deltas need %u texture rows of %u, blending on the CPU",
+                        height, load.maxTextureSize);
+    morphSegments_.clear();
+    return;
+  }
+  texels.resize(size_t(height) * kMorphTextureWidth * 4, 0.0f);
+  load.morphRows = height;
+  load.morphTexels.resize(texels.size() * sizeof(float));
+  memcpy(load.morphTexels.data(), texels.data(), load.morphTexels.size());
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Morph targets: %zu primitives, %zu targets (%zu sparse), %zu KB",
+                      morphTargets_.size(), targetCount, sparseTargets, load.morphTexels.size() / 1024);
+}
+
+// Queues the packed deltas; false if they didn't fit in a texture.
+bool GltfRenderer::CreateMorphTexture(PreparedLoad& load) {
+  if (load.morphTexels.empty()) return false;
+  GpuUploader::TextureUpload upload;
+  upload.texture = morphTexture_ = GpuResourceTracker::Get().CreateTexture({"GltfRenderer", name_, "morph deltas"});
+  upload.internalFormat = GL_RGBA32F;
+  upload.type = GL_FLOAT;
+  // Fetched with texelFetch, which needs a complete texture all the same.
+  upload.minFilter = GL_NEAREST;
+  upload.magFilter = GL_NEAREST;
+  const size_t bytes = load.morphTexels.size();
+  std::vector<uint8_t>& level = upload.storage.emplace_back(std::move(load.morphTexels));
+  upload.levels.push_back({kMorphTextureWidth, load.morphRows, level.data(), bytes});
+  uploader_->UploadTexture(std::move(upload));
+  return true;
+}
+
+// Builds full mip chains for each image. Decoding, filtering and compression run several
+// images at a time, with each image's block rows spread over whatever threads are left.
+void GltfRenderer::PrepareTextures(const tinygltf::Model& model, PreparedLoad& load) {
+  const std::vector<TextureUsage> usage = ClassifyImages(model);
+  std::vector<TextureData>& prepared = load.textures;
+  std::vector<uint8_t>& preparedOk = load.texturesOk;
+  prepared.assign(model.images.size(), TextureData{});
+  preparedOk.assign(model.images.size(), 0);
+  ThreadPool* pool = loadPool_.get();
+  auto prepareAll = [&](const std::vector<size_t>& images) {
+    pool->ParallelFor(images.size(), [&](size_t n) {
+      const size_t i = images[n];
+      std::string error;
+      preparedOk[i] = PrepareTexture(model.images[i], usage[i], load.support, load.compress, pool, prepared[i], &error);
+      if (!preparedOk[i]) {
+        __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Texture %zu (%s): %s", i, model.images[i].name.c_str(),
+                            error.c_str());
+      }
+    });
+  };
+
+  // KTX2 images first, so fallback images whose texture got its KTX2 source needn't be
+  // decoded at all.
+  std::vector<size_t> images;
   for (size_t i = 0; i < model.images.size(); ++i) {
-    const auto& img = model.images[i];
-    __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Creating texture %zu: width=%d, height=%d, component=%d", i, img.width,
-                        img.height, img.component);
-    GLuint tex = 0;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.width, img.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.image.data());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    texturesGL_[i] = {tex, img.width, img.height};
-  }
-  glBindTexture(GL_TEXTURE_2D, 0);
+    if (IsKtx2(model.images[i].image.data(), model.images[i].image.size())) images.push_back(i);
+  }
+  prepareAll(images);
+
+  std::vector<bool> needed(model.images.size(), false);
+  for (size_t t = 0; t < model.textures.size(); t++) {
+    const int source = model.textures[t].source;
+    const int ktx2 = Ktx2Source(model.textures[t]);
+    if (source >= 0 && static_cast<size_t>(source) < needed.size() && !preparedOk[source] &&
+        !(ktx2 >= 0 && static_cast<size_t>(ktx2) < preparedOk.size() && preparedOk[ktx2])) {
+      needed[source] = true;
+    }
+  }
+  images.clear();
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (needed[i]) images.push_back(i);
+  }
+  auto start = std::chrono::steady_clock::now();
+  prepareAll(images);
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Prepared %zu images in %.1f ms on %u threads", images.size(), ms,
+                      pool->GetThreadCount());
+
+  // Small images that match go into texture arrays, the rest to the streamer.
+  std::vector<const TextureData*> chains(model.images.size(), nullptr);
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (preparedOk[i]) chains[i] = &prepared[i];
+  }
+  load.arrays = PlanTextureArrays(chains, kMaxArrayTextureSize, load.maxArrayLayers);
+  load.arrayUploads.resize(load.arrays.arrays.size());
+  for (size_t a = 0; a < load.arrays.arrays.size(); a++) {
+    GpuUploader::TextureUpload& upload = load.arrayUploads[a];
+    if (!PackTextureArray(load.arrays.arrays[a], chains, "array " + std::to_string(a), upload)) upload = {};
+  }
+}
+
+// Hands the prepared chains to the streamer, which uploads only the tails for now.
+bool GltfRenderer::CreateTextures(const tinygltf::Model& model, PreparedLoad& load) {
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "CreateTextures called");
+  textures_.Destroy();
+  textureHandles_.assign(model.images.size(), -1);
+  imageLayers_.assign(model.images.size(), {});
+  std::vector<TextureData>& prepared = load.textures;
+  std::vector<uint8_t>& preparedOk = load.texturesOk;
+  auto upload = [&](size_t i) {
+    if (!preparedOk[i]) return;
+    const TextureData& data = prepared[i];
+    const uint32_t width = data.levels[0].width, height = data.levels[0].height;
+    const size_t levels = data.levels.size(), bytes = data.ByteSize();
+    const GLenum format = data.internalFormat;
+    const size_t residentBefore = textures_.GetStats().residentBytes;
+    // The streamer keeps the chain, so it moves rather than copies.
+    const std::string label = "image " + std::to_string(i) + " " + model.images[i].name;
+    textureHandles_[i] = textures_.Add(std::move(prepared[i]), {"TextureStreamer", name_, label});
+    uploadStats_.rawTextureBytes += size_t(width) * height * 4;
+    uploadStats_.textureBytes += bytes;
+    __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Texture %zu: %ux%u, %zu levels, format 0x%x, %zu KB, %zu KB resident",
+                        i, width, height, levels, format, bytes / 1024,
+                        (textures_.GetStats().residentBytes - residentBefore) / 1024);
+  };
+
+  // Arrays that couldn't be packed leave their images to the streamer.
+  for (size_t a = 0; a < load.arrays.arrays.size(); a++) {
+    const auto& array = load.arrays.arrays[a];
+    if (load.arrayUploads[a].levels.empty()) continue;
+    const std::string label = "array " + std::to_string(a);
+    const GLuint texture = UploadTextureArray(std::move(load.arrayUploads[a]), {"GltfRenderer", name_, label}, *uploader_);
+    textureArrays_.push_back(texture);
+    for (size_t layer = 0; layer < array.members.size(); layer++) {
+      const size_t i = array.members[layer];
+      imageLayers_[i] = {static_cast<int>(textureArrays_.size()) - 1, static_cast<int>(layer)};
+      uploadStats_.rawTextureBytes += size_t(array.width) * array.height * 4;
+      uploadStats_.textureBytes += prepared[i].ByteSize();
+      uploadStats_.packedImages++;
+      prepared[i] = TextureData{};
+      preparedOk[i] = 0;
+    }
+    __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "Texture array %zu: %zu layers of %ux%u, %u levels, format 0x%x", a,
+                        array.members.size(), array.width, array.height, array.levels, array.internalFormat);
+  }
+  for (size_t i = 0; i < model.images.size(); ++i) upload(i);
+
+  // Sampled in place of a missing base color texture, so the factor alone comes through.
+  GpuUploader::TextureUpload white;
+  white.texture = whiteTexture_ = GpuResourceTracker::Get().CreateTexture({"GltfRenderer", name_, "white"});
+  white.minFilter = GL_NEAREST;
+  white.magFilter = GL_NEAREST;
+  std::vector<uint8_t>& texel = white.storage.emplace_back(4, uint8_t(255));
+  white.levels.push_back({1, 1, texel.data(), texel.size()});
+  uploader_->UploadTexture(std::move(white));
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer",
+                      "Textures: %zu KB with mips to stream from, %zu KB resident, %zu KB as RGBA8 without",
+                      uploadStats_.textureBytes / 1024, textures_.GetStats().residentBytes / 1024,
+                      uploadStats_.rawTextureBytes / 1024);
   return true;
 }
 
-namespace {
-r3::Matrix4f GetNodeTransform(const tinygltf::Node& node) {
-  r3::Matrix4f mat = r3::Matrix4f::Identity();
+// A KHR_texture_basisu source wins over the fallback image when it could be uploaded.
+int GltfRenderer::GetTextureImage(const tinygltf::Model& model, int textureIndex) const {
+  if (textureIndex < 0 || static_cast<size_t>(textureIndex) >= model.textures.size()) return -1;
+  const tinygltf::Texture& texture = model.textures[textureIndex];
+  auto uploaded = [&](int image) {
+    return image >= 0 && static_cast<size_t>(image) < textureHandles_.size() &&
+           (textureHandles_[image] >= 0 || imageLayers_[image].array >= 0);
+  };
+  const int ktx2 = Ktx2Source(texture);
+  if (uploaded(ktx2)) {
+    return ktx2;
+  }
+  return uploaded(texture.source) ? texture.source : -1;
+}
+
+// Works out per scene node which mesh each LOD level draws and at which EXT_mesh_gpu_instancing
+// transforms, and builds the BVH over the instances, boxes and triangles both.
+void GltfRenderer::PlaceNodes(const tinygltf::Model& model, PreparedLoad& load) {
+  gpuInstanceLocal_.clear();
+  bvh_.Clear();
+
+  // Nodes listed in some MSFT_lod chain are drawn in place of the node that lists them.
+  lods_.clear();
+  std::vector<bool> isLodNode(model.nodes.size(), false);
+  for (const auto& node : model.nodes) {
+    for (int lodNode : node.lods) {
+      if (lodNode >= 0 && static_cast<size_t>(lodNode) < model.nodes.size()) isLodNode[lodNode] = true;
+    }
+  }
 
-  if (node.matrix.size() == 16) {
-    // Use the node's matrix directly
-    mat = r3::Matrix4f(node.matrix[0], node.matrix[1], node.matrix[2], node.matrix[3], node.matrix[4], node.matrix[5],
-                       node.matrix[6], node.matrix[7], node.matrix[8], node.matrix[9], node.matrix[10], node.matrix[11],
-                       node.matrix[12], node.matrix[13], node.matrix[14], node.matrix[15]);
-  } else {
-    // Compose from T * R * S
-    r3::Vec3f translation(0.0f, 0.0f, 0.0f);
-    if (node.translation.size() == 3) {
-      translation = r3::Vec3f(static_cast<float>(node.translation[0]), static_cast<float>(node.translation[1]),
-                              static_cast<float>(node.translation[2]));
+  const auto& nodes = scene_.GetNodes();
+  load.nodes.assign(nodes.size(), {});
+  for (int nodeIdx = 0; nodeIdx < static_cast<int>(nodes.size()); nodeIdx++) {
+    const int gltfNodeIdx = nodes[nodeIdx].gltfNode;
+    const tinygltf::Node& gltfNode = model.nodes[gltfNodeIdx];
+    if (isLodNode[gltfNodeIdx]) {
+      continue;
     }
+    PreparedLoad::NodePlan& plan = load.nodes[nodeIdx];
 
-    r3::Quaternionf rotation = r3::Quaternionf::Identity();
-    if (node.rotation.size() == 4) {
-      rotation = r3::Quaternionf(static_cast<float>(node.rotation[3]),  // w
-                                 static_cast<float>(node.rotation[0]),  // x
-                                 static_cast<float>(node.rotation[1]),  // y
-                                 static_cast<float>(node.rotation[2])   // z
-      );
+    // The meshes of each level; a LOD node's own transform and children are not used.
+    std::vector<int>& levelMeshes = plan.levelMeshes;
+    levelMeshes = {nodes[nodeIdx].mesh};
+    for (int lodNode : gltfNode.lods) {
+      levelMeshes.push_back(lodNode >= 0 && static_cast<size_t>(lodNode) < model.nodes.size() ? model.nodes[lodNode].mesh : -1);
+    }
+    if (levelMeshes.size() > 1) {
+      plan.lod = static_cast<int>(lods_.size());
+      LodState& state = lods_.emplace_back();
+      state.node = nodeIdx;
+      state.coverage = ReadLodCoverage(gltfNode, levelMeshes.size());
+      for (int meshIdx : levelMeshes) {
+        if (meshIdx >= 0 && static_cast<size_t>(meshIdx) < meshBounds_.size()) {
+          state.bounds = meshBounds_[meshIdx];
+          break;
+        }
+      }
     }
 
-    r3::Vec3f scale(1.0f, 1.0f, 1.0f);
-    if (node.scale.size() == 3) {
-      scale = r3::Vec3f(static_cast<float>(node.scale[0]), static_cast<float>(node.scale[1]), static_cast<float>(node.scale[2]));
+    auto gpuInstances = ReadGpuInstances(model, gltfNode);
+    if (!gpuInstances.empty()) {
+      plan.firstGpuInstance = static_cast<int>(gpuInstanceLocal_.size());
+      plan.instanceCount = static_cast<uint32_t>(gpuInstances.size());
+      gpuInstanceLocal_.insert(gpuInstanceLocal_.end(), gpuInstances.begin(), gpuInstances.end());
     }
 
-    r3::Matrix4f tMat = r3::Matrix4f::Translate(translation);
-    r3::Matrix4f rMat = rotation.GetMatrix4();
-    r3::Matrix4f sMat = r3::Matrix4f::Scale(scale);
+    // Every instance but skinned ones gets a BVH item, boxed by the first level with a mesh.
+    for (int meshIdx : levelMeshes) {
+      if (gltfNode.skin >= 0 || meshIdx < 0 || static_cast<size_t>(meshIdx) >= model.meshes.size()) continue;
+      plan.firstBvhItem = static_cast<int>(bvh_.GetItemCount());
+      for (uint32_t i = 0; i < plan.instanceCount; i++) {
+        bvh_.AddItem(nodeIdx, meshIdx, gpuInstances.empty() ? r3::Matrix4f::Identity() : gpuInstances[i]);
+      }
+      break;
+    }
+  }
+  bvh_.Build(model, scene_);
+}
 
-    mat = tMat * rMat * sMat;
+void GltfRenderer::BuildDrawList(const tinygltf::Model& model, const PreparedLoad& load) {
+  drawList_.clear();
+  instances_.clear();
+  deformedDraws_.clear();
+  maxGpuJoints_ = 0;
+  GLint maxUniformBlockSize = 16384;  // the GLES 3.0 minimum
+  glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUniformBlockSize);
+  const size_t maxUniformJoints = maxUniformBlockSize / sizeof(r3::Matrix4f);
+
+  // Slot 0 is the glTF default material, for primitives without one.
+  materialBlocks_.assign(model.materials.size() + 1, MaterialBlock{});
+  for (size_t i = 0; i < model.materials.size(); i++) {
+    const auto& material = model.materials[i];
+    const auto& pbr = material.pbrMetallicRoughness;
+    MaterialBlock& block = materialBlocks_[i + 1];
+    for (size_t c = 0; c < 4 && c < pbr.baseColorFactor.size(); c++) {
+      block.baseColorFactor[c] = static_cast<float>(pbr.baseColorFactor[c]);
+    }
+    block.metallicRoughnessAlphaCutoff[0] = static_cast<float>(pbr.metallicFactor);
+    block.metallicRoughnessAlphaCutoff[1] = static_cast<float>(pbr.roughnessFactor);
+    block.metallicRoughnessAlphaCutoff[2] = material.alphaMode == "MASK" ? static_cast<float>(material.alphaCutoff) : 0.0f;
+    const int image = GetTextureImage(model, pbr.baseColorTexture.index);
+    if (image >= 0 && imageLayers_[image].array >= 0) {
+      block.textureLayer[0] = static_cast<float>(imageLayers_[image].layer);
+    }
   }
 
-  return mat;
-}
-}  // namespace
+  // One entry per node primitive, to be sorted and merged into instanced batches.
+  struct NodeDraw {
+    DrawItem item;
+    int node = 0;
+    int firstGpuInstance = -1;  // into gpuInstanceLocal_, or -1 for a single instance
+    int lod = -1;
+    int lodLevel = 0;
+    int firstBvhItem = -1;  // into bvh_, an item per instance, or -1 if never culled
+  };
+  std::vector<NodeDraw> nodeDraws;
 
-void GltfRenderer::DrawNode(int nodeIndex, const r3::Matrix4f& parentMatrix, Shader* shader) {
-  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer", "DrawNode called for node %d", nodeIndex);
-  const auto& node = model_->nodes[nodeIndex];
-  r3::Matrix4f toClipFromObject = parentMatrix * GetNodeTransform(node);
-
-  int currVaoIdx = -1;
-  if (node.mesh >= 0 && node.mesh < model_->meshes.size()) {
-    const auto& mesh = model_->meshes[node.mesh];
-    for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
-      currVaoIdx++;
-      const auto& prim = mesh.primitives[primIdx];
-      if (currVaoIdx < vaos_.size()) {
-        glBindVertexArray(vaos_[currVaoIdx]);
+  const auto& nodes = scene_.GetNodes();
+  for (int nodeIdx = 0; nodeIdx < static_cast<int>(nodes.size()); nodeIdx++) {
+    const PreparedLoad::NodePlan& plan = load.nodes[nodeIdx];
+    const tinygltf::Node& gltfNode = model.nodes[nodes[nodeIdx].gltfNode];
+    const std::vector<int>& levelMeshes = plan.levelMeshes;
+    const int lod = plan.lod, firstGpuInstance = plan.firstGpuInstance, firstBvhItem = plan.firstBvhItem;
+    const uint32_t instanceCount = plan.instanceCount;
+
+    for (int level = 0; level < static_cast<int>(levelMeshes.size()); level++) {
+      const int meshIdx = levelMeshes[level];
+      if (meshIdx < 0 || static_cast<size_t>(meshIdx) >= model.meshes.size()) {
+        continue;
       }
-      // TODO: Bind material/textures if needed
-
-      shader->setToClipFromObject(toClipFromObject);
-      // Set model matrix uniform if using shaders
-      // GLint modelLoc = glGetUniformLocation(shaderProgram_, "u_ModelMatrix");
-      // glUniformMatrix4fv(modelLoc, 1, GL_FALSE, localMatrix.Data());
-
-      // Draw call
-      if (prim.indices >= 0 && prim.indices < model_->accessors.size()) {
-        const auto& accessor = model_->accessors[prim.indices];
-        GLenum mode = prim.mode == -1 ? GL_TRIANGLES : prim.mode;
-        GLenum type = accessor.componentType;
-        GLsizei count = accessor.count;
-        GLvoid* offset = reinterpret_cast<GLvoid*>(accessor.byteOffset);
-        glDrawElements(mode, count, type, offset);
-      } else {
-        // No indices, draw arrays
-        GLenum mode = prim.mode == -1 ? GL_TRIANGLES : prim.mode;
-        const auto& posAccessor = prim.attributes.at("POSITION");
-        const auto& accessor = model_->accessors[posAccessor];
-        GLsizei count = accessor.count;
-        glDrawArrays(mode, 0, count);
+      const auto& mesh = model.meshes[meshIdx];
+      for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+        const auto& prim = mesh.primitives[primIdx];
+        const int primGLIdx = meshFirstPrimitive_[meshIdx] + static_cast<int>(primIdx);
+        const PrimitiveGL& primGL = primitives_[primGLIdx];
+        if (!primGL.vao) {
+          continue;
+        }
+
+        DrawItem item;
+        item.material = prim.material >= 0 && static_cast<size_t>(prim.material) < model.materials.size() ? prim.material : -1;
+        item.program = MaterialShaderFeatures(model, item.material);
+        item.primitive = primGLIdx;
+        item.vao = primGL.vao;
+        item.mode = primGL.mode;
+        item.count = primGL.count;
+        item.indexType = primGL.indexType;
+        item.indexOffset = primGL.indexOffset;
+        item.instanceCount = instanceCount;
+
+        // A skinned or morphed node's primitives each get a draw of their own.
+        DeformedDraw draw;
+        draw.node = nodeIdx;
+        draw.primitive = primGLIdx;
+        const int skin = gltfNode.skin;
+        size_t jointCount = 0;
+        if (skin >= 0 && static_cast<size_t>(skin) < skins_.size() && primGL.jointLimit > 0) {
+          jointCount = skins_[skin].joints.size();
+          if (primGL.jointLimit > jointCount) {
+            __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "Mesh %s needs %u joints but skin %d has %zu, not skinning it",
+                                mesh.name.c_str(), primGL.jointLimit, skin, jointCount);
+          } else {
+            draw.skin = skin;
+          }
+        }
+        bool cpuMorph = false;
+        if (primGL.morphTargets >= 0) {
+          draw.morph = primGL.morphTargets;
+          cpuMorph = morphMode_ == MorphMode::Cpu || morphTargets_[draw.morph].targets.size() > kMaxGpuMorphTargets;
+        }
+        if (draw.skin >= 0 || draw.morph >= 0) {
+          const bool cpuSkin = draw.skin >= 0 && (skinningMode_ == SkinningMode::Cpu || jointCount > maxUniformJoints);
+          draw.cpu = cpuSkin || cpuMorph;
+          if (draw.cpu) {
+            bool normals = false;
+            for (const auto& attribute : primGL.attributes) normals |= attribute.location == kLocationNormal;
+            const size_t bytes = size_t(primGL.vertexCount) * 3 * (normals ? 2 : 1) * sizeof(float);
+            auto& gpu = GpuResourceTracker::Get();
+            draw.streamBuffer = gpu.CreateBuffer({"GltfRenderer", name_, "deformed " + mesh.name});
+            glBindBuffer(GL_ARRAY_BUFFER, draw.streamBuffer);
+            glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            gpu.SetBufferSize(draw.streamBuffer, bytes);
+          } else if (draw.skin >= 0) {
+            maxGpuJoints_ = std::max(maxGpuJoints_, static_cast<uint32_t>(jointCount));
+          }
+          draw.vao = CreateDeformedVao(primGL, draw.streamBuffer);
+          item.deformed = static_cast<int>(deformedDraws_.size());
+          item.vao = draw.vao;
+          if (!draw.cpu && draw.skin >= 0) {
+            item.program |= kShaderSkinned;
+          }
+          if (!draw.cpu && draw.morph >= 0) {
+            item.program |= kShaderMorphed;
+          }
+          deformedDraws_.push_back(std::move(draw));
+        }
+
+        if (prim.material >= 0 && static_cast<size_t>(prim.material) < model.materials.size()) {
+          const int image = GetTextureImage(model, model.materials[prim.material].pbrMetallicRoughness.baseColorTexture.index);
+          if (image >= 0) {
+            item.baseColorTexture = textureHandles_[image];
+            item.textureArray = imageLayers_[image].array;
+          }
+        }
+        if (item.textureArray >= 0) {
+          item.program |= kShaderTextureArray;
+        }
+
+        // program, then texture binding, then material, then VAO; materials sharing an array
+        // sort together and keep it bound
+        const uint64_t binding = item.textureArray >= 0 ? item.textureArray + 1
+                                                        : textureArrays_.size() + 1 + (item.baseColorTexture + 1);
+        item.key = (uint64_t(item.program & 0xff) << 56) | ((binding & 0xffff) << 40) |
+                   (uint64_t((item.material + 1) & 0xffff) << 24) | (uint64_t(primGLIdx) & 0xffffff);
+        nodeDraws.push_back({item, nodeIdx, firstGpuInstance, lod, level, firstBvhItem});
       }
-      glBindVertexArray(0);
     }
   }
+  // Stable, so instances keep scene order. Deformed draws of a key go after its static ones,
+  // which then stay one run however the scene interleaves them.
+  std::stable_sort(nodeDraws.begin(), nodeDraws.end(), [](const NodeDraw& a, const NodeDraw& b) {
+    if (a.item.key != b.item.key) return a.item.key < b.item.key;
+    return a.item.deformed < 0 && b.item.deformed >= 0;
+  });
 
-  for (int child : node.children) {
-    DrawNode(child, toClipFromObject, shader);
+  // A VAO is one mesh primitive, so equal keys draw identical geometry with identical state
+  // and differ only by transform: merge each run into one instanced draw. Deformed draws
+  // differ by more than that, so nothing merges into one, nor one into anything.
+  for (const auto& nodeDraw : nodeDraws) {
+    if (drawList_.empty() || drawList_.back().key != nodeDraw.item.key || drawList_.back().deformed >= 0 ||
+        nodeDraw.item.deformed >= 0) {
+      drawList_.push_back(nodeDraw.item);
+      drawList_.back().firstInstance = static_cast<uint32_t>(instances_.size());
+      drawList_.back().instanceCount = 0;
+    }
+    for (uint32_t i = 0; i < nodeDraw.item.instanceCount; i++) {
+      const int gpuInstance = nodeDraw.firstGpuInstance < 0 ? -1 : nodeDraw.firstGpuInstance + static_cast<int>(i);
+      const bool skinned = nodeDraw.item.deformed >= 0 && deformedDraws_[nodeDraw.item.deformed].skin >= 0;
+      const int bvhItem = nodeDraw.firstBvhItem < 0 ? -1 : nodeDraw.firstBvhItem + static_cast<int>(i);
+      instances_.push_back({nodeDraw.node, gpuInstance, nodeDraw.lod, nodeDraw.lodLevel, skinned, bvhItem});
+    }
+    drawList_.back().instanceCount += nodeDraw.item.instanceCount;
+  }
+
+  // Each VAO appears in exactly one batch, so its instance attributes can point at the
+  // batch's range of the instance buffer once, here, rather than every frame. A VAO in two
+  // batches would draw both from the last one's range, so that's a batching bug worth a line.
+  std::unordered_set<GLuint> batchedVaos;
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+  for (const auto& item : drawList_) {
+    if (!batchedVaos.insert(item.vao).second) {
+      __android_log_print(ANDROID_LOG_ERROR, "GltfRenderer", "VAO %u is in more than one batch, its instances will be wrong",
+                          item.vao);
+    }
+    glBindVertexArray(item.vao);
+    for (GLuint col = 0; col < 4; col++) {
+      const uintptr_t offset = (item.firstInstance * 16 + col * 4) * sizeof(float);
+      glEnableVertexAttribArray(kInstanceMatrixLocation + col);
+      glVertexAttribPointer(kInstanceMatrixLocation + col, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float),
+                            reinterpret_cast<const GLvoid*>(offset));
+      glVertexAttribDivisor(kInstanceMatrixLocation + col, 1);
+    }
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  instancesDirty_ = true;
+  visibleItems_.clear();
+
+  // Bind pose copies and morph bases are only read on the CPU.
+  std::vector<bool> cpuSkinned(skinnedVertices_.size(), false), cpuMorphed(morphTargets_.size(), false);
+  size_t cpuDraws = 0, skinnedDraws = 0, morphedDraws = 0;
+  for (const auto& draw : deformedDraws_) {
+    skinnedDraws += draw.skin >= 0 ? 1 : 0;
+    morphedDraws += draw.morph >= 0 ? 1 : 0;
+    if (!draw.cpu) continue;
+    if (draw.skin >= 0) cpuSkinned[primitives_[draw.primitive].skinnedVertices] = true;
+    if (draw.morph >= 0) cpuMorphed[draw.morph] = true;
+    cpuDraws++;
+  }
+  for (size_t i = 0; i < skinnedVertices_.size(); i++) {
+    if (!cpuSkinned[i]) skinnedVertices_[i] = SkinnedVertices{};
+  }
+  for (size_t i = 0; i < morphTargets_.size(); i++) {
+    if (!cpuMorphed[i]) morphTargets_[i] = MorphTargetSet{};
+  }
+  if (cpuDraws > 0 && !skinningPool_) {
+    skinningPool_ = std::make_unique<ThreadPool>();
+  }
+  if (!deformedDraws_.empty()) {
+    __android_log_print(ANDROID_LOG_INFO, "GltfRenderer",
+                        "Deformation: %zu skinned and %zu morphed draws, %zu on the CPU, GPU palette of %u joints",
+                        skinnedDraws, morphedDraws, cpuDraws, maxGpuJoints_);
+  }
+
+  __android_log_print(ANDROID_LOG_INFO, "GltfRenderer",
+                      "Draw list: %zu node draws, %zu instances in %zu draw calls, %zu LOD chains", nodeDraws.size(),
+                      instances_.size(), drawList_.size(), lods_.size());
+  if (!textureArrays_.empty()) {
+    // A texture bind wherever consecutive draws sample different images, against wherever
+    // they sample different GL textures now.
+    uint32_t imageBinds = 0, arrayBinds = 0;
+    for (size_t i = 0; i < drawList_.size(); i++) {
+      const DrawItem& item = drawList_[i];
+      const DrawItem* previous = i > 0 ? &drawList_[i - 1] : nullptr;
+      const int layer = item.textureArray >= 0 ? static_cast<int>(materialBlocks_[item.material + 1].textureLayer[0]) : 0;
+      const int previousLayer = previous && previous->textureArray >= 0
+                                    ? static_cast<int>(materialBlocks_[previous->material + 1].textureLayer[0])
+                                    : 0;
+      const bool sameTexture = previous && previous->textureArray == item.textureArray &&
+                               previous->baseColorTexture == item.baseColorTexture;
+      imageBinds += sameTexture && layer == previousLayer ? 0 : 1;
+      arrayBinds += sameTexture ? 0 : 1;
+    }
+    uploadStats_.textureBindsUnpacked = imageBinds;
+    uploadStats_.textureBinds = arrayBinds;
+    __android_log_print(ANDROID_LOG_INFO, "GltfRenderer",
+                        "Texture arrays: %zu images in %zu arrays, %u texture binds per frame instead of %u",
+                        uploadStats_.packedImages, textureArrays_.size(), arrayBinds, imageBinds);
   }
 }
@@ -2,11 +2,27 @@
 
 #include <GLES3/gl3.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "GlStateCache.h"
+#include "GpuUploader.h"
+#include "MorphTargets.h"
+#include "SceneBvh.h"
+#include "SceneGraph.h"
 #include "Shader.h"
+#include "ShaderVariants.h"
+#include "Skinning.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include "UniformRing.h"
 #include "linear.h"
 #include "tiny_gltf.h"
 
@@ -15,44 +31,331 @@ class GltfRenderer {
   GltfRenderer();
   ~GltfRenderer();
 
-  // Initialize OpenGL resources from a loaded tinygltf::Model
-  bool Init(const tinygltf::Model& model);
+  // Initialize OpenGL resources from a loaded tinygltf::Model. framesInFlight is the
+  // swapchain length, which sizes the per-frame uniform ring. quantizeVertices packs vertex
+  // attributes into 16 and 8 bit formats at load (see QuantizePrimitiveGeometry), and
+  // compressTextures ETC2 encodes images that aren't already KTX2 (see PrepareTexture).
+  // Everything but creating GL objects runs on a pool while frames go on: the scene graph,
+  // repacked geometry, texture chains and BVH. Render() creates the GL objects once that's
+  // done and draws once their uploads are; until IsLoaded() the scene graph isn't there
+  // either. model has to outlive Destroy(), and a model that can't be drawn is logged and
+  // leaves nothing to draw.
+  bool Init(const tinygltf::Model& model, uint32_t framesInFlight = 3, bool quantizeVertices = true,
+            bool compressTextures = true);
+
+  // Init, with parse filling model on the pool first, so not even the file is read on the
+  // calling thread.
+  bool Load(tinygltf::Model& model, std::function<bool(tinygltf::Model&)> parse, uint32_t framesInFlight = 3,
+            bool quantizeVertices = true, bool compressTextures = true);
+
+  // Where the model's buffers and textures are uploaded; set before Init. Whoever owns the
+  // uploader calls its Update() every frame and keeps it alive past Destroy(). Without one the
+  // renderer keeps its own, which uploads on the render thread within a per-frame budget.
+  // Nothing is drawn until all of the model's uploads are done.
+  void SetUploader(GpuUploader* uploader) {
+    uploader_ = uploader;
+  }
+
+  // Names the model's GPU resources in GpuResourceTracker; set before Init.
+  void SetAssetName(const std::string& name) {
+    name_ = name;
+  }
+
+  // Where skinned meshes are deformed; set before Init. Skins with more joints than a uniform
+  // block holds are skinned on the CPU either way.
+  void SetSkinningMode(SkinningMode mode) {
+    skinningMode_ = mode;
+  }
+
+  // Where morph targets are blended; set before Init. Primitives with more than
+  // kMaxGpuMorphTargets targets are blended on the CPU either way.
+  void SetMorphMode(MorphMode mode) {
+    morphMode_ = mode;
+  }
 
   // Render the model (call every frame as needed)
-  void Render(Shader* shader);
+  void Render(const r3::Matrix4f& toClipFromWorld);
+
+  // Size of the render target, which decides how fine a texture level is worth streaming in.
+  void SetViewportSize(uint32_t width, uint32_t height) {
+    viewportPixels_ = float(width) * float(height);
+  }
+
+  // GPU memory the streamed texture levels may use.
+  void SetTextureBudget(size_t bytes) {
+    textures_.SetBudget(bytes);
+  }
+  const TextureStreamer::Stats& GetTextureStats() const {
+    return textures_.GetStats();
+  }
 
   // Destroy OpenGL resources
   void Destroy();
 
+  // The compiled node hierarchy, for animating node transforms once IsLoaded().
+  SceneGraph& GetScene() {
+    return scene_;
+  }
+
+  // Every drawn instance that isn't skinned, refit as the scene moves; Raycast() it to pick
+  // what a controller points at. Items map back to scene nodes with GetItemNode().
+  const SceneBvh& GetBvh() const {
+    return bvh_;
+  }
+
+  // Skips instances whose box is outside the view frustum (on by default). Texture streaming
+  // still sees them, so turning around doesn't evict what's behind.
+  void SetFrustumCulling(bool enabled) {
+    frustumCulling_ = enabled;
+    visibleItems_.clear();
+    instancesDirty_ = true;
+  }
+  // BVH items inside the last Render()'s frustum, before LOD selection.
+  size_t GetVisibleItemCount() const {
+    return visibleItems_.empty() ? bvh_.GetItemCount() : std::count(visibleItems_.begin(), visibleItems_.end(), 1);
+  }
+
+  // Program variants built so far, and the frames that had to skip draws waiting on one.
+  const ShaderVariants::Stats& GetShaderVariantStats() const {
+    return variants_.GetStats();
+  }
+
+  // Draw calls, GL state changes and redundant binds skipped during the last Render().
+  const GlStateCache::Stats& GetFrameStats() const {
+    return frameStats_;
+  }
+
+  struct UploadStats {
+    size_t rawBufferBytes = 0;  // sum of the model's buffers, which is what used to be uploaded
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+    size_t rawTextureBytes = 0;  // every image as RGBA8 without mips, which is what used to be uploaded
+    size_t textureBytes = 0;     // all levels, held on the CPU for streaming
+    size_t packedImages = 0;     // in textureArrays_ rather than streamed
+    // Per frame, in draw list order, with each image its own texture and with texture arrays.
+    uint32_t textureBindsUnpacked = 0;
+    uint32_t textureBinds = 0;
+  };
+  const UploadStats& GetUploadStats() const {
+    return uploadStats_;
+  }
+
+  // Whether everything Init started has been prepared, created and uploaded.
+  bool IsLoaded() const {
+    return loaded_;
+  }
+
  private:
-  struct BufferGL {
-    GLuint buffer = 0;
-    GLsizeiptr size = 0;
+  GpuUploader* uploader_ = nullptr;
+  std::unique_ptr<GpuUploader> ownUploader_;  // when no uploader was set
+  GpuUploader::Ticket loadTicket_ = 0;        // the last upload FinishInit queued
+  std::chrono::steady_clock::time_point loadStart_;
+  bool loaded_ = false;
+  // The load's CPU work, run on loadPool_ into load_ until loadPrepared_ is ready.
+  struct PreparedLoad;
+  std::unique_ptr<ThreadPool> loadPool_;
+  std::unique_ptr<PreparedLoad> load_;
+  std::future<void> loadPrepared_;
+  uint32_t framesInFlight_ = 3;
+
+  // Every image's mip chain, of which only the levels recent frames needed are in GL.
+  TextureStreamer textures_;
+  std::vector<int> textureHandles_;  // per image, into textures_; -1 where the image couldn't be used
+  GLuint whiteTexture_ = 0;  // 1x1, bound for materials without a base color texture
+  // Images no larger than this that match others in format, size and levels are packed into
+  // texture arrays, fully resident, instead of streamed.
+  static constexpr uint32_t kMaxArrayTextureSize = 256;
+  std::vector<GLuint> textureArrays_;
+  struct ImageLayer {
+    int array = -1;  // into textureArrays_, -1 for streamed images
+    int layer = 0;
+  };
+  std::vector<ImageLayer> imageLayers_;  // per image
+  float viewportPixels_ = 1024.0f * 1024.0f;
+
+  // All primitives' interleaved vertex streams share one buffer, and their indices another.
+  GLuint vertexBuffer_ = 0;
+  GLuint indexBuffer_ = 0;
+
+  struct PrimitiveGL {
+    GLuint vao = 0;
+    GLenum mode = GL_TRIANGLES;
+    GLsizei count = 0;     // indices, or vertices for non-indexed primitives
+    GLenum indexType = 0;  // 0 for glDrawArrays
+    uintptr_t indexOffset = 0;
+    bool quantized = false;
+    r3::Matrix4f dequantize;  // applied after the instance transform when quantized
+    int mesh = -1;            // into meshBounds_
+    float uvDensity = 0.0f;   // see UvDensity
+    // The vertex layout in vertexBuffer_, for the VAOs of deformed draws.
+    std::vector<VertexAttribute> attributes;
+    uint32_t stride = 0;
+    uint32_t vertexCount = 0;
+    uintptr_t vertexOffset = 0;
+    uint32_t jointLimit = 0;     // see JointLimit, 0 unless some node skins the mesh
+    int skinnedVertices = -1;  // into skinnedVertices_
+    int morphTargets = -1;     // into morphTargets_
   };
+  // Every mesh primitive, in mesh order; invalid primitives have no VAO.
+  std::vector<PrimitiveGL> primitives_;
+  // Index of each mesh's first primitive in primitives_
+  std::vector<int> meshFirstPrimitive_;
 
-  struct TextureGL {
-    GLuint texture = 0;
-    int width = 0;
-    int height = 0;
+  // One entry per batch of node primitives that share a program, material and VAO (i.e.
+  // the same mesh primitive), built once and sorted by that key so state changes are
+  // minimal. Each batch is a single instanced draw.
+  struct DrawItem {
+    uint64_t key = 0;
+    uint32_t program = 0;  // the shader variant, ShaderFeature bits
+    int material = -1;
+    int primitive = -1;  // into primitives_
+    GLuint vao = 0;
+    int baseColorTexture = -1;  // into textures_
+    int textureArray = -1;      // into textureArrays_, instead of baseColorTexture
+    GLenum mode = GL_TRIANGLES;
+    GLsizei count = 0;
+    GLenum indexType = 0;  // 0 for glDrawArrays
+    uintptr_t indexOffset = 0;
+    uint32_t firstInstance = 0;  // into instances_
+    uint32_t instanceCount = 0;
+    uint32_t visibleCount = 0;  // instances at their selected LOD, packed at the front of the range
+    int deformed = -1;          // into deformedDraws_
   };
+  std::vector<DrawItem> drawList_;
 
-  // Store OpenGL handles for each bufferView and texture
-  std::vector<BufferGL> buffersGL_;
-  std::vector<TextureGL> texturesGL_;
+  // A node primitive deformed by a skin, morph targets or both. Its vertices (CPU), palette or
+  // weights (GPU) are its own, so it's never batched, and it gets its own VAO since the
+  // instance attributes live there. When either deformation has to run on the CPU both do,
+  // since morphing comes before skinning.
+  struct DeformedDraw {
+    int node = 0;       // into scene_.GetNodes(), for the morph weights
+    int skin = -1;      // into skins_
+    int morph = -1;     // into morphTargets_
+    int primitive = 0;  // into primitives_
+    bool cpu = false;
+    GLuint vao = 0;
+    GLuint streamBuffer = 0;            // CPU: deformed positions, then normals
+    bool streamed = false;              // CPU: streamBuffer holds this draw's vertices
+    std::vector<float> blendedWeights;  // CPU: the morph weights streamBuffer was blended with
+  };
+  std::vector<DeformedDraw> deformedDraws_;
+  std::vector<Skin> skins_;
+  std::vector<std::vector<r3::Matrix4f>> palettes_;  // per skin, recomputed when the scene moves
+  std::vector<SkinnedVertices> skinnedVertices_;     // bind pose, for CPU skinned primitives
+  std::vector<float> deformedScratch_;
+  SkinningMode skinningMode_ = SkinningMode::Gpu;
+  uint32_t maxGpuJoints_ = 0;  // palette size of the skinned program, 0 when there's none
+  std::unique_ptr<ThreadPool> skinningPool_;
 
-  // Store VAOs for each mesh/primitive
-  std::vector<GLuint> vaos_;
+  // Morph targets of every morphed primitive, and where their position deltas sit in
+  // morphTexture_. The sets are only kept for primitives some draw blends on the CPU.
+  std::vector<MorphTargetSet> morphTargets_;
+  std::vector<std::vector<MorphSegment>> morphSegments_;
+  GLuint morphTexture_ = 0;
+  std::vector<float> morphScratch_;
+  MorphMode morphMode_ = MorphMode::Gpu;
+
+  // Per-instance object to world matrices are streamed from instances_ into instanceBuffer_
+  // whenever the scene changes.
+  struct Instance {
+    int node = 0;          // index into scene_.GetNodes()
+    int gpuInstance = -1;  // index into gpuInstanceLocal_ for EXT_mesh_gpu_instancing
+    int lod = -1;          // index into lods_, or -1 if always drawn
+    int lodLevel = 0;      // drawn when lods_[lod].level is this
+    bool skinned = false;  // the palette already goes to world space
+    int bvhItem = -1;      // into bvh_, or -1 if never culled
+  };
+  std::vector<Instance> instances_;
+  std::vector<r3::Matrix4f> gpuInstanceLocal_;
+  GLuint instanceBuffer_ = 0;
+  bool instancesDirty_ = true;
+
+  // Object space bounding sphere of each mesh, for screen coverage.
+  struct Bounds {
+    r3::Vec3f center;
+    float radius = 0.0f;
+  };
+  std::vector<Bounds> meshBounds_;
+
+  // A node with an MSFT_lod chain. Level 0 is the node's own mesh, level i the mesh of its
+  // i-th LOD node, and coverage.size() (only reachable when the asset gives a coverage for
+  // every level) draws nothing.
+  struct LodState {
+    int node = 0;  // index into scene_.GetNodes()
+    Bounds bounds;
+    std::vector<float> coverage;  // minimum screen coverage for each level, decreasing
+    int level = 0;
+  };
+  std::vector<LodState> lods_;
+
+  // The item visibility the instance buffer was packed with (empty when everything is), and
+  // the next frame's, swapped in when it differs.
+  SceneBvh bvh_;
+  std::vector<uint8_t> visibleItems_;
+  std::vector<uint8_t> cullScratch_;
+  bool frustumCulling_ = true;
+
+  // std140 uniform blocks, written into uniforms_ every frame.
+  struct ViewBlock {
+    float toClipFromWorld[16];
+  };
+  struct MaterialBlock {
+    float baseColorFactor[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    float metallicRoughnessAlphaCutoff[4] = {1.0f, 1.0f, 0.0f, 0.0f};
+    float textureLayer[4] = {0.0f, 0.0f, 0.0f, 0.0f};  // x, of the base color's texture array
+  };
+  // The targets with non-zero weight, as many as the shader takes.
+  struct MorphBlock {
+    int32_t segments[kMaxGpuMorphTargets][4];  // first texel, texel count, sparse, unused
+    float weights[kMaxGpuMorphTargets];
+    int32_t count;
+    int32_t padding[3];
+  };
+  // Indexed by material + 1, so slot 0 is the default material.
+  std::vector<MaterialBlock> materialBlocks_;
+  UniformRing uniforms_;
+  uint32_t loggedUniformOverflows_ = 0;  // so a steady overflow is logged once
+  // This frame's blocks per draw list item, and the packed instance matrices; members so their
+  // capacity carries over from frame to frame.
+  std::vector<UniformRing::Allocation> materialAllocs_;
+  std::vector<UniformRing::Allocation> skinAllocs_;
+  std::vector<UniformRing::Allocation> morphAllocs_;
+  std::vector<float> instanceData_;
+
+  UploadStats uploadStats_;
+  GlStateCache glState_;
+  GlStateCache::Stats frameStats_;
 
   // Store the model for reference (optional)
   const tinygltf::Model* model_ = nullptr;
+  std::string name_ = "gltf";
 
-  // Helper functions
-  bool CreateBuffers(const tinygltf::Model& model);
-  bool CreateTextures(const tinygltf::Model& model);
-  bool CreateVertexArrays(const tinygltf::Model& model);
+  // Flattened node hierarchy with cached local and world matrices
+  SceneGraph scene_;
 
-  void DrawNode(int nodeIndex, const r3::Matrix4f& parentMatrix, Shader* shader);
+  // Helper functions
+  bool StartLoad(const tinygltf::Model& model, std::function<bool()> parse, uint32_t framesInFlight, bool quantizeVertices,
+                 bool compressTextures);
+  bool PrepareScene(const tinygltf::Model& model);
+  void PrepareGeometry(const tinygltf::Model& model, PreparedLoad& load);
+  void PrepareMorphTexture(PreparedLoad& load);
+  void PrepareTextures(const tinygltf::Model& model, PreparedLoad& load);
+  void PlaceNodes(const tinygltf::Model& model, PreparedLoad& load);
+  bool FinishInit(const tinygltf::Model& model);
+  bool CreateGeometry(const tinygltf::Model& model, PreparedLoad& load);
+  bool CreateTextures(const tinygltf::Model& model, PreparedLoad& load);
+  int GetTextureImage(const tinygltf::Model& model, int textureIndex) const;
+  void BuildDrawList(const tinygltf::Model& model, const PreparedLoad& load);
+  void UploadInstances();
+  bool SelectLods(const r3::Matrix4f& toClipFromWorld);
+  bool CullItems(const r3::Matrix4f& toClipFromWorld);
+  void RequestTextureLevels(const r3::Matrix4f& toClipFromWorld);
+  bool CreateMorphTexture(PreparedLoad& load);
+  GLuint CreateDeformedVao(const PrimitiveGL& prim, GLuint streamBuffer) const;
+  void UpdateDeformations(bool moved);
+  void RequestPrograms();
+  bool SetUpProgram(uint32_t variant);
 
-  // Add your shader program(s) and uniform locations here
-  GLuint shaderProgram_ = 0;
+  // The instanced textured program in every variant some draw uses.
+  ShaderVariants variants_;
 };
\ No newline at end of file
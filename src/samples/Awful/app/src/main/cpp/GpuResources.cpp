@@ -0,0 +1,355 @@
+#include "GpuResources.h"
+
+#include <GLES2/gl2ext.h>
+#include <android/log.h>
+
+#include <algorithm>
+#include <cmath>
+
+// tinygltf's copy of nlohmann/json.
+#include "json.hpp"
+
+namespace {
+struct FormatSize {
+  GLenum format;
+  uint32_t blockWidth;
+  uint32_t blockHeight;
+  uint32_t blockBytes;
+};
+
+// Renderable and sampleable formats this app uses or might, as GL stores them. 24-bit
+// depth and RGB8 are padded to 4 bytes by every driver we've looked at.
+constexpr FormatSize kFormatSizes[] = {
+    {GL_R8, 1, 1, 1},
+    {GL_RG8, 1, 1, 2},
+    {GL_RGB8, 1, 1, 4},
+    {GL_RGB, 1, 1, 4},
+    {GL_RGBA8, 1, 1, 4},
+    {GL_RGBA, 1, 1, 4},
+    {GL_SRGB8, 1, 1, 4},
+    {GL_SRGB8_ALPHA8, 1, 1, 4},
+    {GL_RGB565, 1, 1, 2},
+    {GL_RGBA4, 1, 1, 2},
+    {GL_RGB5_A1, 1, 1, 2},
+    {GL_RGB10_A2, 1, 1, 4},
+    {GL_R11F_G11F_B10F, 1, 1, 4},
+    {GL_R16F, 1, 1, 2},
+    {GL_RG16F, 1, 1, 4},
+    {GL_RGBA16F, 1, 1, 8},
+    {GL_R32F, 1, 1, 4},
+    {GL_RGBA32F, 1, 1, 16},
+    {GL_DEPTH_COMPONENT16, 1, 1, 2},
+    {GL_DEPTH_COMPONENT24, 1, 1, 4},
+    {GL_DEPTH_COMPONENT32F, 1, 1, 4},
+    {GL_DEPTH24_STENCIL8, 1, 1, 4},
+    {GL_DEPTH32F_STENCIL8, 1, 1, 8},
+    {GL_STENCIL_INDEX8, 1, 1, 1},
+    {GL_COMPRESSED_RGB8_ETC2, 4, 4, 8},
+    {GL_COMPRESSED_SRGB8_ETC2, 4, 4, 8},
+    {GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, 4, 4, 8},
+    {GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2, 4, 4, 8},
+    {GL_COMPRESSED_RGBA8_ETC2_EAC, 4, 4, 16},
+    {GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, 4, 4, 16},
+    {GL_COMPRESSED_R11_EAC, 4, 4, 8},
+    {GL_COMPRESSED_RG11_EAC, 4, 4, 16},
+};
+
+// ASTC blocks are all 16 bytes; the enums run through the block sizes in this order.
+constexpr uint8_t kAstcBlocks[][2] = {{4, 4}, {5, 4}, {5, 5},  {6, 5},  {6, 6},   {8, 5},   {8, 6},
+                                      {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}};
+
+FormatSize FindFormatSize(GLenum format) {
+  for (const auto& size : kFormatSizes) {
+    if (size.format == format) return size;
+  }
+  for (GLenum first : {GLenum(GL_COMPRESSED_RGBA_ASTC_4x4_KHR), GLenum(GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR)}) {
+    if (format >= first && format - first < std::size(kAstcBlocks)) {
+      return {format, kAstcBlocks[format - first][0], kAstcBlocks[format - first][1], 16};
+    }
+  }
+  return {format, 1, 1, 4};
+}
+}  // namespace
+
+const char* ToString(GpuResourceKind kind) {
+  switch (kind) {
+    case GpuResourceKind::Buffer:
+      return "buffer";
+    case GpuResourceKind::Texture:
+      return "texture";
+    case GpuResourceKind::Renderbuffer:
+      return "renderbuffer";
+    case GpuResourceKind::Framebuffer:
+      return "framebuffer";
+  }
+  return "unknown";
+}
+
+size_t EstimateTextureBytes(GLenum internalFormat, uint32_t width, uint32_t height, uint32_t levels, uint32_t samples) {
+  const FormatSize size = FindFormatSize(internalFormat);
+  size_t bytes = 0;
+  for (uint32_t level = 0; levels == 0 || level < levels; level++) {
+    const size_t blocksX = (width + size.blockWidth - 1) / size.blockWidth;
+    const size_t blocksY = (height + size.blockHeight - 1) / size.blockHeight;
+    bytes += blocksX * blocksY * size.blockBytes;
+    if (width <= 1 && height <= 1) break;
+    width = std::max(width / 2, 1u);
+    height = std::max(height / 2, 1u);
+  }
+  return bytes * std::max(samples, 1u);
+}
+
+uint32_t GetTextureBlockHeight(GLenum internalFormat) {
+  return FindFormatSize(internalFormat).blockHeight;
+}
+
+GpuResourceTracker& GpuResourceTracker::Get() {
+  static GpuResourceTracker tracker;
+  return tracker;
+}
+
+GLuint GpuResourceTracker::CreateBuffer(const GpuResourceTag& tag) {
+  GLuint name = 0;
+  glGenBuffers(1, &name);
+  Register(GpuResourceKind::Buffer, name, tag);
+  return name;
+}
+
+GLuint GpuResourceTracker::CreateTexture(const GpuResourceTag& tag) {
+  GLuint name = 0;
+  glGenTextures(1, &name);
+  Register(GpuResourceKind::Texture, name, tag);
+  return name;
+}
+
+GLuint GpuResourceTracker::CreateRenderbuffer(const GpuResourceTag& tag) {
+  GLuint name = 0;
+  glGenRenderbuffers(1, &name);
+  Register(GpuResourceKind::Renderbuffer, name, tag);
+  return name;
+}
+
+GLuint GpuResourceTracker::CreateFramebuffer(const GpuResourceTag& tag) {
+  GLuint name = 0;
+  glGenFramebuffers(1, &name);
+  Register(GpuResourceKind::Framebuffer, name, tag);
+  return name;
+}
+
+void GpuResourceTracker::DeleteBuffer(GLuint& buffer) {
+  if (!buffer) return;
+  glDeleteBuffers(1, &buffer);
+  Unregister(GpuResourceKind::Buffer, buffer);
+  buffer = 0;
+}
+
+void GpuResourceTracker::DeleteTexture(GLuint& texture) {
+  if (!texture) return;
+  glDeleteTextures(1, &texture);
+  Unregister(GpuResourceKind::Texture, texture);
+  texture = 0;
+}
+
+void GpuResourceTracker::DeleteRenderbuffer(GLuint& renderbuffer) {
+  if (!renderbuffer) return;
+  glDeleteRenderbuffers(1, &renderbuffer);
+  Unregister(GpuResourceKind::Renderbuffer, renderbuffer);
+  renderbuffer = 0;
+}
+
+void GpuResourceTracker::DeleteFramebuffer(GLuint& framebuffer) {
+  if (!framebuffer) return;
+  glDeleteFramebuffers(1, &framebuffer);
+  Unregister(GpuResourceKind::Framebuffer, framebuffer);
+  framebuffer = 0;
+}
+
+void GpuResourceTracker::Register(GpuResourceKind kind, GLuint name, const GpuResourceTag& tag) {
+  if (!name) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  Record& record = records_[Key(kind, name)];
+  if (record.group) {
+    // GL handed out a name we think is live, so whoever deleted it went around us.
+    __android_log_print(ANDROID_LOG_WARN, "GpuResources", "%s %u (%s, %s) reused without being deleted here",
+                        ToString(kind), name, record.resource.tag.subsystem.c_str(), record.resource.tag.asset.c_str());
+    SetBytes(record, 0);
+    record.group->count--;
+  }
+  record.resource = {};
+  record.resource.kind = kind;
+  record.resource.name = name;
+  record.resource.tag = tag;
+  record.group = &groups_[{tag.subsystem, tag.asset}];
+  record.group->count++;
+}
+
+void GpuResourceTracker::Unregister(GpuResourceKind kind, GLuint name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(Key(kind, name));
+  if (it == records_.end()) {
+    __android_log_print(ANDROID_LOG_WARN, "GpuResources", "Deleting untracked %s %u", ToString(kind), name);
+    return;
+  }
+  SetBytes(it->second, 0);
+  it->second.group->count--;
+  records_.erase(it);
+}
+
+// Call with mutex_ held.
+void GpuResourceTracker::SetBytes(Record& record, size_t bytes) {
+  totalBytes_ = totalBytes_ - record.resource.bytes + bytes;
+  record.group->bytes = record.group->bytes - record.resource.bytes + bytes;
+  record.resource.bytes = bytes;
+  peakBytes_ = std::max(peakBytes_, totalBytes_);
+  record.group->peakBytes = std::max(record.group->peakBytes, record.group->bytes);
+}
+
+void GpuResourceTracker::SetBufferSize(GLuint buffer, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(Key(GpuResourceKind::Buffer, buffer));
+  if (it == records_.end()) {
+    __android_log_print(ANDROID_LOG_WARN, "GpuResources", "Sizing untracked buffer %u", buffer);
+    return;
+  }
+  SetBytes(it->second, bytes);
+}
+
+void GpuResourceTracker::SetTextureStorage(GLuint texture, GLenum internalFormat, uint32_t width, uint32_t height,
+                                           uint32_t levels, uint32_t samples) {
+  const size_t bytes = EstimateTextureBytes(internalFormat, width, height, levels, samples);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(Key(GpuResourceKind::Texture, texture));
+  if (it == records_.end()) {
+    __android_log_print(ANDROID_LOG_WARN, "GpuResources", "Sizing untracked texture %u", texture);
+    return;
+  }
+  auto& resource = it->second.resource;
+  resource.format = internalFormat;
+  resource.width = width;
+  resource.height = height;
+  resource.levels = levels ? levels : static_cast<uint32_t>(std::log2(std::max({width, height, 1u}))) + 1;
+  resource.layers = 1;
+  resource.samples = samples;
+  SetBytes(it->second, bytes);
+}
+
+void GpuResourceTracker::SetTextureArrayStorage(GLuint texture, GLenum internalFormat, uint32_t width, uint32_t height,
+                                                uint32_t layers, uint32_t levels) {
+  const size_t bytes = EstimateTextureBytes(internalFormat, width, height, levels) * layers;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(Key(GpuResourceKind::Texture, texture));
+  if (it == records_.end()) {
+    __android_log_print(ANDROID_LOG_WARN, "GpuResources", "Sizing untracked texture %u", texture);
+    return;
+  }
+  auto& resource = it->second.resource;
+  resource.format = internalFormat;
+  resource.width = width;
+  resource.height = height;
+  resource.levels = levels ? levels : static_cast<uint32_t>(std::log2(std::max({width, height, 1u}))) + 1;
+  resource.layers = layers;
+  resource.samples = 1;
+  SetBytes(it->second, bytes);
+}
+
+void GpuResourceTracker::SetRenderbufferStorage(GLuint renderbuffer, GLenum internalFormat, uint32_t width, uint32_t height,
+                                                uint32_t samples) {
+  const size_t bytes = EstimateTextureBytes(internalFormat, width, height, 1, samples);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = records_.find(Key(GpuResourceKind::Renderbuffer, renderbuffer));
+  if (it == records_.end()) {
+    __android_log_print(ANDROID_LOG_WARN, "GpuResources", "Sizing untracked renderbuffer %u", renderbuffer);
+    return;
+  }
+  auto& resource = it->second.resource;
+  resource.format = internalFormat;
+  resource.width = width;
+  resource.height = height;
+  resource.levels = 1;
+  resource.layers = 1;
+  resource.samples = samples;
+  SetBytes(it->second, bytes);
+}
+
+size_t GpuResourceTracker::EndFrame() {
+  lastFrameUploadBytes_ = frameUploadBytes_.exchange(0);
+  return lastFrameUploadBytes_;
+}
+
+size_t GpuResourceTracker::GetTotalBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return totalBytes_;
+}
+
+size_t GpuResourceTracker::GetPeakBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peakBytes_;
+}
+
+GpuResourceSnapshot GpuResourceTracker::GetSnapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  GpuResourceSnapshot snapshot;
+  snapshot.resources.reserve(records_.size());
+  for (const auto& [key, record] : records_) {
+    snapshot.resources.push_back(record.resource);
+  }
+  // Largest first, which is the order anyone reading a dump wants.
+  std::sort(snapshot.resources.begin(), snapshot.resources.end(),
+            [](const auto& a, const auto& b) { return a.bytes != b.bytes ? a.bytes > b.bytes : a.name < b.name; });
+  for (const auto& [key, group] : groups_) {
+    snapshot.groups.push_back({key.first, key.second, group.count, group.bytes, group.peakBytes});
+  }
+  snapshot.totalBytes = totalBytes_;
+  snapshot.peakBytes = peakBytes_;
+  return snapshot;
+}
+
+size_t GpuResourceTracker::ReportLeaks(const std::string& subsystem, const std::string& asset) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t leaks = 0;
+  for (const auto& [key, record] : records_) {
+    const GpuResourceTag& tag = record.resource.tag;
+    if ((!subsystem.empty() && tag.subsystem != subsystem) || (!asset.empty() && tag.asset != asset)) {
+      continue;
+    }
+    __android_log_print(ANDROID_LOG_WARN, "GpuResources", "Leaked %s %u (%s, %s, %s): %zu bytes",
+                        ToString(record.resource.kind), record.resource.name, tag.subsystem.c_str(), tag.asset.c_str(),
+                        tag.label.c_str(), record.resource.bytes);
+    leaks++;
+  }
+  return leaks;
+}
+
+std::string ToJson(const GpuResourceSnapshot& snapshot) {
+  nlohmann::json resources = nlohmann::json::array();
+  for (const auto& resource : snapshot.resources) {
+    nlohmann::json entry = {
+        {"kind", ToString(resource.kind)}, {"name", resource.name},       {"subsystem", resource.tag.subsystem},
+        {"asset", resource.tag.asset},     {"label", resource.tag.label}, {"bytes", resource.bytes},
+    };
+    if (resource.kind == GpuResourceKind::Texture || resource.kind == GpuResourceKind::Renderbuffer) {
+      entry["format"] = resource.format;
+      entry["width"] = resource.width;
+      entry["height"] = resource.height;
+      entry["levels"] = resource.levels;
+      entry["layers"] = resource.layers;
+      entry["samples"] = resource.samples;
+    }
+    resources.push_back(std::move(entry));
+  }
+  nlohmann::json groups = nlohmann::json::array();
+  for (const auto& group : snapshot.groups) {
+    groups.push_back({{"subsystem", group.subsystem},
+                      {"asset", group.asset},
+                      {"count", group.count},
+                      {"bytes", group.bytes},
+                      {"peakBytes", group.peakBytes}});
+  }
+  nlohmann::json root = {
+      {"totalBytes", snapshot.totalBytes},
+      {"peakBytes", snapshot.peakBytes},
+      {"groups", std::move(groups)},
+      {"resources", std::move(resources)},
+  };
+  return root.dump(2);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Registry of the GL objects that own memory: buffers, textures, renderbuffers and
+// framebuffers. Everything that creates one goes through here, tagged with the subsystem
+// (the class that made it) and the asset it holds, and records its storage once allocated.
+// Sizes are estimates from format, dimensions, mip count and sample count; drivers pad and
+// compress behind our back, but the estimate is what we'd budget against. VAOs, programs
+// and syncs hold no storage worth counting and aren't tracked.
+//
+//   auto& gpu = GpuResourceTracker::Get();
+//   GLuint vbo = gpu.CreateBuffer({"GltfRenderer", "duck.gltf", "vertices"});
+//   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+//   glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+//   gpu.SetBufferSize(vbo, bytes);
+//   ...
+//   gpu.DeleteBuffer(vbo);
+//
+// GL objects belong to the context's thread, but snapshots can be taken from anywhere.
+
+enum class GpuResourceKind { Buffer, Texture, Renderbuffer, Framebuffer };
+
+const char* ToString(GpuResourceKind kind);
+
+struct GpuResourceTag {
+  std::string subsystem;
+  std::string asset;
+  std::string label;  // what it is within the asset, optional
+};
+
+struct GpuResourceSnapshot {
+  struct Resource {
+    GpuResourceKind kind = GpuResourceKind::Buffer;
+    GLuint name = 0;
+    GpuResourceTag tag;
+    GLenum format = 0;  // internal format of textures and renderbuffers
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levels = 0;
+    uint32_t layers = 0;  // of texture arrays, 1 for everything else
+    uint32_t samples = 0;
+    size_t bytes = 0;
+  };
+  // Totals per subsystem and asset. Groups whose resources are all gone stay, for their peak.
+  struct Group {
+    std::string subsystem;
+    std::string asset;
+    uint32_t count = 0;
+    size_t bytes = 0;
+    size_t peakBytes = 0;
+  };
+  std::vector<Resource> resources;
+  std::vector<Group> groups;
+  size_t totalBytes = 0;
+  size_t peakBytes = 0;
+};
+
+class GpuResourceTracker {
+ public:
+  static GpuResourceTracker& Get();
+
+  // glGen* plus registration. The storage is 0 bytes until one of the Set* calls below.
+  GLuint CreateBuffer(const GpuResourceTag& tag);
+  GLuint CreateTexture(const GpuResourceTag& tag);
+  GLuint CreateRenderbuffer(const GpuResourceTag& tag);
+  GLuint CreateFramebuffer(const GpuResourceTag& tag);
+
+  // glDelete* plus deregistration. Zero the name; 0 is ignored.
+  void DeleteBuffer(GLuint& buffer);
+  void DeleteTexture(GLuint& texture);
+  void DeleteRenderbuffer(GLuint& renderbuffer);
+  void DeleteFramebuffer(GLuint& framebuffer);
+
+  // Record what was just allocated, replacing whatever was recorded before (glBufferData and
+  // glTexImage* reallocate too). levels 0 means the full chain down to 1x1.
+  void SetBufferSize(GLuint buffer, size_t bytes);
+  void SetTextureStorage(GLuint texture, GLenum internalFormat, uint32_t width, uint32_t height, uint32_t levels,
+                         uint32_t samples = 1);
+  void SetTextureArrayStorage(GLuint texture, GLenum internalFormat, uint32_t width, uint32_t height, uint32_t layers,
+                              uint32_t levels);
+  void SetRenderbufferStorage(GLuint renderbuffer, GLenum internalFormat, uint32_t width, uint32_t height,
+                              uint32_t samples = 1);
+
+  // Vertex, index and texture bytes handed to GL, from any thread, so a frame that streams
+  // nothing shows 0. Uniform blocks are per-frame parameters rather than data and aren't
+  // counted. EndFrame() on the render thread latches the frame's total.
+  void CountUpload(size_t bytes) {
+    frameUploadBytes_ += bytes;
+  }
+  size_t EndFrame();
+  size_t GetFrameUploadBytes() const {
+    return lastFrameUploadBytes_;
+  }
+
+  size_t GetTotalBytes() const;
+  size_t GetPeakBytes() const;
+  GpuResourceSnapshot GetSnapshot() const;
+
+  // Logs every live resource matching the tag (an empty subsystem or asset matches any) and
+  // returns how many there were. Call after an owner's Destroy(): anything left is a leak.
+  size_t ReportLeaks(const std::string& subsystem, const std::string& asset = {}) const;
+
+ private:
+  struct Group {
+    uint32_t count = 0;
+    size_t bytes = 0;
+    size_t peakBytes = 0;
+  };
+  struct Record {
+    GpuResourceSnapshot::Resource resource;
+    Group* group = nullptr;
+  };
+
+  GpuResourceTracker() = default;
+
+  static uint64_t Key(GpuResourceKind kind, GLuint name) {
+    return uint64_t(kind) << 32 | name;
+  }
+  void Register(GpuResourceKind kind, GLuint name, const GpuResourceTag& tag);
+  void Unregister(GpuResourceKind kind, GLuint name);
+  void SetBytes(Record& record, size_t bytes);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, Record> records_;
+  std::map<std::pair<std::string, std::string>, Group> groups_;  // by subsystem, asset
+  size_t totalBytes_ = 0;
+  size_t peakBytes_ = 0;
+  std::atomic<size_t> frameUploadBytes_ = 0;
+  size_t lastFrameUploadBytes_ = 0;
+};
+
+// Storage for a texture or renderbuffer: every level (levels 0 for the full chain) times
+// samples. Block compressed formats round up to whole blocks; unknown formats count 4 bytes
+// per texel.
+size_t EstimateTextureBytes(GLenum internalFormat, uint32_t width, uint32_t height, uint32_t levels, uint32_t samples = 1);
+
+// Rows per block of a block compressed format, 1 for everything else. Sub-image uploads of
+// compressed formats start on, and mostly cover, whole rows of blocks.
+uint32_t GetTextureBlockHeight(GLenum internalFormat);
+
+std::string ToJson(const GpuResourceSnapshot& snapshot);
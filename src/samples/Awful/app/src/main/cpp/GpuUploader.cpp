@@ -0,0 +1,324 @@
+#include "GpuUploader.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+#include "GpuResources.h"
+
+GpuUploader::~GpuUploader() {
+  StopLoaderThread();
+  for (const Done& done : done_) {
+    glDeleteSync(done.fence);
+  }
+  ReleaseStaging(staging_);
+}
+
+bool GpuUploader::StartLoaderThread(EGLDisplay display, EGLConfig config, EGLContext shareContext) {
+  if (loader_.joinable()) return true;
+  const EGLint contextAttribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
+  EGLContext context = eglCreateContext(display, config, shareContext, contextAttribs);
+  if (context == EGL_NO_CONTEXT) {
+    __android_log_print(ANDROID_LOG_WARN, "GpuUploader", "eglCreateContext() failed (0x%x), uploading on the frame budget",
+                        eglGetError());
+    return false;
+  }
+  // The config is the render context's, which already has to support pbuffers.
+  const EGLint surfaceAttribs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+  EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+  if (surface == EGL_NO_SURFACE) {
+    __android_log_print(ANDROID_LOG_WARN, "GpuUploader", "eglCreatePbufferSurface() failed, uploading on the frame budget");
+    eglDestroyContext(display, context);
+    return false;
+  }
+  std::promise<bool> current;
+  std::future<bool> started = current.get_future();
+  stopping_ = false;
+  loader_ = std::thread(&GpuUploader::LoaderMain, this, display, surface, context, std::move(current));
+  if (!started.get()) {
+    loader_.join();
+    __android_log_print(ANDROID_LOG_WARN, "GpuUploader",
+                        "eglMakeCurrent() failed on the loader thread, uploading on the frame budget");
+    return false;
+  }
+  stats_.threaded = true;
+  __android_log_print(ANDROID_LOG_INFO, "GpuUploader", "Uploading on a shared context");
+  return true;
+}
+
+void GpuUploader::StopLoaderThread() {
+  if (!loader_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  loader_.join();
+  stats_.threaded = false;
+}
+
+void GpuUploader::LoaderMain(EGLDisplay display, EGLSurface surface, EGLContext context, std::promise<bool> current) {
+  const bool made = eglMakeCurrent(display, surface, surface, context) == EGL_TRUE;
+  current.set_value(made);
+  if (made) {
+    Staging staging;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (stopping_) break;
+      Job job = std::move(queue_.front());
+      queue_.pop_front();
+      lock.unlock();
+      while (!Step(job, staging) && !stopping_) {
+      }
+      // The render thread polls the fence, so it has to reach the GPU without waiting for
+      // this context's next flush.
+      Done done{job.ticket, job.size, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)};
+      glFlush();
+      lock.lock();
+      done_.push_back(done);
+    }
+    lock.unlock();
+    ReleaseStaging(staging);
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+  eglDestroySurface(display, surface);
+  eglDestroyContext(display, context);
+  eglReleaseThread();
+}
+
+GpuUploader::Ticket GpuUploader::UploadBuffer(GLuint buffer, std::vector<uint8_t>&& data, GLenum usage) {
+  Job job;
+  job.buffer = buffer;
+  job.bufferUsage = usage;
+  job.size = data.size();
+  job.bytes = std::move(data);
+  GpuResourceTracker::Get().SetBufferSize(buffer, job.size);
+  return Submit(std::move(job));
+}
+
+GpuUploader::Ticket GpuUploader::UploadTexture(TextureUpload&& upload) {
+  if (upload.levels.empty() || upload.layers == 0) {
+    __android_log_print(ANDROID_LOG_ERROR, "GpuUploader", "Texture %u has nothing to upload", upload.texture);
+    return 0;
+  }
+  Job job;
+  job.isTexture = true;
+  for (const auto& level : upload.levels) job.size += level.size;
+  const auto& base = upload.levels[0];
+  const uint32_t levels = static_cast<uint32_t>(upload.levels.size());
+  auto& gpu = GpuResourceTracker::Get();
+  if (upload.target == GL_TEXTURE_2D_ARRAY) {
+    gpu.SetTextureArrayStorage(upload.texture, upload.internalFormat, base.width, base.height, upload.layers, levels);
+  } else {
+    gpu.SetTextureStorage(upload.texture, upload.internalFormat, base.width, base.height, levels);
+  }
+  job.texture = std::move(upload);
+  return Submit(std::move(job));
+}
+
+GpuUploader::Ticket GpuUploader::Submit(Job&& job) {
+  job.ticket = nextTicket_++;
+  stats_.queuedBytes += job.size;
+  stats_.pendingBytes += job.size;
+  stats_.pendingUploads++;
+  const Ticket ticket = job.ticket;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(job));
+  }
+  wake_.notify_one();
+  return ticket;
+}
+
+void GpuUploader::Update() {
+  const auto start = Clock::now();
+  Retire();
+  if (!stats_.threaded) {
+    Issue(stats_.budgetMs);
+  }
+  stats_.lastUpdateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  stats_.maxUpdateMs = std::max(stats_.maxUpdateMs, stats_.lastUpdateMs);
+}
+
+void GpuUploader::Finish() {
+  if (!stats_.threaded) {
+    Issue(-1.0);
+    return;
+  }
+  while (!IsComplete(GetLastTicket())) {
+    GLsync fence = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!done_.empty()) fence = done_.front().fence;
+    }
+    if (fence) {
+      glClientWaitSync(fence, 0, GLuint64(100) * 1000 * 1000);
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Retire();
+  }
+}
+
+// Fences signal in the order the loader thread finished, which is ticket order.
+void GpuUploader::Retire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t retired = 0;
+  for (; retired < done_.size(); retired++) {
+    const Done& done = done_[retired];
+    const GLenum status = glClientWaitSync(done.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) break;
+    glDeleteSync(done.fence);
+    Complete(done.ticket, done.size);
+  }
+  done_.erase(done_.begin(), done_.begin() + retired);
+}
+
+// Issues chunks from the front of the queue on this thread until ms have passed, or until
+// it's empty when ms is negative. Later commands in this context see the data, so jobs are
+// complete as soon as they're issued.
+void GpuUploader::Issue(double ms) {
+  const auto start = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!queue_.empty()) {
+    Job& job = queue_.front();
+    if (Step(job, staging_)) {
+      Complete(job.ticket, job.size);
+      queue_.pop_front();
+    }
+    if (ms >= 0.0 && std::chrono::duration<double, std::milli>(Clock::now() - start).count() >= ms) break;
+  }
+}
+
+void GpuUploader::Complete(Ticket ticket, size_t size) {
+  completed_ = ticket;
+  stats_.uploadedBytes += size;
+  stats_.pendingBytes -= size;
+  stats_.pendingUploads--;
+}
+
+bool GpuUploader::Step(Job& job, Staging& staging) {
+  return job.isTexture ? StepTexture(job, staging) : StepBuffer(job, staging);
+}
+
+// Storage first, then a chunk at a time copied over from the staging buffer.
+bool GpuUploader::StepBuffer(Job& job, Staging& staging) {
+  if (!job.allocated) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, job.buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, job.size, nullptr, job.bufferUsage);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    job.allocated = true;
+    return job.size == 0;
+  }
+  const size_t bytes = std::min(kChunkBytes, job.size - job.offset);
+  void* dst = Stage(staging, GL_COPY_READ_BUFFER, bytes);
+  if (dst) {
+    memcpy(dst, job.bytes.data() + job.offset, bytes);
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, job.buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, job.offset, bytes);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    GpuResourceTracker::Get().CountUpload(bytes);
+  } else {
+    __android_log_print(ANDROID_LOG_ERROR, "GpuUploader", "Couldn't map staging, buffer %u left incomplete", job.buffer);
+    job.offset = job.size - bytes;
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  job.offset += bytes;
+  if (job.offset < job.size) return false;
+  job.bytes = {};
+  return true;
+}
+
+// Immutable storage for the whole chain first, then bands of rows from a pixel unpack buffer,
+// level by level and layer by layer.
+bool GpuUploader::StepTexture(Job& job, Staging& staging) {
+  const TextureUpload& upload = job.texture;
+  const GLsizei levels = static_cast<GLsizei>(upload.levels.size());
+  if (!job.allocated) {
+    const auto& base = upload.levels[0];
+    glBindTexture(upload.target, upload.texture);
+    if (upload.target == GL_TEXTURE_2D_ARRAY) {
+      glTexStorage3D(upload.target, levels, upload.internalFormat, base.width, base.height, upload.layers);
+    } else {
+      glTexStorage2D(upload.target, levels, upload.internalFormat, base.width, base.height);
+    }
+    const GLint minFilter = upload.minFilter ? upload.minFilter : levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+    glTexParameteri(upload.target, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(upload.target, GL_TEXTURE_MAG_FILTER, upload.magFilter);
+    glBindTexture(upload.target, 0);
+    job.allocated = true;
+    return false;
+  }
+
+  const auto& level = upload.levels[job.level];
+  const uint32_t blockHeight = upload.compressed ? GetTextureBlockHeight(upload.internalFormat) : 1;
+  const uint32_t blockRows = (level.height + blockHeight - 1) / blockHeight;
+  const size_t layerBytes = level.size / upload.layers;
+  const size_t rowBytes = std::max<size_t>(1, layerBytes / blockRows);
+  const uint32_t firstBlockRow = job.row / blockHeight;
+  const uint32_t rows =
+      static_cast<uint32_t>(std::min<size_t>(std::max<size_t>(1, kChunkBytes / rowBytes), blockRows - firstBlockRow));
+  const size_t bytes = rows * rowBytes;
+  const uint32_t y = job.row, height = std::min(level.height - y, rows * blockHeight);
+
+  void* dst = Stage(staging, GL_PIXEL_UNPACK_BUFFER, bytes);
+  if (dst) {
+    memcpy(dst, level.data + job.layer * layerBytes + firstBlockRow * rowBytes, bytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindTexture(upload.target, upload.texture);
+    const GLint l = static_cast<GLint>(job.level);
+    if (upload.target == GL_TEXTURE_2D_ARRAY) {
+      if (upload.compressed) {
+        glCompressedTexSubImage3D(upload.target, l, 0, y, job.layer, level.width, height, 1, upload.internalFormat, bytes,
+                                  nullptr);
+      } else {
+        glTexSubImage3D(upload.target, l, 0, y, job.layer, level.width, height, 1, upload.format, upload.type, nullptr);
+      }
+    } else if (upload.compressed) {
+      glCompressedTexSubImage2D(upload.target, l, 0, y, level.width, height, upload.internalFormat, bytes, nullptr);
+    } else {
+      glTexSubImage2D(upload.target, l, 0, y, level.width, height, upload.format, upload.type, nullptr);
+    }
+    glBindTexture(upload.target, 0);
+    GpuResourceTracker::Get().CountUpload(bytes);
+  } else {
+    __android_log_print(ANDROID_LOG_ERROR, "GpuUploader", "Couldn't map staging, texture %u left incomplete", upload.texture);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  job.row += rows * blockHeight;
+  if (job.row < level.height) return false;
+  job.row = 0;
+  if (++job.layer < upload.layers) return false;
+  job.layer = 0;
+  if (++job.level < upload.levels.size()) return false;
+  job.texture.storage = {};
+  return true;
+}
+
+// Orphans the staging buffer and maps it for the next chunk, leaving it bound to target. The
+// driver hands out fresh memory while earlier chunks are still being read, so this never
+// waits on the GPU.
+void* GpuUploader::Stage(Staging& staging, GLenum target, size_t size) {
+  auto& gpu = GpuResourceTracker::Get();
+  if (!staging.buffer) {
+    staging.buffer = gpu.CreateBuffer({"GpuUploader", "", "staging"});
+  }
+  const size_t capacity = std::max(size, kChunkBytes);
+  glBindBuffer(target, staging.buffer);
+  glBufferData(target, capacity, nullptr, GL_STREAM_DRAW);
+  if (capacity != staging.size) {
+    staging.size = capacity;
+    gpu.SetBufferSize(staging.buffer, capacity);
+  }
+  return glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+void GpuUploader::ReleaseStaging(Staging& staging) {
+  GpuResourceTracker::Get().DeleteBuffer(staging.buffer);
+  staging.size = 0;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Buffer and texture uploads moved off the frame. The render thread creates the GL names and
+// queues the data; the bytes reach GL in chunks of kChunkBytes through a staging buffer, so
+// no single call copies a whole asset:
+//
+//   - With StartLoaderThread() the chunks are issued by a thread of our own on an EGL context
+//     shared with the render context. Each upload ends in a fence the render thread polls,
+//     so the frame never waits on the copy or the driver's conversion.
+//   - Without one (or if the context can't be made), Update() issues chunks on the render
+//     thread until the frame's time budget is spent, and carries the rest over.
+//
+// Either way a ticket says when an upload's object is safe to draw with. Objects may be
+// bound to VAOs or framebuffers in the meantime, just not drawn from.
+//
+//   GLuint vbo = gpu.CreateBuffer(tag);
+//   GpuUploader::Ticket ticket = uploader.UploadBuffer(vbo, std::move(bytes), GL_STATIC_DRAW);
+//   ...
+//   uploader.Update();  // once per frame, on the render thread
+//   if (uploader.IsComplete(ticket)) { ... draw ... }
+//
+// The uploader records storage sizes with GpuResourceTracker when an upload is queued.
+class GpuUploader {
+ public:
+  using Ticket = uint64_t;
+  static constexpr size_t kChunkBytes = size_t(256) << 10;
+
+  // A whole texture: storage for every level is allocated up front with glTexStorage*, then
+  // filled a band of rows at a time. Levels hold every layer, one after the other.
+  struct TextureUpload {
+    struct Level {
+      uint32_t width = 0;
+      uint32_t height = 0;
+      const uint8_t* data = nullptr;
+      size_t size = 0;
+    };
+    GLenum target = GL_TEXTURE_2D;  // or GL_TEXTURE_2D_ARRAY
+    GLuint texture = 0;
+    GLenum internalFormat = GL_RGBA8;
+    bool compressed = false;
+    GLenum format = GL_RGBA;  // of uncompressed data
+    GLenum type = GL_UNSIGNED_BYTE;
+    uint32_t layers = 1;
+    GLint minFilter = 0;  // 0 for linear, trilinear when there are mips
+    GLint magFilter = GL_LINEAR;
+    std::vector<Level> levels;
+    // What levels point into when the upload owns its bytes. Left empty, the caller keeps the
+    // data alive until the ticket completes.
+    std::vector<std::vector<uint8_t>> storage;
+  };
+
+  struct Stats {
+    bool threaded = false;       // a loader thread issues the uploads
+    uint64_t queuedBytes = 0;    // submitted so far
+    uint64_t uploadedBytes = 0;  // completed so far
+    size_t pendingBytes = 0;     // submitted, not yet complete
+    uint32_t pendingUploads = 0;
+    double budgetMs = 2.0;      // per frame, without a loader thread
+    double lastUpdateMs = 0.0;  // render thread time spent in the last Update()
+    double maxUpdateMs = 0.0;
+  };
+
+  GpuUploader() = default;
+  // Stops the loader thread; uploads it hadn't started are dropped.
+  ~GpuUploader();
+  GpuUploader(const GpuUploader&) = delete;
+  GpuUploader& operator=(const GpuUploader&) = delete;
+
+  // Call on the render thread with its context current. Returns false (and stays on the
+  // frame budget) if the shared context or its thread can't be set up.
+  bool StartLoaderThread(EGLDisplay display, EGLConfig config, EGLContext shareContext);
+
+  // Render thread time Update() may spend issuing chunks when there's no loader thread. One
+  // chunk is always issued, so this is a target rather than a bound.
+  void SetFrameBudgetMs(double ms) {
+    stats_.budgetMs = ms;
+  }
+
+  // The name must already exist in this share group; its storage is (re)allocated here.
+  Ticket UploadBuffer(GLuint buffer, std::vector<uint8_t>&& data, GLenum usage = GL_STATIC_DRAW);
+  Ticket UploadTexture(TextureUpload&& upload);
+
+  // Per frame on the render thread: retires finished uploads and, without a loader thread,
+  // spends the frame budget on the queue.
+  void Update();
+
+  bool IsComplete(Ticket ticket) const {
+    return ticket <= completed_;
+  }
+  // The last ticket handed out, 0 before any. Complete once everything queued so far is.
+  Ticket GetLastTicket() const {
+    return nextTicket_ - 1;
+  }
+
+  // Blocks until everything queued is complete, for teardown and tests. Render thread.
+  void Finish();
+
+  const Stats& GetStats() const {
+    return stats_;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Job {
+    Ticket ticket = 0;
+    GLenum bufferUsage = 0;  // buffer jobs
+    GLuint buffer = 0;
+    std::vector<uint8_t> bytes;
+    bool isTexture = false;  // texture jobs
+    TextureUpload texture;
+    // Progress: allocated, then level, layer and row (buffers use only offset).
+    bool allocated = false;
+    uint32_t level = 0;
+    uint32_t layer = 0;
+    uint32_t row = 0;
+    size_t offset = 0;
+    size_t size = 0;
+  };
+  // A job the loader thread finished, with the fence that says the GPU did too.
+  struct Done {
+    Ticket ticket = 0;
+    size_t size = 0;
+    GLsync fence = nullptr;
+  };
+
+  // Staging for one context's chunks; each context that uploads has its own.
+  struct Staging {
+    GLuint buffer = 0;
+    size_t size = 0;
+  };
+
+  Ticket Submit(Job&& job);
+  void Retire();
+  void Issue(double ms);
+  void Complete(Ticket ticket, size_t size);
+  // Issues the job's next chunk in the current context. True once it has issued them all.
+  bool Step(Job& job, Staging& staging);
+  bool StepBuffer(Job& job, Staging& staging);
+  bool StepTexture(Job& job, Staging& staging);
+  static void* Stage(Staging& staging, GLenum target, size_t size);
+  static void ReleaseStaging(Staging& staging);
+  void LoaderMain(EGLDisplay display, EGLSurface surface, EGLContext context, std::promise<bool> current);
+  void StopLoaderThread();
+
+  // Shared with the loader thread.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Job> queue_;
+  std::vector<Done> done_;
+  std::atomic<bool> stopping_ = false;
+  std::thread loader_;
+
+  // Render thread only.
+  Ticket nextTicket_ = 1;
+  Ticket completed_ = 0;
+  Staging staging_;
+  Stats stats_;
+};
@@ -0,0 +1,323 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace {
+// Forsyth's scoring: recently used vertices score high, the last triangle's a little less
+// (its edges are already covered), and vertices with few triangles left get a boost so
+// they're finished off rather than left stranded.
+constexpr int kScoreCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriangleScore = 0.75f;
+constexpr float kValenceBoostScale = 2.0f;
+constexpr float kValenceBoostPower = 0.5f;
+
+constexpr uint32_t kMaxValenceTable = 32;
+
+// The pow()s dominate otherwise, so the score is two table lookups.
+struct ScoreTables {
+  float cache[kScoreCacheSize];
+  float valence[kMaxValenceTable];
+  ScoreTables() {
+    for (int i = 0; i < kScoreCacheSize; i++) {
+      if (i < 3) {
+        cache[i] = kLastTriangleScore;
+      } else {
+        const float scaler = 1.0f / (kScoreCacheSize - 3);
+        cache[i] = std::pow(1.0f - (i - 3) * scaler, kCacheDecayPower);
+      }
+    }
+    valence[0] = 0.0f;
+    for (uint32_t i = 1; i < kMaxValenceTable; i++) {
+      valence[i] = kValenceBoostScale * std::pow(float(i), -kValenceBoostPower);
+    }
+  }
+};
+
+float VertexScore(int cachePosition, uint32_t liveTriangles) {
+  static const ScoreTables tables;
+  if (liveTriangles == 0) {
+    return -1.0f;  // nothing left to draw with this vertex
+  }
+  const float cacheScore = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+  return cacheScore + tables.valence[std::min(liveTriangles, kMaxValenceTable - 1)];
+}
+
+const float* Position(const uint8_t* positions, uint32_t stride, uint32_t v) {
+  return reinterpret_cast<const float*>(positions + size_t(v) * stride);
+}
+}  // namespace
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize) {
+  VertexCacheStats stats;
+  if (indices.size() < 3 || vertexCount == 0) {
+    return stats;
+  }
+  // Timestamps make the FIFO check O(1): a vertex is cached if it was added fewer than
+  // cacheSize insertions ago.
+  std::vector<uint32_t> insertedAt(vertexCount, 0);
+  std::vector<bool> used(vertexCount, false);
+  uint32_t clock = cacheSize + 1;
+  uint32_t misses = 0;
+  for (uint32_t index : indices) {
+    if (clock - insertedAt[index] > cacheSize) {
+      insertedAt[index] = clock++;
+      misses++;
+    }
+    used[index] = true;
+  }
+  const size_t usedCount = std::count(used.begin(), used.end(), true);
+  stats.acmr = float(misses) / float(indices.size() / 3);
+  stats.atvr = float(misses) / float(usedCount);
+  return stats;
+}
+
+void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount) {
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount == 0) {
+    return;
+  }
+
+  // Triangles using each vertex, packed. The first liveTriangles[v] entries of a vertex's
+  // range are the ones not emitted yet.
+  std::vector<uint32_t> liveTriangles(vertexCount, 0);
+  for (uint32_t index : indices) {
+    liveTriangles[index]++;
+  }
+  std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+  std::partial_sum(liveTriangles.begin(), liveTriangles.end(), adjacencyOffset.begin() + 1);
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+      adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> vertexScore(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; v++) {
+    vertexScore[v] = VertexScore(-1, liveTriangles[v]);
+  }
+  auto triangleScore = [&](size_t t) {
+    return vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+  };
+
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  std::vector<uint32_t> cache, nextCache;
+  cache.reserve(kScoreCacheSize + 3);
+  nextCache.reserve(kScoreCacheSize + 3);
+
+  size_t scanCursor = 0;
+  int64_t best = 0;
+  float bestScore = triangleScore(0);
+  for (size_t t = 1; t < triangleCount; t++) {
+    const float score = triangleScore(t);
+    if (score > bestScore) {
+      bestScore = score;
+      best = t;
+    }
+  }
+
+  for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+    if (best < 0) {
+      // Nothing in the cache touches a live triangle: start again from the first one left.
+      while (emitted[scanCursor]) scanCursor++;
+      best = scanCursor;
+    }
+    const uint32_t* tri = &indices[best * 3];
+    result.insert(result.end(), tri, tri + 3);
+    emitted[best] = true;
+
+    // Retire the triangle from its vertices' live lists.
+    for (int c = 0; c < 3; c++) {
+      const uint32_t v = tri[c];
+      uint32_t* begin = &adjacency[adjacencyOffset[v]];
+      uint32_t* end = begin + liveTriangles[v];
+      uint32_t* it = std::find(begin, end, uint32_t(best));
+      if (it != end) {
+        std::swap(*it, *(end - 1));
+        liveTriangles[v]--;
+      }
+    }
+
+    // The triangle's vertices move to the front of the LRU cache.
+    nextCache.assign(tri, tri + 3);
+    for (uint32_t v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) nextCache.push_back(v);
+    }
+    for (size_t i = kScoreCacheSize; i < nextCache.size(); i++) {
+      cachePosition[nextCache[i]] = -1;
+      vertexScore[nextCache[i]] = VertexScore(-1, liveTriangles[nextCache[i]]);
+    }
+    nextCache.resize(std::min<size_t>(nextCache.size(), kScoreCacheSize));
+    std::swap(cache, nextCache);
+    for (size_t i = 0; i < cache.size(); i++) {
+      cachePosition[cache[i]] = static_cast<int>(i);
+      vertexScore[cache[i]] = VertexScore(static_cast<int>(i), liveTriangles[cache[i]]);
+    }
+
+    // The next triangle is the best one touching the cache.
+    best = -1;
+    bestScore = -INFINITY;
+    for (uint32_t v : cache) {
+      for (uint32_t i = 0; i < liveTriangles[v]; i++) {
+        const uint32_t t = adjacency[adjacencyOffset[v] + i];
+        const float score = triangleScore(t);
+        if (score > bestScore) {
+          bestScore = score;
+          best = t;
+        }
+      }
+    }
+  }
+  indices.swap(result);
+}
+
+bool OptimizeOverdraw(std::vector<uint32_t>& indices, const uint8_t* positions, uint32_t stride, uint32_t vertexCount,
+                      float threshold) {
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount < 2) {
+    return false;
+  }
+
+  // Cluster boundaries are where the cache starts cold: a triangle with no cached vertex.
+  constexpr uint32_t kCacheSize = 16;
+  std::vector<size_t> clusterStart;
+  {
+    std::vector<uint32_t> insertedAt(vertexCount, 0);
+    uint32_t clock = kCacheSize + 1;
+    for (size_t t = 0; t < triangleCount; t++) {
+      int misses = 0;
+      for (int c = 0; c < 3; c++) {
+        const uint32_t v = indices[t * 3 + c];
+        if (clock - insertedAt[v] > kCacheSize) {
+          insertedAt[v] = clock++;
+          misses++;
+        }
+      }
+      if (t == 0 || misses == 3) clusterStart.push_back(t);
+    }
+  }
+  if (clusterStart.size() < 2) {
+    return false;
+  }
+  clusterStart.push_back(triangleCount);
+
+  // Area weighted centroid and normal per cluster, and for the whole mesh.
+  struct Cluster {
+    size_t begin, end;
+    float centroid[3];
+    float normal[3];
+    float sortKey;
+  };
+  std::vector<Cluster> clusters(clusterStart.size() - 1);
+  float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+  float meshArea = 0.0f;
+  for (size_t c = 0; c < clusters.size(); c++) {
+    Cluster& cluster = clusters[c];
+    cluster = {clusterStart[c], clusterStart[c + 1], {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 0.0f};
+    float area = 0.0f;
+    for (size_t t = cluster.begin; t < cluster.end; t++) {
+      const float* p0 = Position(positions, stride, indices[t * 3]);
+      const float* p1 = Position(positions, stride, indices[t * 3 + 1]);
+      const float* p2 = Position(positions, stride, indices[t * 3 + 2]);
+      const float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+      const float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+      const float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+      const float a = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (int k = 0; k < 3; k++) {
+        cluster.normal[k] += n[k];
+        cluster.centroid[k] += (p0[k] + p1[k] + p2[k]) * a / 3.0f;
+      }
+      area += a;
+    }
+    for (int k = 0; k < 3; k++) {
+      meshCentroid[k] += cluster.centroid[k];
+      cluster.centroid[k] = area > 0.0f ? cluster.centroid[k] / area : 0.0f;
+    }
+    meshArea += area;
+  }
+  if (meshArea <= 0.0f) {
+    return false;
+  }
+  for (int k = 0; k < 3; k++) {
+    meshCentroid[k] /= meshArea;
+  }
+
+  // Clusters facing away from the center are on the outside, and occlude the others.
+  for (auto& cluster : clusters) {
+    const float* n = cluster.normal;
+    const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    float dot = 0.0f;
+    for (int k = 0; k < 3; k++) {
+      dot += (cluster.centroid[k] - meshCentroid[k]) * n[k];
+    }
+    cluster.sortKey = length > 0.0f ? dot / length : 0.0f;
+  }
+  std::stable_sort(clusters.begin(), clusters.end(),
+                   [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+  std::vector<uint32_t> sorted;
+  sorted.reserve(indices.size());
+  for (const auto& cluster : clusters) {
+    sorted.insert(sorted.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+  }
+  // Seams between reordered clusters cost some cache efficiency; don't pay too much.
+  const float before = AnalyzeVertexCache(indices, vertexCount).acmr;
+  const float after = AnalyzeVertexCache(sorted, vertexCount).acmr;
+  if (after > before * threshold) {
+    return false;
+  }
+  indices.swap(sorted);
+  return true;
+}
+
+MeshOptimizeStats OptimizePrimitiveGeometry(PrimitiveGeometry& geom, std::vector<uint32_t>* vertexRemap) {
+  MeshOptimizeStats stats;
+  if (vertexRemap) vertexRemap->clear();
+  if (geom.mode != GL_TRIANGLES || geom.indices.size() < 3 || geom.indices.size() % 3 != 0 || geom.quantized) {
+    return stats;
+  }
+  stats.before = AnalyzeVertexCache(geom.indices, geom.vertexCount);
+
+  OptimizeVertexCache(geom.indices, geom.vertexCount);
+  const VertexAttribute* position = geom.FindAttribute(kLocationPosition);
+  if (position && position->type == GL_FLOAT) {
+    stats.overdrawSorted =
+        OptimizeOverdraw(geom.indices, geom.vertices.data() + position->offset, geom.stride, geom.vertexCount);
+  }
+
+  // Vertex fetch: number vertices in the order the indices first use them.
+  constexpr uint32_t kUnused = kRemovedVertex;
+  std::vector<uint32_t> remap(geom.vertexCount, kUnused);
+  uint32_t next = 0;
+  for (uint32_t& index : geom.indices) {
+    if (remap[index] == kUnused) {
+      remap[index] = next++;
+    }
+    index = remap[index];
+  }
+  std::vector<uint8_t> vertices(size_t(next) * geom.stride);
+  for (uint32_t v = 0; v < geom.vertexCount; v++) {
+    if (remap[v] != kUnused) {
+      memcpy(&vertices[size_t(remap[v]) * geom.stride], &geom.vertices[size_t(v) * geom.stride], geom.stride);
+    }
+  }
+  stats.unusedVertices = geom.vertexCount - next;
+  geom.vertices.swap(vertices);
+  geom.vertexCount = next;
+  if (vertexRemap) vertexRemap->swap(remap);
+
+  if (geom.indexType == GL_UNSIGNED_INT && geom.vertexCount <= 65536) {
+    geom.indexType = GL_UNSIGNED_SHORT;
+    stats.narrowed = true;
+  }
+  stats.after = AnalyzeVertexCache(geom.indices, geom.vertexCount);
+  return stats;
+}
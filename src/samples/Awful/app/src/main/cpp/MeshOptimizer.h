@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "GltfGeometry.h"
+
+// Load-time reordering of indexed triangle lists, applied to a PrimitiveGeometry after it's
+// built and before it's quantized and uploaded. Nothing here touches GL, so it can run (and
+// be checked) off device against any model tinygltf loads.
+
+struct VertexCacheStats {
+  float acmr = 0.0f;  // average cache miss ratio: vertex shader invocations per triangle, 0.5 - 3
+  float atvr = 0.0f;  // average transformed vertex ratio: invocations per vertex, 1 is ideal
+};
+
+// Simulates a FIFO post-transform cache of the given size.
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize = 16);
+
+// Reorders triangles for the post-transform vertex cache, with Forsyth's linear-speed
+// algorithm.
+void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount);
+
+// Splits a cache-optimized triangle list into clusters at cache restarts and sorts the
+// clusters outside-in, so front faces tend to draw first and occlude the rest. Keeps the
+// original order if that would cost more than threshold times the ACMR. positions are xyz
+// floats, stride bytes apart. Returns whether the order was changed.
+bool OptimizeOverdraw(std::vector<uint32_t>& indices, const uint8_t* positions, uint32_t stride, uint32_t vertexCount,
+                      float threshold = 1.05f);
+
+struct MeshOptimizeStats {
+  VertexCacheStats before;
+  VertexCacheStats after;
+  bool overdrawSorted = false;
+  uint32_t unusedVertices = 0;  // dropped by fetch reordering
+  bool narrowed = false;        // 32-bit indices now fit in 16
+};
+
+// All of the above, then reorders the vertex stream in first use order (dropping vertices
+// nothing references) so vertex fetch walks memory forwards, and narrows the index type when
+// the vertex count allows. Only indexed, unquantized triangle lists are changed. vertexRemap,
+// if given, gets each old vertex's new index (kRemovedVertex if dropped), or is left empty
+// when the vertices weren't moved.
+constexpr uint32_t kRemovedVertex = ~0u;
+MeshOptimizeStats OptimizePrimitiveGeometry(PrimitiveGeometry& geom, std::vector<uint32_t>* vertexRemap = nullptr);
@@ -0,0 +1,368 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <unordered_map>
+
+#include "GltfAccess.h"
+
+namespace {
+// Symmetric 4x4 matrix, upper triangle: a00 a01 a02 a03 a11 a12 a13 a22 a23 a33.
+struct Quadric {
+  double a[10] = {};
+
+  static Quadric FromPlane(double nx, double ny, double nz, double d) {
+    Quadric q;
+    q.a[0] = nx * nx, q.a[1] = nx * ny, q.a[2] = nx * nz, q.a[3] = nx * d;
+    q.a[4] = ny * ny, q.a[5] = ny * nz, q.a[6] = ny * d;
+    q.a[7] = nz * nz, q.a[8] = nz * d;
+    q.a[9] = d * d;
+    return q;
+  }
+
+  Quadric& operator+=(const Quadric& o) {
+    for (int i = 0; i < 10; i++) a[i] += o.a[i];
+    return *this;
+  }
+
+  // Sum of squared distances from p to the accumulated planes.
+  double Evaluate(const float* p) const {
+    const double x = p[0], y = p[1], z = p[2];
+    return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x + a[4] * y * y + 2 * a[5] * y * z +
+           2 * a[6] * y + a[7] * z * z + 2 * a[8] * z + a[9];
+  }
+};
+
+struct Collapse {
+  double cost;
+  uint32_t from, to;
+  uint32_t fromVersion, toVersion;
+  bool operator>(const Collapse& o) const {
+    return cost > o.cost;
+  }
+};
+
+void Cross(const float* a, const float* b, const float* c, double* n) {
+  const double e1[3] = {double(b[0]) - a[0], double(b[1]) - a[1], double(b[2]) - a[2]};
+  const double e2[3] = {double(c[0]) - a[0], double(c[1]) - a[1], double(c[2]) - a[2]};
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+}  // namespace
+
+std::vector<uint32_t> SimplifyMesh(const std::vector<uint32_t>& indices, const uint8_t* positions, uint32_t stride,
+                                   uint32_t vertexCount, size_t targetIndexCount, float maxError, float* resultError) {
+  if (resultError) *resultError = 0.0f;
+  const size_t triangleCount = indices.size() / 3;
+  auto position = [&](uint32_t v) { return reinterpret_cast<const float*>(positions + size_t(v) * stride); };
+
+  // Weld by position, so seams can be found and quadrics shared across them.
+  std::vector<uint32_t> positionId(vertexCount);
+  std::vector<uint32_t> wedges;  // vertices per position id
+  {
+    std::map<std::array<float, 3>, uint32_t> ids;
+    for (uint32_t v = 0; v < vertexCount; v++) {
+      const float* p = position(v);
+      auto [it, inserted] = ids.emplace(std::array<float, 3>{p[0], p[1], p[2]}, uint32_t(wedges.size()));
+      if (inserted) wedges.push_back(0);
+      positionId[v] = it->second;
+      wedges[it->second]++;
+    }
+  }
+  const size_t positionCount = wedges.size();
+
+  // Locked: seam vertices and both ends of every edge used by only one triangle.
+  std::vector<bool> locked(vertexCount, false);
+  for (uint32_t v = 0; v < vertexCount; v++) {
+    locked[v] = wedges[positionId[v]] > 1;
+  }
+  {
+    std::unordered_map<uint64_t, int> edgeUse;
+    for (size_t t = 0; t < triangleCount; t++) {
+      for (int e = 0; e < 3; e++) {
+        uint32_t a = positionId[indices[t * 3 + e]], b = positionId[indices[t * 3 + (e + 1) % 3]];
+        if (a > b) std::swap(a, b);
+        edgeUse[(uint64_t(a) << 32) | b]++;
+      }
+    }
+    for (size_t t = 0; t < triangleCount; t++) {
+      for (int e = 0; e < 3; e++) {
+        const uint32_t va = indices[t * 3 + e], vb = indices[t * 3 + (e + 1) % 3];
+        uint32_t a = positionId[va], b = positionId[vb];
+        if (a > b) std::swap(a, b);
+        if (edgeUse[(uint64_t(a) << 32) | b] == 1) locked[va] = locked[vb] = true;
+      }
+    }
+  }
+
+  // Plane quadrics, and the radius the error is relative to.
+  std::vector<Quadric> quadrics(positionCount);
+  float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+  for (uint32_t v = 0; v < vertexCount; v++) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], position(v)[c]);
+      hi[c] = std::max(hi[c], position(v)[c]);
+    }
+  }
+  const double radius =
+      0.5 * std::sqrt(double(hi[0] - lo[0]) * (hi[0] - lo[0]) + double(hi[1] - lo[1]) * (hi[1] - lo[1]) +
+                      double(hi[2] - lo[2]) * (hi[2] - lo[2]));
+  const double maxCost = (maxError * radius) * (maxError * radius);
+
+  std::vector<uint32_t> tris(indices.begin(), indices.begin() + triangleCount * 3);
+  std::vector<bool> dead(triangleCount, false);
+  std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+  for (size_t t = 0; t < triangleCount; t++) {
+    const float* p0 = position(tris[t * 3]);
+    double n[3];
+    Cross(p0, position(tris[t * 3 + 1]), position(tris[t * 3 + 2]), n);
+    const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0.0) {
+      n[0] /= length, n[1] /= length, n[2] /= length;
+      const Quadric q = Quadric::FromPlane(n[0], n[1], n[2], -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]));
+      for (int c = 0; c < 3; c++) quadrics[positionId[tris[t * 3 + c]]] += q;
+    }
+    for (int c = 0; c < 3; c++) vertexTriangles[tris[t * 3 + c]].push_back(static_cast<uint32_t>(t));
+  }
+
+  std::vector<uint32_t> version(vertexCount, 0);
+  std::vector<bool> removed(vertexCount, false);
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+  auto push = [&](uint32_t from, uint32_t to) {
+    if (locked[from] || from == to) return;
+    Quadric q = quadrics[positionId[from]];
+    q += quadrics[positionId[to]];
+    heap.push({std::max(0.0, q.Evaluate(position(to))), from, to, version[from], version[to]});
+  };
+  for (size_t t = 0; t < triangleCount; t++) {
+    for (int e = 0; e < 3; e++) {
+      push(tris[t * 3 + e], tris[t * 3 + (e + 1) % 3]);
+      push(tris[t * 3 + (e + 1) % 3], tris[t * 3 + e]);
+    }
+  }
+
+  size_t liveTriangles = triangleCount;
+  double worstCost = 0.0;
+  while (liveTriangles * 3 > targetIndexCount && !heap.empty()) {
+    const Collapse c = heap.top();
+    heap.pop();
+    if (removed[c.from] || removed[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion) {
+      continue;  // stale
+    }
+    if (c.cost > maxCost) {
+      break;
+    }
+
+    // Moving 'from' onto 'to' mustn't flip any triangle that survives the collapse.
+    bool flips = false;
+    for (uint32_t t : vertexTriangles[c.from]) {
+      const uint32_t* tri = &tris[t * 3];
+      if (dead[t] || tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) continue;
+      const float* p[3] = {position(tri[0]), position(tri[1]), position(tri[2])};
+      double before[3], after[3];
+      Cross(p[0], p[1], p[2], before);
+      for (int k = 0; k < 3; k++) {
+        if (tri[k] == c.from) p[k] = position(c.to);
+      }
+      Cross(p[0], p[1], p[2], after);
+      const double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+      const double lengths = std::sqrt((before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+                                       (after[0] * after[0] + after[1] * after[1] + after[2] * after[2]));
+      if (dot <= 0.2 * lengths) {
+        flips = true;
+        break;
+      }
+    }
+    if (flips) {
+      continue;
+    }
+
+    removed[c.from] = true;
+    quadrics[positionId[c.to]] += quadrics[positionId[c.from]];
+    for (uint32_t t : vertexTriangles[c.from]) {
+      if (dead[t]) continue;
+      uint32_t* tri = &tris[t * 3];
+      for (int k = 0; k < 3; k++) {
+        if (tri[k] == c.from) tri[k] = c.to;
+      }
+      if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+        dead[t] = true;
+        liveTriangles--;
+      } else {
+        vertexTriangles[c.to].push_back(t);
+      }
+    }
+    vertexTriangles[c.from].clear();
+    worstCost = std::max(worstCost, c.cost);
+
+    // Costs around 'to' changed: bump its version and queue its edges again.
+    version[c.to]++;
+    auto& around = vertexTriangles[c.to];
+    around.erase(std::remove_if(around.begin(), around.end(), [&](uint32_t t) { return dead[t]; }), around.end());
+    for (uint32_t t : around) {
+      for (int k = 0; k < 3; k++) {
+        const uint32_t u = tris[t * 3 + k];
+        if (u == c.to) continue;
+        push(u, c.to);
+        push(c.to, u);
+      }
+    }
+  }
+
+  std::vector<uint32_t> result;
+  result.reserve(liveTriangles * 3);
+  for (size_t t = 0; t < triangleCount; t++) {
+    if (!dead[t]) result.insert(result.end(), &tris[t * 3], &tris[t * 3] + 3);
+  }
+  if (resultError && radius > 0.0) {
+    *resultError = static_cast<float>(std::sqrt(worstCost) / radius);
+  }
+  return result;
+}
+
+namespace {
+// Appends index data as a new buffer view and accessor, returning the accessor index.
+int AddIndexAccessor(tinygltf::Model& model, int buffer, const std::vector<uint32_t>& indices, uint32_t vertexCount) {
+  auto& data = model.buffers[buffer].data;
+  const bool narrow = vertexCount <= 65536;
+  while (data.size() % 4) data.push_back(0);
+
+  tinygltf::BufferView view;
+  view.buffer = buffer;
+  view.byteOffset = data.size();
+  view.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+  for (uint32_t index : indices) {
+    if (narrow) {
+      const uint16_t i16 = static_cast<uint16_t>(index);
+      data.insert(data.end(), reinterpret_cast<const uint8_t*>(&i16), reinterpret_cast<const uint8_t*>(&i16) + 2);
+    } else {
+      data.insert(data.end(), reinterpret_cast<const uint8_t*>(&index), reinterpret_cast<const uint8_t*>(&index) + 4);
+    }
+  }
+  view.byteLength = data.size() - view.byteOffset;
+  model.bufferViews.push_back(view);
+
+  tinygltf::Accessor accessor;
+  accessor.bufferView = static_cast<int>(model.bufferViews.size()) - 1;
+  accessor.componentType = narrow ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT : TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+  accessor.type = TINYGLTF_TYPE_SCALAR;
+  accessor.count = indices.size();
+  model.accessors.push_back(accessor);
+  return static_cast<int>(model.accessors.size()) - 1;
+}
+
+// A level has to drop at least this much of the previous one to be worth a draw of its own.
+constexpr float kMinReduction = 0.9f;
+}  // namespace
+
+int GenerateLods(tinygltf::Model& model, const LodOptions& options) {
+  model.buffers.emplace_back();
+  model.buffers.back().name = "lod indices";
+  const int buffer = static_cast<int>(model.buffers.size()) - 1;
+
+  // Chains are built per mesh, then shared by every node that uses the mesh.
+  std::vector<std::vector<int>> meshLods(model.meshes.size());
+  const size_t originalMeshes = model.meshes.size();
+  for (size_t m = 0; m < originalMeshes; m++) {
+    // Full detail positions and indices of each triangle primitive.
+    struct Source {
+      std::vector<float> positions;
+      std::vector<uint32_t> indices;
+      std::vector<uint32_t> previous;
+    };
+    std::vector<Source> sources(model.meshes[m].primitives.size());
+    size_t fullIndices = 0;
+    for (size_t p = 0; p < sources.size(); p++) {
+      const auto& prim = model.meshes[m].primitives[p];
+      auto pos = prim.attributes.find("POSITION");
+      if ((prim.mode != -1 && prim.mode != TINYGLTF_MODE_TRIANGLES) || pos == prim.attributes.end() ||
+          ReadAccessorFloats(model, pos->second, sources[p].positions) != 3) {
+        continue;
+      }
+      if (prim.indices >= 0) {
+        if (!ReadAccessorIndices(model, prim.indices, sources[p].indices)) continue;
+      } else {
+        sources[p].indices.resize(sources[p].positions.size() / 3);
+        for (uint32_t i = 0; i < sources[p].indices.size(); i++) sources[p].indices[i] = i;
+      }
+      sources[p].previous = sources[p].indices;
+      fullIndices += sources[p].indices.size();
+    }
+    if (fullIndices == 0) {
+      continue;
+    }
+
+    size_t previousIndices = fullIndices;
+    for (float ratio : options.ratios) {
+      tinygltf::Mesh lodMesh = model.meshes[m];
+      lodMesh.name += "_LOD" + std::to_string(meshLods[m].size() + 1);
+      size_t lodIndices = 0;
+      for (size_t p = 0; p < sources.size(); p++) {
+        Source& src = sources[p];
+        if (src.indices.empty()) continue;
+        const uint32_t vertexCount = static_cast<uint32_t>(src.positions.size() / 3);
+        const size_t target = size_t(src.indices.size() * ratio) / 3 * 3;
+        // Each level starts from the last, which is cheaper and keeps the chain nested.
+        src.previous = SimplifyMesh(src.previous, reinterpret_cast<const uint8_t*>(src.positions.data()), 12, vertexCount,
+                                    target, options.maxError);
+        lodIndices += src.previous.size();
+        lodMesh.primitives[p].indices = AddIndexAccessor(model, buffer, src.previous, vertexCount);
+        lodMesh.primitives[p].mode = TINYGLTF_MODE_TRIANGLES;
+      }
+      if (lodIndices == 0 || lodIndices > previousIndices * kMinReduction) {
+        break;
+      }
+      previousIndices = lodIndices;
+      model.meshes.push_back(std::move(lodMesh));
+      meshLods[m].push_back(static_cast<int>(model.meshes.size()) - 1);
+    }
+  }
+
+  int added = 0;
+  const size_t originalNodes = model.nodes.size();
+  for (size_t n = 0; n < originalNodes; n++) {
+    const int mesh = model.nodes[n].mesh;
+    if (mesh < 0 || size_t(mesh) >= originalMeshes || meshLods[mesh].empty() || !model.nodes[n].lods.empty()) {
+      continue;
+    }
+    std::vector<int> lodNodes;
+    for (size_t level = 0; level < meshLods[mesh].size(); level++) {
+      tinygltf::Node lodNode;
+      lodNode.name = model.nodes[n].name + "_LOD" + std::to_string(level + 1);
+      lodNode.mesh = meshLods[mesh][level];
+      model.nodes.push_back(std::move(lodNode));
+      lodNodes.push_back(static_cast<int>(model.nodes.size()) - 1);
+      added++;
+    }
+    tinygltf::Node& node = model.nodes[n];
+    node.lods = lodNodes;
+
+    // One coverage per level, the full mesh included, ending with the last configured value.
+    tinygltf::Value::Array coverage;
+    const size_t last = options.coverage.empty() ? 0 : options.coverage.size() - 1;
+    for (size_t level = 0; level <= lodNodes.size(); level++) {
+      const size_t i = level == lodNodes.size() ? last : std::min(level, last);
+      coverage.emplace_back(options.coverage.empty() ? 0.0 : double(options.coverage[i]));
+    }
+    tinygltf::Value::Object extras;
+    if (node.extras.IsObject()) extras = node.extras.Get<tinygltf::Value::Object>();
+    extras["MSFT_screencoverage"] = tinygltf::Value(std::move(coverage));
+    node.extras = tinygltf::Value(std::move(extras));
+  }
+  if (model.buffers[buffer].data.empty()) {
+    model.buffers.pop_back();
+  }
+  return added;
+}
+
+bool WriteGltfWithLods(tinygltf::Model& model, const std::string& filename) {
+  const bool binary = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".glb") == 0;
+  tinygltf::TinyGLTF writer;
+  return writer.WriteGltfSceneToFile(&model, filename, binary /* embedImages */, true /* embedBuffers */,
+                                     true /* prettyPrint */, binary);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tiny_gltf.h"
+
+// Quadric error metric simplification (Garland and Heckbert) and the LOD chain generator
+// built on it. CPU only, for preprocessing assets on or off device.
+
+// Collapses edges of an indexed triangle list, cheapest first, until at most
+// targetIndexCount indices remain or the next collapse would move the surface more than
+// maxError (relative to the mesh's radius). Vertices only ever collapse onto neighbours, so
+// the result indexes the same vertex buffer. Vertices on open borders and attribute seams
+// (several vertices at one position) are kept in place, which preserves silhouettes and
+// texture layout at the cost of some reduction. positions are xyz floats, stride bytes
+// apart. Returns the new indices; resultError, if given, receives the largest relative
+// error of the collapses made.
+std::vector<uint32_t> SimplifyMesh(const std::vector<uint32_t>& indices, const uint8_t* positions, uint32_t stride,
+                                   uint32_t vertexCount, size_t targetIndexCount, float maxError,
+                                   float* resultError = nullptr);
+
+struct LodOptions {
+  // Triangle count of each generated level relative to the full mesh.
+  std::vector<float> ratios = {0.5f, 0.25f, 0.125f};
+  float maxError = 0.05f;
+  // Written as MSFT_screencoverage, one per level including the full mesh. The last is
+  // where the node stops being drawn at all.
+  std::vector<float> coverage = {0.25f, 0.0625f, 0.015625f, 0.0f};
+};
+
+// Adds an MSFT_lod chain to every node that has a triangle mesh and no chain yet. Each level
+// is a new mesh whose primitives share the original vertex accessors and only add an index
+// accessor, and a new node that references it; levels that don't reduce the mesh enough to
+// be worth it end the chain early. Returns the number of LOD nodes added.
+int GenerateLods(tinygltf::Model& model, const LodOptions& options = LodOptions());
+
+// Writes the model with TinyGLTF::WriteGltfSceneToFile, as .glb if the name says so. The
+// sample calls it when built with AWFUL_BAKE_LODS.
+bool WriteGltfWithLods(tinygltf::Model& model, const std::string& filename);
@@ -0,0 +1,170 @@
+#include "MipGenerator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "ThreadPool.h"
+
+namespace {
+// GCC/Clang vector extension: NEON on the device, SSE on a desktop build.
+typedef float Float4 __attribute__((vector_size(16)));
+typedef int32_t Int4 __attribute__((vector_size(16)));
+
+constexpr size_t kRowsPerTask = 32;
+
+float SrgbToLinear(float v) {
+  return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+float LinearToSrgb(float v) {
+  return v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+}
+
+// sRGB decode for every 8 and 16 bit value, built on first use.
+const float* SrgbDecodeTable(int bits) {
+  static const std::vector<float> table8 = [] {
+    std::vector<float> t(256);
+    for (int i = 0; i < 256; i++) t[i] = SrgbToLinear(i / 255.0f);
+    return t;
+  }();
+  if (bits == 8) return table8.data();
+  static const std::vector<float> table16 = [] {
+    std::vector<float> t(65536);
+    for (int i = 0; i < 65536; i++) t[i] = SrgbToLinear(i / 65535.0f);
+    return t;
+  }();
+  return table16.data();
+}
+
+// sRGB encode to 8 bits, indexed by linear value. The table is fine enough that every
+// 8 bit value survives a decode and encode unchanged.
+constexpr int kEncodeTableSize = 16384;
+const uint8_t* SrgbEncodeTable() {
+  static const std::array<uint8_t, kEncodeTableSize> table = [] {
+    std::array<uint8_t, kEncodeTableSize> t;
+    for (int i = 0; i < kEncodeTableSize; i++) {
+      t[i] = static_cast<uint8_t>(std::lround(LinearToSrgb(i / float(kEncodeTableSize - 1)) * 255.0f));
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+Float4 Splat(float v) {
+  return Float4{v, v, v, v};
+}
+
+Int4 ToInt(Float4 v) {
+  return __builtin_convertvector(v, Int4);
+}
+
+struct FloatLevel {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<Float4> pixels;
+};
+
+FloatLevel Decode(const uint8_t* pixels, uint32_t width, uint32_t height, int components, int bits, TextureUsage usage,
+                  ThreadPool* pool) {
+  FloatLevel level{width, height, std::vector<Float4>(size_t(width) * height)};
+  const float* srgb = usage == TextureUsage::Color ? SrgbDecodeTable(bits) : nullptr;
+  const float scale = bits == 8 ? 1.0f / 255.0f : 1.0f / 65535.0f;
+  ParallelForRanges(pool, height, kRowsPerTask, [&](size_t y0, size_t y1) {
+    for (size_t i = y0 * width; i < y1 * width; i++) {
+      uint32_t raw[4] = {0, 0, 0, 0};
+      for (int c = 0; c < components; c++) {
+        if (bits == 8) {
+          raw[c] = pixels[i * components + c];
+        } else {
+          uint16_t value;
+          memcpy(&value, pixels + (i * components + c) * 2, 2);
+          raw[c] = value;
+        }
+      }
+      Float4 v;
+      if (components <= 2) {  // luminance, and maybe alpha
+        const float l = srgb ? srgb[raw[0]] : raw[0] * scale;
+        v = Float4{l, l, l, components == 2 ? raw[1] * scale : 1.0f};
+      } else {
+        for (int c = 0; c < 3; c++) v[c] = srgb ? srgb[raw[c]] : raw[c] * scale;
+        v[3] = components == 4 ? raw[3] * scale : 1.0f;
+      }
+      level.pixels[i] = v;
+    }
+  });
+  return level;
+}
+
+FloatLevel Downsample(const FloatLevel& src, TextureUsage usage, ThreadPool* pool) {
+  FloatLevel dst;
+  dst.width = std::max(src.width / 2, 1u);
+  dst.height = std::max(src.height / 2, 1u);
+  dst.pixels.resize(size_t(dst.width) * dst.height);
+  ParallelForRanges(pool, dst.height, kRowsPerTask, [&](size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+      const Float4* row0 = &src.pixels[std::min<size_t>(y * 2, src.height - 1) * src.width];
+      const Float4* row1 = &src.pixels[std::min<size_t>(y * 2 + 1, src.height - 1) * src.width];
+      Float4* out = &dst.pixels[y * dst.width];
+      for (uint32_t x = 0; x < dst.width; x++) {
+        const uint32_t x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+        Float4 v = (row0[x0] + row0[x1] + row1[x0] + row1[x1]) * Splat(0.25f);
+        if (usage == TextureUsage::Normal) {
+          Float4 n = v * Splat(2.0f) - Splat(1.0f);
+          const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+          if (length > 0.0f) {
+            n = n * Splat(0.5f / length) + Splat(0.5f);
+            n[3] = v[3];
+            v = n;
+          }
+        }
+        out[x] = v;
+      }
+    }
+  });
+  return dst;
+}
+
+TextureLevel Encode(const FloatLevel& src, TextureUsage usage, ThreadPool* pool) {
+  TextureLevel level;
+  level.width = src.width;
+  level.height = src.height;
+  level.data.resize(size_t(src.width) * src.height * 4);
+  const uint8_t* srgb = usage == TextureUsage::Color ? SrgbEncodeTable() : nullptr;
+  ParallelForRanges(pool, src.height, kRowsPerTask, [&](size_t y0, size_t y1) {
+    for (size_t i = y0 * src.width; i < y1 * src.width; i++) {
+      Float4 v = src.pixels[i];
+      for (int c = 0; c < 4; c++) v[c] = std::clamp(v[c], 0.0f, 1.0f);
+      uint8_t* out = &level.data[i * 4];
+      if (srgb) {
+        const Int4 index = ToInt(v * Splat(kEncodeTableSize - 1) + Splat(0.5f));
+        const Int4 alpha = ToInt(v * Splat(255.0f) + Splat(0.5f));
+        out[0] = srgb[index[0]];
+        out[1] = srgb[index[1]];
+        out[2] = srgb[index[2]];
+        out[3] = static_cast<uint8_t>(alpha[3]);
+      } else {
+        const Int4 q = ToInt(v * Splat(255.0f) + Splat(0.5f));
+        for (int c = 0; c < 4; c++) out[c] = static_cast<uint8_t>(q[c]);
+      }
+    }
+  });
+  return level;
+}
+}  // namespace
+
+std::vector<TextureLevel> GenerateMipChain(const uint8_t* pixels, uint32_t width, uint32_t height, int components, int bits,
+                                           TextureUsage usage, ThreadPool* pool) {
+  std::vector<TextureLevel> levels;
+  if (!pixels || width == 0 || height == 0 || components < 1 || components > 4 || (bits != 8 && bits != 16)) {
+    return levels;
+  }
+  FloatLevel level = Decode(pixels, width, height, components, bits, usage, pool);
+  levels.push_back(Encode(level, usage, pool));
+  while (level.width > 1 || level.height > 1) {
+    level = Downsample(level, usage, pool);
+    levels.push_back(Encode(level, usage, pool));
+  }
+  return levels;
+}
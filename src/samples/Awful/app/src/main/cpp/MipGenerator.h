@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "TextureCodec.h"
+
+class ThreadPool;
+
+// Builds a full mip chain on the CPU, down to 1x1, from decoded pixels with 1 to 4 channels
+// of 8 or 16 bits (native endian, as tinygltf stores them). Levels come out as RGBA8.
+//
+// Each level is filtered from the previous one in float, a pixel per SIMD vector. Color
+// textures are decoded from sRGB first so levels average light rather than encoded values
+// (alpha stays linear), which keeps them from darkening the way glGenerateMipmap does on
+// most drivers. Normal maps are renormalized at every level. Rows are spread over pool when
+// there is one. Returns an empty chain for a layout it can't read.
+std::vector<TextureLevel> GenerateMipChain(const uint8_t* pixels, uint32_t width, uint32_t height, int components, int bits,
+                                           TextureUsage usage, ThreadPool* pool = nullptr);
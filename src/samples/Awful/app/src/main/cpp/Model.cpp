@@ -0,0 +1,69 @@
+#include "Model.h"
+
+#include <cstddef>
+#include <utility>
+
+#include "GpuResources.h"
+
+Model::Model(std::span<const Vertex> vertices, std::span<const Index> indices, std::shared_ptr<TextureAsset> spTexture)
+    : indexCount_(static_cast<GLsizei>(indices.size())), spTexture_(std::move(spTexture)) {
+  auto& gpu = GpuResourceTracker::Get();
+  vertexBuffer_ = gpu.CreateBuffer({"Model", "", "vertices"});
+  indexBuffer_ = gpu.CreateBuffer({"Model", "", "indices"});
+
+  glGenVertexArrays(1, &vertexArray_);
+  glBindVertexArray(vertexArray_);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer_);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size_bytes(), vertices.data(), GL_STATIC_DRAW);
+  // The index buffer binding is part of the vertex array object.
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size_bytes(), indices.data(), GL_STATIC_DRAW);
+
+  // The position attribute is 3 floats, followed by the uv's 2
+  glVertexAttribPointer(kPositionLocation, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<const GLvoid*>(offsetof(Vertex, position)));
+  glEnableVertexAttribArray(kPositionLocation);
+  glVertexAttribPointer(kUVLocation, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<const GLvoid*>(offsetof(Vertex, uv)));
+  glEnableVertexAttribArray(kUVLocation);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  gpu.SetBufferSize(vertexBuffer_, vertices.size_bytes());
+  gpu.SetBufferSize(indexBuffer_, indices.size_bytes());
+  gpu.CountUpload(vertices.size_bytes() + indices.size_bytes());
+}
+
+Model::~Model() {
+  release();
+}
+
+Model::Model(Model&& other) noexcept
+    : vertexBuffer_(std::exchange(other.vertexBuffer_, 0)),
+      indexBuffer_(std::exchange(other.indexBuffer_, 0)),
+      vertexArray_(std::exchange(other.vertexArray_, 0)),
+      indexCount_(std::exchange(other.indexCount_, 0)),
+      spTexture_(std::move(other.spTexture_)) {}
+
+Model& Model::operator=(Model&& other) noexcept {
+  if (this != &other) {
+    release();
+    vertexBuffer_ = std::exchange(other.vertexBuffer_, 0);
+    indexBuffer_ = std::exchange(other.indexBuffer_, 0);
+    vertexArray_ = std::exchange(other.vertexArray_, 0);
+    indexCount_ = std::exchange(other.indexCount_, 0);
+    spTexture_ = std::move(other.spTexture_);
+  }
+  return *this;
+}
+
+void Model::release() {
+  if (vertexArray_) {
+    glDeleteVertexArrays(1, &vertexArray_);
+    vertexArray_ = 0;
+  }
+  auto& gpu = GpuResourceTracker::Get();
+  gpu.DeleteBuffer(vertexBuffer_);
+  gpu.DeleteBuffer(indexBuffer_);
+}
@@ -1,7 +1,10 @@
 #ifndef ANDROIDGLINVESTIGATIONS_MODEL_H
 #define ANDROIDGLINVESTIGATIONS_MODEL_H
 
-#include <vector>
+#include <GLES3/gl3.h>
+
+#include <memory>
+#include <span>
 
 #include "TextureAsset.h"
 #include "linear.h"
@@ -15,21 +18,41 @@ struct Vertex {
 
 typedef uint16_t Index;
 
+/*!
+ * A static indexed mesh with one texture. The vertices and indices go into buffers of the
+ * model's own when it's made, along with a vertex array object that feeds them to the
+ * attribute locations below, so drawing it copies nothing.
+ */
 class Model {
  public:
-  inline Model(std::vector<Vertex> vertices, std::vector<Index> indices, std::shared_ptr<TextureAsset> spTexture)
-      : vertices_(std::move(vertices)), indices_(std::move(indices)), spTexture_(std::move(spTexture)) {}
+  /*!
+   * The attribute locations the vertex array object feeds, which a shader drawing the model
+   * must use (layout(location = ...) in the sample's vertex shader).
+   */
+  static constexpr GLuint kPositionLocation = 0;
+  static constexpr GLuint kUVLocation = 1;
 
-  inline const Vertex* getVertexData() const {
-    return vertices_.data();
-  }
+  /*!
+   * Uploads the mesh straight from the caller's memory, which isn't needed afterwards. Needs
+   * a current GL context, as does destroying the model.
+   */
+  Model(std::span<const Vertex> vertices, std::span<const Index> indices, std::shared_ptr<TextureAsset> spTexture);
+  ~Model();
 
-  inline const size_t getIndexCount() const {
-    return indices_.size();
+  Model(Model&& other) noexcept;
+  Model& operator=(Model&& other) noexcept;
+  Model(const Model&) = delete;
+  Model& operator=(const Model&) = delete;
+
+  /*!
+   * @return the vertex array object, which also binds the index buffer
+   */
+  inline GLuint getVertexArray() const {
+    return vertexArray_;
   }
 
-  inline const Index* getIndexData() const {
-    return indices_.data();
+  inline GLsizei getIndexCount() const {
+    return indexCount_;
   }
 
   inline const TextureAsset& getTexture() const {
@@ -37,9 +60,13 @@ class Model {
   }
 
  private:
-  std::vector<Vertex> vertices_;
-  std::vector<Index> indices_;
+  void release();
+
+  GLuint vertexBuffer_ = 0;
+  GLuint indexBuffer_ = 0;
+  GLuint vertexArray_ = 0;
+  GLsizei indexCount_ = 0;
   std::shared_ptr<TextureAsset> spTexture_;
 };
 
-#endif  // ANDROIDGLINVESTIGATIONS_MODEL_H
\ No newline at end of file
+#endif  // ANDROIDGLINVESTIGATIONS_MODEL_H
@@ -0,0 +1,152 @@
+#include "MorphTargets.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "GltfAccess.h"
+#include "MeshOptimizer.h"
+
+namespace {
+// One attribute of one target, sparse if the accessor allows it.
+bool ReadDeltas(const tinygltf::Model& model, int accessor, uint32_t vertexCount, MorphDeltas& out) {
+  out = MorphDeltas{};
+  if (ReadSparseAccessorFloats(model, accessor, out.indices, out.values) == 3) {
+    out.sparse = true;
+    return model.accessors[accessor].count == vertexCount;
+  }
+  return ReadAccessorFloats(model, accessor, out.values) == 3 && out.values.size() == size_t(vertexCount) * 3;
+}
+
+void RemapDeltas(const std::vector<uint32_t>& remap, uint32_t vertexCount, MorphDeltas& deltas) {
+  if (deltas.values.empty()) {
+    return;
+  }
+  if (!deltas.sparse) {
+    std::vector<float> values(size_t(vertexCount) * 3, 0.0f);
+    for (size_t v = 0; v < remap.size(); v++) {
+      if (remap[v] != kRemovedVertex) memcpy(&values[size_t(remap[v]) * 3], &deltas.values[v * 3], 3 * sizeof(float));
+    }
+    deltas.values.swap(values);
+    return;
+  }
+  std::vector<std::pair<uint32_t, size_t>> order;  // new index, old entry
+  for (size_t i = 0; i < deltas.indices.size(); i++) {
+    const uint32_t v = remap[deltas.indices[i]];
+    if (v != kRemovedVertex) order.emplace_back(v, i);
+  }
+  std::sort(order.begin(), order.end());
+  std::vector<uint32_t> indices(order.size());
+  std::vector<float> values(order.size() * 3);
+  for (size_t i = 0; i < order.size(); i++) {
+    indices[i] = order[i].first;
+    memcpy(&values[i * 3], &deltas.values[order[i].second * 3], 3 * sizeof(float));
+  }
+  deltas.indices.swap(indices);
+  deltas.values.swap(values);
+}
+
+void AddDeltas(const MorphDeltas& deltas, float weight, float* out) {
+  if (deltas.sparse) {
+    for (size_t i = 0; i < deltas.indices.size(); i++) {
+      float* dst = out + size_t(deltas.indices[i]) * 3;
+      for (int c = 0; c < 3; c++) dst[c] += weight * deltas.values[i * 3 + c];
+    }
+  } else {
+    for (size_t i = 0; i < deltas.values.size(); i++) out[i] += weight * deltas.values[i];
+  }
+}
+}  // namespace
+
+bool BuildMorphTargets(const tinygltf::Model& model, const tinygltf::Primitive& prim, uint32_t vertexCount,
+                       MorphTargetSet& out) {
+  out = MorphTargetSet{};
+  out.vertexCount = vertexCount;
+  out.targets.resize(prim.targets.size());
+  for (size_t t = 0; t < prim.targets.size(); t++) {
+    for (const auto& [semantic, accessor] : prim.targets[t]) {
+      MorphDeltas* deltas = semantic == "POSITION" ? &out.targets[t].positions
+                            : semantic == "NORMAL" ? &out.targets[t].normals
+                                                   : nullptr;
+      if (deltas && !ReadDeltas(model, accessor, vertexCount, *deltas)) {
+        __android_log_print(ANDROID_LOG_ERROR, "MorphTargets", "Bad %s accessor %d in target %zu", semantic.c_str(),
+                            accessor, t);
+        out.targets.clear();
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void RemapMorphTargets(const std::vector<uint32_t>& remap, uint32_t vertexCount, MorphTargetSet& targets) {
+  if (remap.empty()) {
+    return;
+  }
+  for (auto& target : targets.targets) {
+    RemapDeltas(remap, vertexCount, target.positions);
+    RemapDeltas(remap, vertexCount, target.normals);
+  }
+  targets.vertexCount = vertexCount;
+}
+
+bool ExtractMorphBase(const PrimitiveGeometry& geom, MorphTargetSet& targets) {
+  const VertexAttribute* position = geom.FindAttribute(kLocationPosition);
+  const VertexAttribute* normal = geom.FindAttribute(kLocationNormal);
+  if (geom.quantized || !position || geom.vertexCount != targets.vertexCount) {
+    return false;
+  }
+  targets.basePositions.resize(size_t(geom.vertexCount) * 3);
+  targets.baseNormals.resize(normal ? size_t(geom.vertexCount) * 3 : 0);
+  for (uint32_t v = 0; v < geom.vertexCount; v++) {
+    const uint8_t* vertex = geom.vertices.data() + size_t(v) * geom.stride;
+    memcpy(&targets.basePositions[size_t(v) * 3], vertex + position->offset, 3 * sizeof(float));
+    if (normal) memcpy(&targets.baseNormals[size_t(v) * 3], vertex + normal->offset, 3 * sizeof(float));
+  }
+  return true;
+}
+
+void BlendMorphTargets(const MorphTargetSet& targets, const float* weights, size_t weightCount, float* outPositions,
+                       float* outNormals) {
+  const bool normals = outNormals && !targets.baseNormals.empty();
+  std::copy(targets.basePositions.begin(), targets.basePositions.end(), outPositions);
+  if (normals) std::copy(targets.baseNormals.begin(), targets.baseNormals.end(), outNormals);
+  bool normalsMoved = false;
+  for (size_t t = 0; t < targets.targets.size() && t < weightCount; t++) {
+    if (weights[t] == 0.0f) continue;
+    AddDeltas(targets.targets[t].positions, weights[t], outPositions);
+    if (normals && !targets.targets[t].normals.values.empty()) {
+      AddDeltas(targets.targets[t].normals, weights[t], outNormals);
+      normalsMoved = true;
+    }
+  }
+  if (!normalsMoved) {
+    return;
+  }
+  for (uint32_t v = 0; v < targets.vertexCount; v++) {
+    float* n = outNormals + size_t(v) * 3;
+    const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0.0f) {
+      for (int c = 0; c < 3; c++) n[c] /= length;
+    }
+  }
+}
+
+std::vector<MorphSegment> PackMorphPositions(const MorphTargetSet& targets, std::vector<float>& texels) {
+  std::vector<MorphSegment> segments(targets.targets.size());
+  for (size_t t = 0; t < targets.targets.size(); t++) {
+    const MorphDeltas& deltas = targets.targets[t].positions;
+    MorphSegment& segment = segments[t];
+    segment.firstTexel = static_cast<uint32_t>(texels.size() / 4);
+    segment.count = static_cast<uint32_t>(deltas.values.size() / 3);
+    segment.sparse = deltas.sparse;
+    for (uint32_t i = 0; i < segment.count; i++) {
+      // Vertex indices are exact in a float well past any vertex count.
+      const float w = deltas.sparse ? float(deltas.indices[i]) : 0.0f;
+      texels.insert(texels.end(), {deltas.values[i * 3], deltas.values[i * 3 + 1], deltas.values[i * 3 + 2], w});
+    }
+  }
+  return segments;
+}
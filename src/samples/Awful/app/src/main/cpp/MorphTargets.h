@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "GltfGeometry.h"
+#include "tiny_gltf.h"
+
+// glTF morph targets of one primitive, with each target's deltas kept in the form the asset
+// stores them. A target whose accessor is sparse over zeros (the usual export for a blend
+// shape that moves part of a mesh) holds just the vertices it moves, and stays that way on
+// the GPU.
+//
+// On the GPU, the position deltas of every morphed primitive go into one RGBA32F texture, a
+// run of texels per target (MorphSegment). Dense runs are indexed by gl_VertexID; sparse runs
+// carry the vertex index in w and are binary searched. Only targets with a non-zero weight are
+// handed to the shader. BlendMorphTargets does the same on the CPU, normals included, for
+// primitives with more targets than the shader takes and to check the GPU path against.
+
+enum class MorphMode { Gpu, Cpu };
+
+// The most targets the morphing vertex shader blends; primitives with more go to the CPU.
+constexpr uint32_t kMaxGpuMorphTargets = 8;
+
+struct MorphDeltas {
+  bool sparse = false;
+  std::vector<uint32_t> indices;  // ascending vertex indices when sparse
+  std::vector<float> values;      // xyz per index when sparse, per vertex otherwise; empty if nothing moves
+};
+
+struct MorphTarget {
+  MorphDeltas positions;
+  MorphDeltas normals;
+};
+
+struct MorphTargetSet {
+  uint32_t vertexCount = 0;
+  std::vector<MorphTarget> targets;
+  // The unmorphed stream, only kept for blending on the CPU.
+  std::vector<float> basePositions;  // xyz per vertex
+  std::vector<float> baseNormals;    // xyz per vertex, empty without NORMAL
+};
+
+// Reads the POSITION and NORMAL deltas of every target, for vertexCount vertices numbered as
+// the accessors number them. TANGENT deltas are ignored. False if a target doesn't match the
+// primitive.
+bool BuildMorphTargets(const tinygltf::Model& model, const tinygltf::Primitive& prim, uint32_t vertexCount,
+                       MorphTargetSet& out);
+
+// Renumbers the deltas after OptimizePrimitiveGeometry moved the vertices (see its
+// vertexRemap), dropping removed vertices. Sparse deltas stay sparse.
+void RemapMorphTargets(const std::vector<uint32_t>& remap, uint32_t vertexCount, MorphTargetSet& targets);
+
+// Copies the base positions and normals out of a float stream (before quantizing).
+bool ExtractMorphBase(const PrimitiveGeometry& geom, MorphTargetSet& targets);
+
+// The base plus the weighted deltas of every target with a non-zero weight, into tightly
+// packed xyz. Targets past weightCount weigh 0. Normals are renormalized; outNormals may be
+// null, and is left alone without base normals.
+void BlendMorphTargets(const MorphTargetSet& targets, const float* weights, size_t weightCount, float* outPositions,
+                       float* outNormals);
+
+// A target's position deltas in the morph texture.
+struct MorphSegment {
+  uint32_t firstTexel = 0;
+  uint32_t count = 0;  // 0 if the target doesn't move positions
+  bool sparse = false;
+};
+constexpr uint32_t kMorphTextureWidth = 1024;
+
+// Appends the targets' position deltas to texels, four floats per texel, and returns where
+// each target's went.
+std::vector<MorphSegment> PackMorphPositions(const MorphTargetSet& targets, std::vector<float>& texels);
@@ -0,0 +1,167 @@
+#include "ProgramCache.h"
+
+#include <android/log.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+constexpr uint32_t kMagic = 0x42505741;  // "AWPB"
+constexpr uint32_t kFileVersion = 1;
+constexpr uint32_t kMaxBinaryBytes = 16 << 20;
+
+// Precedes the binary in each file.
+struct BinaryHeader {
+  uint32_t magic = kMagic;
+  uint32_t version = kFileVersion;
+  uint64_t key = 0;
+  uint32_t format = 0;  // from glGetProgramBinary
+  uint32_t size = 0;
+  float compileMs = 0.0f;
+  uint32_t pad = 0;
+};
+
+// FNV-1a, continuing from hash.
+uint64_t Hash(const std::string& s, uint64_t hash) {
+  for (unsigned char c : s) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  // The terminator too, so "ab" + "c" and "a" + "bc" differ.
+  return hash * 0x100000001b3ull;
+}
+
+std::string GlString(GLenum name) {
+  const GLubyte* s = glGetString(name);
+  return s ? reinterpret_cast<const char*>(s) : "";
+}
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+}  // namespace
+
+ProgramCache& ProgramCache::Get() {
+  static ProgramCache cache;
+  return cache;
+}
+
+bool ProgramCache::Open(const std::string& directory) {
+  directory_.clear();
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats <= 0) {
+    __android_log_print(ANDROID_LOG_WARN, "ProgramCache", "The driver has no program binary formats, not caching");
+    return false;
+  }
+  if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+    __android_log_print(ANDROID_LOG_ERROR, "ProgramCache", "Can't create %s: %s", directory.c_str(), strerror(errno));
+    return false;
+  }
+  directory_ = directory;
+  driver_ = GlString(GL_RENDERER) + "\n" + GlString(GL_VERSION);
+  stats_ = Stats{};
+  return true;
+}
+
+uint64_t ProgramCache::Key(const std::string& vertexSource, const std::string& fragmentSource) const {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash = Hash(driver_, hash);
+  hash = Hash(vertexSource, hash);
+  return Hash(fragmentSource, hash);
+}
+
+std::string ProgramCache::PathFor(uint64_t key) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016" PRIx64 ".bin", key);
+  return directory_ + name;
+}
+
+GLuint ProgramCache::Load(uint64_t key) {
+  if (!IsOpen()) {
+    return 0;
+  }
+  const std::string path = PathFor(key);
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    stats_.misses++;
+    return 0;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  BinaryHeader header;
+  std::vector<uint8_t> binary;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == kMagic &&
+               header.version == kFileVersion && header.key == key && header.size > 0 && header.size <= kMaxBinaryBytes;
+  if (valid) {
+    binary.resize(header.size);
+    valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+  }
+  fclose(file);
+
+  GLuint program = valid ? glCreateProgram() : 0;
+  if (program) {
+    glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+      glDeleteProgram(program);
+      program = 0;
+    }
+  }
+  if (!program) {
+    // Usually a driver that changed without its version string changing. The recompiled
+    // program gets stored over it.
+    __android_log_print(ANDROID_LOG_WARN, "ProgramCache", "Rejected %s", path.c_str());
+    remove(path.c_str());
+    stats_.misses++;
+    stats_.rejected++;
+    return 0;
+  }
+  const double ms = MsSince(start);
+  stats_.hits++;
+  stats_.loadMs += ms;
+  stats_.savedMs += header.compileMs - ms;
+  return program;
+}
+
+void ProgramCache::Store(uint64_t key, GLuint program, double compileMs) {
+  stats_.compileMs += compileMs;
+  if (!IsOpen()) {
+    return;
+  }
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0 || uint32_t(length) > kMaxBinaryBytes) {
+    return;
+  }
+  std::vector<uint8_t> binary(length);
+  GLsizei written = 0;
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &written, &format, binary.data());
+  if (written <= 0) {
+    return;
+  }
+  BinaryHeader header;
+  header.key = key;
+  header.format = format;
+  header.size = static_cast<uint32_t>(written);
+  header.compileMs = static_cast<float>(compileMs);
+
+  // Written aside and renamed into place, so a crash mid-write can't leave a torn binary.
+  const std::string path = PathFor(key);
+  const std::string temp = path + ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+  if (!file) {
+    __android_log_print(ANDROID_LOG_ERROR, "ProgramCache", "Can't write %s: %s", temp.c_str(), strerror(errno));
+    return;
+  }
+  const bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, written, file) == size_t(written);
+  if (fclose(file) != 0 || !ok || rename(temp.c_str(), path.c_str()) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, "ProgramCache", "Failed to store %s", path.c_str());
+    remove(temp.c_str());
+  }
+}
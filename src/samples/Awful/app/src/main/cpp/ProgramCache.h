@@ -0,0 +1,65 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <cstdint>
+#include <string>
+
+// Linked GL programs saved to disk with glGetProgramBinary, so later launches skip compiling.
+// A program is keyed by a hash of its vertex and fragment sources (defines included, they're
+// prepended to the source) and the GL_RENDERER and GL_VERSION strings, so a driver update
+// misses instead of feeding the driver a stale binary. Drivers may still reject a binary they
+// wrote; the caller then compiles from source and the fresh binary replaces it.
+//
+//   ProgramCache::Get().Open(internalDataPath + "/programs");  // with the context current
+//   ...
+//   const uint64_t key = cache.Key(vertexSource, fragmentSource);
+//   GLuint program = cache.Load(key);
+//   if (!program) {
+//     // compile, glProgramParameteri(GL_PROGRAM_BINARY_RETRIEVABLE_HINT), link, time it
+//     cache.Store(key, program, compileMs);
+//   }
+//
+// Like the programs, it belongs to the GL context's thread.
+class ProgramCache {
+ public:
+  static ProgramCache& Get();
+
+  // Starts reading and writing binaries under directory, creating it if needed. Until then,
+  // or if the driver supports no binary formats, Load always misses and Store does nothing.
+  bool Open(const std::string& directory);
+  bool IsOpen() const {
+    return !directory_.empty();
+  }
+
+  uint64_t Key(const std::string& vertexSource, const std::string& fragmentSource) const;
+
+  // A linked program from the cached binary, or 0 if there's none or the driver rejected it.
+  GLuint Load(uint64_t key);
+
+  // Saves a linked program's binary, with how long it took to compile and link.
+  void Store(uint64_t key, GLuint program, double compileMs);
+
+  // Since Open. savedMs is what the hits took to compile when they were stored, less what
+  // loading them took.
+  struct Stats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t rejected = 0;  // binaries the driver refused, also counted as misses
+    double compileMs = 0.0;
+    double loadMs = 0.0;
+    double savedMs = 0.0;
+  };
+  const Stats& GetStats() const {
+    return stats_;
+  }
+
+ private:
+  ProgramCache() = default;
+
+  std::string PathFor(uint64_t key) const;
+
+  std::string directory_;
+  std::string driver_;  // GL_RENDERER and GL_VERSION, part of every key
+  Stats stats_;
+};
@@ -0,0 +1,210 @@
+#include "RenderPass.h"
+
+// gl2ext.h needs gl3.h's platform macros first.
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+#include <android/log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "GpuResources.h"
+
+namespace {
+constexpr GLenum kDepthFormat = GL_DEPTH_COMPONENT24;
+
+bool HasExtension(const char* name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+    if (ext && !strcmp(ext, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+RenderPass::~RenderPass() {
+  Destroy();
+}
+
+bool RenderPass::Init(uint32_t width, uint32_t height, std::span<const GLuint> colorImages, uint32_t colorLayers,
+                      uint32_t colorBytesPerPixel, uint32_t samples, const std::string& asset) {
+  Destroy();
+  width_ = width;
+  height_ = height;
+  layers_ = std::max(colorLayers, 1u);
+  colorBytesPerPixel_ = colorBytesPerPixel;
+  const bool layered = colorLayers > 1;
+
+  PFNGLFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC framebufferTexture2DMultisample = nullptr;
+  PFNGLRENDERBUFFERSTORAGEMULTISAMPLEEXTPROC renderbufferStorageMultisample = nullptr;
+  PFNGLFRAMEBUFFERTEXTUREMULTISAMPLEMULTIVIEWOVRPROC framebufferTextureMultisampleMultiview = nullptr;
+  if (samples > 1 && layered && HasExtension("GL_OVR_multiview_multisampled_render_to_texture")) {
+    // A layer is attached as a multiview of one view, the only way to render one on chip.
+    framebufferTextureMultisampleMultiview = reinterpret_cast<PFNGLFRAMEBUFFERTEXTUREMULTISAMPLEMULTIVIEWOVRPROC>(
+        eglGetProcAddress("glFramebufferTextureMultisampleMultiviewOVR"));
+  } else if (samples > 1 && !layered && HasExtension("GL_EXT_multisampled_render_to_texture")) {
+    framebufferTexture2DMultisample = reinterpret_cast<PFNGLFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC>(
+        eglGetProcAddress("glFramebufferTexture2DMultisampleEXT"));
+    renderbufferStorageMultisample = reinterpret_cast<PFNGLRENDERBUFFERSTORAGEMULTISAMPLEEXTPROC>(
+        eglGetProcAddress("glRenderbufferStorageMultisampleEXT"));
+  }
+  const bool multiview = framebufferTextureMultisampleMultiview != nullptr;
+  if (multiview || (framebufferTexture2DMultisample && renderbufferStorageMultisample)) {
+    GLint maxSamples = 1;
+    glGetIntegerv(GL_MAX_SAMPLES_EXT, &maxSamples);
+    samples = std::min<uint32_t>(samples, std::max(maxSamples, 1));
+  } else {
+    if (samples > 1) {
+      __android_log_print(ANDROID_LOG_WARN, "RenderPass", "No %s, rendering %s without MSAA",
+                          layered ? "GL_OVR_multiview_multisampled_render_to_texture" : "GL_EXT_multisampled_render_to_texture",
+                          asset.c_str());
+    }
+    samples = 1;
+  }
+
+  auto& gpu = GpuResourceTracker::Get();
+  if (multiview) {
+    // Multiview attachments must all be multiview, so depth is a single layer array, whose
+    // samples only ever live on chip like the color's.
+    depthTexture_ = gpu.CreateTexture({"RenderPass", asset, "depth"});
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture_);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, kDepthFormat, width, height, 1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    gpu.SetTextureArrayStorage(depthTexture_, kDepthFormat, width, height, 1, 1);
+  } else {
+    depth_ = gpu.CreateRenderbuffer({"RenderPass", asset, "depth"});
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_);
+    if (samples > 1) {
+      // Must match the color attachments' samples, and like them only ever lives on chip.
+      renderbufferStorageMultisample(GL_RENDERBUFFER, samples, kDepthFormat, width, height);
+    } else {
+      glRenderbufferStorage(GL_RENDERBUFFER, kDepthFormat, width, height);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    gpu.SetRenderbufferStorage(depth_, kDepthFormat, width, height, samples);
+  }
+
+  bool complete = true;
+  for (size_t i = 0; i < colorImages.size(); i++) {
+    for (uint32_t layer = 0; layer < layers_; layer++) {
+      std::string name = "image " + std::to_string(i);
+      if (layered) name += " layer " + std::to_string(layer);
+      GLuint framebuffer = gpu.CreateFramebuffer({"RenderPass", asset, name});
+      framebuffers_.push_back(framebuffer);
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+      if (multiview) {
+        framebufferTextureMultisampleMultiview(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorImages[i], 0, samples, layer, 1);
+        framebufferTextureMultisampleMultiview(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture_, 0, samples, 0, 1);
+      } else {
+        if (layered) {
+          glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorImages[i], 0, layer);
+        } else if (samples > 1) {
+          framebufferTexture2DMultisample(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorImages[i], 0, samples);
+        } else {
+          glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorImages[i], 0);
+        }
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_);
+      }
+      const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+      if (status != GL_FRAMEBUFFER_COMPLETE) {
+        __android_log_print(ANDROID_LOG_ERROR, "RenderPass", "%s %s: framebuffer not complete (0x%x)", asset.c_str(),
+                            name.c_str(), status);
+        complete = false;
+      }
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  stats_ = Stats{};
+  stats_.images = static_cast<uint32_t>(colorImages.size());
+  stats_.layers = layers_;
+  stats_.samples = samples;
+  // The multiview depth array is allocated single sampled; its samples live on chip.
+  stats_.depthBytes = EstimateTextureBytes(kDepthFormat, width, height, 1, multiview ? 1 : samples);
+  // Against single sampled depth textures, one per framebuffer; multisampled depth lives on chip.
+  const size_t perImageDepth = EstimateTextureBytes(kDepthFormat, width, height, 1);
+  stats_.depthBytesSaved = framebuffers_.empty() ? 0 : perImageDepth * (framebuffers_.size() - 1);
+  __android_log_print(ANDROID_LOG_INFO, "RenderPass", "%s: %zu framebuffers of %ux%u, %ux MSAA, one depth for all (%zu KB saved)",
+                      asset.c_str(), framebuffers_.size(), width, height, samples, stats_.depthBytesSaved / 1024);
+  return complete;
+}
+
+size_t RenderPass::ColorBytes() const {
+  return size_t(width_) * height_ * colorBytesPerPixel_;
+}
+
+void RenderPass::Begin(uint32_t imageIndex, uint32_t layer, const RenderPassOps& ops) {
+  const size_t framebuffer = size_t(imageIndex) * layers_ + layer;
+  if (layer >= layers_ || framebuffer >= framebuffers_.size()) {
+    __android_log_print(ANDROID_LOG_ERROR, "RenderPass", "Invalid image %u layer %u of %zu", imageIndex, layer,
+                        framebuffers_.size());
+    return;
+  }
+  current_ = static_cast<int>(framebuffer);
+  ops_ = ops;
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[framebuffer]);
+  glViewport(0, 0, width_, height_);
+
+  GLenum invalidate[2];
+  GLsizei invalidateCount = 0;
+  GLbitfield clear = 0;
+  if (ops.colorLoad == LoadOp::DontCare) invalidate[invalidateCount++] = GL_COLOR_ATTACHMENT0;
+  if (ops.depthLoad == LoadOp::DontCare) invalidate[invalidateCount++] = GL_DEPTH_ATTACHMENT;
+  if (invalidateCount) {
+    glInvalidateFramebuffer(GL_FRAMEBUFFER, invalidateCount, invalidate);
+  }
+  if (ops.colorLoad == LoadOp::Clear) {
+    glClearColor(ops.clearColor[0], ops.clearColor[1], ops.clearColor[2], ops.clearColor[3]);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    clear |= GL_COLOR_BUFFER_BIT;
+  }
+  if (ops.depthLoad == LoadOp::Clear) {
+    glClearDepthf(ops.clearDepth);
+    glDepthMask(GL_TRUE);
+    clear |= GL_DEPTH_BUFFER_BIT;
+  }
+  if (clear) {
+    // A full clear is what lets the tiler skip loading the attachment.
+    glDisable(GL_SCISSOR_TEST);
+    glClear(clear);
+  }
+}
+
+void RenderPass::End() {
+  if (current_ < 0) return;
+  GLenum invalidate[2];
+  GLsizei invalidateCount = 0;
+  if (ops_.colorStore == StoreOp::Discard) invalidate[invalidateCount++] = GL_COLOR_ATTACHMENT0;
+  if (ops_.depthStore == StoreOp::Discard) invalidate[invalidateCount++] = GL_DEPTH_ATTACHMENT;
+  if (invalidateCount) {
+    glInvalidateFramebuffer(GL_FRAMEBUFFER, invalidateCount, invalidate);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  current_ = -1;
+
+  const size_t samples = stats_.samples;
+  const size_t color = ColorBytes() * samples;
+  const size_t depth = EstimateTextureBytes(kDepthFormat, width_, height_, 1) * samples;
+  size_t saved = 0;
+  saved += ops_.colorLoad != LoadOp::Load ? color : 0;
+  // Resolving on chip writes one sample of each pixel back instead of all of them.
+  saved += ops_.colorStore == StoreOp::Discard ? color : color - color / samples;
+  saved += ops_.depthLoad != LoadOp::Load ? depth : 0;
+  saved += ops_.depthStore == StoreOp::Discard ? depth : 0;
+  stats_.frameBytesSaved = saved;
+}
+
+void RenderPass::Destroy() {
+  auto& gpu = GpuResourceTracker::Get();
+  for (GLuint& framebuffer : framebuffers_) {
+    gpu.DeleteFramebuffer(framebuffer);
+  }
+  framebuffers_.clear();
+  gpu.DeleteRenderbuffer(depth_);
+  gpu.DeleteTexture(depthTexture_);
+  current_ = -1;
+}
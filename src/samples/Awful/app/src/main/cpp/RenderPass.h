@@ -0,0 +1,109 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// What happens to an attachment's contents when a pass begins and ends. Tiled GPUs keep the
+// frame on chip, so loading what was in memory before and writing it back afterwards are the
+// expensive parts; anything not loaded or stored is bandwidth saved.
+enum class LoadOp {
+  Load,      // keep what's there
+  Clear,     // to the pass's clear value
+  DontCare,  // whatever's there is about to be overwritten; invalidated up front
+};
+enum class StoreOp {
+  Store,    // written back (resolved, when multisampled)
+  Discard,  // invalidated before the tile would be written back
+};
+
+struct RenderPassOps {
+  LoadOp colorLoad = LoadOp::Clear;
+  StoreOp colorStore = StoreOp::Store;
+  LoadOp depthLoad = LoadOp::Clear;
+  StoreOp depthStore = StoreOp::Discard;
+  float clearColor[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+  float clearDepth = 1.0f;
+};
+
+// Rendering into a set of color images, such as a swapchain's, with one framebuffer per image
+// built and validated up front. Depth only lives for the length of a pass, so every image
+// shares one depth renderbuffer, whose contents are discarded at the end of each pass.
+//
+// With EXT_multisampled_render_to_texture and samples > 1, the pass renders multisampled on
+// chip and resolves into the color image as tiles are written back; the multisampled data
+// never reaches memory.
+//
+// Color images can also be texture arrays, such as a stereo swapchain's with an eye a layer,
+// each layer getting a framebuffer of its own. Those need
+// OVR_multiview_multisampled_render_to_texture for on-chip MSAA.
+//
+//   pass.Init(width, height, images, 4, "swapchain");
+//   ...
+//   pass.Begin(imageIndex, ops);
+//   ... draw ...
+//   pass.End();
+class RenderPass {
+ public:
+  struct Stats {
+    uint32_t images = 0;
+    uint32_t layers = 1;
+    uint32_t samples = 1;        // what the pass got, which may be fewer than asked for
+    size_t depthBytes = 0;       // the shared depth renderbuffer, every sample counted
+    size_t depthBytesSaved = 0;  // against a single sampled depth texture per image
+    // Attachment traffic the last pass's load and store ops skipped, against loading and
+    // storing every attachment (and every sample of it, had it been multisampled in memory).
+    size_t frameBytesSaved = 0;
+  };
+
+  ~RenderPass();
+
+  // Builds a framebuffer per color image and layer (GL_TEXTURE_2D names when colorLayers is 1,
+  // GL_TEXTURE_2D_ARRAY otherwise, owned by the caller) and the shared depth.
+  // colorBytesPerPixel is the images' pixel size, for the stats. samples > 1 asks for on-chip
+  // MSAA and falls back to 1 without the extension. Returns false if a framebuffer isn't
+  // complete. What's created is tagged with asset in GpuResourceTracker.
+  bool Init(uint32_t width, uint32_t height, std::span<const GLuint> colorImages, uint32_t colorLayers,
+            uint32_t colorBytesPerPixel, uint32_t samples, const std::string& asset);
+
+  // Binds the framebuffer of the image's layer, sets the viewport and applies the load ops.
+  void Begin(uint32_t imageIndex, uint32_t layer, const RenderPassOps& ops);
+  void Begin(uint32_t imageIndex, const RenderPassOps& ops) {
+    Begin(imageIndex, 0, ops);
+  }
+  // Applies the store ops and unbinds.
+  void End();
+
+  uint32_t GetWidth() const {
+    return width_;
+  }
+  uint32_t GetHeight() const {
+    return height_;
+  }
+  uint32_t GetLayers() const {
+    return layers_;
+  }
+  const Stats& GetStats() const {
+    return stats_;
+  }
+
+  void Destroy();
+
+ private:
+  size_t ColorBytes() const;
+
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  uint32_t layers_ = 1;
+  uint32_t colorBytesPerPixel_ = 4;
+  std::vector<GLuint> framebuffers_;  // layers_ per image
+  GLuint depth_ = 0;
+  GLuint depthTexture_ = 0;  // instead of depth_ for multiview attachments, which must all be textures
+  int current_ = -1;         // framebuffer of the pass begun, -1 between passes
+  RenderPassOps ops_;
+  Stats stats_;
+};
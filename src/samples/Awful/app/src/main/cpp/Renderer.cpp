@@ -8,6 +8,8 @@
 #include <vector>
 
 #include "AndroidOut.h"
+#include "GpuResources.h"
+#include "ProgramCache.h"
 #include "Shader.h"
 #include "TextureAsset.h"
 #include "linear.h"
@@ -89,6 +91,17 @@ static constexpr float kProjectionNearPlane = -1.f;
 static constexpr float kProjectionFarPlane = 1.f;
 
 Renderer::~Renderer() {
+  if (context_ != EGL_NO_CONTEXT) {
+    // GL objects go while the context is still current. The swapchain's color images belong
+    // to the OpenXR runtime.
+    auto& gpu = GpuResourceTracker::Get();
+    pass_.Destroy();
+    models_.clear();
+    gpu.ReportLeaks("Renderer");
+    gpu.ReportLeaks("RenderPass");
+    gpu.ReportLeaks("Model");
+    gpu.ReportLeaks("TextureAsset");
+  }
   if (display_ != EGL_NO_DISPLAY) {
     eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
     if (context_ != EGL_NO_CONTEXT) {
@@ -104,49 +117,33 @@ Renderer::~Renderer() {
   }
 }
 
-void Renderer::bindFbo(uint32_t imageIndex) {
+void Renderer::bindFbo(uint32_t imageIndex, uint32_t layer) {
   // Make sure we have a valid context
   if (context_ == EGL_NO_CONTEXT || display_ == EGL_NO_DISPLAY || surface_ == EGL_NO_SURFACE) {
     aout << "Renderer::bindFbo() called without a valid EGL context, display, or surface" << endl;
     return;
   }
 
-  if (imageIndex >= colorImages_.size()) {
-    aout << "Invalid image index: " << imageIndex << ", numImages: " << colorImages_.size() << endl;
-    return;
-  }
-
-  // Configure the fbo
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorImages_[imageIndex].textureId, 0);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthImages_[imageIndex].textureId, 0);
-  // Check FBO completeness
-  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-  if (status != GL_FRAMEBUFFER_COMPLETE) {
-    aout << "Framebuffer not complete: 0x" << std::hex << status << std::dec << endl;
-    return;
-  }
-}
-
-void Renderer::render() {
-  glViewport(0, 0, colorImages_[0].width, colorImages_[0].height);
-
+  // Color and depth are cleared rather than loaded, and depth is never written back.
+  RenderPassOps ops;
   static int frameCount = 0;
   frameCount++;
   {
     float t = frameCount / 60.f;
-    glClearColor(sin(1.7212 * t + 1.813) * 0.5f + 0.5f, sin(0.6212 * t + 2.13) * 0.5f + 0.5f,
-                 sin(0.7612 * t + .213) * 0.5f + 0.5f, 0.5f);
+    ops.clearColor[0] = sin(1.7212 * t + 1.813) * 0.5f + 0.5f;
+    ops.clearColor[1] = sin(0.6212 * t + 2.13) * 0.5f + 0.5f;
+    ops.clearColor[2] = sin(0.7612 * t + .213) * 0.5f + 0.5f;
+    ops.clearColor[3] = 0.5f;
   }
+  pass_.Begin(imageIndex, layer, ops);
+}
 
-  // clear the color and depth buffers
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
+void Renderer::render() {
   shader_->activate();
 
   // Render all the models. There's no depth testing in this sample so they're accepted in the
-  // order provided. But the sample EGL setup requests a 24 bit depth buffer so you could
-  // configure it at the end of initRenderer
+  // order provided. But the render pass has a depth attachment, so you could configure it at
+  // the end of initRenderer
   if (!models_.empty()) {
     for (const auto& model : models_) {
       shader_->drawModel(model);
@@ -155,7 +152,7 @@ void Renderer::render() {
 }
 
 void Renderer::unbindFbo() {
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  pass_.End();
 }
 
 void Renderer::initRenderer() {
@@ -266,8 +263,8 @@ void Renderer::initRenderer() {
   PRINT_GL_STRING(GL_VERSION);
   PRINT_GL_STRING_AS_LIST(GL_EXTENSIONS);
 
-  // Create a framebuffer object to render to
-  glGenFramebuffers(1, &fbo);
+  // Every program after this, ours and GltfRenderer's, goes through the cache.
+  ProgramCache::Get().Open(string(app_->activity->internalDataPath) + "/programs");
 
   shader_ = unique_ptr<Shader>(Shader::loadShader(vertex, fragment, "inPosition", "inUV", "uToClipFromObject"));
 
@@ -313,25 +310,15 @@ void Renderer::createModels() {
   auto assetManager = app_->activity->assetManager;
   auto spAndroidRobotTexture = TextureAsset::loadAsset(assetManager, "android_robot.png");
 
-  // Create a model and put it in the back of the render list.
+  // Create a model and put it in the back of the render list. It uploads the mesh into buffers
+  // of its own, so the vectors can go once it's made.
   models_.emplace_back(vertices, indices, spAndroidRobotTexture);
 }
 
-void Renderer::setSwapchainImages(uint32_t width, uint32_t height, const std::span<GLuint>& images) {
-  // Populate the swapchainImages vector with the provided images
-  colorImages_.reserve(images.size());
-  depthImages_.reserve(images.size());
-  for (auto& image : images) {
-    colorImages_.push_back({image, width, height});
-    // Create a depth texture for each swapchain image
-    GLuint depthTex = 0;
-    glGenTextures(1, &depthTex);
-    glBindTexture(GL_TEXTURE_2D, depthTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    depthImages_.push_back({depthTex, width, height});
+void Renderer::setSwapchainImages(uint32_t width, uint32_t height, const std::span<GLuint>& images, uint32_t layers,
+                                  uint32_t bytesPerPixel, uint32_t samples) {
+  // A framebuffer per image and layer, validated here rather than every frame, sharing one depth buffer.
+  if (!pass_.Init(width, height, images, layers, bytesPerPixel, samples, "swapchain")) {
+    aout << "Swapchain framebuffers are incomplete" << endl;
   }
 }
@@ -10,6 +10,7 @@
 #include <span>
 
 #include "Model.h"
+#include "RenderPass.h"
 #include "Shader.h"
 
 struct android_app;
@@ -31,8 +32,12 @@ class Renderer {
    * @param width The width of the swap chain images.
    * @param height The height of the swap chain images.
    * @param images A span of GLuint handles representing the swap chain images.
+   * @param layers The swap chain's array size, 2 for a stereo one with an eye a layer.
+   * @param bytesPerPixel The size of a pixel in the swap chain's format.
+   * @param samples MSAA samples, resolved on chip; 1 without EXT_multisampled_render_to_texture.
    */
-  void setSwapchainImages(uint32_t width, uint32_t height, const std::span<GLuint>& images);
+  void setSwapchainImages(uint32_t width, uint32_t height, const std::span<GLuint>& images, uint32_t layers,
+                          uint32_t bytesPerPixel, uint32_t samples = 1);
 
   /*!
    * Renders all the models in the renderer to the specified image.
@@ -55,9 +60,21 @@ class Renderer {
     return context_;
   }
 
-  void bindFbo(uint32_t imageIndex);
+  /*!
+   * Begins the render pass into a swapchain image's layer (its eye, for a stereo swapchain):
+   * binds its framebuffer and clears color and depth, so neither is loaded from memory.
+   */
+  void bindFbo(uint32_t imageIndex, uint32_t layer = 0);
+
+  /*!
+   * Ends the render pass, discarding depth so it's never written back.
+   */
   void unbindFbo();
 
+  const RenderPass::Stats& getRenderPassStats() const {
+    return pass_.GetStats();
+  }
+
  private:
   /*!
    * Performs necessary OpenGL initialization. Customize this if you want to change your EGL
@@ -86,15 +103,8 @@ class Renderer {
   std::unique_ptr<Shader> shader_;
   std::vector<Model> models_;
 
-  struct SwapchainImage {
-    GLuint textureId;
-    uint32_t width;
-    uint32_t height;
-  };
-
-  std::vector<SwapchainImage> colorImages_;
-  std::vector<SwapchainImage> depthImages_;
-  GLuint fbo;
+  // Draws into the swapchain images, one prebuilt framebuffer each.
+  RenderPass pass_;
 };
 
 #endif  // ANDROIDGLINVESTIGATIONS_RENDERER_H
\ No newline at end of file
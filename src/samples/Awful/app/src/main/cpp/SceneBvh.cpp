@@ -0,0 +1,461 @@
+#include "SceneBvh.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "GltfAccess.h"
+#include "examples/raytrace/nanort.h"
+
+struct SceneBvh::MeshTriangles {
+  std::vector<float> positions;  // xyz per vertex, every triangle list primitive's back to back
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> firstTriangle;  // per primitive, so a hit can say which it was
+  nanort::BVHAccel<float> bvh;
+};
+
+namespace {
+// nanort's build interface over boxes, six floats (min, then max) per item: a box per
+// primitive, and the split test on box centers its SAH binning asks for.
+class ItemBoxes {
+ public:
+  explicit ItemBoxes(const float* boxes) : boxes_(boxes) {}
+  void BoundingBox(nanort::real3<float>* bmin, nanort::real3<float>* bmax, unsigned int i) const {
+    for (int c = 0; c < 3; c++) {
+      (*bmin)[c] = boxes_[i * 6 + c];
+      (*bmax)[c] = boxes_[i * 6 + 3 + c];
+    }
+  }
+
+ private:
+  const float* boxes_;
+};
+
+class ItemSplit {
+ public:
+  explicit ItemSplit(const float* boxes) : boxes_(boxes) {}
+  void Set(int axis, float pos) const {
+    axis_ = axis;
+    pos_ = pos;
+  }
+  bool operator()(unsigned int i) const {
+    return boxes_[i * 6 + axis_] + boxes_[i * 6 + 3 + axis_] < 2.0f * pos_;
+  }
+
+ private:
+  const float* boxes_;
+  mutable int axis_ = 0;
+  mutable float pos_ = 0.0f;
+};
+
+// The range of a POSITION accessor (or target), from its min and max where they can be
+// trusted, else from the data.
+bool AccessorRange(const tinygltf::Model& model, int accessorIndex, float lo[3], float hi[3]) {
+  if (accessorIndex < 0 || static_cast<size_t>(accessorIndex) >= model.accessors.size()) {
+    return false;
+  }
+  const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+  // Exporters disagree on whether normalized min and max are in stored units, so read those.
+  if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3 && !accessor.normalized) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = static_cast<float>(accessor.minValues[c]);
+      hi[c] = static_cast<float>(accessor.maxValues[c]);
+    }
+    return true;
+  }
+  std::vector<float> positions;
+  if (ReadAccessorFloats(model, accessorIndex, positions) != 3 || positions.empty()) {
+    return false;
+  }
+  std::fill(lo, lo + 3, INFINITY);
+  std::fill(hi, hi + 3, -INFINITY);
+  for (size_t i = 0; i < positions.size(); i += 3) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], positions[i + c]);
+      hi[c] = std::max(hi[c], positions[i + c]);
+    }
+  }
+  return true;
+}
+
+// Where a ray enters a box, or false if it misses it or enters past maxT.
+bool IntersectBox(const float bmin[3], const float bmax[3], const r3::Vec3f& origin, const float invDir[3], float maxT,
+                  float* entry) {
+  float tmin = 0.0f, tmax = maxT;
+  for (int c = 0; c < 3; c++) {
+    const float t0 = (bmin[c] - origin[c]) * invDir[c];
+    const float t1 = (bmax[c] - origin[c]) * invDir[c];
+    tmin = std::max(tmin, std::min(t0, t1));
+    tmax = std::min(tmax, std::max(t0, t1));
+  }
+  *entry = tmin;
+  return tmin <= tmax;
+}
+
+// Clip space planes as a * x + b * y + c * z + d >= 0 for points inside, from the rows of
+// toClipFromWorld (-w <= x, y, z <= w).
+struct FrustumPlanes {
+  float plane[6][4];
+
+  explicit FrustumPlanes(const r3::Matrix4f& m) {
+    for (int axis = 0; axis < 3; axis++) {
+      for (int c = 0; c < 4; c++) {
+        plane[axis * 2][c] = m(3, c) + m(axis, c);
+        plane[axis * 2 + 1][c] = m(3, c) - m(axis, c);
+      }
+    }
+  }
+
+  // The planes of mask the box still straddles, or -1 if it's outside one of them.
+  int Test(const float bmin[3], const float bmax[3], int mask) const {
+    for (int p = 0; p < 6; p++) {
+      if (!(mask & (1 << p))) continue;
+      const float* n = plane[p];
+      float nearest = n[3], farthest = n[3];
+      for (int c = 0; c < 3; c++) {
+        nearest += n[c] * (n[c] > 0.0f ? bmin[c] : bmax[c]);
+        farthest += n[c] * (n[c] > 0.0f ? bmax[c] : bmin[c]);
+      }
+      if (farthest < 0.0f) return -1;
+      if (nearest >= 0.0f) mask &= ~(1 << p);
+    }
+    return mask;
+  }
+};
+
+constexpr int kAllPlanes = 0x3f;
+constexpr int kMaxStackDepth = 512;  // nanort's own traversal limit
+}  // namespace
+
+SceneBvh::SceneBvh() = default;
+SceneBvh::~SceneBvh() = default;
+
+int SceneBvh::AddItem(int node, int mesh, const r3::Matrix4f& local) {
+  Item& item = items_.emplace_back();
+  item.node = node;
+  item.mesh = mesh;
+  item.local = local;
+  return static_cast<int>(items_.size() - 1);
+}
+
+bool SceneBvh::Build(const tinygltf::Model& model, const SceneGraph& scene, bool triangles) {
+  const auto start = std::chrono::steady_clock::now();
+  nodes_.clear();
+  order_.clear();
+  meshTriangles_.clear();
+  if (items_.empty()) {
+    return false;
+  }
+  std::vector<bool> used(model.meshes.size(), false);
+  for (const auto& item : items_) {
+    if (item.mesh >= 0 && static_cast<size_t>(item.mesh) < used.size()) used[item.mesh] = true;
+  }
+
+  // Object space boxes, with each morph target's reach added on so any weights in [0, 1]
+  // stay inside.
+  meshBounds_.assign(model.meshes.size(), MeshBounds{});
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    if (!used[m]) continue;
+    float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (const auto& prim : model.meshes[m].primitives) {
+      auto position = prim.attributes.find("POSITION");
+      float primLo[3], primHi[3];
+      if (position == prim.attributes.end() || !AccessorRange(model, position->second, primLo, primHi)) {
+        continue;
+      }
+      for (const auto& target : prim.targets) {
+        auto delta = target.find("POSITION");
+        float deltaLo[3], deltaHi[3];
+        if (delta == target.end() || !AccessorRange(model, delta->second, deltaLo, deltaHi)) continue;
+        for (int c = 0; c < 3; c++) {
+          primLo[c] += std::min(deltaLo[c], 0.0f);
+          primHi[c] += std::max(deltaHi[c], 0.0f);
+        }
+      }
+      for (int c = 0; c < 3; c++) {
+        lo[c] = std::min(lo[c], primLo[c]);
+        hi[c] = std::max(hi[c], primHi[c]);
+      }
+    }
+    if (lo[0] <= hi[0]) {
+      for (int c = 0; c < 3; c++) {
+        meshBounds_[m].center[c] = (lo[c] + hi[c]) * 0.5f;
+        meshBounds_[m].extent[c] = (hi[c] - lo[c]) * 0.5f;
+      }
+    }
+  }
+
+  // The top level, built by nanort over the current world boxes and then copied out so it
+  // can be refit.
+  std::vector<float> boxes(items_.size() * 6);
+  for (size_t i = 0; i < items_.size(); i++) {
+    Item& item = items_[i];
+    BoxItem(item, scene);
+    // Items without a box are placed at their origin so the SAH doesn't see infinities.
+    const bool empty = item.bmin[0] > item.bmax[0];
+    for (int c = 0; c < 3; c++) {
+      boxes[i * 6 + c] = empty ? item.world(c, 3) : item.bmin[c];
+      boxes[i * 6 + 3 + c] = empty ? item.world(c, 3) : item.bmax[c];
+    }
+  }
+  nanort::BVHAccel<float> top;
+  nanort::BVHBuildOptions<float> options;
+  options.min_leaf_primitives = 2;
+  top.Build(static_cast<unsigned int>(items_.size()), ItemBoxes(boxes.data()), ItemSplit(boxes.data()), options);
+  order_ = top.GetIndices();
+  nodes_.resize(top.GetNodes().size());
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    const nanort::BVHNode<float>& built = top.GetNodes()[i];
+    Node& node = nodes_[i];
+    if (built.flag == 1) {
+      node.first = built.data[1];
+      node.end = built.data[1] + built.data[0];
+    } else {
+      node.axis = built.axis;
+      node.children[0] = built.data[0];
+      node.children[1] = built.data[1];
+    }
+  }
+  RefitNodes();
+
+  // The bottom level: a triangle BVH per mesh, over its triangle list primitives.
+  size_t triangleCount = 0;
+  if (triangles) {
+    meshTriangles_.resize(model.meshes.size());
+    for (size_t m = 0; m < model.meshes.size(); m++) {
+      if (!used[m]) continue;
+      MeshTriangles& mesh = meshTriangles_[m];
+      for (const auto& prim : model.meshes[m].primitives) {
+        mesh.firstTriangle.push_back(static_cast<uint32_t>(mesh.indices.size() / 3));
+        auto position = prim.attributes.find("POSITION");
+        std::vector<float> positions;
+        if ((prim.mode != -1 && prim.mode != TINYGLTF_MODE_TRIANGLES) || position == prim.attributes.end() ||
+            ReadAccessorFloats(model, position->second, positions) != 3) {
+          continue;
+        }
+        std::vector<uint32_t> indices;
+        const uint32_t vertexCount = static_cast<uint32_t>(positions.size() / 3);
+        if (prim.indices < 0) {
+          indices.resize(vertexCount - vertexCount % 3);
+          for (uint32_t i = 0; i < indices.size(); i++) indices[i] = i;
+        } else if (!ReadAccessorIndices(model, prim.indices, indices)) {
+          continue;
+        }
+        const uint32_t base = static_cast<uint32_t>(mesh.positions.size() / 3);
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+          if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount) continue;
+          mesh.indices.insert(mesh.indices.end(), {base + indices[i], base + indices[i + 1], base + indices[i + 2]});
+        }
+        mesh.positions.insert(mesh.positions.end(), positions.begin(), positions.end());
+      }
+      const unsigned int count = static_cast<unsigned int>(mesh.indices.size() / 3);
+      if (count > 0) {
+        nanort::TriangleMesh<float> triangleMesh(mesh.positions.data(), mesh.indices.data(), 3 * sizeof(float));
+        nanort::TriangleSAHPred<float> triangleSplit(mesh.positions.data(), mesh.indices.data(), 3 * sizeof(float));
+        mesh.bvh.Build(count, triangleMesh, triangleSplit);
+      }
+      triangleCount += count;
+    }
+  }
+
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  __android_log_print(ANDROID_LOG_INFO, "SceneBvh", "%zu items in %zu nodes (depth %u), %zu triangles, built in %.2f ms",
+                      items_.size(), nodes_.size(), top.GetStatistics().max_tree_depth, triangleCount, ms);
+  return true;
+}
+
+void SceneBvh::Refit(const SceneGraph& scene) {
+  for (auto& item : items_) {
+    BoxItem(item, scene);
+  }
+  RefitNodes();
+}
+
+void SceneBvh::Clear() {
+  items_.clear();
+  nodes_.clear();
+  order_.clear();
+  meshBounds_.clear();
+  meshTriangles_.clear();
+}
+
+// The world box of the mesh's object space box: the center transformed, and the extent
+// through the absolute values of the matrix.
+void SceneBvh::BoxItem(Item& item, const SceneGraph& scene) const {
+  item.world = scene.GetNodes()[item.node].world;
+  item.world.MultRight(item.local);
+  const bool valid =
+      item.mesh >= 0 && static_cast<size_t>(item.mesh) < meshBounds_.size() && meshBounds_[item.mesh].extent[0] >= 0.0f;
+  if (!valid) {
+    std::fill(item.bmin, item.bmin + 3, INFINITY);
+    std::fill(item.bmax, item.bmax + 3, -INFINITY);
+    return;
+  }
+  const MeshBounds& bounds = meshBounds_[item.mesh];
+  const r3::Matrix4f& m = item.world;
+  for (int r = 0; r < 3; r++) {
+    float center = m(r, 3), extent = 0.0f;
+    for (int c = 0; c < 3; c++) {
+      center += m(r, c) * bounds.center[c];
+      extent += std::fabs(m(r, c)) * bounds.extent[c];
+    }
+    item.bmin[r] = center - extent;
+    item.bmax[r] = center + extent;
+  }
+}
+
+// Children come after their parent, so a backwards pass sees them first.
+void SceneBvh::RefitNodes() {
+  for (size_t i = nodes_.size(); i-- > 0;) {
+    Node& node = nodes_[i];
+    std::fill(node.bmin, node.bmin + 3, INFINITY);
+    std::fill(node.bmax, node.bmax + 3, -INFINITY);
+    auto grow = [&](const float bmin[3], const float bmax[3]) {
+      for (int c = 0; c < 3; c++) {
+        node.bmin[c] = std::min(node.bmin[c], bmin[c]);
+        node.bmax[c] = std::max(node.bmax[c], bmax[c]);
+      }
+    };
+    if (node.children[0] == 0) {
+      for (uint32_t k = node.first; k < node.end; k++) {
+        grow(items_[order_[k]].bmin, items_[order_[k]].bmax);
+      }
+    } else {
+      const Node& left = nodes_[node.children[0]];
+      const Node& right = nodes_[node.children[1]];
+      grow(left.bmin, left.bmax);
+      grow(right.bmin, right.bmax);
+      node.first = left.first;
+      node.end = right.end;
+    }
+  }
+}
+
+bool SceneBvh::GetBounds(r3::Vec3f& bmin, r3::Vec3f& bmax) const {
+  if (nodes_.empty()) {
+    return false;
+  }
+  bmin = r3::Vec3f(nodes_[0].bmin[0], nodes_[0].bmin[1], nodes_[0].bmin[2]);
+  bmax = r3::Vec3f(nodes_[0].bmax[0], nodes_[0].bmax[1], nodes_[0].bmax[2]);
+  return true;
+}
+
+size_t SceneBvh::Cull(const r3::Matrix4f& toClipFromWorld, std::vector<uint8_t>& visible) const {
+  visible.assign(items_.size(), 0);
+  if (nodes_.empty()) {
+    return 0;
+  }
+  const FrustumPlanes frustum(toClipFromWorld);
+  struct Entry {
+    uint32_t node;
+    int mask;  // planes the parent straddled
+  };
+  Entry stack[kMaxStackDepth];
+  int top = 0;
+  stack[0] = {0, kAllPlanes};
+  size_t count = 0;
+  while (top >= 0) {
+    const Entry entry = stack[top--];
+    const Node& node = nodes_[entry.node];
+    const int mask = frustum.Test(node.bmin, node.bmax, entry.mask);
+    if (mask < 0) {
+      continue;
+    }
+    if (mask != 0 && node.children[0] != 0 && top + 2 < kMaxStackDepth) {
+      stack[++top] = {node.children[0], mask};
+      stack[++top] = {node.children[1], mask};
+      continue;
+    }
+    // A leaf, or a subtree entirely inside: only the items still straddling a plane are tested.
+    for (uint32_t k = node.first; k < node.end; k++) {
+      const Item& item = items_[order_[k]];
+      if (item.bmin[0] > item.bmax[0] || (mask != 0 && frustum.Test(item.bmin, item.bmax, mask) < 0)) {
+        continue;
+      }
+      visible[order_[k]] = 1;
+      count++;
+    }
+  }
+  return count;
+}
+
+bool SceneBvh::Raycast(const r3::Vec3f& origin, const r3::Vec3f& direction, float maxDistance, RayHit& hit) const {
+  hit = RayHit{};
+  const float length = direction.Length();
+  if (nodes_.empty() || !(length > 0.0f)) {
+    return false;
+  }
+  const r3::Vec3f dir = direction / length;
+  float invDir[3];
+  for (int c = 0; c < 3; c++) {
+    invDir[c] = 1.0f / dir[c];
+  }
+
+  // Nearer child first, so the closest hit so far prunes the far one.
+  float closest = maxDistance;
+  uint32_t stack[kMaxStackDepth];
+  int top = 0;
+  stack[0] = 0;
+  while (top >= 0) {
+    const Node& node = nodes_[stack[top--]];
+    float entry = 0.0f;
+    if (!IntersectBox(node.bmin, node.bmax, origin, invDir, closest, &entry)) {
+      continue;
+    }
+    if (node.children[0] != 0 && top + 2 < kMaxStackDepth) {
+      const int nearChild = dir[node.axis] < 0.0f ? 1 : 0;
+      stack[++top] = node.children[1 - nearChild];
+      stack[++top] = node.children[nearChild];
+      continue;
+    }
+    for (uint32_t k = node.first; k < node.end; k++) {
+      const int itemIndex = static_cast<int>(order_[k]);
+      const Item& item = items_[itemIndex];
+      if (item.bmin[0] > item.bmax[0] || !IntersectBox(item.bmin, item.bmax, origin, invDir, closest, &entry)) {
+        continue;
+      }
+      const MeshTriangles* mesh = meshTriangles_.empty() ? nullptr : &meshTriangles_[item.mesh];
+      if (!mesh) {
+        closest = entry;
+        hit.item = itemIndex;
+        hit.primitive = -1;
+        continue;
+      }
+      if (!mesh->bvh.IsValid()) {
+        continue;
+      }
+      // In object space the direction isn't unit length any more, but t still measures along
+      // it, so it stays the world space distance.
+      const r3::Matrix4f objectFromWorld = item.world.Inverted();
+      r3::Vec3f objectOrigin, objectDir;
+      objectFromWorld.MultMatrixVec(origin, objectOrigin);
+      objectFromWorld.MultMatrixDir(dir, objectDir);
+      nanort::Ray<float> ray;
+      for (int c = 0; c < 3; c++) {
+        ray.org[c] = objectOrigin[c];
+        ray.dir[c] = objectDir[c];
+      }
+      ray.min_t = 0.0f;
+      ray.max_t = closest;
+      nanort::TriangleIntersector<float> intersector(mesh->positions.data(), mesh->indices.data(), 3 * sizeof(float));
+      nanort::TriangleIntersection<float> isect;
+      if (!mesh->bvh.Traverse(ray, intersector, &isect)) {
+        continue;
+      }
+      closest = isect.t;
+      const auto primitive = std::upper_bound(mesh->firstTriangle.begin(), mesh->firstTriangle.end(), isect.prim_id) - 1;
+      hit.item = itemIndex;
+      hit.primitive = static_cast<int>(primitive - mesh->firstTriangle.begin());
+      hit.triangle = isect.prim_id - *primitive;
+    }
+  }
+  if (hit.item < 0) {
+    return false;
+  }
+  hit.distance = closest;
+  hit.position = origin + dir * closest;
+  return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "SceneGraph.h"
+#include "linear.h"
+#include "tiny_gltf.h"
+
+// A two-level bounding volume hierarchy over the scene, for frustum culling and ray picking.
+//
+// The top level holds an item per placed mesh (a node, times its EXT_mesh_gpu_instancing
+// transforms if it has any), boxed in world space from the POSITION accessors' min and max.
+// nanort builds it once; after that Refit() only recomputes the boxes bottom up as nodes
+// move, which keeps the tree's shape and is far cheaper than a rebuild. The bottom level is a
+// nanort triangle BVH per mesh, in object space, so moving a node never touches it.
+//
+// Skinned meshes aren't in it: their vertices go wherever the joints take them, so they're
+// always drawn and can't be picked. Morphed meshes are boxed with every target fully applied,
+// and picked in their rest pose.
+//
+//   SceneBvh bvh;
+//   bvh.AddItem(nodeIndex, meshIndex);
+//   bvh.Build(model, scene);
+//   ...
+//   if (scene.UpdateWorldMatrices() > 0) bvh.Refit(scene);
+//   bvh.Cull(toClipFromWorld, visible);
+//   SceneBvh::RayHit hit;
+//   if (bvh.Raycast(aimOrigin, aimDirection, 10.0f, hit)) { ... }
+class SceneBvh {
+ public:
+  SceneBvh();
+  ~SceneBvh();
+
+  // Adds a mesh placed at a scene node, transformed by local (a GPU instance's) after the
+  // node's world matrix. Returns its index, which Cull() and Raycast() report.
+  int AddItem(int node, int mesh, const r3::Matrix4f& local = r3::Matrix4f::Identity());
+
+  // Boxes every item and builds both levels. Without triangles only the boxes are kept, and
+  // Raycast() reports the first box hit. False if there's nothing to build.
+  bool Build(const tinygltf::Model& model, const SceneGraph& scene, bool triangles = true);
+
+  // Moves the boxes to the scene's current world matrices.
+  void Refit(const SceneGraph& scene);
+
+  void Clear();
+
+  // visible[item] is set to 1 for items whose box intersects the view frustum and 0 for the
+  // rest. Subtrees fully inside a plane stop testing it, and ones inside all of them aren't
+  // tested at all. Returns the number visible.
+  size_t Cull(const r3::Matrix4f& toClipFromWorld, std::vector<uint8_t>& visible) const;
+
+  struct RayHit {
+    int item = -1;
+    int primitive = -1;     // of the item's mesh, -1 for a box hit
+    uint32_t triangle = 0;  // in the primitive
+    float distance = 0.0f;
+    r3::Vec3f position;  // world space
+  };
+  // The closest hit along a ray within maxDistance; direction needn't be normalized.
+  bool Raycast(const r3::Vec3f& origin, const r3::Vec3f& direction, float maxDistance, RayHit& hit) const;
+
+  // World space box around every item, as of the last Build or Refit. False when empty.
+  bool GetBounds(r3::Vec3f& bmin, r3::Vec3f& bmax) const;
+
+  size_t GetItemCount() const {
+    return items_.size();
+  }
+  int GetItemNode(int item) const {
+    return items_[item].node;
+  }
+
+ private:
+  struct Item {
+    int node = -1;  // into SceneGraph::GetNodes()
+    int mesh = -1;  // into tinygltf::Model::meshes
+    r3::Matrix4f local;
+    r3::Matrix4f world;  // the node's world matrix times local, as of the last Build or Refit
+    float bmin[3] = {0.0f, 0.0f, 0.0f};  // world space
+    float bmax[3] = {0.0f, 0.0f, 0.0f};
+  };
+  // The top level as nanort laid it out, children after their parent.
+  struct Node {
+    float bmin[3];
+    float bmax[3];
+    uint32_t first = 0;  // range of order_ under the node
+    uint32_t end = 0;
+    uint32_t children[2] = {0, 0};  // both 0 for leaves; the root is nobody's child
+    int axis = 0;
+  };
+  // An object space box and, when built, triangles of a mesh.
+  struct MeshBounds {
+    float center[3] = {0.0f, 0.0f, 0.0f};
+    float extent[3] = {-1.0f, -1.0f, -1.0f};  // negative when the mesh has no positions
+  };
+  struct MeshTriangles;
+
+  void BoxItem(Item& item, const SceneGraph& scene) const;
+  void RefitNodes();
+
+  std::vector<Item> items_;
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> order_;  // items, in leaf order
+  std::vector<MeshBounds> meshBounds_;
+  std::vector<MeshTriangles> meshTriangles_;  // per mesh, empty when built without triangles
+};
@@ -0,0 +1,184 @@
+#include "SceneGraph.h"
+
+#include <algorithm>
+
+namespace {
+r3::Matrix4f GetLocalMatrix(const tinygltf::Node& node) {
+  if (node.matrix.size() == 16) {
+    // glTF matrices are column major, same as r3::Matrix4.
+    r3::Matrix4f mat;
+    for (int i = 0; i < 16; i++) {
+      mat.m[i] = static_cast<float>(node.matrix[i]);
+    }
+    return mat;
+  }
+
+  r3::Vec3f translation(0.0f, 0.0f, 0.0f);
+  if (node.translation.size() == 3) {
+    translation = r3::Vec3f(static_cast<float>(node.translation[0]), static_cast<float>(node.translation[1]),
+                            static_cast<float>(node.translation[2]));
+  }
+
+  // glTF stores rotation as x, y, z, w.
+  r3::Quaternionf rotation = r3::Quaternionf::Identity();
+  if (node.rotation.size() == 4) {
+    rotation = r3::Quaternionf(static_cast<float>(node.rotation[0]), static_cast<float>(node.rotation[1]),
+                               static_cast<float>(node.rotation[2]), static_cast<float>(node.rotation[3]));
+  }
+
+  r3::Vec3f scale(1.0f, 1.0f, 1.0f);
+  if (node.scale.size() == 3) {
+    scale = r3::Vec3f(static_cast<float>(node.scale[0]), static_cast<float>(node.scale[1]), static_cast<float>(node.scale[2]));
+  }
+
+  return SceneGraph::ComposeLocal(translation, rotation, scale);
+}
+}  // namespace
+
+r3::Matrix4f SceneGraph::ComposeLocal(const r3::Vec3f& translation, const r3::Quaternionf& rotation, const r3::Vec3f& scale) {
+  // T * R * S without the matrix multiplies: the rotation columns scaled, plus translation.
+  r3::Matrix4f mat;
+  r3::Posef(rotation, translation).GetValue(mat);
+  for (int row = 0; row < 3; row++) {
+    mat(row, 0) *= scale.x;
+    mat(row, 1) *= scale.y;
+    mat(row, 2) *= scale.z;
+  }
+  return mat;
+}
+
+void SceneGraph::Clear() {
+  nodes_.clear();
+  instances_.clear();
+  dirty_.clear();
+}
+
+bool SceneGraph::Build(const tinygltf::Model& model) {
+  Clear();
+  const int numGltfNodes = static_cast<int>(model.nodes.size());
+  instances_.resize(numGltfNodes);
+
+  // Gather the roots. Without any scenes, every node that isn't somebody's child is a root.
+  std::vector<std::vector<int>> sceneRoots;
+  for (const auto& scene : model.scenes) {
+    sceneRoots.push_back(scene.nodes);
+  }
+  if (sceneRoots.empty()) {
+    std::vector<bool> isChild(numGltfNodes, false);
+    for (const auto& node : model.nodes) {
+      for (int child : node.children) {
+        if (child >= 0 && child < numGltfNodes) isChild[child] = true;
+      }
+    }
+    std::vector<int> roots;
+    for (int i = 0; i < numGltfNodes; i++) {
+      if (!isChild[i]) roots.push_back(i);
+    }
+    sceneRoots.push_back(std::move(roots));
+  }
+
+  // Depth first, pre-order, so each subtree ends up contiguous.
+  std::vector<int> visitedInScene(numGltfNodes, -1);
+  std::vector<std::pair<int, int>> stack;  // gltf node, flattened parent
+  for (int sceneIdx = 0; sceneIdx < static_cast<int>(sceneRoots.size()); sceneIdx++) {
+    const auto& roots = sceneRoots[sceneIdx];
+    for (auto it = roots.rbegin(); it != roots.rend(); ++it) {
+      stack.emplace_back(*it, -1);
+    }
+    while (!stack.empty()) {
+      auto [gltfIdx, parent] = stack.back();
+      stack.pop_back();
+      if (gltfIdx < 0 || gltfIdx >= numGltfNodes || visitedInScene[gltfIdx] == sceneIdx) {
+        // Out of range, or a node with two parents / a cycle. Either way not a valid glTF.
+        Clear();
+        return false;
+      }
+      visitedInScene[gltfIdx] = sceneIdx;
+
+      const auto& gltfNode = model.nodes[gltfIdx];
+      const int flatIdx = static_cast<int>(nodes_.size());
+      Node& node = nodes_.emplace_back();
+      node.parent = parent;
+      node.subtreeEnd = flatIdx + 1;
+      node.gltfNode = gltfIdx;
+      node.mesh = gltfNode.mesh;
+      node.local = GetLocalMatrix(gltfNode);
+      if (gltfNode.mesh >= 0 && static_cast<size_t>(gltfNode.mesh) < model.meshes.size()) {
+        // One weight per target, defaulting to 0 where neither node nor mesh gives them.
+        const auto& mesh = model.meshes[gltfNode.mesh];
+        size_t targets = 0;
+        for (const auto& prim : mesh.primitives) targets = std::max(targets, prim.targets.size());
+        const auto& weights = gltfNode.weights.empty() ? mesh.weights : gltfNode.weights;
+        node.weights.assign(targets, 0.0f);
+        std::copy(weights.begin(), weights.begin() + std::min(targets, weights.size()), node.weights.begin());
+      }
+      instances_[gltfIdx].push_back(flatIdx);
+
+      for (auto it = gltfNode.children.rbegin(); it != gltfNode.children.rend(); ++it) {
+        stack.emplace_back(*it, flatIdx);
+      }
+    }
+  }
+
+  // Children follow their parents, so a reverse sweep propagates the subtree extents.
+  for (int i = static_cast<int>(nodes_.size()) - 1; i >= 0; i--) {
+    const int parent = nodes_[i].parent;
+    if (parent >= 0) {
+      nodes_[parent].subtreeEnd = std::max(nodes_[parent].subtreeEnd, nodes_[i].subtreeEnd);
+    } else {
+      dirty_.push_back(i);
+    }
+  }
+  UpdateWorldMatrices();
+  return true;
+}
+
+void SceneGraph::MarkDirty(int nodeIndex) {
+  dirty_.push_back(nodeIndex);
+}
+
+void SceneGraph::SetLocalTransform(int nodeIndex, const r3::Vec3f& translation, const r3::Quaternionf& rotation,
+                                   const r3::Vec3f& scale) {
+  nodes_[nodeIndex].local = ComposeLocal(translation, rotation, scale);
+  MarkDirty(nodeIndex);
+}
+
+void SceneGraph::SetLocalMatrix(int nodeIndex, const r3::Matrix4f& local) {
+  nodes_[nodeIndex].local = local;
+  MarkDirty(nodeIndex);
+}
+
+void SceneGraph::SetMorphWeights(int nodeIndex, const float* weights, size_t count) {
+  auto& dst = nodes_[nodeIndex].weights;
+  std::copy(weights, weights + std::min(count, dst.size()), dst.begin());
+}
+
+size_t SceneGraph::UpdateWorldMatrices() {
+  if (dirty_.empty()) {
+    return 0;
+  }
+  std::sort(dirty_.begin(), dirty_.end());
+
+  size_t updated = 0;
+  int processedEnd = 0;
+  for (int idx : dirty_) {
+    if (idx < processedEnd) {
+      // Already covered by an ancestor's subtree.
+      continue;
+    }
+    const int end = nodes_[idx].subtreeEnd;
+    for (int i = idx; i < end; i++) {
+      Node& node = nodes_[i];
+      if (node.parent >= 0) {
+        node.world = nodes_[node.parent].world;
+        node.world.MultRight(node.local);
+      } else {
+        node.world = node.local;
+      }
+    }
+    updated += end - idx;
+    processedEnd = end;
+  }
+  dirty_.clear();
+  return updated;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "linear.h"
+#include "tiny_gltf.h"
+
+// A flattened, cached copy of the glTF node hierarchy.
+//
+// Nodes are stored in depth-first order, so every parent precedes its children and every
+// subtree occupies a contiguous range of the array. Local matrices are cached in float and
+// only rebuilt when a node's transform is set. UpdateWorldMatrices() then recomputes world
+// matrices for the changed subtrees only, with a linear walk over each range.
+class SceneGraph {
+ public:
+  struct Node {
+    int parent = -1;       // index into GetNodes(), -1 for roots
+    int subtreeEnd = 0;    // one past the last descendant in GetNodes()
+    int gltfNode = -1;     // index into tinygltf::Model::nodes
+    int mesh = -1;         // index into tinygltf::Model::meshes, or -1
+    r3::Matrix4f local;    // T * R * S or the node's matrix
+    r3::Matrix4f world;    // parent world * local
+    // A morph weight per target of the mesh, from the node or else the mesh.
+    std::vector<float> weights;
+  };
+
+  // Flattens the nodes of every scene in the model. Returns false if the hierarchy
+  // references nodes that don't exist.
+  bool Build(const tinygltf::Model& model);
+
+  void Clear();
+
+  // Set a node's local transform and mark its subtree for update.
+  void SetLocalTransform(int nodeIndex, const r3::Vec3f& translation, const r3::Quaternionf& rotation,
+                         const r3::Vec3f& scale);
+  void SetLocalMatrix(int nodeIndex, const r3::Matrix4f& local);
+
+  // Morph weights don't move anything, so they're read as they are each frame. count is
+  // clamped to the node's weight count.
+  void SetMorphWeights(int nodeIndex, const float* weights, size_t count);
+
+  // Propagates world matrices through the subtrees of nodes changed since the last call.
+  // Returns the number of world matrices recomputed, 0 for a static frame.
+  size_t UpdateWorldMatrices();
+
+  const std::vector<Node>& GetNodes() const {
+    return nodes_;
+  }
+
+  // Flattened indices of the instances of a glTF node (a node may appear in several scenes).
+  const std::vector<int>& GetInstances(int gltfNode) const {
+    return instances_[gltfNode];
+  }
+
+  static r3::Matrix4f ComposeLocal(const r3::Vec3f& translation, const r3::Quaternionf& rotation, const r3::Vec3f& scale);
+
+ private:
+  void MarkDirty(int nodeIndex);
+
+  std::vector<Node> nodes_;
+  std::vector<std::vector<int>> instances_;
+  std::vector<int> dirty_;
+};
@@ -1,98 +1,140 @@
 #include "Shader.h"
 
+#include <chrono>
+
 #include "AndroidOut.h"
 #include "Model.h"
+#include "ProgramCache.h"
 
 Shader* Shader::loadShader(const std::string& vertexSource, const std::string& fragmentSource,
                            const std::string& positionAttributeName, const std::string& uvAttributeName,
                            const std::string& toClipFromObjectUniformName) {
-  aout << "Loading shader with vertex source:\n" << vertexSource << "\nand fragment source:\n" << fragmentSource << std::endl;
-  Shader* shader = nullptr;
+  ProgramCache& cache = ProgramCache::Get();
+  const uint64_t key = cache.Key(vertexSource, fragmentSource);
+  GLuint program = cache.Load(key);
+  if (program) {
+    aout << "Shader program " << program << " loaded from the program cache" << std::endl;
+  } else {
+    const auto start = std::chrono::steady_clock::now();
+    program = linkProgram(vertexSource, fragmentSource);
+    if (!program) {
+      return nullptr;
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    aout << "Shader program " << program << " compiled in " << ms << " ms" << std::endl;
+    cache.Store(key, program, ms);
+  }
 
-  GLuint vertexShader = loadShader(GL_VERTEX_SHADER, vertexSource);
-  if (!vertexShader) {
-    aout << "Failed to load vertex shader." << std::endl;
-    return nullptr;
+  Shader* shader = fromProgram(program, positionAttributeName, uvAttributeName, toClipFromObjectUniformName);
+  if (!shader) {
+    glDeleteProgram(program);
   }
+  return shader;
+}
 
-  GLuint fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragmentSource);
-  if (!fragmentShader) {
-    glDeleteShader(vertexShader);
-    aout << "Failed to load fragment shader." << std::endl;
+Shader* Shader::fromProgram(GLuint program, const std::string& positionAttributeName, const std::string& uvAttributeName,
+                            const std::string& toClipFromObjectUniformName) {
+  // Get the attribute and uniform locations by name. That works for shaders that fix their
+  // attribute locations with layout(location = ...), as the glTF ones do, and for those that
+  // don't. Uniform blocks are given their binding points separately, with bindUniformBlock.
+  GLint positionAttribute = glGetAttribLocation(program, positionAttributeName.c_str());
+  GLint uvAttribute = glGetAttribLocation(program, uvAttributeName.c_str());
+  GLint toClipFromObjectUniform = -1;
+  bool hasUniforms = true;
+  if (!toClipFromObjectUniformName.empty()) {
+    toClipFromObjectUniform = glGetUniformLocation(program, toClipFromObjectUniformName.c_str());
+    hasUniforms = toClipFromObjectUniform != -1;
+  }
+
+  // Only create a new shader if all the attributes are found.
+  if (positionAttribute == -1 || uvAttribute == -1 || !hasUniforms) {
+    aout << "Failed to find all attributes or uniforms in shader program." << std::endl;
     return nullptr;
   }
+  return new Shader(program, positionAttribute, uvAttribute, toClipFromObjectUniform);
+}
+
+GLuint Shader::linkProgram(const std::string& vertexSource, const std::string& fragmentSource) {
+  GLuint program = startProgram(vertexSource, fragmentSource);
+  return program && finishProgram(program) ? program : 0;
+}
 
-  GLuint program = glCreateProgram();
+GLuint Shader::startProgram(const std::string& vertexSource, const std::string& fragmentSource) {
+  GLuint vertexShader = loadShader(GL_VERTEX_SHADER, vertexSource);
+  GLuint fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragmentSource);
+  GLuint program = vertexShader && fragmentShader ? glCreateProgram() : 0;
   if (program) {
     glAttachShader(program, vertexShader);
     glAttachShader(program, fragmentShader);
 
+    // Without the hint some drivers won't hand the binary to the program cache.
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
-    GLint linkStatus = GL_FALSE;
-    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus != GL_TRUE) {
-      GLint logLength = 0;
-      glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
-
-      // If we fail to link the shader program, log the result for debugging
-      if (logLength) {
-        std::vector<GLchar> log(logLength + 1, 0);
-        glGetProgramInfoLog(program, logLength, nullptr, log.data());
-        aout << "Failed to link program with:\n" << log.data() << std::endl;
-      }
-
-      glDeleteProgram(program);
-    } else {
-      // Get the attribute and uniform locations by name. You may also choose to hardcode
-      // indices with layout= in your shader, but it is not done in this sample
-      GLint positionAttribute = glGetAttribLocation(program, positionAttributeName.c_str());
-      GLint uvAttribute = glGetAttribLocation(program, uvAttributeName.c_str());
-      GLint toClipFromObjectUniform = glGetUniformLocation(program, toClipFromObjectUniformName.c_str());
-
-      // Only create a new shader if all the attributes are found.
-      if (positionAttribute != -1 && uvAttribute != -1 && toClipFromObjectUniform != -1) {
-        shader = new Shader(program, positionAttribute, uvAttribute, toClipFromObjectUniform);
-        aout << "Shader loaded successfully with program ID: " << program << std::endl;
-      } else {
-        aout << "Failed to find all attributes or uniforms in shader program." << std::endl;
-        glDeleteProgram(program);
-      }
-    }
   }
 
-  // The shaders are no longer needed once the program is linked. Release their memory.
+  // Attached shaders live until the program lets go of them in finishProgram.
   glDeleteShader(vertexShader);
   glDeleteShader(fragmentShader);
-
-  return shader;
+  return program;
 }
 
-GLuint Shader::loadShader(GLenum shaderType, const std::string& shaderSource) {
-  GLuint shader = glCreateShader(shaderType);
-  if (shader) {
-    auto* shaderRawString = (GLchar*)shaderSource.c_str();
-    GLint shaderLength = shaderSource.length();
-    glShaderSource(shader, 1, &shaderRawString, &shaderLength);
-    glCompileShader(shader);
-
+bool Shader::finishProgram(GLuint& program) {
+  GLuint shaders[2] = {0, 0};
+  GLsizei shaderCount = 0;
+  glGetAttachedShaders(program, 2, &shaderCount, shaders);
+  bool compiled = true;
+  for (GLsizei i = 0; i < shaderCount; i++) {
     GLint shaderCompiled = 0;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &shaderCompiled);
+    glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &shaderCompiled);
 
     // If the shader doesn't compile, log the result to the terminal for debugging
     if (!shaderCompiled) {
       GLint infoLength = 0;
-      glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLength);
+      glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH, &infoLength);
 
       if (infoLength) {
         std::vector<GLchar> infoLog(infoLength + 1, 0);
-        glGetShaderInfoLog(shader, infoLength, nullptr, infoLog.data());
+        glGetShaderInfoLog(shaders[i], infoLength, nullptr, infoLog.data());
         aout << "Failed to compile with:\n" << infoLog.data() << std::endl;
       }
+      compiled = false;
+    }
+  }
 
-      glDeleteShader(shader);
-      shader = 0;
+  GLint linkStatus = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+  if (compiled && linkStatus != GL_TRUE) {
+    GLint logLength = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+
+    // If we fail to link the shader program, log the result for debugging
+    if (logLength) {
+      std::vector<GLchar> log(logLength + 1, 0);
+      glGetProgramInfoLog(program, logLength, nullptr, log.data());
+      aout << "Failed to link program with:\n" << log.data() << std::endl;
     }
   }
+
+  // The shaders are no longer needed once the program is linked. Release their memory.
+  for (GLsizei i = 0; i < shaderCount; i++) {
+    glDetachShader(program, shaders[i]);
+  }
+  if (shaderCount != 2 || linkStatus != GL_TRUE) {
+    glDeleteProgram(program);
+    program = 0;
+    return false;
+  }
+  return true;
+}
+
+GLuint Shader::loadShader(GLenum shaderType, const std::string& shaderSource) {
+  GLuint shader = glCreateShader(shaderType);
+  if (shader) {
+    auto* shaderRawString = (GLchar*)shaderSource.c_str();
+    GLint shaderLength = shaderSource.length();
+    glShaderSource(shader, 1, &shaderRawString, &shaderLength);
+    glCompileShader(shader);
+  }
   return shader;
 }
 
@@ -105,23 +147,27 @@ void Shader::deactivate() const {
 }
 
 void Shader::drawModel(const Model& model) const {
-  // The position attribute is 3 floats
-  glVertexAttribPointer(position_, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), model.getVertexData());
-  glEnableVertexAttribArray(position_);
-
-  // The uv attribute is 2 floats
-  glVertexAttribPointer(uv_, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), ((uint8_t*)model.getVertexData()) + sizeof(r3::Vec3f));
-  glEnableVertexAttribArray(uv_);
+  // The model's vertex array object already holds its buffers and attribute layout.
+  glBindVertexArray(model.getVertexArray());
 
   // Setup the texture
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, model.getTexture().getTextureID());
 
   // Draw as indexed triangles
-  glDrawElements(GL_TRIANGLES, model.getIndexCount(), GL_UNSIGNED_SHORT, model.getIndexData());
+  glDrawElements(GL_TRIANGLES, model.getIndexCount(), GL_UNSIGNED_SHORT, nullptr);
 
-  glDisableVertexAttribArray(uv_);
-  glDisableVertexAttribArray(position_);
+  glBindVertexArray(0);
+}
+
+bool Shader::bindUniformBlock(const std::string& blockName, GLuint binding) const {
+  GLuint blockIndex = glGetUniformBlockIndex(program_, blockName.c_str());
+  if (blockIndex == GL_INVALID_INDEX) {
+    aout << "No uniform block " << blockName << " in program " << program_ << std::endl;
+    return false;
+  }
+  glUniformBlockBinding(program_, blockIndex, binding);
+  return true;
 }
 
 void Shader::setToClipFromObject(const r3::Matrix4f& toClipFromObject) const {
@@ -21,19 +21,45 @@ class Shader {
   /*!
    * Loads a shader given the full sourcecode and names for necessary attributes and uniforms to
    * link to. Returns a valid shader on success or null on failure. Shader resources are
-   * automatically cleaned up on destruction.
+   * automatically cleaned up on destruction. The linked program comes from the ProgramCache
+   * when it has one for these sources, and goes into it otherwise.
    *
    * @param vertexSource The full source code for your vertex program
    * @param fragmentSource The full source code of your fragment program
    * @param positionAttributeName The name of the position attribute in your vertex program
    * @param uvAttributeName The name of the uv coordinate attribute in your vertex program
-   * @param toClipFromObjectUniformName The name of your model/view/projection matrix uniform
+   * @param toClipFromObjectUniformName The name of your model/view/projection matrix uniform, or
+   * empty if the program gets its matrices from a uniform block instead
    * @return a valid Shader on success, otherwise null.
    */
   static Shader* loadShader(const std::string& vertexSource, const std::string& fragmentSource,
                             const std::string& positionAttributeName, const std::string& uvAttributeName,
                             const std::string& toClipFromObjectUniformName);
 
+  /*!
+   * Wraps a linked program, looking up the same attributes and uniform as loadShader. The
+   * Shader owns the program on success; on failure the caller still does.
+   * @return a valid Shader on success, otherwise null.
+   */
+  static Shader* fromProgram(GLuint program, const std::string& positionAttributeName, const std::string& uvAttributeName,
+                             const std::string& toClipFromObjectUniformName);
+
+  /*!
+   * Issues the compile and link of a program without waiting on either. With
+   * GL_KHR_parallel_shader_compile the driver works on them off this thread until
+   * GL_COMPLETION_STATUS_KHR says they're done; without it, finishProgram blocks until they are.
+   * @return the id of the program, or 0 if GL couldn't create the objects
+   */
+  static GLuint startProgram(const std::string& vertexSource, const std::string& fragmentSource);
+
+  /*!
+   * Checks how a started program's compile and link went, logging why they failed, and frees
+   * its shaders.
+   * @param program from startProgram, deleted and zeroed on failure
+   * @return true if the program linked
+   */
+  static bool finishProgram(GLuint& program);
+
   inline ~Shader() {
     if (program_) {
       glDeleteProgram(program_);
@@ -52,7 +78,8 @@ class Shader {
   void deactivate() const;
 
   /*!
-   * Renders a single model
+   * Renders a single model from its own buffers. The program must take the position and uv at
+   * Model::kPositionLocation and Model::kUVLocation.
    * @param model a model to render
    */
   void drawModel(const Model& model) const;
@@ -63,9 +90,33 @@ class Shader {
    */
   void setToClipFromObject(const r3::Matrix4f& toClipFromObject) const;
 
+  /*!
+   * Assigns a uniform block of the program to a uniform buffer binding point.
+   * @param blockName the name of the block in the shader source
+   * @param binding the index later passed to glBindBufferRange
+   * @return false if the program has no such block
+   */
+  bool bindUniformBlock(const std::string& blockName, GLuint binding) const;
+
+  /*!
+   * @return the GL program id, for callers that track bound state themselves
+   */
+  GLuint getProgram() const {
+    return program_;
+  }
+
  private:
   /*!
-   * Helper function to load a shader of a given type
+   * startProgram and finishProgram, waiting on the driver in between
+   * @param vertexSource The full source code for your vertex program
+   * @param fragmentSource The full source code of your fragment program
+   * @return the id of the program, as returned by glCreateProgram, or 0 in the case of an error
+   */
+  static GLuint linkProgram(const std::string& vertexSource, const std::string& fragmentSource);
+
+  /*!
+   * Helper function to create a shader of a given type and issue its compile, which
+   * finishProgram checks
    * @param shaderType The OpenGL shader type. Should either be GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
    * @param shaderSource The full source of the shader
    * @return the id of the shader, as returned by glCreateShader, or 0 in the case of an error
@@ -0,0 +1,166 @@
+#include "ShaderVariants.h"
+
+// gl2ext.h needs gl3.h's platform macros first.
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+#include <android/log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "ProgramCache.h"
+
+namespace {
+bool HasParallelShaderCompile() {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+    if (ext && !strcmp(ext, "GL_KHR_parallel_shader_compile")) {
+      return true;
+    }
+  }
+  return false;
+}
+
+double MsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+}  // namespace
+
+uint32_t MaterialShaderFeatures(const tinygltf::Model& model, int material) {
+  if (material < 0 || material >= static_cast<int>(model.materials.size())) {
+    return 0;
+  }
+  uint32_t features = 0;
+  if (model.materials[material].alphaMode == "MASK") {
+    features |= kShaderAlphaMask;
+  }
+  return features;
+}
+
+void ShaderVariants::Request(uint32_t key, const std::string& vertexSource, const std::string& fragmentSource) {
+  if (std::find(requested_.begin(), requested_.end(), key) != requested_.end()) {
+    return;
+  }
+  if (!queried_) {
+    queried_ = true;
+    stats_.parallel = HasParallelShaderCompile();
+    // Let the driver pick how many threads; the default may be none.
+    auto maxThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(
+        stats_.parallel ? eglGetProcAddress("glMaxShaderCompilerThreadsKHR") : nullptr);
+    if (maxThreads) maxThreads(0xffffffff);
+  }
+  if (requested_.empty()) {
+    firstRequest_ = Clock::now();
+  }
+  requested_.push_back(key);
+  stats_.requested++;
+  reported_ = false;
+
+  Pending pending;
+  pending.key = key;
+  if (!stats_.parallel) {
+    // Compiling here would stall whichever frame asked; Poll() builds these one a frame.
+    pending.vertexSource = vertexSource;
+    pending.fragmentSource = fragmentSource;
+    pending_.push_back(std::move(pending));
+    return;
+  }
+  if (Start(pending, vertexSource, fragmentSource)) {
+    pending_.push_back(pending);
+  }
+}
+
+// Takes the variant from the ProgramCache if it's there and starts compiling it otherwise.
+// False when there's nothing left to wait for.
+bool ShaderVariants::Start(Pending& pending, const std::string& vertexSource, const std::string& fragmentSource) {
+  ProgramCache& cache = ProgramCache::Get();
+  pending.cacheKey = cache.Key(vertexSource, fragmentSource);
+  pending.start = Clock::now();
+  if (GLuint program = cache.Load(pending.cacheKey)) {
+    Shader* shader = Shader::fromProgram(program, "inPosition", "inUV", "");
+    if (shader) {
+      shaders_[pending.key].reset(shader);
+      ready_.push_back(pending.key);
+      stats_.ready++;
+      stats_.cached++;
+      return false;
+    }
+    glDeleteProgram(program);
+  }
+  pending.program = Shader::startProgram(vertexSource, fragmentSource);
+  return true;
+}
+
+std::vector<uint32_t> ShaderVariants::Poll() {
+  if (!stats_.parallel && !pending_.empty()) {
+    // One variant a frame, loaded or compiled and linked on the spot.
+    Pending next = std::move(pending_.front());
+    pending_.erase(pending_.begin());
+    if (Start(next, next.vertexSource, next.fragmentSource)) {
+      Finish(next);
+    }
+  }
+  for (size_t i = 0; stats_.parallel && i < pending_.size();) {
+    GLint done = GL_FALSE;
+    if (pending_[i].program) glGetProgramiv(pending_[i].program, GL_COMPLETION_STATUS_KHR, &done);
+    if (pending_[i].program && !done) {
+      i++;
+      continue;
+    }
+    Finish(pending_[i]);
+    pending_.erase(pending_.begin() + i);
+  }
+  if (pending_.empty() && !requested_.empty() && !reported_) {
+    reported_ = true;
+    stats_.prewarmMs = MsBetween(firstRequest_, Clock::now());
+    __android_log_print(ANDROID_LOG_INFO, "ShaderVariants",
+                        "%u of %u variants ready (%u cached, %u failed) in %.1f ms, %s, %u frames skipped %u draws meanwhile",
+                        stats_.ready, stats_.requested, stats_.cached, stats_.failed, stats_.prewarmMs,
+                        stats_.parallel ? "compiled in parallel" : "compiled one a frame", stats_.missedFrames,
+                        stats_.missedDraws);
+  }
+  std::vector<uint32_t> ready;
+  ready.swap(ready_);
+  return ready;
+}
+
+void ShaderVariants::Finish(const Pending& pending) {
+  GLuint program = pending.program;
+  Shader* shader = program && Shader::finishProgram(program) ? Shader::fromProgram(program, "inPosition", "inUV", "") : nullptr;
+  if (!shader) {
+    if (program) glDeleteProgram(program);
+    __android_log_print(ANDROID_LOG_ERROR, "ShaderVariants", "Variant 0x%x failed to build", pending.key);
+    stats_.failed++;
+    return;
+  }
+  ProgramCache::Get().Store(pending.cacheKey, program, MsBetween(pending.start, Clock::now()));
+  shaders_[pending.key].reset(shader);
+  ready_.push_back(pending.key);
+  stats_.ready++;
+}
+
+void ShaderVariants::CountMisses(uint32_t draws) {
+  if (draws == 0) {
+    return;
+  }
+  // Only the first is logged; the rest are in the stats and the prewarm summary.
+  if (stats_.missedFrames++ == 0) {
+    __android_log_print(ANDROID_LOG_WARN, "ShaderVariants", "Skipping %u draws until their variants are ready", draws);
+  }
+  stats_.missedDraws += draws;
+}
+
+void ShaderVariants::Clear() {
+  for (const auto& pending : pending_) {
+    glDeleteProgram(pending.program);
+  }
+  pending_.clear();
+  shaders_.clear();
+  requested_.clear();
+  ready_.clear();
+  reported_ = false;
+  stats_ = Stats{};
+  queried_ = false;
+}
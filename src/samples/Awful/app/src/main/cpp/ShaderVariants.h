@@ -0,0 +1,106 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Shader.h"
+#include "tiny_gltf.h"
+
+// Features a shader variant is compiled with; its key ORs them together. Each is a define
+// ahead of the shared source (see GltfRenderer's shaders).
+enum ShaderFeature : uint32_t {
+  kShaderSkinned = 1 << 0,       // MAX_JOINTS: palette skinning in the vertex shader
+  kShaderMorphed = 1 << 1,       // MAX_MORPH_TARGETS: deltas from the morph texture
+  kShaderAlphaMask = 1 << 2,     // ALPHA_MASK: fragments under the material's alphaCutoff are discarded
+  kShaderTextureArray = 1 << 3,  // TEXTURE_ARRAY: the base color is a layer of a texture array
+};
+
+// The features a glTF material asks for; -1 is the default material. The deformations
+// depend on the primitive and where it's deformed, so the renderer adds those.
+uint32_t MaterialShaderFeatures(const tinygltf::Model& model, int material);
+
+// Linked programs by variant key. Every variant a model needs is requested at load and built
+// in the background: with GL_KHR_parallel_shader_compile the driver compiles on its own
+// threads and Poll() picks up the finished ones without waiting. Without it Poll() compiles
+// and links one variant a frame, so no frame waits on more than one. Either way programs
+// come from the ProgramCache when it has them.
+//
+// Variants take their matrices from uniform blocks and name their attributes inPosition and
+// inUV, like every program here.
+//
+//   variants.Request(key, vertexSource, fragmentSource);  // at load, for every key
+//   ...
+//   for (uint32_t key : variants.Poll()) { ... }  // bind the new programs' blocks
+//   if (const Shader* shader = variants.Get(key)) { ... } else { missed++; }
+//   variants.CountMisses(missed);
+class ShaderVariants {
+ public:
+  // Starts building a variant, or queues it for Poll() without parallel compile. Keys already
+  // requested are ignored.
+  void Request(uint32_t key, const std::string& vertexSource, const std::string& fragmentSource);
+
+  // Finishes the variants the driver is done with and returns their keys. Never waits on the
+  // driver.
+  std::vector<uint32_t> Poll();
+
+  // Null until the variant is ready, and for variants that failed.
+  const Shader* Get(uint32_t key) const {
+    auto it = shaders_.find(key);
+    return it == shaders_.end() ? nullptr : it->second.get();
+  }
+
+  bool IsPending() const {
+    return !pending_.empty();
+  }
+
+  // Records a frame that skipped draws because their variant wasn't ready; 0 is ignored. Only
+  // the first such frame is logged, the rest go to the stats.
+  void CountMisses(uint32_t draws);
+
+  void Clear();
+
+  struct Stats {
+    bool parallel = false;  // GL_KHR_parallel_shader_compile
+    uint32_t requested = 0;
+    uint32_t ready = 0;
+    uint32_t cached = 0;  // of ready, loaded from the ProgramCache
+    uint32_t failed = 0;
+    double prewarmMs = 0.0;     // first request to last variant ready, to the frame when polled
+    uint32_t missedFrames = 0;  // frames that skipped a draw waiting on a variant
+    uint32_t missedDraws = 0;
+  };
+  const Stats& GetStats() const {
+    return stats_;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Pending {
+    uint32_t key = 0;
+    GLuint program = 0;
+    uint64_t cacheKey = 0;
+    Clock::time_point start;
+    // Without parallel compile, what Poll() builds the variant from when its turn comes.
+    std::string vertexSource;
+    std::string fragmentSource;
+  };
+
+  bool Start(Pending& pending, const std::string& vertexSource, const std::string& fragmentSource);
+  void Finish(const Pending& pending);
+
+  std::unordered_map<uint32_t, std::unique_ptr<Shader>> shaders_;
+  std::vector<uint32_t> requested_;
+  std::vector<Pending> pending_;
+  std::vector<uint32_t> ready_;  // since the last Poll
+  Clock::time_point firstRequest_;
+  bool queried_ = false;
+  bool reported_ = false;
+  Stats stats_;
+};
@@ -0,0 +1,164 @@
+#include "Skinning.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "GltfAccess.h"
+#include "ThreadPool.h"
+
+namespace {
+// GCC/Clang vector extension, as in MipGenerator: a matrix column per vector.
+typedef float Float4 __attribute__((vector_size(16)));
+
+constexpr size_t kVerticesPerTask = 1024;
+
+Float4 Load(const float* p) {
+  Float4 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+Float4 Splat(float v) {
+  return Float4{v, v, v, v};
+}
+}  // namespace
+
+std::vector<Skin> BuildSkins(const tinygltf::Model& model, const SceneGraph& scene) {
+  std::vector<Skin> skins(model.skins.size());
+  for (size_t s = 0; s < model.skins.size(); s++) {
+    const tinygltf::Skin& gltfSkin = model.skins[s];
+    Skin& skin = skins[s];
+    skin.name = gltfSkin.name;
+
+    // Without inverse bind matrices every joint's is the identity.
+    std::vector<float> inverseBind;
+    if (gltfSkin.inverseBindMatrices >= 0 &&
+        (ReadAccessorFloats(model, gltfSkin.inverseBindMatrices, inverseBind) != 16 ||
+         inverseBind.size() != gltfSkin.joints.size() * 16)) {
+      __android_log_print(ANDROID_LOG_ERROR, "Skinning", "Skin %s: bad inverse bind matrices", skin.name.c_str());
+      continue;
+    }
+    for (size_t j = 0; j < gltfSkin.joints.size(); j++) {
+      const int node = gltfSkin.joints[j];
+      if (node < 0 || static_cast<size_t>(node) >= model.nodes.size() || scene.GetInstances(node).empty()) {
+        __android_log_print(ANDROID_LOG_ERROR, "Skinning", "Skin %s: joint %zu isn't in the scene", skin.name.c_str(), j);
+        skin.joints.clear();
+        skin.inverseBind.clear();
+        break;
+      }
+      // A joint in several scenes drives the skin from its first.
+      skin.joints.push_back(scene.GetInstances(node)[0]);
+      r3::Matrix4f& matrix = skin.inverseBind.emplace_back();
+      if (!inverseBind.empty()) {
+        std::copy(&inverseBind[j * 16], &inverseBind[j * 16] + 16, matrix.m);
+      }
+    }
+  }
+  return skins;
+}
+
+void ComputeJointPalette(const Skin& skin, const SceneGraph& scene, std::vector<r3::Matrix4f>& palette) {
+  const auto& nodes = scene.GetNodes();
+  palette.resize(skin.joints.size());
+  for (size_t j = 0; j < skin.joints.size(); j++) {
+    palette[j] = nodes[skin.joints[j]].world;
+    palette[j].MultRight(skin.inverseBind[j]);
+  }
+}
+
+uint32_t JointLimit(const PrimitiveGeometry& geom) {
+  const VertexAttribute* joints = geom.FindAttribute(kLocationJoints0);
+  const VertexAttribute* weights = geom.FindAttribute(kLocationWeights0);
+  if (geom.quantized || !joints || !weights) {
+    return 0;
+  }
+  float limit = 0.0f;
+  for (uint32_t v = 0; v < geom.vertexCount; v++) {
+    const uint8_t* vertex = geom.vertices.data() + size_t(v) * geom.stride;
+    const float* j = reinterpret_cast<const float*>(vertex + joints->offset);
+    const float* w = reinterpret_cast<const float*>(vertex + weights->offset);
+    for (int k = 0; k < 4; k++) {
+      if (w[k] > 0.0f) limit = std::max(limit, j[k] + 1.0f);
+    }
+  }
+  return static_cast<uint32_t>(limit);
+}
+
+bool ExtractSkinnedVertices(const PrimitiveGeometry& geom, uint32_t jointCount, SkinnedVertices& out) {
+  const VertexAttribute* position = geom.FindAttribute(kLocationPosition);
+  const VertexAttribute* normal = geom.FindAttribute(kLocationNormal);
+  const VertexAttribute* joints = geom.FindAttribute(kLocationJoints0);
+  const VertexAttribute* weights = geom.FindAttribute(kLocationWeights0);
+  if (geom.quantized || !position || !joints || !weights || jointCount == 0) {
+    return false;
+  }
+  auto source = [&](uint32_t v, const VertexAttribute& attribute) {
+    return reinterpret_cast<const float*>(geom.vertices.data() + size_t(v) * geom.stride + attribute.offset);
+  };
+  out = SkinnedVertices{};
+  out.vertexCount = geom.vertexCount;
+  out.positions.resize(size_t(geom.vertexCount) * 3);
+  if (normal) out.normals.resize(size_t(geom.vertexCount) * 3);
+  out.joints.resize(size_t(geom.vertexCount) * 4);
+  out.weights.resize(size_t(geom.vertexCount) * 4);
+  for (uint32_t v = 0; v < geom.vertexCount; v++) {
+    memcpy(&out.positions[size_t(v) * 3], source(v, *position), 3 * sizeof(float));
+    if (normal) memcpy(&out.normals[size_t(v) * 3], source(v, *normal), 3 * sizeof(float));
+    const float* j = source(v, *joints);
+    const float* w = source(v, *weights);
+    uint16_t* dstJoints = &out.joints[size_t(v) * 4];
+    float* dstWeights = &out.weights[size_t(v) * 4];
+    float sum = 0.0f;
+    for (int k = 0; k < 4; k++) {
+      const bool valid = j[k] >= 0.0f && j[k] < float(jointCount);
+      dstJoints[k] = valid ? static_cast<uint16_t>(j[k]) : 0;
+      dstWeights[k] = valid ? std::max(w[k], 0.0f) : 0.0f;
+      sum += dstWeights[k];
+    }
+    // Exporters don't all normalize, and dropped joints leave a gap.
+    if (sum > 0.0f) {
+      for (int k = 0; k < 4; k++) dstWeights[k] /= sum;
+    } else {
+      dstWeights[0] = 1.0f;
+    }
+  }
+  return true;
+}
+
+void SkinVertices(const SkinnedVertices& in, const r3::Matrix4f* palette, float* outPositions, float* outNormals,
+                  ThreadPool* pool, const float* positions, const float* normals) {
+  if (!positions) positions = in.positions.data();
+  if (!normals) normals = in.normals.empty() ? nullptr : in.normals.data();
+  const bool skinNormals = outNormals && normals;
+  ParallelForRanges(pool, in.vertexCount, kVerticesPerTask, [&](size_t begin, size_t end) {
+    for (size_t v = begin; v < end; v++) {
+      // Blend the joint matrices column by column, skipping the unused influences most
+      // vertices have.
+      const uint16_t* joints = &in.joints[v * 4];
+      const float* weights = &in.weights[v * 4];
+      Float4 c0 = Splat(0.0f), c1 = c0, c2 = c0, c3 = c0;
+      for (int k = 0; k < 4; k++) {
+        if (weights[k] == 0.0f) continue;
+        const float* m = palette[joints[k]].m;  // column major
+        const Float4 w = Splat(weights[k]);
+        c0 += Load(m) * w;
+        c1 += Load(m + 4) * w;
+        c2 += Load(m + 8) * w;
+        c3 += Load(m + 12) * w;
+      }
+      const float* p = &positions[v * 3];
+      const Float4 position = c0 * Splat(p[0]) + c1 * Splat(p[1]) + c2 * Splat(p[2]) + c3;
+      memcpy(&outPositions[v * 3], &position, 3 * sizeof(float));
+      if (skinNormals) {
+        const float* n = &normals[v * 3];
+        const Float4 normal = c0 * Splat(n[0]) + c1 * Splat(n[1]) + c2 * Splat(n[2]);
+        const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        const Float4 unit = length > 0.0f ? normal * Splat(1.0f / length) : normal;
+        memcpy(&outNormals[v * 3], &unit, 3 * sizeof(float));
+      }
+    }
+  });
+}
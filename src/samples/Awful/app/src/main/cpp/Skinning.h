@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "GltfGeometry.h"
+#include "SceneGraph.h"
+#include "linear.h"
+#include "tiny_gltf.h"
+
+class ThreadPool;
+
+// Linear blend skinning for glTF skins. A skin's joint palette (each joint's world matrix
+// times its inverse bind matrix) takes bind pose vertices straight to world space, so the
+// skinned mesh node's own transform is ignored, as the spec says.
+//
+// There are two backends, chosen per renderer:
+//  - GPU: the palette goes into a uniform block and the vertex shader blends up to four
+//    joints per vertex.
+//  - CPU: SkinVertices blends positions and normals here, a vertex's columns per SIMD
+//    vector, spread over a thread pool, and the result is streamed to a vertex buffer. It
+//    suits skins too big for a uniform block, and GPUs where vertex work is the bottleneck.
+
+enum class SkinningMode { Gpu, Cpu };
+
+struct Skin {
+  std::string name;
+  std::vector<int> joints;  // into SceneGraph::GetNodes()
+  std::vector<r3::Matrix4f> inverseBind;
+};
+
+// Resolves every skin in the model against the scene graph. A joint node that is in no
+// scene (or a skin that's malformed) leaves that skin with no joints, which draws unskinned.
+std::vector<Skin> BuildSkins(const tinygltf::Model& model, const SceneGraph& scene);
+
+// Joint world times inverse bind for every joint, into palette (resized to fit).
+void ComputeJointPalette(const Skin& skin, const SceneGraph& scene, std::vector<r3::Matrix4f>& palette);
+
+// One past the largest joint index any vertex gives weight to: the fewest joints a skin
+// needs to drive the primitive. 0 without JOINTS_0 and WEIGHTS_0 in the float stream.
+uint32_t JointLimit(const PrimitiveGeometry& geom);
+
+// Bind pose data for CPU skinning, pulled out of a primitive's float vertex stream.
+struct SkinnedVertices {
+  uint32_t vertexCount = 0;
+  std::vector<float> positions;  // xyz per vertex
+  std::vector<float> normals;    // xyz per vertex, empty without NORMAL
+  std::vector<uint16_t> joints;  // four per vertex, indices into the palette
+  std::vector<float> weights;    // four per vertex, summing to 1
+};
+
+// Needs JOINTS_0 and WEIGHTS_0, and the unquantized stream. Joints past jointCount are
+// clamped to joint 0 with their weight dropped.
+bool ExtractSkinnedVertices(const PrimitiveGeometry& geom, uint32_t jointCount, SkinnedVertices& out);
+
+// Skins every vertex with palette, writing xyz positions (and normals, if the source has
+// them) tightly packed. Normals are transformed by the blended matrix and renormalized, which
+// is right for rigid and uniformly scaled joints. Vertex ranges are spread over pool when
+// there is one. positions and normals, when given, stand in for the bind pose ones in in, e.g.
+// after morphing.
+void SkinVertices(const SkinnedVertices& in, const r3::Matrix4f* palette, float* outPositions, float* outNormals,
+                  ThreadPool* pool = nullptr, const float* positions = nullptr, const float* normals = nullptr);
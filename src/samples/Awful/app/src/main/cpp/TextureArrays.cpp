@@ -0,0 +1,76 @@
+#include "TextureArrays.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+TextureArrayPlan PlanTextureArrays(const std::vector<const TextureData*>& chains, uint32_t maxSize, uint32_t maxLayers) {
+  // Ordered, so the plan doesn't depend on hashing.
+  using Shape = std::tuple<GLenum, bool, uint32_t, uint32_t, size_t>;
+  std::map<Shape, std::vector<size_t>> groups;
+  for (size_t i = 0; i < chains.size(); i++) {
+    const TextureData* chain = chains[i];
+    if (!chain || chain->levels.empty()) continue;
+    const TextureLevel& base = chain->levels[0];
+    if (base.width > maxSize || base.height > maxSize) continue;
+    groups[{chain->internalFormat, chain->compressed, base.width, base.height, chain->levels.size()}].push_back(i);
+  }
+
+  TextureArrayPlan plan;
+  plan.layers.assign(chains.size(), {});
+  for (const auto& [shape, members] : groups) {
+    for (size_t first = 0; first < members.size(); first += maxLayers) {
+      const size_t count = std::min<size_t>(maxLayers, members.size() - first);
+      if (count < 2) continue;
+      TextureArrayPlan::Array& array = plan.arrays.emplace_back();
+      std::tie(array.internalFormat, array.compressed, array.width, array.height, std::ignore) = shape;
+      array.levels = static_cast<uint32_t>(std::get<4>(shape));
+      array.members.assign(members.begin() + first, members.begin() + first + count);
+      for (size_t layer = 0; layer < count; layer++) {
+        plan.layers[array.members[layer]] = {static_cast<int>(plan.arrays.size()) - 1, static_cast<int>(layer)};
+      }
+    }
+  }
+  return plan;
+}
+
+bool PackTextureArray(const TextureArrayPlan::Array& array, const std::vector<const TextureData*>& chains,
+                      const std::string& label, GpuUploader::TextureUpload& upload) {
+  upload.target = GL_TEXTURE_2D_ARRAY;
+  upload.internalFormat = array.internalFormat;
+  upload.compressed = array.compressed;
+  upload.layers = static_cast<uint32_t>(array.members.size());
+  // A level's layers are consecutive in memory, so the upload owns a copy of each level.
+  for (uint32_t l = 0; l < array.levels; l++) {
+    const TextureLevel& first = chains[array.members[0]]->levels[l];
+    std::vector<uint8_t>& level = upload.storage.emplace_back();
+    level.reserve(first.data.size() * array.members.size());
+    for (size_t member : array.members) {
+      const TextureLevel& layer = chains[member]->levels[l];
+      if (layer.data.size() != first.data.size()) {
+        __android_log_print(ANDROID_LOG_ERROR, "TextureArrays", "%s: layer %zu level %u doesn't match the first",
+                            label.c_str(), member, l);
+        return false;
+      }
+      level.insert(level.end(), layer.data.begin(), layer.data.end());
+    }
+    upload.levels.push_back({first.width, first.height, level.data(), level.size()});
+  }
+  return true;
+}
+
+GLuint UploadTextureArray(GpuUploader::TextureUpload upload, const GpuResourceTag& tag, GpuUploader& uploader) {
+  upload.texture = GpuResourceTracker::Get().CreateTexture(tag);
+  const GLuint texture = upload.texture;
+  uploader.UploadTexture(std::move(upload));
+  return texture;
+}
+
+GLuint UploadTextureArray(const TextureArrayPlan::Array& array, const std::vector<const TextureData*>& chains,
+                          const GpuResourceTag& tag, GpuUploader& uploader) {
+  GpuUploader::TextureUpload upload;
+  if (!PackTextureArray(array, chains, tag.label, upload)) return 0;
+  return UploadTextureArray(std::move(upload), tag, uploader);
+}
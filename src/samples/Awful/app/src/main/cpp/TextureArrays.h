@@ -0,0 +1,61 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "GpuResources.h"
+#include "GpuUploader.h"
+#include "TextureCodec.h"
+
+// Small textures packed as the layers of GL_TEXTURE_2D_ARRAYs, so materials that sample
+// different ones still share a binding and sort into one run of draws. Layers keep their own
+// wrapping and mips, so unlike an atlas nothing needs gutters or rewritten UVs; the shader
+// takes the layer from the material. The catch is that layers must match exactly: same
+// format, size and level count. Packed textures are fully resident rather than streamed,
+// which is why only small ones are worth packing.
+//
+//   TextureArrayPlan plan = PlanTextureArrays(chains, 256, maxLayers);
+//   for (const auto& array : plan.arrays) {
+//     GLuint texture = UploadTextureArray(array, chains, {"GltfRenderer", asset, "array"}, uploader);
+//   }
+//   // chains[i] is layer plan.layers[i].layer of plan.layers[i].array
+struct TextureArrayPlan {
+  struct Array {
+    GLenum internalFormat = GL_RGBA8;
+    bool compressed = false;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levels = 0;
+    std::vector<size_t> members;  // indices into the chains, a layer each, in layer order
+  };
+  struct Layer {
+    int array = -1;  // -1 when the texture is left alone
+    int layer = 0;
+  };
+  std::vector<Array> arrays;
+  std::vector<Layer> layers;  // per chain
+};
+
+// Groups the chains no larger than maxSize on either side that share a format, size and
+// level count, at most maxLayers to an array. Groups of one stay as they are. Null chains
+// are skipped.
+TextureArrayPlan PlanTextureArrays(const std::vector<const TextureData*>& chains, uint32_t maxSize, uint32_t maxLayers);
+
+// Copies every level of every layer of a planned array into upload, a level's layers
+// consecutive, with the same filtering TextureStreamer uses. Touches no GL, so it can run off
+// the render thread. False if the layers don't match after all; label names the array in the
+// log.
+bool PackTextureArray(const TextureArrayPlan::Array& array, const std::vector<const TextureData*>& chains,
+                      const std::string& label, GpuUploader::TextureUpload& upload);
+
+// Creates the texture for a packed array, registered under tag, queues upload on the
+// uploader and returns it; it can be drawn from once the upload's ticket completes.
+GLuint UploadTextureArray(GpuUploader::TextureUpload upload, const GpuResourceTag& tag, GpuUploader& uploader);
+
+// PackTextureArray and UploadTextureArray in one go. Returns 0 on failure.
+GLuint UploadTextureArray(const TextureArrayPlan::Array& array, const std::vector<const TextureData*>& chains,
+                          const GpuResourceTag& tag, GpuUploader& uploader);
@@ -5,6 +5,7 @@
 #include <format>
 
 #include "AndroidOut.h"
+#include "GpuResources.h"
 
 using namespace std;
 
@@ -36,8 +37,8 @@ std::shared_ptr<TextureAsset> TextureAsset::loadAsset(AAssetManager* assetManage
   auto decodeResult = AImageDecoder_decodeImage(pAndroidDecoder, upAndroidImageData->data(), stride, upAndroidImageData->size());
 
   // Get an opengl texture
-  GLuint textureId;
-  glGenTextures(1, &textureId);
+  auto& gpu = GpuResourceTracker::Get();
+  GLuint textureId = gpu.CreateTexture({"TextureAsset", assetPath, ""});
   glBindTexture(GL_TEXTURE_2D, textureId);
 
   // Clamp to the edge, you'll get odd results alpha blending if you don't
@@ -61,6 +62,8 @@ std::shared_ptr<TextureAsset> TextureAsset::loadAsset(AAssetManager* assetManage
 
   // generate mip levels. Not really needed for 2D, but good to do
   glGenerateMipmap(GL_TEXTURE_2D);
+  gpu.SetTextureStorage(textureId, GL_RGBA8, width, height, 0);
+  gpu.CountUpload(upAndroidImageData->size());
 
   // cleanup helpers
   AImageDecoder_delete(pAndroidDecoder);
@@ -72,6 +75,5 @@ std::shared_ptr<TextureAsset> TextureAsset::loadAsset(AAssetManager* assetManage
 
 TextureAsset::~TextureAsset() {
   // return texture resources
-  glDeleteTextures(1, &textureID_);
-  textureID_ = 0;
+  GpuResourceTracker::Get().DeleteTexture(textureID_);
 }
\ No newline at end of file
@@ -0,0 +1,370 @@
+#include "TextureCodec.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+
+namespace {
+constexpr uint8_t kKtx2Identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+constexpr size_t kKtx2HeaderSize = 80;  // identifier, header and index, before the level index
+
+template <typename T>
+T ReadLE(const uint8_t* p) {
+  T value;
+  memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+struct Ktx2Format {
+  uint32_t vkFormat;
+  GLenum internalFormat;
+  bool compressed;
+  uint32_t blockWidth, blockHeight, blockBytes;
+};
+
+// VkFormat values from vulkan_core.h, for the formats GLES can sample directly.
+constexpr Ktx2Format kKtx2Formats[] = {
+    {37, GL_RGBA8, false, 1, 1, 4},
+    {43, GL_SRGB8_ALPHA8, false, 1, 1, 4},
+    {147, GL_COMPRESSED_RGB8_ETC2, true, 4, 4, 8},
+    {148, GL_COMPRESSED_SRGB8_ETC2, true, 4, 4, 8},
+    {149, GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, true, 4, 4, 8},
+    {150, GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2, true, 4, 4, 8},
+    {151, GL_COMPRESSED_RGBA8_ETC2_EAC, true, 4, 4, 16},
+    {152, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, true, 4, 4, 16},
+};
+
+// VK_FORMAT_ASTC_4x4_UNORM_BLOCK onwards come in UNORM/SRGB pairs, in the same order as the
+// GL_COMPRESSED_RGBA_ASTC_*_KHR and GL_COMPRESSED_SRGB8_ALPHA8_ASTC_*_KHR enums.
+constexpr uint32_t kVkFormatAstcFirst = 157;
+constexpr uint8_t kAstcBlocks[][2] = {{4, 4}, {5, 4}, {5, 5},  {6, 5},  {6, 6},   {8, 5},   {8, 6},
+                                      {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}};
+
+bool FindKtx2Format(uint32_t vkFormat, Ktx2Format& out) {
+  for (const auto& format : kKtx2Formats) {
+    if (format.vkFormat == vkFormat) {
+      out = format;
+      return true;
+    }
+  }
+  const uint32_t astc = vkFormat - kVkFormatAstcFirst;
+  if (vkFormat >= kVkFormatAstcFirst && astc / 2 < std::size(kAstcBlocks)) {
+    const GLenum first = astc % 2 ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR : GL_COMPRESSED_RGBA_ASTC_4x4_KHR;
+    out = {vkFormat, first + astc / 2, true, kAstcBlocks[astc / 2][0], kAstcBlocks[astc / 2][1], 16};
+    return true;
+  }
+  return false;
+}
+
+bool IsAstc(GLenum format) {
+  return (format >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR && format <= GL_COMPRESSED_RGBA_ASTC_12x12_KHR) ||
+         (format >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR && format <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR);
+}
+
+// ETC1 intensity modifiers, which ETC2's individual and differential modes share.
+constexpr int kEtcModifiers[8][2] = {{2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+
+constexpr int kEacModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12}, {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12}, {-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10}, {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},  {-2, -4, -8, -10, 1, 3, 7, 9},  {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},  {-1, -2, -3, -10, 0, 1, 2, 9},  {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+int Clamp255(int v) {
+  return std::clamp(v, 0, 255);
+}
+
+struct SubblockFit {
+  uint32_t error = UINT32_MAX;
+  int table = 0;
+  uint8_t selectors[8] = {};
+};
+
+// Best modifier table and per pixel selectors for eight pixels around one base color.
+SubblockFit FitSubblock(const uint8_t* const* pixels, const int base[3]) {
+  SubblockFit best;
+  for (int t = 0; t < 8; t++) {
+    SubblockFit fit;
+    fit.table = t;
+    fit.error = 0;
+    for (int i = 0; i < 8 && fit.error < best.error; i++) {
+      uint32_t pixelBest = UINT32_MAX;
+      for (int s = 0; s < 4; s++) {
+        const int modifier = (s & 2) ? -kEtcModifiers[t][s & 1] : kEtcModifiers[t][s & 1];
+        uint32_t e = 0;
+        for (int c = 0; c < 3; c++) {
+          const int d = Clamp255(base[c] + modifier) - pixels[i][c];
+          e += d * d;
+        }
+        if (e < pixelBest) {
+          pixelBest = e;
+          fit.selectors[i] = s;
+        }
+      }
+      fit.error += pixelBest;
+    }
+    if (fit.error < best.error) best = fit;
+  }
+  return best;
+}
+
+void WriteBE64(uint64_t bits, uint8_t* out) {
+  for (int i = 0; i < 8; i++) out[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+}
+
+// block holds 16 RGBA pixels in raster order.
+void EncodeEtc2ColorBlock(const uint8_t* block, uint8_t* out) {
+  uint32_t bestError = UINT32_MAX;
+  uint64_t bestBits = 0;
+  for (int flip = 0; flip < 2; flip++) {
+    // Subblock pixels in ETC's x-major pixel order, so selector i is pixel i of the subblock.
+    const uint8_t* pixels[2][8];
+    int positions[2][8];
+    int counts[2] = {0, 0};
+    float average[2][3] = {};
+    for (int x = 0; x < 4; x++) {
+      for (int y = 0; y < 4; y++) {
+        const int sub = flip ? (y >= 2) : (x >= 2);
+        const uint8_t* p = block + (y * 4 + x) * 4;
+        pixels[sub][counts[sub]] = p;
+        positions[sub][counts[sub]++] = x * 4 + y;
+        for (int c = 0; c < 3; c++) average[sub][c] += p[c] / 8.0f;
+      }
+    }
+
+    for (int differential = 0; differential < 2; differential++) {
+      int quantized[2][3], base[2][3];
+      bool fits = true;
+      for (int sub = 0; sub < 2; sub++) {
+        for (int c = 0; c < 3; c++) {
+          if (differential) {
+            quantized[sub][c] = std::clamp(int(average[sub][c] * 31.0f / 255.0f + 0.5f), 0, 31);
+            base[sub][c] = (quantized[sub][c] << 3) | (quantized[sub][c] >> 2);
+          } else {
+            quantized[sub][c] = std::clamp(int(average[sub][c] * 15.0f / 255.0f + 0.5f), 0, 15);
+            base[sub][c] = quantized[sub][c] * 17;
+          }
+        }
+      }
+      if (differential) {
+        for (int c = 0; c < 3; c++) {
+          const int delta = quantized[1][c] - quantized[0][c];
+          fits = fits && delta >= -4 && delta <= 3;
+        }
+      }
+      if (!fits) continue;
+
+      const SubblockFit fit[2] = {FitSubblock(pixels[0], base[0]), FitSubblock(pixels[1], base[1])};
+      const uint32_t error = fit[0].error + fit[1].error;
+      if (error >= bestError) continue;
+
+      uint64_t bits = 0;
+      for (int c = 0; c < 3; c++) {
+        const int shift = 59 - 8 * c;  // R at 63, G at 55, B at 47
+        if (differential) {
+          bits |= uint64_t(quantized[0][c]) << shift;
+          bits |= uint64_t((quantized[1][c] - quantized[0][c]) & 7) << (shift - 3);
+        } else {
+          bits |= uint64_t(quantized[0][c]) << (shift + 1);
+          bits |= uint64_t(quantized[1][c]) << (shift - 3);
+        }
+      }
+      bits |= uint64_t(fit[0].table) << 37 | uint64_t(fit[1].table) << 34;
+      bits |= uint64_t(differential) << 33 | uint64_t(flip) << 32;
+      for (int sub = 0; sub < 2; sub++) {
+        for (int i = 0; i < 8; i++) {
+          const int s = fit[sub].selectors[i];
+          bits |= uint64_t(s >> 1) << (positions[sub][i] + 16) | uint64_t(s & 1) << positions[sub][i];
+        }
+      }
+      bestError = error;
+      bestBits = bits;
+    }
+  }
+  WriteBE64(bestBits, out);
+}
+
+void EncodeEacAlphaBlock(const uint8_t* block, uint8_t* out) {
+  int alpha[16];  // x-major, as EAC orders its selectors
+  int lo = 255, hi = 0;
+  for (int x = 0; x < 4; x++) {
+    for (int y = 0; y < 4; y++) {
+      alpha[x * 4 + y] = block[(y * 4 + x) * 4 + 3];
+      lo = std::min(lo, alpha[x * 4 + y]);
+      hi = std::max(hi, alpha[x * 4 + y]);
+    }
+  }
+
+  uint32_t bestError = UINT32_MAX;
+  uint64_t bestBits = 0;
+  for (int t = 0; t < 16; t++) {
+    const int* modifiers = kEacModifiers[t];
+    const int span = modifiers[7] - modifiers[3];
+    const int firstMultiplier = std::clamp((hi - lo + span - 1) / span, 1, 15);
+    for (int multiplier = firstMultiplier; multiplier <= std::min(firstMultiplier + 1, 15); multiplier++) {
+      const int base = Clamp255((lo + hi - (modifiers[7] + modifiers[3]) * multiplier + 1) / 2);
+      uint64_t bits = uint64_t(base) << 56 | uint64_t(multiplier) << 52 | uint64_t(t) << 48;
+      uint32_t error = 0;
+      for (int i = 0; i < 16; i++) {
+        uint32_t pixelBest = UINT32_MAX;
+        int selector = 0;
+        for (int s = 0; s < 8; s++) {
+          const int d = Clamp255(base + modifiers[s] * multiplier) - alpha[i];
+          if (uint32_t(d * d) < pixelBest) {
+            pixelBest = d * d;
+            selector = s;
+          }
+        }
+        error += pixelBest;
+        bits |= uint64_t(selector) << (45 - 3 * i);
+      }
+      if (error < bestError) {
+        bestError = error;
+        bestBits = bits;
+      }
+    }
+  }
+  WriteBE64(bestBits, out);
+}
+}  // namespace
+
+size_t TextureData::ByteSize() const {
+  size_t size = 0;
+  for (const auto& level : levels) size += level.data.size();
+  return size;
+}
+
+bool IsKtx2(const uint8_t* data, size_t size) {
+  return size >= kKtx2HeaderSize && memcmp(data, kKtx2Identifier, sizeof(kKtx2Identifier)) == 0;
+}
+
+bool ReadKtx2Size(const uint8_t* data, size_t size, int* width, int* height) {
+  if (!IsKtx2(data, size)) return false;
+  *width = static_cast<int>(ReadLE<uint32_t>(data + 20));
+  *height = static_cast<int>(ReadLE<uint32_t>(data + 24));
+  return true;
+}
+
+bool ParseKtx2(const uint8_t* data, size_t size, TextureData& out, std::string* error) {
+  auto fail = [&](const std::string& message) {
+    if (error) *error = "KTX2: " + message;
+    return false;
+  };
+  if (!IsKtx2(data, size)) return fail("bad identifier");
+  const uint32_t vkFormat = ReadLE<uint32_t>(data + 12);
+  const uint32_t width = ReadLE<uint32_t>(data + 20);
+  const uint32_t height = ReadLE<uint32_t>(data + 24);
+  const uint32_t depth = ReadLE<uint32_t>(data + 28);
+  const uint32_t layers = ReadLE<uint32_t>(data + 32);
+  const uint32_t faces = ReadLE<uint32_t>(data + 36);
+  const uint32_t levelCount = std::max(ReadLE<uint32_t>(data + 40), 1u);
+  const uint32_t supercompression = ReadLE<uint32_t>(data + 44);
+
+  if (vkFormat == 0 || supercompression == 1) {
+    return fail("Basis Universal data needs the basisu transcoder, which isn't built in");
+  }
+  if (supercompression != 0) return fail("unsupported supercompression scheme " + std::to_string(supercompression));
+  if (width == 0 || height == 0 || depth > 1 || layers > 1 || faces != 1) return fail("only single 2D images are supported");
+  Ktx2Format format;
+  if (!FindKtx2Format(vkFormat, format)) return fail("unsupported vkFormat " + std::to_string(vkFormat));
+  if (kKtx2HeaderSize + size_t(levelCount) * 24 > size) return fail("truncated level index");
+
+  out = TextureData{};
+  out.internalFormat = format.internalFormat;
+  out.compressed = format.compressed;
+  out.levels.resize(levelCount);
+  for (uint32_t i = 0; i < levelCount; i++) {
+    const uint8_t* entry = data + kKtx2HeaderSize + size_t(i) * 24;
+    const uint64_t offset = ReadLE<uint64_t>(entry);
+    const uint64_t length = ReadLE<uint64_t>(entry + 8);
+    TextureLevel& level = out.levels[i];
+    level.width = std::max(width >> i, 1u);
+    level.height = std::max(height >> i, 1u);
+    const uint64_t expected = uint64_t((level.width + format.blockWidth - 1) / format.blockWidth) *
+                              ((level.height + format.blockHeight - 1) / format.blockHeight) * format.blockBytes;
+    if (length != expected || offset > size || length > size - offset) {
+      return fail("level " + std::to_string(i) + " has the wrong size");
+    }
+    level.data.assign(data + offset, data + offset + length);
+  }
+  return true;
+}
+
+std::vector<uint8_t> EncodeEtc2(const TextureLevel& rgba, bool alpha, ThreadPool* pool) {
+  const uint32_t blocksX = (rgba.width + 3) / 4, blocksY = (rgba.height + 3) / 4;
+  const size_t blockBytes = alpha ? 16 : 8;
+  std::vector<uint8_t> out(size_t(blocksX) * blocksY * blockBytes);
+  ParallelForRanges(pool, blocksY, 8, [&](size_t firstRow, size_t endRow) {
+    uint8_t block[16 * 4];
+    for (uint32_t by = firstRow; by < endRow; by++) {
+      for (uint32_t bx = 0; bx < blocksX; bx++) {
+        for (uint32_t y = 0; y < 4; y++) {
+          for (uint32_t x = 0; x < 4; x++) {
+            const uint32_t sx = std::min(bx * 4 + x, rgba.width - 1), sy = std::min(by * 4 + y, rgba.height - 1);
+            memcpy(block + (y * 4 + x) * 4, &rgba.data[(size_t(sy) * rgba.width + sx) * 4], 4);
+          }
+        }
+        uint8_t* dst = &out[(size_t(by) * blocksX + bx) * blockBytes];
+        if (alpha) {
+          EncodeEacAlphaBlock(block, dst);
+          dst += 8;
+        }
+        EncodeEtc2ColorBlock(block, dst);
+      }
+    }
+  });
+  return out;
+}
+
+bool PrepareTexture(const tinygltf::Image& image, TextureUsage usage, const TextureFormatSupport& support, bool compress,
+                    ThreadPool* pool, TextureData& out, std::string* error) {
+  if (IsKtx2(image.image.data(), image.image.size())) {
+    if (!ParseKtx2(image.image.data(), image.image.size(), out, error)) return false;
+    if (IsAstc(out.internalFormat) ? !support.astc : out.compressed && !support.etc2) {
+      if (error) *error = "KTX2: the context can't sample this compressed format";
+      return false;
+    }
+    return true;
+  }
+
+  const size_t pixels = size_t(std::max(image.width, 0)) * std::max(image.height, 0);
+  if (pixels == 0 || image.image.size() != pixels * std::max(image.component, 0) * (image.bits / 8)) {
+    if (error) *error = "unsupported image layout";
+    return false;
+  }
+  out = TextureData{};
+  // Color levels come out sRGB encoded, so they're sampled as sRGB: the hardware then filters
+  // and blends in linear light, and the swapchain encodes once on the way out.
+  const bool srgb = usage == TextureUsage::Color;
+  out.internalFormat = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+  out.levels = GenerateMipChain(image.image.data(), image.width, image.height, image.component, image.bits, usage, pool);
+  if (out.levels.empty()) {
+    if (error) *error = "unsupported image layout";
+    return false;
+  }
+  if (compress && support.etc2) {
+    bool alpha = false;
+    const auto& base = out.levels[0].data;
+    for (size_t i = 3; i < base.size() && !alpha; i += 4) alpha = base[i] != 255;
+    if (srgb) {
+      out.internalFormat = alpha ? GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC : GL_COMPRESSED_SRGB8_ETC2;
+    } else {
+      out.internalFormat = alpha ? GL_COMPRESSED_RGBA8_ETC2_EAC : GL_COMPRESSED_RGB8_ETC2;
+    }
+    out.compressed = true;
+    // Levels are independent once filtered, so they compress side by side.
+    auto encode = [&](size_t level) { out.levels[level].data = EncodeEtc2(out.levels[level], alpha, pool); };
+    if (pool) {
+      pool->ParallelFor(out.levels.size(), encode);
+    } else {
+      for (size_t level = 0; level < out.levels.size(); level++) encode(level);
+    }
+  }
+  return true;
+}
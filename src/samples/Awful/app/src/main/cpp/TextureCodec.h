@@ -0,0 +1,72 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+// gl2ext.h needs gl3.h's platform macros first.
+#include <GLES2/gl2ext.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tiny_gltf.h"
+
+class ThreadPool;
+
+// CPU side of texture loading: KTX2 parsing, mip chain generation and ETC2 compression.
+// Formats are GL enums, but nothing here calls GL, so it all runs (and can be checked) off
+// device.
+
+struct TextureLevel {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint8_t> data;
+};
+
+// A texture ready to upload, base level first. Compressed textures go through
+// glCompressedTexImage2D with internalFormat; the rest are GL_RGBA8 or GL_SRGB8_ALPHA8, as
+// GL_RGBA / GL_UNSIGNED_BYTE.
+struct TextureData {
+  GLenum internalFormat = GL_RGBA8;
+  bool compressed = false;
+  std::vector<TextureLevel> levels;
+
+  size_t ByteSize() const;
+};
+
+// How a material samples an image, which decides how its mips are filtered.
+enum class TextureUsage {
+  Color,   // sRGB encoded: base color, emissive
+  Data,    // linear values: metallic-roughness, occlusion
+  Normal,  // tangent space normals, renormalized per level
+};
+
+// Block compressed formats the context can sample. ETC2 is core in GLES 3.0; ASTC LDR needs
+// GL_KHR_texture_compression_astc_ldr.
+struct TextureFormatSupport {
+  bool etc2 = true;
+  bool astc = false;
+};
+
+bool IsKtx2(const uint8_t* data, size_t size);
+
+// Reads the base level size from a KTX2 header, for the loader.
+bool ReadKtx2Size(const uint8_t* data, size_t size, int* width, int* height);
+
+// Reads a 2D KTX2 container holding ETC2, ASTC or RGBA8 levels without supercompression.
+// Basis Universal payloads (BasisLZ/ETC1S and UASTC) need the basisu transcoder, which isn't
+// part of this tree, so they're rejected with an error that says so.
+bool ParseKtx2(const uint8_t* data, size_t size, TextureData& out, std::string* error);
+
+// ETC2 compression of a tightly packed RGBA8 level, as GL_COMPRESSED_RGBA8_ETC2_EAC blocks if
+// alpha is set and GL_COMPRESSED_RGB8_ETC2 otherwise; their SRGB8 variants' blocks are the
+// same. Only the ETC1 compatible modes are searched, which every ETC2 decoder reads. Partial
+// edge blocks repeat the last row and column. Block rows are spread over pool when there is one.
+std::vector<uint8_t> EncodeEtc2(const TextureLevel& rgba, bool alpha, ThreadPool* pool = nullptr);
+
+// Turns a loaded glTF image into an upload: KTX2 images pass through if the format is
+// supported, anything tinygltf decoded gets a mip chain (see GenerateMipChain), ETC2
+// compressed when compress is set. Color images get sRGB formats, the rest linear ones. Safe to
+// call for several images at once, sharing a pool.
+bool PrepareTexture(const tinygltf::Image& image, TextureUsage usage, const TextureFormatSupport& support, bool compress,
+                    ThreadPool* pool, TextureData& out, std::string* error);
@@ -0,0 +1,168 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+
+TextureStreamer::~TextureStreamer() {
+  Destroy();
+}
+
+void TextureStreamer::SetBudget(size_t bytes) {
+  budget_ = bytes;
+  stats_.budgetBytes = bytes;
+}
+
+int TextureStreamer::Add(TextureData&& data, GpuResourceTag tag) {
+  if (data.levels.empty()) return -1;
+  Entry& entry = entries_.emplace_back();
+  entry.data = std::move(data);
+  entry.tag = std::move(tag);
+  const int levels = static_cast<int>(entry.data.levels.size());
+  entry.tailLevel = levels - 1;
+  while (entry.tailLevel > 0 && std::max(entry.data.levels[entry.tailLevel - 1].width,
+                                         entry.data.levels[entry.tailLevel - 1].height) <= kTailSize) {
+    entry.tailLevel--;
+  }
+  entry.residentLevel = levels;  // nothing yet
+  SetResidentLevel(entry, entry.tailLevel);
+  stats_.budgetBytes = budget_;
+  return static_cast<int>(entries_.size()) - 1;
+}
+
+GLuint TextureStreamer::GetTexture(int handle) const {
+  return handle >= 0 && static_cast<size_t>(handle) < entries_.size() ? entries_[handle].texture : 0;
+}
+
+uint32_t TextureStreamer::GetWidth(int handle) const {
+  return handle >= 0 && static_cast<size_t>(handle) < entries_.size() ? entries_[handle].data.levels[0].width : 0;
+}
+
+uint32_t TextureStreamer::GetHeight(int handle) const {
+  return handle >= 0 && static_cast<size_t>(handle) < entries_.size() ? entries_[handle].data.levels[0].height : 0;
+}
+
+void TextureStreamer::BeginFrame() {
+  frame_++;
+  for (auto& entry : entries_) {
+    entry.requestedLevel = entry.tailLevel;
+    if (entry.pendingTexture && uploader_->IsComplete(entry.pendingTicket)) {
+      GpuResourceTracker::Get().DeleteTexture(entry.texture);
+      entry.texture = entry.pendingTexture;
+      entry.pendingTexture = 0;
+      stats_.residentBytes -= entry.retiringBytes;
+      entry.retiringBytes = 0;
+    }
+  }
+}
+
+void TextureStreamer::Request(int handle, int level) {
+  if (handle < 0 || static_cast<size_t>(handle) >= entries_.size()) return;
+  Entry& entry = entries_[handle];
+  entry.requestedLevel = std::min(entry.requestedLevel, std::clamp(level, 0, entry.tailLevel));
+  entry.lastUsed = frame_;
+}
+
+size_t TextureStreamer::BytesFrom(const Entry& entry, int level) const {
+  size_t bytes = 0;
+  for (size_t i = level; i < entry.data.levels.size(); i++) bytes += entry.data.levels[i].data.size();
+  return bytes;
+}
+
+// Never called while the entry's previous change is pending: the loader thread may be
+// writing that texture.
+size_t TextureStreamer::SetResidentLevel(Entry& entry, int level) {
+  if (level == entry.residentLevel) return 0;
+  const TextureData& data = entry.data;
+  GpuUploader::TextureUpload upload;
+  upload.texture = GpuResourceTracker::Get().CreateTexture(entry.tag);
+  upload.internalFormat = data.internalFormat;
+  upload.compressed = data.compressed;
+  // KTX2 files may carry a partial chain; the storage ends where it does.
+  for (size_t i = level; i < data.levels.size(); i++) {
+    const TextureLevel& l = data.levels[i];
+    upload.levels.push_back({l.width, l.height, l.data.data(), l.data.size()});
+  }
+  entry.pendingTexture = upload.texture;
+  entry.pendingTicket = uploader_->UploadTexture(std::move(upload));
+
+  // The old texture stays until the new one replaces it in BeginFrame().
+  entry.retiringBytes = entry.residentBytes;
+  entry.residentBytes = BytesFrom(entry, level);
+  stats_.residentBytes += entry.residentBytes;
+  entry.residentLevel = level;
+  return entry.residentBytes;
+}
+
+// The least recently used texture holding a level finer than it needs this frame.
+TextureStreamer::Entry* TextureStreamer::FindVictim(const Entry* except) {
+  Entry* victim = nullptr;
+  for (auto& entry : entries_) {
+    if (&entry == except || entry.pendingTexture || entry.residentLevel >= entry.tailLevel ||
+        entry.residentLevel >= entry.requestedLevel) {
+      continue;
+    }
+    if (!victim || entry.lastUsed < victim->lastUsed) victim = &entry;
+  }
+  return victim;
+}
+
+void TextureStreamer::Update() {
+  stats_.uploads = 0;
+  stats_.evictions = 0;
+  stats_.budgetPressure = 0;
+  stats_.uploadBytes = 0;
+
+  // Most recently used first, then whichever is furthest from what it wants. Textures whose
+  // last change is still uploading wait for it.
+  std::vector<Entry*> wanting;
+  for (auto& entry : entries_) {
+    if (entry.requestedLevel < entry.residentLevel && !entry.pendingTexture) wanting.push_back(&entry);
+  }
+  std::sort(wanting.begin(), wanting.end(), [](const Entry* a, const Entry* b) {
+    if (a->lastUsed != b->lastUsed) return a->lastUsed > b->lastUsed;
+    return a->residentLevel - a->requestedLevel > b->residentLevel - b->requestedLevel;
+  });
+
+  // One level per texture per frame, which also spreads the uploads out. A change allocates
+  // and uploads the whole new chain while the old one is still around, and an eviction only
+  // gives memory back once its smaller chain has replaced the old one, so what this frame's
+  // evictions will free is tracked apart from what's allocated now.
+  size_t uploaded = 0;
+  size_t freeing = 0;
+  for (Entry* entry : wanting) {
+    if (uploaded >= uploadBytesPerFrame_) break;
+    const int level = entry->residentLevel - 1;
+    const size_t chain = BytesFrom(*entry, level);
+    while (stats_.residentBytes - freeing + chain > budget_ && uploaded < uploadBytesPerFrame_) {
+      Entry* victim = FindVictim(entry);
+      if (!victim) break;
+      uploaded += SetResidentLevel(*victim, victim->residentLevel + 1);
+      freeing += victim->retiringBytes;
+      stats_.evictions++;
+    }
+    if (stats_.residentBytes + chain > budget_) {
+      stats_.budgetPressure++;  // until the evictions land, or for good without victims
+      continue;
+    }
+    if (uploaded >= uploadBytesPerFrame_) break;
+    uploaded += SetResidentLevel(*entry, level);
+    stats_.uploads++;
+  }
+  stats_.uploadBytes = uploaded;
+
+  stats_.pendingUploads = 0;
+  for (const auto& entry : entries_) {
+    if (entry.requestedLevel < entry.residentLevel) stats_.pendingUploads++;
+  }
+}
+
+void TextureStreamer::Destroy() {
+  // Queued uploads read the chains about to be freed.
+  if (uploader_ && !entries_.empty()) uploader_->Finish();
+  for (auto& entry : entries_) {
+    GpuResourceTracker::Get().DeleteTexture(entry.texture);
+    GpuResourceTracker::Get().DeleteTexture(entry.pendingTexture);
+  }
+  entries_.clear();
+  stats_ = Stats{};
+  stats_.budgetBytes = budget_;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "GpuResources.h"
+#include "GpuUploader.h"
+#include "TextureCodec.h"
+
+// Mip level residency for a set of textures under a GPU memory budget. Each texture's full
+// chain stays on the CPU; GL only ever holds a suffix of it, starting with the mip tail
+// (levels no larger than kTailSize) and growing a level at a time as the renderer asks for
+// finer ones. When a finer level doesn't fit, textures that hold more than this frame needs
+// give up their finest level, least recently used first.
+//
+// GLES has no sparse textures, so changing a texture's levels reallocates it and uploads the
+// whole new chain; the handle stays the same but GetTexture may return a new name after
+// BeginFrame(). New levels go through a GpuUploader, and the texture they replace is drawn
+// with, and counts against the budget, until they're done.
+class TextureStreamer {
+ public:
+  static constexpr uint32_t kTailSize = 64;
+
+  struct Stats {
+    size_t residentBytes = 0;  // including textures waiting to be replaced
+    size_t budgetBytes = 0;
+    size_t uploadBytes = 0;    // queued by the last Update(), evictions included
+    uint32_t pendingUploads = 0;  // textures still wanting finer levels after Update()
+    uint32_t uploads = 0;         // level additions in the last Update()
+    uint32_t evictions = 0;       // level removals in the last Update()
+    uint32_t budgetPressure = 0;  // additions the last Update() couldn't make room for
+  };
+
+  ~TextureStreamer();
+
+  // Where uploads go; set before the first Add(). The uploader reads each chain in place, so
+  // it must outlive the streamer's textures.
+  void SetUploader(GpuUploader* uploader) {
+    uploader_ = uploader;
+  }
+
+  void SetBudget(size_t bytes);
+  // Caps how much the per-frame Update() uploads, to bound hitches. The first change of a frame
+  // always goes through, however large its chain, or it never would.
+  void SetUploadBytesPerFrame(size_t bytes) {
+    uploadBytesPerFrame_ = bytes;
+  }
+
+  // Takes a prepared chain and queues its tail. Returns a handle, or -1 if it's empty. The
+  // texture is registered with GpuResourceTracker under tag, and GetTexture is 0 until the
+  // tail is uploaded.
+  int Add(TextureData&& data, GpuResourceTag tag);
+
+  GLuint GetTexture(int handle) const;
+  // Size of level 0, whether or not it's resident.
+  uint32_t GetWidth(int handle) const;
+  uint32_t GetHeight(int handle) const;
+
+  // Per frame, after the uploader's Update(): BeginFrame(), Request() the finest level each
+  // drawn texture needs, then Update() once the frame's draws are issued.
+  void BeginFrame();
+  void Request(int handle, int level);
+  void Update();
+
+  const Stats& GetStats() const {
+    return stats_;
+  }
+
+  void Destroy();
+
+ private:
+  // Entries move as the vector grows, but their levels' bytes don't, which is what queued
+  // uploads point at.
+  struct Entry {
+    TextureData data;  // every level, the backing store for streaming
+    GpuResourceTag tag;
+    GLuint texture = 0;
+    GLuint pendingTexture = 0;  // replaces texture once its upload completes
+    GpuUploader::Ticket pendingTicket = 0;
+    int tailLevel = 0;       // coarsest level ever resident; never evicted
+    int residentLevel = 0;   // finest level in GL, or on its way
+    int requestedLevel = 0;  // finest level asked for this frame
+    uint64_t lastUsed = 0;   // frame of the last Request()
+    size_t residentBytes = 0;
+    size_t retiringBytes = 0;  // of texture, while pendingTexture replaces it
+  };
+
+  size_t BytesFrom(const Entry& entry, int level) const;
+  // Returns the bytes queued for upload.
+  size_t SetResidentLevel(Entry& entry, int level);
+  Entry* FindVictim(const Entry* except);
+
+  GpuUploader* uploader_ = nullptr;
+  std::vector<Entry> entries_;
+  size_t budget_ = size_t(256) << 20;
+  size_t uploadBytesPerFrame_ = size_t(8) << 20;
+  uint64_t frame_ = 0;
+  Stats stats_;
+};
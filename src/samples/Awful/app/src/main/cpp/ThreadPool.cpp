@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  }
+  threads_.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; i++) {
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+void ThreadPool::WorkerLoop() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& body) {
+  if (count == 0) return;
+  if (count == 1 || threads_.empty()) {
+    for (size_t i = 0; i < count; i++) body(i);
+    return;
+  }
+
+  // Every participant claims indices from one counter until they run out. Helpers that only
+  // get scheduled after the caller has finished everything find nothing left and return, so
+  // the shared state has to outlive this call but body doesn't.
+  struct Job {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    size_t count = 0;
+    const std::function<void(size_t)>* body = nullptr;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  auto job = std::make_shared<Job>();
+  job->count = count;
+  job->body = &body;
+  auto run = [job] {
+    for (size_t i = job->next++; i < job->count; i = job->next++) {
+      (*job->body)(i);
+      if (++job->done == job->count) {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->finished.notify_all();
+      }
+    }
+  };
+
+  const size_t helpers = std::min(count - 1, threads_.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < helpers; i++) queue_.push_back(run);
+  }
+  if (helpers == 1) {
+    wake_.notify_one();
+  } else {
+    wake_.notify_all();
+  }
+  run();
+
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->finished.wait(lock, [&] { return job->done == job->count; });
+}
+
+void ThreadPool::Run(std::function<void()> task) {
+  if (threads_.empty()) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(task));
+  }
+  wake_.notify_one();
+}
+
+void ParallelForRanges(ThreadPool* pool, size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+  grain = std::max<size_t>(grain, 1);
+  const size_t ranges = (count + grain - 1) / grain;
+  auto range = [&](size_t r) { body(r * grain, std::min(count, (r + 1) * grain)); };
+  if (pool) {
+    pool->ParallelFor(ranges, range);
+  } else {
+    for (size_t r = 0; r < ranges; r++) range(r);
+  }
+}
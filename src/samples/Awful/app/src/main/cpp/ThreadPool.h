@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for load-time CPU work (texture preparation and the like).
+// Work is handed out through ParallelFor, where the calling thread takes part too, so a
+// ParallelFor inside another one's body just spreads across whatever threads are free
+// rather than deadlocking. Run hands a worker a whole task for the caller not to wait on.
+class ThreadPool {
+ public:
+  // threadCount 0 means one fewer than the hardware has, leaving a core for the caller.
+  explicit ThreadPool(uint32_t threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Runs body(i) for every i in [0, count) and returns once all have finished.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+  // Queues task for a worker and returns at once; the caller finds out it's done some other
+  // way. The task may ParallelFor on this pool. Without workers it runs inline. Tasks still
+  // queued when the pool is destroyed run first.
+  void Run(std::function<void()> task);
+
+  uint32_t GetThreadCount() const {
+    return static_cast<uint32_t>(threads_.size());
+  }
+
+ private:
+  void WorkerLoop();
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::function<void()>> queue_;
+  bool stopping_ = false;
+};
+
+// ParallelFor over [0, count) in ranges of up to grain items, e.g. bands of image rows. Runs
+// inline without a pool.
+void ParallelForRanges(ThreadPool* pool, size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
@@ -0,0 +1,116 @@
+#include "UniformRing.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+
+#include "GpuResources.h"
+
+UniformRing::~UniformRing() {
+  Destroy();
+}
+
+bool UniformRing::Init(GLsizeiptr bytesPerFrame, uint32_t allocationsPerFrame, uint32_t frameCount, const std::string& asset) {
+  Destroy();
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment_);
+  alignment_ = std::max(alignment_, 1);
+  // Worst case every allocation is padded out to the alignment.
+  regionSize_ = bytesPerFrame + GLsizeiptr(allocationsPerFrame) * (alignment_ - 1);
+  regionSize_ = (regionSize_ + alignment_ - 1) / alignment_ * alignment_;
+  fences_.assign(std::max(frameCount, 3u), nullptr);
+
+  auto& gpu = GpuResourceTracker::Get();
+  buffer_ = gpu.CreateBuffer({"UniformRing", asset, "uniforms"});
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+  glBufferData(GL_UNIFORM_BUFFER, regionSize_ * fences_.size(), nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  gpu.SetBufferSize(buffer_, regionSize_ * fences_.size());
+  __android_log_print(ANDROID_LOG_INFO, "UniformRing", "%zu frames of %ld bytes, alignment %d", fences_.size(),
+                      long(regionSize_), alignment_);
+  stats_ = {};
+  return buffer_ != 0;
+}
+
+void UniformRing::Destroy() {
+  for (auto& fence : fences_) {
+    if (fence) glDeleteSync(fence);
+  }
+  fences_.clear();
+  if (buffer_) {
+    if (mapped_) {
+      glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+      glUnmapBuffer(GL_UNIFORM_BUFFER);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    GpuResourceTracker::Get().DeleteBuffer(buffer_);
+  }
+  buffer_ = 0;
+  mapped_ = nullptr;
+}
+
+bool UniformRing::BeginFrame() {
+  if (!buffer_ || mapped_) return false;
+  frame_ = (frame_ + 1) % fences_.size();
+
+  GLsync& fence = fences_[frame_];
+  if (fence) {
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      stats_.fenceWaits++;
+      constexpr GLuint64 kOneSecond = 1000000000ull;
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kOneSecond) == GL_TIMEOUT_EXPIRED) {
+        __android_log_print(ANDROID_LOG_WARN, "UniformRing", "Still waiting for frame %u", frame_);
+      }
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  // The fence is the synchronization, so don't let the driver add its own.
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+  mapped_ = static_cast<uint8_t*>(glMapBufferRange(
+      GL_UNIFORM_BUFFER, frame_ * regionSize_, regionSize_,
+      GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  used_ = 0;
+  stats_.allocations = 0;
+  stats_.bytesUsed = 0;
+  stats_.overflows = 0;
+  return mapped_ != nullptr;
+}
+
+UniformRing::Allocation UniformRing::Allocate(GLsizeiptr size) {
+  Allocation allocation;
+  if (!mapped_ || used_ + size > regionSize_) {
+    stats_.overflows++;
+    return allocation;
+  }
+  allocation.data = mapped_ + used_;
+  allocation.offset = frame_ * regionSize_ + used_;
+  allocation.size = size;
+  used_ = std::min((used_ + size + alignment_ - 1) / alignment_ * alignment_, regionSize_);
+  stats_.allocations++;
+  stats_.bytesUsed = static_cast<uint32_t>(used_);
+  return allocation;
+}
+
+void UniformRing::Unmap() {
+  if (!mapped_) return;
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+  if (used_ > 0) {
+    glFlushMappedBufferRange(GL_UNIFORM_BUFFER, 0, used_);
+  }
+  glUnmapBuffer(GL_UNIFORM_BUFFER);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  mapped_ = nullptr;
+}
+
+void UniformRing::Bind(GLuint binding, const Allocation& allocation) const {
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_, allocation.offset, allocation.size);
+}
+
+void UniformRing::EndFrame() {
+  Unmap();
+  if (!fences_.empty()) {
+    fences_[frame_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+}
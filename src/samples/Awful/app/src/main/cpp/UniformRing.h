@@ -0,0 +1,78 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A ring of per-frame regions in one uniform buffer.
+//
+// Each frame maps its own region once with GL_MAP_UNSYNCHRONIZED_BIT, writes uniform blocks
+// into it linearly, unmaps, and binds the blocks with glBindBufferRange. Nothing waits on the
+// driver except a fence per region: a region is only reused once the GPU is done with the
+// frame that last wrote it, which with as many regions as the swapchain has images (and at
+// least three) is practically never a wait.
+//
+//   ring.BeginFrame();
+//   auto view = ring.Allocate(sizeof(ViewBlock));  // write through view.data
+//   ...
+//   ring.Unmap();
+//   ring.Bind(kViewBinding, view);  // then draw
+//   ...
+//   ring.EndFrame();
+class UniformRing {
+ public:
+  struct Allocation {
+    void* data = nullptr;  // write-only, valid until Unmap()
+    GLintptr offset = 0;   // in the buffer, for Bind()
+    GLsizeiptr size = 0;
+  };
+
+  struct Stats {
+    uint32_t allocations = 0;
+    uint32_t bytesUsed = 0;
+    uint32_t overflows = 0;   // allocations that didn't fit this frame
+    uint32_t fenceWaits = 0;  // times the GPU was still using the region we wanted, since Init()
+  };
+
+  UniformRing() = default;
+  ~UniformRing();
+  UniformRing(const UniformRing&) = delete;
+  UniformRing& operator=(const UniformRing&) = delete;
+
+  // Sized for allocationsPerFrame blocks totalling bytesPerFrame before alignment. frameCount
+  // is usually the swapchain length; fewer than three frames is rounded up. The buffer is
+  // tracked as the asset's, see GpuResourceTracker.
+  bool Init(GLsizeiptr bytesPerFrame, uint32_t allocationsPerFrame, uint32_t frameCount, const std::string& asset = {});
+  void Destroy();
+
+  // Waits for the next region to be free and maps it.
+  bool BeginFrame();
+
+  // Aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. data is null when the region is full.
+  Allocation Allocate(GLsizeiptr size);
+
+  // Flushes and unmaps what was written. Blocks can't be read by draws while mapped.
+  void Unmap();
+
+  void Bind(GLuint binding, const Allocation& allocation) const;
+
+  // Fences the region, call after the last draw that reads it.
+  void EndFrame();
+
+  // Usage of the current (or last) frame; fenceWaits accumulates.
+  const Stats& GetStats() const {
+    return stats_;
+  }
+
+ private:
+  GLuint buffer_ = 0;
+  GLsizeiptr regionSize_ = 0;
+  GLint alignment_ = 256;
+  uint32_t frame_ = 0;
+  std::vector<GLsync> fences_;
+  uint8_t* mapped_ = nullptr;
+  GLsizeiptr used_ = 0;
+  Stats stats_;
+};
@@ -1,16 +1,39 @@
 #include <android/asset_manager.h>
 #include <android/log.h>
 
+#include "TextureCodec.h"
+
+// TextureCodec.h has already included tiny_gltf.h, but the implementation is outside its
+// include guard, so it is still compiled here.
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "tiny_gltf.h"
 
+namespace {
+// KTX2 images (KHR_texture_basisu sources) are kept as they are for GltfRenderer to parse;
+// anything else goes through tinygltf's stb_image decode.
+bool LoadImageDataOrKtx2(tinygltf::Image* image, const int imageIndex, std::string* err, std::string* warn, int reqWidth,
+                         int reqHeight, const unsigned char* bytes, int size, void* userData) {
+  if (IsKtx2(bytes, size)) {
+    ReadKtx2Size(bytes, size, &image->width, &image->height);
+    image->component = 4;
+    image->bits = 8;
+    image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    image->as_is = true;
+    image->image.assign(bytes, bytes + size);
+    return true;
+  }
+  return tinygltf::LoadImageData(image, imageIndex, err, warn, reqWidth, reqHeight, bytes, size, userData);
+}
+}  // namespace
+
 bool LoadGltfModelFromAsset(AAssetManager* assetManager, const std::string& assetPath, tinygltf::Model* model, bool isBinary) {
   // Set the global asset_manager pointer used by TinyGLTF
   tinygltf::asset_manager = assetManager;
 
   tinygltf::TinyGLTF loader;
+  loader.SetImageLoader(LoadImageDataOrKtx2, nullptr);
   std::string err, warn;
   bool ret = false;
 
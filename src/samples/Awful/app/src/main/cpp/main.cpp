@@ -7,7 +7,6 @@
 
 #include "AndroidOut.h"
 #include "Renderer.h"
-#include "gltfloader.h"
 #include "xrapp.h"
 #include "xrh.h"
 #include "xrhlinear.h"
@@ -79,9 +78,6 @@ void android_main(struct android_app* pApp) {
     return;
   }
 
-  tinygltf::Model model;
-  LoadGltfModelFromAsset(pApp->activity->assetManager, "cartoony_rubber_ducky/scene.gltf", &model);
-
   // This sets up a typical game/event loop. It will run until the app is destroyed.
   int events;
   android_poll_source* pSource;
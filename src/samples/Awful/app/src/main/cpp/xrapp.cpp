@@ -2,13 +2,39 @@
 
 #include <game-activity/native_app_glue/android_native_app_glue.h>
 
+#include <sstream>
+
 #include "AndroidOut.h"
+#include "Benchmarks.h"
+#include "GpuResources.h"
+#include "MeshSimplifier.h"
+#include "ProgramCache.h"
 #include "gltfloader.h"
 
 using namespace xrh;
 using namespace std;
 
 namespace xr {
+namespace {
+// The view the model is drawn into the quad with, which LOD selection, culling and texture
+// streaming all work from. It circles the model and moves in and out, so they have something
+// to do; before the scene's bounds are known the model is drawn in clip space as is.
+r3::Matrix4f ModelCamera(const GltfRenderer& gltf, uint32_t width, uint32_t height, double seconds) {
+  r3::Vec3f bmin, bmax;
+  if (!gltf.IsLoaded() || !gltf.GetBvh().GetBounds(bmin, bmax)) {
+    return r3::Matrix4f::Identity();
+  }
+  const r3::Vec3f center = (bmin + bmax) * 0.5f;
+  const float radius = std::max((bmax - bmin).Length() * 0.5f, 1e-3f);
+  const float angle = static_cast<float>(seconds * 0.3);
+  const float distance = radius * (3.5f + 2.5f * std::sin(static_cast<float>(seconds * 0.2)));
+  const r3::Vec3f eye = center + r3::Vec3f(std::sin(angle), 0.3f, std::cos(angle)) * distance;
+  const float aspect = height ? float(width) / float(height) : 1.0f;
+  const r3::Matrix4f projection = r3::Perspective(45.0f, aspect, distance * 0.1f, distance + radius * 2.0f);
+  return projection * r3::CameraLookAt(eye, center, r3::Vec3f(0.0f, 1.0f, 0.0f));
+}
+}  // namespace
+
 #if defined(XR_USE_GRAPHICS_API_OPENGL_ES)
 App::App(android_app* pApp)
     : app(pApp)
@@ -46,18 +72,52 @@ App::App()
   local = ssn->create_refspace(rsci);
 
   auto vcv = inst->get_xr_view_config_view(0);
-  auto scci = Swapchain::element_type::make_create_info(vcv.recommendedImageRectWidth, vcv.recommendedImageRectHeight);
+  // The quad is opaque and its color linear, so alpha is optional but sRGB isn't.
+  xrh::SwapchainFormatNeeds needs;
+  needs.alpha = false;
+  needs.srgb = true;
+  auto format = ssn->choose_swapchain_format(needs);
+  aout << "Swapchain format: 0x" << hex << format.format << dec << ", " << format.bytes_per_pixel
+       << " bytes a pixel" << endl;
+  // The quad shows one view, so one layer. Stereo content would ask for an array size of 2, render
+  // each eye with bindFbo(imageIndex, eye) and submit the quad with set_stereo_swapchain.
+  auto scci = Swapchain::element_type::make_create_info(vcv.recommendedImageRectWidth, vcv.recommendedImageRectHeight,
+                                                        format.format);
   sc = ssn->create_swapchain(scci);
 
-  renderer->setSwapchainImages(sc->get_width(), sc->get_height(), sc->enumerate_images());
-
-  LoadGltfModelFromAsset(app->activity->assetManager, "cartoony_rubber_ducky/scene.gltf", &model);
-
-  gltfRenderer.Init(model);
+  // 4x MSAA costs little when it's resolved on chip.
+  renderer->setSwapchainImages(sc->get_width(), sc->get_height(), sc->enumerate_images(), sc->get_array_size(),
+                               format.bytes_per_pixel, 4);
+
+  // Uploads go through a context of their own on a loader thread, or on the frame budget if
+  // that can't be had.
+  uploader.StartLoaderThread(renderer->getDisplay(), renderer->getConfig(), renderer->getContext());
+  gltfRenderer.SetUploader(&uploader);
+  const char* modelPath = "cartoony_rubber_ducky/scene.gltf";
+  gltfRenderer.SetAssetName(modelPath);
+  gltfRenderer.SetViewportSize(sc->get_width(), sc->get_height());
+  // Parsing and image decoding happen on the renderer's load pool along with everything else,
+  // so frames keep going while the model loads. aout isn't shared with that thread.
+  gltfRenderer.Load(
+      model,
+      [this, modelPath](tinygltf::Model& loaded) {
+        if (!LoadGltfModelFromAsset(app->activity->assetManager, modelPath, &loaded)) return false;
+#if defined(AWFUL_BAKE_LODS)
+        // The baked chains are what gets drawn, and the file is the offline asset to ship.
+        const int added = GenerateLods(loaded);
+        const string baked = string(app->activity->internalDataPath) + "/lods.glb";
+        const bool written = WriteGltfWithLods(loaded, baked);
+        __android_log_print(ANDROID_LOG_INFO, "App", "Baked %d LOD nodes, %s %s", added,
+                            written ? "wrote" : "failed to write", baked.c_str());
+#endif
+        return true;
+      },
+      sc->get_chain_length());
 }
 
 App::~App() {
   aout << "Destroying App instance." << inst.get() << endl;
+  animations.Clear();
   gltfRenderer.Destroy();
 }
 
@@ -84,12 +144,81 @@ void App::frame() {
   if (sc) {
     uint32_t imageIndex = sc->acquire_and_wait_image();
 
+    const double displayTime = ssn->get_predicted_display_time() * 1e-9;
+    if (lastDisplayTime > 0.0) {
+      animations.Update(static_cast<float>(displayTime - lastDisplayTime), animationPool.get());
+    }
+    lastDisplayTime = displayTime;
+
     // Render a frame
     renderer->bindFbo(imageIndex);
     renderer->render();
-    gltfRenderer.Render(renderer->getShader());
+    uploader.Update();
+    gltfRenderer.Render(ModelCamera(gltfRenderer, sc->get_width(), sc->get_height(), displayTime));
     renderer->unbindFbo();
 
+    // The model and its scene graph only exist once the load is done, some frames in.
+    if (!loadReported && gltfRenderer.IsLoaded()) {
+      loadReported = true;
+      // Loop every clip on the whole scene; a pool only pays off once there's enough to spread.
+      animations.Init(model, gltfRenderer.GetScene());
+      size_t animatedChannels = 0;
+      for (int clip = 0; clip < static_cast<int>(animations.GetClips().size()); clip++) {
+        if (animations.Play(clip) >= 0) animatedChannels += animations.GetClips()[clip].channels.size();
+      }
+      if (animatedChannels >= 256) {
+        animationPool = make_unique<ThreadPool>();
+      }
+      const auto& programs = ProgramCache::Get().GetStats();
+      aout << "Program cache: " << programs.hits << "/" << programs.hits + programs.misses << " hits ("
+           << programs.rejected << " rejected), compiled in " << programs.compileMs << " ms, loaded in "
+           << programs.loadMs << " ms, saved " << programs.savedMs << " ms" << endl;
+      // A line per log entry, logcat truncates long ones.
+      istringstream gpuResources(ToJson(GpuResourceTracker::Get().GetSnapshot()));
+      aout << "GPU resources after load:" << endl;
+      for (string line; getline(gpuResources, line);) {
+        aout << line << endl;
+      }
+
+#if defined(AWFUL_BENCHMARKS)
+      RunSceneGraphBenchmark();
+      RunMeshOptimizerBenchmark(model);
+      RunLodBenchmark(model);
+      RunSkinningBenchmark(model);
+      RunAnimationBenchmark();
+      RunSceneBvhBenchmark();
+#endif
+    }
+
+    // A scene that isn't moving or streaming anything in should upload nothing.
+    static int uploadingFrames = 0;
+    uploadingFrames += GpuResourceTracker::Get().EndFrame() > 0 ? 1 : 0;
+
+    static int statsFrameCount = 0;
+    if (++statsFrameCount % 600 == 0) {
+      const auto& stats = gltfRenderer.GetFrameStats();
+      aout << "GltfRenderer frame: draws=" << stats.drawCalls << " instances=" << stats.instances
+           << " stateChanges=" << stats.stateChanges << " bindsAvoided=" << stats.bindsAvoided
+           << " visibleItems=" << gltfRenderer.GetVisibleItemCount() << "/"
+           << (gltfRenderer.IsLoaded() ? gltfRenderer.GetBvh().GetItemCount() : 0)
+           << " shaderWaitFrames=" << gltfRenderer.GetShaderVariantStats().missedFrames
+           << " shaderWaitDraws=" << gltfRenderer.GetShaderVariantStats().missedDraws << endl;
+      const auto& textures = gltfRenderer.GetTextureStats();
+      aout << "GltfRenderer textures: residentKB=" << textures.residentBytes / 1024
+           << " budgetKB=" << textures.budgetBytes / 1024 << " pending=" << textures.pendingUploads
+           << " budgetPressure=" << textures.budgetPressure << " uploadKB=" << textures.uploadBytes / 1024 << endl;
+      const auto& pass = renderer->getRenderPassStats();
+      aout << "Render pass: samples=" << pass.samples << " depthKBSaved=" << pass.depthBytesSaved / 1024
+           << " frameAttachmentKBSaved=" << pass.frameBytesSaved / 1024 << endl;
+      const auto& uploads = uploader.GetStats();
+      aout << "Uploads: threaded=" << uploads.threaded << " uploadedKB=" << uploads.uploadedBytes / 1024
+           << " pendingKB=" << uploads.pendingBytes / 1024 << " maxUpdateMs=" << uploads.maxUpdateMs << endl;
+      const auto& gpu = GpuResourceTracker::Get();
+      aout << "GPU memory: totalKB=" << gpu.GetTotalBytes() / 1024 << " peakKB=" << gpu.GetPeakBytes() / 1024
+           << " frameUploadBytes=" << gpu.GetFrameUploadBytes() << " uploadingFrames=" << uploadingFrames << endl;
+      uploadingFrames = 0;
+    }
+
     // add a layer to be submitted at the end of the frame
     xrh::QuadLayer quad;
     double t = ssn->get_predicted_display_time() * 1e-9;  // Convert from nanoseconds to seconds
@@ -2,8 +2,11 @@
 
 #include <memory>
 
+#include "Animation.h"
 #include "GltfRenderer.h"
+#include "GpuUploader.h"
 #include "Renderer.h"
+#include "ThreadPool.h"
 #include "xrh.h"
 
 namespace xr {
@@ -29,7 +32,12 @@ struct App {
   xrh::Space local;
   xrh::Swapchain sc;
   tinygltf::Model model;
+  GpuUploader uploader;  // outlives gltfRenderer, which uploads through it
   GltfRenderer gltfRenderer;
+  AnimationSystem animations;
+  std::unique_ptr<ThreadPool> animationPool;
+  double lastDisplayTime = 0.0;
+  bool loadReported = false;
 };
 
 }  // namespace xr
\ No newline at end of file
@@ -50,6 +50,7 @@
 // #include <memory.h>
 #include <assert.h>
 #include <math.h>
+#include <stddef.h>
 
 #include <algorithm>
 
@@ -1428,11 +1429,8 @@ class Matrix4 {
 
 template <typename T>
 inline Matrix4<T> operator*(const Matrix4<T>& m1, const Matrix4<T>& m2) {
-  static Matrix4<T> product;
-
-  product = m1;
+  Matrix4<T> product(m1);
   product.MultRight(m2);
-
   return product;
 }
 
@@ -1606,10 +1604,49 @@ class Quaternion {
     m(2, 2) = T(R3_ONE - (xx + yy));
   }
 
+  // Fills the rotation directly into m, without going through a Matrix3.
   void GetValue(Matrix4<T>& m) const {
-    Matrix3<T> m3;
-    GetValue(m3);
-    m = FromMatrix3(m3);
+    T s, xs, ys, zs, wx, wy, wz, xx, xy, xz, yy, yz, zz;
+
+    T norm = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+
+    s = (Equivalent(norm, T(R3_ZERO))) ? R3_ZERO : (R3_TWO / norm);
+
+    xs = q[0] * s;
+    ys = q[1] * s;
+    zs = q[2] * s;
+
+    wx = q[3] * xs;
+    wy = q[3] * ys;
+    wz = q[3] * zs;
+
+    xx = q[0] * xs;
+    xy = q[0] * ys;
+    xz = q[0] * zs;
+
+    yy = q[1] * ys;
+    yz = q[1] * zs;
+    zz = q[2] * zs;
+
+    m(0, 0) = T(R3_ONE - (yy + zz));
+    m(1, 0) = T(xy + wz);
+    m(2, 0) = T(xz - wy);
+    m(3, 0) = T(R3_ZERO);
+
+    m(0, 1) = T(xy - wz);
+    m(1, 1) = T(R3_ONE - (xx + zz));
+    m(2, 1) = T(yz + wx);
+    m(3, 1) = T(R3_ZERO);
+
+    m(0, 2) = T(xz + wy);
+    m(1, 2) = T(yz - wx);
+    m(2, 2) = T(R3_ONE - (xx + yy));
+    m(3, 2) = T(R3_ZERO);
+
+    m(0, 3) = T(R3_ZERO);
+    m(1, 3) = T(R3_ZERO);
+    m(2, 3) = T(R3_ZERO);
+    m(3, 3) = T(R3_ONE);
   }
 
   Matrix3<T> GetMatrix3() const {
@@ -1769,10 +1806,11 @@ class Quaternion {
   }
 
   void Normalize() {
-    T rnorm = R3_ONE / T(sqrt(w * w + x * x + y * y + z * z));
-    if (Equivalent(rnorm, R3_ZERO)) {
+    T norm = T(sqrt(w * w + x * x + y * y + z * z));
+    if (Equivalent(norm, T(R3_ZERO))) {
       return;
     }
+    T rnorm = R3_ONE / norm;
     x *= rnorm;
     y *= rnorm;
     z *= rnorm;
@@ -1830,10 +1868,13 @@ class Quaternion {
     MultVec(Vec3<T>(src_and_dst), src_and_dst);
   }
 
+  // Rotates v by a unit quaternion:
+  // v' = v + w * t + u x t, where u = (x, y, z) and t = 2 * (u x v)
   Vec3<T> Rotate(const Vec3<T>& v) const {
-    Vec3<T> ret;
-    (*this).MultVec(v, ret);
-    return ret;
+    T tx = R3_TWO * (y * v.z - z * v.y);
+    T ty = R3_TWO * (z * v.x - x * v.z);
+    T tz = R3_TWO * (x * v.y - y * v.x);
+    return Vec3<T>(v.x + w * tx + (y * tz - z * ty), v.y + w * ty + (z * tx - x * tz), v.z + w * tz + (x * ty - y * tx));
   }
 
   void ScaleAngle(T scaleFactor) {
@@ -1859,15 +1900,15 @@ class Quaternion {
     // complementary interpolation parameter
     T beta = R3_ONE - alpha;
 
-    if (cos_omega <= R3_ONE - R3_EPSILON) {
-      return p;
-    }
-
-    T omega = T(acos(cos_omega));
-    T one_over_sin_omega = R3_ONE / T(sin(omega));
+    // nearly parallel: sin(omega) vanishes, so interpolate linearly and renormalize
+    bool linear = cos_omega >= R3_ONE - R3_EPSILON;
+    if (!linear) {
+      T omega = T(acos(cos_omega));
+      T one_over_sin_omega = R3_ONE / T(sin(omega));
 
-    beta = T(sin(omega * beta) * one_over_sin_omega);
-    alpha = T(sin(omega * alpha) * one_over_sin_omega);
+      beta = T(sin(omega * beta) * one_over_sin_omega);
+      alpha = T(sin(omega * alpha) * one_over_sin_omega);
+    }
 
     if (bflip) {
       alpha = -alpha;
@@ -1877,6 +1918,9 @@ class Quaternion {
     r.y = beta * p.q[1] + alpha * q.q[1];
     r.z = beta * p.q[2] + alpha * q.q[2];
     r.w = beta * p.q[3] + alpha * q.q[3];
+    if (linear) {
+      r.Normalize();
+    }
     return r;
   }
 
@@ -2136,7 +2180,8 @@ struct Pose {
   // which is identity for a Pose.
   Pose() {}
 
-  Pose(const Pose& p) : r(p.r), t(p.t) {}
+  // Trivially copyable, so a Pose can alias the equivalent OpenXR type.
+  Pose(const Pose& p) = default;
 
   Pose(const Q& rotation, const V& translation) {
     SetValue(rotation, translation);
@@ -2163,16 +2208,174 @@ struct Pose {
     return t + r.Rotate(pos);
   }
 
+  // Transforms count positions from src into dst. The rotation is expanded to a 3x3
+  // once, so this is considerably cheaper than calling Transform() per element.
+  // src and dst may be the same array.
+  void TransformBatch(const V* src, V* dst, size_t count) const {
+    Matrix3<T> m = r.GetMatrix3();
+    const T m00 = m(0, 0), m01 = m(0, 1), m02 = m(0, 2);
+    const T m10 = m(1, 0), m11 = m(1, 1), m12 = m(1, 2);
+    const T m20 = m(2, 0), m21 = m(2, 1), m22 = m(2, 2);
+    const T tx = t.x, ty = t.y, tz = t.z;
+    for (size_t i = 0; i < count; i++) {
+      const T sx = src[i].x, sy = src[i].y, sz = src[i].z;
+      dst[i].x = m00 * sx + m01 * sy + m02 * sz + tx;
+      dst[i].y = m10 * sx + m11 * sy + m12 * sz + ty;
+      dst[i].z = m20 * sx + m21 * sy + m22 * sz + tz;
+    }
+  }
+
   Pose Inverted() const {
     Q ir = r.Inverted();
     return Pose(ir, ir.Rotate(-t));
   }
 
+  // this = this * rhs, i.e. rhs is applied first.
+  Pose& operator*=(const Pose& rhs) {
+    t = t + r.Rotate(rhs.t);
+    r *= rhs.r;
+    return *this;
+  }
+
+  // Fills m directly, no translate * rotate matrix multiply.
+  void GetValue(Matrix4<T>& m) const {
+    r.GetValue(m);
+    m(0, 3) = t.x;
+    m(1, 3) = t.y;
+    m(2, 3) = t.z;
+  }
+
+  Matrix4<T> GetMatrix4() const {
+    Matrix4<T> m;
+    GetValue(m);
+    return m;
+  }
+
+  static Pose Identity() {
+    return Pose();
+  }
+};
+
+template <typename T>
+inline Pose<T> operator*(const Pose<T>& p1, const Pose<T>& p2) {
+  Pose<T> r(p1);
+  r *= p2;
+  return r;
+}
+
+template <typename T>
+inline Vec3<T> operator*(const Pose<T>& p, const Vec3<T>& v) {
+  return p.Transform(v);
+}
+
+// Unit dual quaternion. The real part is the rotation, and the dual part encodes the
+// translation as 0.5 * t * real. Rigid transforms in this form can be blended linearly
+// (with renormalization), which is what skinning wants.
+template <typename T>
+struct DualQuaternion {
+  typedef T ElementType;
+  typedef Quaternion<T> Q;
+  typedef Vec3<T> V;
+  Q real;
+  Q dual;
+
+  DualQuaternion() : dual(T(0), T(0), T(0), T(0)) {}
+
+  DualQuaternion(const Q& real_, const Q& dual_) : real(real_), dual(dual_) {}
+
+  explicit DualQuaternion(const Pose<T>& p) {
+    SetValue(p);
+  }
+
+  void SetValue(const Pose<T>& p) {
+    real = p.r;
+    // dual = 0.5 * (t, 0) * real
+    const V& t = p.t;
+    dual.x = T(0.5) * (t.x * real.w + t.y * real.z - t.z * real.y);
+    dual.y = T(0.5) * (t.y * real.w + t.z * real.x - t.x * real.z);
+    dual.z = T(0.5) * (t.z * real.w + t.x * real.y - t.y * real.x);
+    dual.w = T(-0.5) * (t.x * real.x + t.y * real.y + t.z * real.z);
+  }
+
+  V GetTranslation() const {
+    // t = 2 * dual * conjugate(real)
+    Q tq = dual * real.Inverted();
+    return V(R3_TWO * tq.x, R3_TWO * tq.y, R3_TWO * tq.z);
+  }
+
+  Pose<T> GetPose() const {
+    return Pose<T>(real, GetTranslation());
+  }
+
+  void GetValue(Matrix4<T>& m) const {
+    real.GetValue(m);
+    m.SetTranslate(GetTranslation());
+  }
+
   Matrix4<T> GetMatrix4() const {
-    return Matrix4<T>::Translate(t) * r.GetMatrix4();
+    Matrix4<T> m;
+    GetValue(m);
+    return m;
+  }
+
+  V Transform(const V& pos) const {
+    return real.Rotate(pos) + GetTranslation();
+  }
+
+  // this = this * rhs, i.e. rhs is applied first.
+  DualQuaternion& operator*=(const DualQuaternion& rhs) {
+    Q rd = real * rhs.dual;
+    Q dr = dual * rhs.real;
+    real *= rhs.real;
+    dual.SetValue(rd.x + dr.x, rd.y + dr.y, rd.z + dr.z, rd.w + dr.w);
+    return *this;
+  }
+
+  void Normalize() {
+    T len = T(sqrt(real.x * real.x + real.y * real.y + real.z * real.z + real.w * real.w));
+    if (Equivalent(len, T(R3_ZERO))) {
+      return;
+    }
+    T rlen = T(R3_ONE) / len;
+    for (int i = 0; i < 4; i++) {
+      real.q[i] *= rlen;
+      dual.q[i] *= rlen;
+    }
+  }
+
+  // Dual quaternion linear blending. Inputs are flipped into the hemisphere of the
+  // first one so antipodal rotations don't cancel out.
+  static DualQuaternion Blend(const DualQuaternion* dqs, const T* weights, int count) {
+    DualQuaternion r(Q(T(0), T(0), T(0), T(0)), Q(T(0), T(0), T(0), T(0)));
+    if (count <= 0) {
+      return DualQuaternion();
+    }
+    const Q& pivot = dqs[0].real;
+    for (int i = 0; i < count; i++) {
+      const DualQuaternion& dq = dqs[i];
+      T hemi = pivot.x * dq.real.x + pivot.y * dq.real.y + pivot.z * dq.real.z + pivot.w * dq.real.w;
+      T w = hemi < T(R3_ZERO) ? -weights[i] : weights[i];
+      for (int j = 0; j < 4; j++) {
+        r.real.q[j] += w * dq.real.q[j];
+        r.dual.q[j] += w * dq.dual.q[j];
+      }
+    }
+    r.Normalize();
+    return r;
+  }
+
+  static DualQuaternion Identity() {
+    return DualQuaternion();
   }
 };
 
+template <typename T>
+inline DualQuaternion<T> operator*(const DualQuaternion<T>& dq1, const DualQuaternion<T>& dq2) {
+  DualQuaternion<T> r(dq1);
+  r *= dq2;
+  return r;
+}
+
 // make common typedefs...
 typedef Vec2<int> Vec2i;
 typedef Vec2<float> Vec2f;
@@ -2201,5 +2404,7 @@ typedef Matrix4<float> Matrix4f;
 typedef Matrix4<double> Matrix4d;
 typedef Pose<float> Posef;
 typedef Pose<double> Posed;
+typedef DualQuaternion<float> DualQuaternionf;
+typedef DualQuaternion<double> DualQuaterniond;
 
 }  // namespace r3
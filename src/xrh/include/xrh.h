@@ -16,6 +16,7 @@
 #include <openxr/openxr.h>
 #include <openxr/openxr_platform.h>
 
+#include <algorithm>
 #include <array>
 #include <iostream>
 #include <memory>
@@ -57,12 +58,24 @@ class Layer {
   Layer(Type type_) : type(type_) {}
   virtual ~Layer();
 
-  void set_swapchain(Swapchain sc, int index = 0) {
+  void set_swapchain(Swapchain sc, int index = 0, uint32_t array_index = 0) {
     if (index < 0 || index >= swapchains.size()) {
       // aout << __FUNCTION__ << " Invalid swapchain index: " << index << std::endl;
       return;
     }
     swapchains[index] = sc;
+    array_indices[index] = array_index;
+  }
+
+  // Both eyes from one array swapchain, left in layer 0 and right in layer 1, so a frame
+  // acquires and releases one image for the pair.
+  void set_stereo_swapchain(Swapchain sc) {
+    set_swapchain(sc, 0, 0);
+    set_swapchain(sc, 1, 1);
+  }
+
+  bool is_stereo() const {
+    return swapchains[1] != nullptr;
   }
 
   void set_space(Space space_) {
@@ -76,6 +89,7 @@ class Layer {
   Type type;
   Space space;
   std::array<Swapchain, 2> swapchains;
+  std::array<uint32_t, 2> array_indices{0, 0};
   Posef pose{IdentityPose};
 };
 
@@ -88,7 +102,8 @@ class QuadLayer : public Layer {
     height = heightMeters;
   }
 
-  XrCompositionLayerQuad get_xr_quad_layer() const;
+  // The quad as eye sees it; a stereo quad is submitted once per eye.
+  XrCompositionLayerQuad get_xr_quad_layer(int eye = 0) const;
 
   float width{};
   float height{};
@@ -162,6 +177,19 @@ class InstanceOb : public std::enable_shared_from_this<InstanceOb> {
   std::array<XrViewConfigurationView, 2> view_config_views;
 };
 
+// What a swapchain's contents need from its format, for SessionOb::choose_swapchain_format.
+struct SwapchainFormatNeeds {
+  bool alpha = false;      // blended by the compositor, so alpha must be stored at full precision
+  bool srgb = true;        // linear color that needs perceptual encoding (sRGB or float) to avoid banding
+  bool hdr = false;        // values outside [0, 1]
+  bool bandwidth = false;  // fewest bytes a pixel first, down to 16 bit color
+};
+
+struct SwapchainFormat {
+  int64_t format = 0;
+  uint32_t bytes_per_pixel = 0;
+};
+
 class SessionOb : public std::enable_shared_from_this<SessionOb> {
  public:
   SessionOb(Instance inst_, XrSession ssn_);
@@ -174,6 +202,14 @@ class SessionOb : public std::enable_shared_from_this<SessionOb> {
   Space create_refspace(const XrReferenceSpaceCreateInfo& createInfo);
   Swapchain create_swapchain(const XrSwapchainCreateInfo& createInfo);
 
+  // Swapchain formats the runtime supports, in its order of preference.
+  const std::vector<int64_t>& get_swapchain_formats() const {
+    return swapchain_formats;
+  }
+  bool is_swapchain_format_supported(int64_t format) const;
+  // The best supported format for the needs, or the runtime's first preference if none meet them.
+  SwapchainFormat choose_swapchain_format(const SwapchainFormatNeeds& needs) const;
+
   bool begin_frame();
   XrTime get_predicted_display_time() const {
     return fs.predictedDisplayTime;
@@ -187,6 +223,7 @@ class SessionOb : public std::enable_shared_from_this<SessionOb> {
   XrFrameState fs;
   XrSessionState state;
   std::set<XrReferenceSpaceType> refspacetypes;
+  std::vector<int64_t> swapchain_formats;
 
   struct StereoProjectionLayer {
     XrCompositionLayerProjection proj;
@@ -263,10 +300,15 @@ class SwapchainOb {
   SwapchainOb(Session ssn_, XrSwapchain sc_, const CreateInfo& ci_);
   ~SwapchainOb();
 
-  static constexpr CreateInfo make_create_info(uint32_t width, uint32_t height, int64_t format = SRGB_A) {
-    return {CIST, nullptr, 0, UsageSampled | UsageColorAttachment, format, 1, width, height, 1, 1, 1};
+  // array_size 2 makes a stereo swapchain, whose images are GL_TEXTURE_2D_ARRAY with an eye a layer.
+  static constexpr CreateInfo make_create_info(uint32_t width, uint32_t height, int64_t format = SRGB_A,
+                                               uint32_t samples = 1, uint32_t array_size = 1) {
+    return {CIST, nullptr, 0, UsageSampled | UsageColorAttachment, format, samples, width, height, 1, array_size, 1};
   }
 
+  // Bytes a pixel of a color format takes, 4 for formats xrh doesn't know.
+  static uint32_t get_bytes_per_pixel(int64_t format);
+
   XrSwapchain get_xr_swapchain() const {
     return swapchain;
   }
@@ -279,10 +321,23 @@ class SwapchainOb {
     return ci.height;
   }
 
+  int64_t get_format() const {
+    return ci.format;
+  }
+
+  uint32_t get_array_size() const {
+    return ci.arraySize;
+  }
+
   XrExtent2Di get_extent() const {
     return {static_cast<int>(ci.width), static_cast<int>(ci.height)};
   }
 
+  // Number of images in the chain, i.e. how many frames the runtime may have in flight.
+  uint32_t get_chain_length() const {
+    return chainlength;
+  }
+
 #if defined(XR_USE_GRAPHICS_API_OPENGL_ES)
   const std::span<GLuint> enumerate_images() {
     return images;
@@ -317,7 +372,7 @@ class SwapchainOb {
   Session ssn;
   XrSwapchain swapchain;
   CreateInfo ci;
-  uint32_t chainlength;
+  uint32_t chainlength = 0;
 #if defined(XR_USE_GRAPHICS_API_OPENGL_ES)
   std::vector<GLuint> images;
 #endif
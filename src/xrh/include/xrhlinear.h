@@ -1,19 +1,85 @@
 /* helpers for OpenXR type to/from r3 linear */
 
+#include <cstddef>
+#include <type_traits>
+
 #include "linear.h"
 #include "xrh.h"
 
 #pragma once
 
 namespace xrh {
+
+// The r3 types are layout compatible with their OpenXR counterparts, so poses coming from
+// or going to the runtime can be viewed in place rather than converted.
+static_assert(sizeof(r3::Vec3f) == sizeof(XrVector3f) && offsetof(r3::Vec3f, x) == offsetof(XrVector3f, x) &&
+                  offsetof(r3::Vec3f, y) == offsetof(XrVector3f, y) && offsetof(r3::Vec3f, z) == offsetof(XrVector3f, z),
+              "r3::Vec3f must be layout compatible with XrVector3f");
+static_assert(sizeof(r3::Quaternionf) == sizeof(XrQuaternionf) && offsetof(r3::Quaternionf, x) == offsetof(XrQuaternionf, x) &&
+                  offsetof(r3::Quaternionf, y) == offsetof(XrQuaternionf, y) &&
+                  offsetof(r3::Quaternionf, z) == offsetof(XrQuaternionf, z) &&
+                  offsetof(r3::Quaternionf, w) == offsetof(XrQuaternionf, w),
+              "r3::Quaternionf must be layout compatible with XrQuaternionf");
+static_assert(sizeof(r3::Posef) == sizeof(XrPosef) && offsetof(r3::Posef, r) == offsetof(XrPosef, orientation) &&
+                  offsetof(r3::Posef, t) == offsetof(XrPosef, position),
+              "r3::Posef must be layout compatible with XrPosef");
+static_assert(std::is_trivially_copyable_v<r3::Posef>, "r3::Posef must be trivially copyable");
+
+// Zero-copy views between OpenXR and r3 types.
+inline const r3::Vec3f& as_r3(const XrVector3f& v) {
+  return *reinterpret_cast<const r3::Vec3f*>(&v);
+}
+inline r3::Vec3f& as_r3(XrVector3f& v) {
+  return *reinterpret_cast<r3::Vec3f*>(&v);
+}
+inline const r3::Quaternionf& as_r3(const XrQuaternionf& q) {
+  return *reinterpret_cast<const r3::Quaternionf*>(&q);
+}
+inline r3::Quaternionf& as_r3(XrQuaternionf& q) {
+  return *reinterpret_cast<r3::Quaternionf*>(&q);
+}
+inline const r3::Posef& as_r3(const XrPosef& p) {
+  return *reinterpret_cast<const r3::Posef*>(&p);
+}
+inline r3::Posef& as_r3(XrPosef& p) {
+  return *reinterpret_cast<r3::Posef*>(&p);
+}
+
+inline const XrVector3f& as_xr(const r3::Vec3f& v) {
+  return *reinterpret_cast<const XrVector3f*>(&v);
+}
+inline XrVector3f& as_xr(r3::Vec3f& v) {
+  return *reinterpret_cast<XrVector3f*>(&v);
+}
+inline const XrQuaternionf& as_xr(const r3::Quaternionf& q) {
+  return *reinterpret_cast<const XrQuaternionf*>(&q);
+}
+inline XrQuaternionf& as_xr(r3::Quaternionf& q) {
+  return *reinterpret_cast<XrQuaternionf*>(&q);
+}
+inline const XrPosef& as_xr(const r3::Posef& p) {
+  return *reinterpret_cast<const XrPosef*>(&p);
+}
+inline XrPosef& as_xr(r3::Posef& p) {
+  return *reinterpret_cast<XrPosef*>(&p);
+}
+
+// Views over arrays of poses, e.g. xrLocateViews or hand joint output.
+inline std::span<const r3::Posef> as_r3(std::span<const XrPosef> poses) {
+  return {reinterpret_cast<const r3::Posef*>(poses.data()), poses.size()};
+}
+inline std::span<r3::Posef> as_r3(std::span<XrPosef> poses) {
+  return {reinterpret_cast<r3::Posef*>(poses.data()), poses.size()};
+}
+
 struct Vector3f : public r3::Vec3f {
   Vector3f() = default;
   Vector3f(float x_, float y_, float z_) : r3::Vec3f(x_, y_, z_) {}
   Vector3f(const float* tp) : r3::Vec3f(tp) {}
-  Vector3f(const XrVector3f& v) : r3::Vec3f(&v.x) {}
+  Vector3f(const XrVector3f& v) : r3::Vec3f(as_r3(v)) {}
   Vector3f(const r3::Vec3f& v) : r3::Vec3f(v) {}
   operator const XrVector3f&() const {
-    return *reinterpret_cast<const XrVector3f*>(this);
+    return as_xr(*this);
   }
 };
 
@@ -22,19 +88,20 @@ struct Quatf : public r3::Quaternionf {
   Quatf(float x_, float y_, float z_, float w_) : r3::Quaternionf(x_, y_, z_, w_) {}
   Quatf(const float* v) : r3::Quaternionf(v) {}
   Quatf(const Vector3f& axis, float angle) : r3::Quaternionf(r3::Vec3f(axis), angle) {}
-  Quatf(const XrQuaternionf& q) : r3::Quaternionf(&q.x) {}
+  Quatf(const XrQuaternionf& q) : r3::Quaternionf(as_r3(q)) {}
   Quatf(const r3::Quaternionf& q) : r3::Quaternionf(q) {}
   operator const XrQuaternionf&() const {
-    return *reinterpret_cast<const XrQuaternionf*>(this);
+    return as_xr(*this);
   }
 };
 
 struct Posef : public r3::Posef {
   Posef() = default;
   Posef(const Quatf& r, const Vector3f& t) : r3::Posef(r3::Quaternionf(r), r3::Vec3f(t)) {}
-  Posef(const XrPosef& p) : r3::Posef(Quatf(p.orientation), Vector3f(p.position)) {}
+  Posef(const XrPosef& p) : r3::Posef(as_r3(p)) {}
+  Posef(const r3::Posef& p) : r3::Posef(p) {}
   operator const XrPosef&() const {
-    return *reinterpret_cast<const XrPosef*>(this);
+    return as_xr(*this);
   }
 };
 }  // namespace xrh
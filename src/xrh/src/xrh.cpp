@@ -122,6 +122,35 @@ bool ext_supported(span<const XrExtensionProperties> ext_span, const XrExtension
   return false;
 }
 
+struct FormatInfo {
+  int64_t format;
+  const char* name;
+  uint32_t bytes_per_pixel;
+  bool alpha;          // full precision alpha
+  bool perceptual;     // sRGB encoded or float, so linear color doesn't band
+  bool hdr;            // float
+  bool low_precision;  // under 8 bits a channel
+};
+
+// In order of preference, all else being equal.
+constexpr FormatInfo format_infos[] = {
+    {GL_SRGB8_ALPHA8, "SRGB8_ALPHA8", 4, true, true, false, false},
+    {GL_RGB10_A2, "RGB10_A2", 4, false, false, false, false},
+    {GL_RGBA8, "RGBA8", 4, true, false, false, false},
+    {GL_R11F_G11F_B10F, "R11F_G11F_B10F", 4, false, true, true, false},
+    {GL_RGBA16F, "RGBA16F", 8, true, true, true, false},
+    {GL_RGB565, "RGB565", 2, false, false, false, true},
+};
+
+const FormatInfo* find_format_info(int64_t format) {
+  for (const auto& fi : format_infos) {
+    if (fi.format == format) {
+      return &fi;
+    }
+  }
+  return nullptr;
+}
+
 }  // namespace
 
 namespace xrh {
@@ -299,6 +328,52 @@ SessionOb::SessionOb(Instance inst_, XrSession ssn_) : inst(inst_), ssn(ssn_) {
   for (auto rst : refspaces) {
     refspacetypes.insert(rst);
   }
+
+  uint32_t numFormats = 0;
+  XRH(xrEnumerateSwapchainFormats(ssn, 0, &numFormats, nullptr));
+  swapchain_formats.resize(numFormats);
+  XRH(xrEnumerateSwapchainFormats(ssn, numFormats, &numFormats, swapchain_formats.data()));
+  swapchain_formats.resize(numFormats);
+  if (ostrptr) {
+    (*ostrptr) << "Swapchain formats:";
+    for (auto format : swapchain_formats) {
+      auto fi = find_format_info(format);
+      if (fi) {
+        (*ostrptr) << " " << fi->name;
+      } else {
+        (*ostrptr) << " 0x" << hex << format << dec;
+      }
+    }
+    (*ostrptr) << endl;
+  }
+}
+
+bool SessionOb::is_swapchain_format_supported(int64_t format) const {
+  return find(swapchain_formats.begin(), swapchain_formats.end(), format) != swapchain_formats.end();
+}
+
+SwapchainFormat SessionOb::choose_swapchain_format(const SwapchainFormatNeeds& needs) const {
+  const FormatInfo* best = nullptr;
+  for (const auto& fi : format_infos) {
+    if (!is_swapchain_format_supported(fi.format)) continue;
+    if (needs.alpha && !fi.alpha) continue;
+    if (needs.srgb && !fi.perceptual) continue;
+    if (needs.hdr != fi.hdr) continue;
+    if (fi.low_precision && !needs.bandwidth) continue;
+    // Otherwise the first in order of preference; with bandwidth first, ties go to it too.
+    if (!best || (needs.bandwidth && fi.bytes_per_pixel < best->bytes_per_pixel)) {
+      best = &fi;
+    }
+  }
+  if (best) {
+    return {best->format, best->bytes_per_pixel};
+  }
+  if (swapchain_formats.empty()) {
+    return {};
+  }
+  if (ostrptr) (*ostrptr) << "No swapchain format meets the needs, using the runtime's first." << endl;
+  int64_t format = swapchain_formats.front();
+  return {format, SwapchainOb::get_bytes_per_pixel(format)};
 }
 
 SessionOb::~SessionOb() {
@@ -384,9 +459,10 @@ void SessionOb::add_layer(const Layer& layer) {
   switch (layer.type) {
     case Layer::Type::Quad: {
       auto quadLayer = reinterpret_cast<const QuadLayer*>(&layer);
-      lu.quad = quadLayer->get_xr_quad_layer();
-      layers.push_back(lu);
-      layer_ptrs.push_back(&layers.back().base);
+      for (int eye = 0; eye < (layer.is_stereo() ? 2 : 1); eye++) {
+        lu.quad = quadLayer->get_xr_quad_layer(eye);
+        layers.push_back(lu);
+      }
     } break;
     default:
       return;
@@ -394,6 +470,11 @@ void SessionOb::add_layer(const Layer& layer) {
 }
 
 void SessionOb::end_frame() {
+  // Pointers are taken now that layers won't grow and move any more.
+  layer_ptrs.clear();
+  for (auto& lu : layers) {
+    layer_ptrs.push_back(&lu.base);
+  }
   XrFrameEndInfo fei{XR_TYPE_FRAME_END_INFO};
   fei.displayTime = fs.predictedDisplayTime;
   fei.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_ALPHA_BLEND;
@@ -432,19 +513,29 @@ SwapchainOb::SwapchainOb(Session ssn_, XrSwapchain swapchain_, const XrSwapchain
 #endif
 }
 
+uint32_t SwapchainOb::get_bytes_per_pixel(int64_t format) {
+  auto fi = find_format_info(format);
+  return fi ? fi->bytes_per_pixel : 4;
+}
+
 SwapchainOb::~SwapchainOb() {
   if (ostrptr) (*ostrptr) << "Destroying SwapchainOb: " << swapchain << endl;
   XRH(xrDestroySwapchain(swapchain));
 }
 
-XrCompositionLayerQuad QuadLayer::get_xr_quad_layer() const {
+XrCompositionLayerQuad QuadLayer::get_xr_quad_layer(int eye) const {
+  eye = is_stereo() ? std::clamp(eye, 0, 1) : 0;
   XrCompositionLayerQuad layer{XR_TYPE_COMPOSITION_LAYER_QUAD};
   layer.space = space->get_xr_space();
+  if (is_stereo()) {
+    layer.eyeVisibility = eye == 0 ? XR_EYE_VISIBILITY_LEFT : XR_EYE_VISIBILITY_RIGHT;
+  }
   layer.pose = pose;
   layer.size = {width, height};
-  layer.subImage.swapchain = swapchains[0]->get_xr_swapchain();
+  layer.subImage.swapchain = swapchains[eye]->get_xr_swapchain();
   layer.subImage.imageRect.offset = {0, 0};
-  layer.subImage.imageRect.extent = swapchains[0]->get_extent();
+  layer.subImage.imageRect.extent = swapchains[eye]->get_extent();
+  layer.subImage.imageArrayIndex = array_indices[eye];
   return layer;
 }
 